@@ -22,14 +22,13 @@
 #include <system/SystemLayerImplFreeRTOS.h>
 
 #include "app_matter_ctrl.h"
-#include "nvs_flash.h"
+#include "settings.h"
 
 using namespace esp_matter;
 using namespace chip::app::Clusters;
 extern matter_controller_t g_controller;
 
 static const char *TAG = "app_driver";
-static const uint16_t DEVICE_UPDATE_TIMER_SEC = 40;
 static uint64_t device_node_id = 0;
 static matter_device_t *s_device_ptr = NULL;
 // static TaskHandle_t xRefresh_Ui_Handle = NULL;
@@ -47,21 +46,12 @@ static int count_devices(const matter_device_t *device_list)
     return count;
 }
 /* Callback after updating device list */
+// Вызывается device_mgr только при изменении реестра (частые изменения уже объединены), поэтому
+// список подписок перестраивается каждый раз: подписки на уже подписанные атрибуты не повторяются
 void on_device_list_update(void)
 {
-    static uint32_t last_update = 0;
-    uint32_t now = esp_log_timestamp();
-
-    // Защита от слишком частых обновлений
-    if (last_update != 0 && (now - last_update) < 5000)
-    {
-        ESP_LOGD(TAG, "Skipping too frequent update");
-        return;
-    }
-    last_update = now;
-
     matter_device_t *new_list = esp_matter::controller::device_mgr::get_device_list_clone();
-    if (!new_list)
+    if (!new_list && g_controller.nodes_list)
     {
         ESP_LOGE(TAG, "Failed to get device list clone");
         return;
@@ -71,15 +61,9 @@ void on_device_list_update(void)
     matter_device_t *old_list = s_device_ptr;
     s_device_ptr = new_list;
 
-    // Проверка изменений
-    bool list_changed = !old_list || !new_list || (old_list->node_id != new_list->node_id);
-
-    if (list_changed)
-    {
-        ESP_LOGI(TAG, "Device list updated, count: %d", count_devices(new_list));
-        matter_ctrl_get_device((void *)s_device_ptr);
-        matter_ctrl_subscribe_device_state(SUBSCRIBE_LOCAL_DEVICE);
-    }
+    ESP_LOGI(TAG, "Device list updated, count: %d", count_devices(new_list));
+    matter_ctrl_get_device((void *)s_device_ptr);
+    matter_ctrl_subscribe_device_state(SUBSCRIBE_LOCAL_DEVICE);
 
     if (old_list)
     {
@@ -106,56 +90,18 @@ static void refresh_ui_task(void *pvParameters)
     }
 }
 
-static void Layer_timer_cb(chip::System::Layer *aLayer, void *appState)
-{
-    //    if (!device_get_flag)
-    //    {
-    //        ESP_LOGE(TAG, "Timer callback skipped because device_get_flag=false");
-    //        return;
-    //    }
-
-    // Логирование состояния памяти
-    nvs_stats_t nvs_stats;
-    nvs_get_stats("nvs", &nvs_stats);
-    ESP_LOGI("NVS", "Used entries: %d, Free entries: %d", nvs_stats.used_entries, nvs_stats.free_entries);
-    ESP_LOGI("HEAP", "Free heap: %u Kb", esp_get_free_heap_size() / 1024);
-    ESP_LOGI("HEAP", "Min free heap: %u Kb", esp_get_minimum_free_heap_size() / 1024);
-
-    // Обновление списка устройств
-    esp_err_t err = esp_matter::controller::device_mgr::update_device_list(0);
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Failed to update device list: %d", err);
-    }
-    
-    matter_ctrl_subscribe_device_state(SUBSCRIBE_LOCAL_DEVICE);
-
-    // Перезапускаем таймер
-    esp_matter::lock::chip_stack_lock(portMAX_DELAY);
-    CHIP_ERROR chip_err = chip::DeviceLayer::SystemLayer().StartTimer(
-        chip::System::Clock::Seconds32(DEVICE_UPDATE_TIMER_SEC), Layer_timer_cb, nullptr);
-    // ESP_LOGI(TAG, "Timer start result: %d", chip_err);
-    esp_matter::lock::chip_stack_unlock();
-
-    if (chip_err != CHIP_NO_ERROR)
-    {
-        ESP_LOGE(TAG, "Failed to restart update timer");
-    }
-}
-
 esp_err_t update_device_init()
 {
-    // Инициализация таймера обновления
+    // Список устройств обновляется по изменениям реестра (device_mgr::notify_change), периодическая сверка -
+    // по настройке registry.sweep_min
     esp_matter::lock::chip_stack_lock(portMAX_DELAY);
-    CHIP_ERROR chip_err = chip::DeviceLayer::SystemLayer().StartTimer(
-        chip::System::Clock::Seconds32(DEVICE_UPDATE_TIMER_SEC), Layer_timer_cb, nullptr);
-    // ESP_LOGI(TAG, "Timer start result: %d", chip_err);
+    esp_err_t err = esp_matter::controller::device_mgr::set_sweep_interval(sys_settings.registry.sweep_min);
     esp_matter::lock::chip_stack_unlock();
 
-    if (chip_err != CHIP_NO_ERROR)
+    if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to start update timer");
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "Failed to start registry sweep");
+        return err;
     }
 
     // Создаем задачу для обновления UI
@@ -38,6 +38,9 @@
 #include "console/console.h"
 #include "matter_callbacks.h"
 #include "devices.h"
+#include "session_warm.h"
+#include "node_reachability.h"
+#include "command_policy.h"
 // #include "matter_controller_device_mgr.h"
 
 #include <app_priv.h>
@@ -222,6 +225,11 @@ extern "C" void app_main()
     {
         ESP_LOGW("SETTINGS", "No saved settings, using defaults");
     }
+    // таймауты и повторы команд узлов - до первых команд из MQTT
+    if (command_policy_load() != ESP_OK)
+    {
+        ESP_LOGW("SETTINGS", "Failed to load command policies");
+    }
 
     console_init();
 
@@ -312,5 +320,11 @@ extern "C" void app_main()
     esp_matter::controller::matter_controller_client::get_instance().setup_commissioner();
     esp_matter::lock::chip_stack_unlock();
 #endif // CONFIG_ESP_MATTER_COMMISSIONER_ENABLE
+    // сессии с узлами, чувствительными к задержке, устанавливаются заранее
+    esp_matter::lock::chip_stack_lock(portMAX_DELAY);
+    session_warm_start();
+    // доступность узлов по ответам на команды, подпискам и проверкам
+    node_reachability_start();
+    esp_matter::lock::chip_stack_unlock();
     update_device_init();
 }
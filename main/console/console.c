@@ -8,6 +8,8 @@
 #include "../wifi/settings.h"
 #include "../wifi/wifi.h"
 #include "../wifi/mqtt.h"
+#include "../wifi/mqtt_topics.h"
+#include "../devicemanager/registry_export.h"
 
 static const char *TAG = "console";
 
@@ -23,9 +25,18 @@ static struct {
     struct arg_str *username;
     struct arg_str *password;
     struct arg_str *prefix;
+    struct arg_int *v5;
+    struct arg_int *aliases;
+    struct arg_int *expiry;
     struct arg_end *end;
 } mqtt_args;
 
+static struct {
+    struct arg_str *cursor;
+    struct arg_int *limit;
+    struct arg_end *end;
+} export_args;
+
 static esp_mqtt_client_handle_t mqtt_client = NULL;
 
 /* Функция для подключения к Wi-Fi */
@@ -104,6 +115,21 @@ static int mqtt_connect(int argc, char **argv) {
     if (mqtt_args.prefix->count > 0) {
         strncpy(sys_settings.mqtt.prefix, mqtt_args.prefix->sval[0], sizeof(sys_settings.mqtt.prefix) - 1);
         sys_settings.mqtt.prefix[sizeof(sys_settings.mqtt.prefix) - 1] = '\0';
+        mqtt_topics_invalidate();
+    }
+
+    // MQTT 5: псевдонимы топиков fd, срок хранения состояния, ответы на команды по correlation data
+    if (mqtt_args.v5->count > 0) {
+        sys_settings.mqtt5.enabled = mqtt_args.v5->ival[0] != 0;
+    }
+
+    if (mqtt_args.aliases->count > 0) {
+        int aliases = mqtt_args.aliases->ival[0];
+        sys_settings.mqtt5.topic_aliases = aliases < 0 ? 0 : (aliases > MQTT5_MAX_TOPIC_ALIASES ? MQTT5_MAX_TOPIC_ALIASES : aliases);
+    }
+
+    if (mqtt_args.expiry->count > 0) {
+        sys_settings.mqtt5.state_expiry = mqtt_args.expiry->ival[0] < 0 ? 0 : (uint32_t)mqtt_args.expiry->ival[0];
     }
 
     // Сохранение настроек с единой обработкой ошибок
@@ -126,6 +152,29 @@ static int mqtt_connect(int argc, char **argv) {
     return 0;
 }
 
+/* Постраничная выгрузка реестра устройств в консоль */
+static int export_registry(int argc, char **argv) {
+    int nerrors = arg_parse(argc, argv, (void **)&export_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, export_args.end, argv[0]);
+        return 1;
+    }
+
+    const char *cursor = export_args.cursor->count > 0 ? export_args.cursor->sval[0] : NULL;
+    int limit = export_args.limit->count > 0 ? export_args.limit->ival[0] : 0;
+    if (limit < 0 || limit > UINT16_MAX) {
+        ESP_LOGE(TAG, "Invalid limit: %d", limit);
+        return 1;
+    }
+
+    esp_err_t ret = registry_export_schedule(REGISTRY_EXPORT_TO_CONSOLE, cursor, (uint16_t)limit);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Export failed: %s", esp_err_to_name(ret));
+        return 1;
+    }
+    return 0;
+}
+
 /* Регистрация команд */
 static void register_wifi_connect(void) {
     wifi_args.ssid = arg_str1(NULL, NULL, "<ssid>", "SSID of the access point");
@@ -148,7 +197,10 @@ static void register_mqtt_connect(void) {
     mqtt_args.prefix = arg_str0(NULL, NULL, "<prefix>", "Client ID prefix");
     mqtt_args.username = arg_str0("u", "username", "<username>", "Username for authentication");
     mqtt_args.password = arg_str0("p", "password", "<password>", "Password for authentication");
-    mqtt_args.end = arg_end(4);
+    mqtt_args.v5 = arg_int0(NULL, "v5", "<0|1>", "Use MQTT 5");
+    mqtt_args.aliases = arg_int0(NULL, "aliases", "<n>", "MQTT 5 topic aliases for fd topics (0 - off)");
+    mqtt_args.expiry = arg_int0(NULL, "expiry", "<sec>", "MQTT 5 expiry of state messages (0 - none)");
+    mqtt_args.end = arg_end(7);
 
     const esp_console_cmd_t cmd = {
         .command = "mqtt",
@@ -161,6 +213,22 @@ static void register_mqtt_connect(void) {
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
 }
 
+static void register_export(void) {
+    export_args.cursor = arg_str0(NULL, NULL, "<cursor>", "Cursor printed by the previous page");
+    export_args.limit = arg_int0("n", "limit", "<endpoints>", "Endpoints per page");
+    export_args.end = arg_end(2);
+
+    const esp_console_cmd_t cmd = {
+        .command = "export",
+        .help = "Print the device registry as JSON, one page at a time",
+        .hint = NULL,
+        .func = &export_registry,
+        .argtable = &export_args
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
 void console_init(void) {
 //    esp_console_config_t console_config_ = {
 //        .max_cmdline_args = 8,
@@ -171,6 +239,7 @@ void console_init(void) {
     /* Регистрируем команды */
     register_wifi_connect();
     register_mqtt_connect();
+    register_export();
 
     ESP_LOGI(TAG, "Console commands initialized");
 }
\ No newline at end of file
@@ -0,0 +1,287 @@
+#include "attr_value.h"
+#include <esp_log.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lib/core/TLVTags.h>
+#include <lib/support/CodeUtils.h>
+#include <lib/support/ErrorStr.h>
+
+static const char *TAG = "attr_value";
+
+using chip::TLV::TLVReader;
+using chip::TLV::TLVType;
+
+namespace {
+
+// Первый проход: подсчет элементов и байтов строк
+struct measure_t
+{
+    size_t nodes = 0;
+    size_t pool = 0;
+};
+
+// Второй проход: заполнение блока
+struct fill_t
+{
+    attr_value_node_t *nodes;
+    char *pool;
+    size_t node_pos = 0;
+    size_t pool_pos = 0;
+};
+
+CHIP_ERROR measure(TLVReader &reader, measure_t &m, int depth)
+{
+    if (++m.nodes > ATTR_VALUE_MAX_NODES || depth > ATTR_VALUE_MAX_DEPTH)
+        return CHIP_ERROR_NO_MEMORY;
+
+    switch (reader.GetType())
+    {
+    case chip::TLV::kTLVType_UTF8String:
+    case chip::TLV::kTLVType_ByteString:
+        m.pool += reader.GetLength();
+        return m.pool > ATTR_VALUE_MAX_POOL ? CHIP_ERROR_NO_MEMORY : CHIP_NO_ERROR;
+    case chip::TLV::kTLVType_Structure:
+    case chip::TLV::kTLVType_Array:
+    case chip::TLV::kTLVType_List:
+    {
+        TLVType outer;
+        ReturnErrorOnFailure(reader.EnterContainer(outer));
+        size_t children = 0;
+        CHIP_ERROR err;
+        while ((err = reader.Next()) == CHIP_NO_ERROR)
+        {
+            if (++children > UINT16_MAX)
+                return CHIP_ERROR_NO_MEMORY;
+            ReturnErrorOnFailure(measure(reader, m, depth + 1));
+        }
+        if (err != CHIP_END_OF_TLV)
+            return err;
+        return reader.ExitContainer(outer);
+    }
+    case chip::TLV::kTLVType_NotSpecified:
+        return CHIP_ERROR_WRONG_TLV_TYPE;
+    default:
+        return CHIP_NO_ERROR;
+    }
+}
+
+CHIP_ERROR fill(TLVReader &reader, fill_t &f)
+{
+    attr_value_node_t *node = &f.nodes[f.node_pos++];
+    memset(node, 0, sizeof(*node));
+
+    chip::TLV::Tag tag = reader.GetTag();
+    if (chip::TLV::IsContextTag(tag))
+    {
+        node->has_tag = 1;
+        node->tag = chip::TLV::TagNumFromTag(tag);
+    }
+
+    switch (reader.GetType())
+    {
+    case chip::TLV::kTLVType_SignedInteger:
+        node->type = ATTR_VALUE_INT;
+        return reader.Get(node->v.i);
+    case chip::TLV::kTLVType_UnsignedInteger:
+        node->type = ATTR_VALUE_UINT;
+        return reader.Get(node->v.u);
+    case chip::TLV::kTLVType_Boolean:
+        node->type = ATTR_VALUE_BOOL;
+        return reader.Get(node->v.b);
+    case chip::TLV::kTLVType_FloatingPointNumber:
+        node->type = ATTR_VALUE_DOUBLE;
+        return reader.Get(node->v.d);
+    case chip::TLV::kTLVType_Null:
+        node->type = ATTR_VALUE_NULL;
+        return CHIP_NO_ERROR;
+    case chip::TLV::kTLVType_UTF8String:
+    case chip::TLV::kTLVType_ByteString:
+    {
+        node->type = reader.GetType() == chip::TLV::kTLVType_UTF8String ? ATTR_VALUE_STRING : ATTR_VALUE_BYTES;
+        const uint8_t *data = nullptr;
+        ReturnErrorOnFailure(reader.GetDataPtr(data));
+        uint32_t len = reader.GetLength();
+        if (len > 0)
+            memcpy(f.pool + f.pool_pos, data, len);
+        node->count = static_cast<uint16_t>(len);
+        node->v.offset = static_cast<uint32_t>(f.pool_pos);
+        f.pool_pos += len;
+        return CHIP_NO_ERROR;
+    }
+    case chip::TLV::kTLVType_Structure:
+    case chip::TLV::kTLVType_Array:
+    case chip::TLV::kTLVType_List:
+    {
+        node->type = reader.GetType() == chip::TLV::kTLVType_Structure ? ATTR_VALUE_STRUCT
+                     : reader.GetType() == chip::TLV::kTLVType_Array   ? ATTR_VALUE_ARRAY
+                                                                       : ATTR_VALUE_LIST;
+        TLVType outer;
+        ReturnErrorOnFailure(reader.EnterContainer(outer));
+        CHIP_ERROR err;
+        uint16_t children = 0;
+        while ((err = reader.Next()) == CHIP_NO_ERROR)
+        {
+            children++;
+            ReturnErrorOnFailure(fill(reader, f));
+        }
+        if (err != CHIP_END_OF_TLV)
+            return err;
+        // блок выделен заранее, указатель node остается действительным после рекурсии
+        node->count = children;
+        return reader.ExitContainer(outer);
+    }
+    default:
+        return CHIP_ERROR_WRONG_TLV_TYPE;
+    }
+}
+
+} // namespace
+
+attr_value_t *attr_value_decode(const chip::TLV::TLVReader &reader)
+{
+    measure_t m;
+    TLVReader pass1;
+    pass1.Init(reader);
+    CHIP_ERROR err = measure(pass1, m, 0);
+    if (err != CHIP_NO_ERROR)
+    {
+        ESP_LOGW(TAG, "Value not decoded (nodes=%u, pool=%u): %s", (unsigned)m.nodes, (unsigned)m.pool,
+                 chip::ErrorStr(err));
+        return nullptr;
+    }
+
+    size_t size = sizeof(attr_value_t) + m.nodes * sizeof(attr_value_node_t) + m.pool;
+    attr_value_t *value = static_cast<attr_value_t *>(malloc(size));
+    if (!value)
+    {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for value", (unsigned)size);
+        return nullptr;
+    }
+    value->node_count = static_cast<uint16_t>(m.nodes);
+    value->pool_size = static_cast<uint16_t>(m.pool);
+    value->reserved = 0;
+
+    fill_t f;
+    f.nodes = const_cast<attr_value_node_t *>(attr_value_nodes(value));
+    f.pool = const_cast<char *>(attr_value_pool(value));
+
+    TLVReader pass2;
+    pass2.Init(reader);
+    err = fill(pass2, f);
+    if (err != CHIP_NO_ERROR || f.node_pos != m.nodes || f.pool_pos != m.pool)
+    {
+        ESP_LOGW(TAG, "Value decode failed: %s", chip::ErrorStr(err));
+        free(value);
+        return nullptr;
+    }
+    return value;
+}
+
+size_t attr_value_size(const attr_value_t *value)
+{
+    if (!value)
+        return 0;
+    return sizeof(attr_value_t) + value->node_count * sizeof(attr_value_node_t) + value->pool_size;
+}
+
+void attr_value_free(attr_value_t *value)
+{
+    free(value);
+}
+
+bool attr_value_equal(const attr_value_t *a, const attr_value_t *b)
+{
+    if (!a || !b)
+        return a == b;
+    // элементы обнуляются перед заполнением, поэтому байты выравнивания совпадают
+    size_t size = attr_value_size(a);
+    return size == attr_value_size(b) && memcmp(a, b, size) == 0;
+}
+
+void attr_value_write_json(const attr_value_t *value, json_stream_t *js, const char *key)
+{
+    if (!value || value->node_count == 0)
+    {
+        json_stream_null(js, key);
+        return;
+    }
+
+    const attr_value_node_t *nodes = attr_value_nodes(value);
+    const char *pool = attr_value_pool(value);
+
+    // Для каждого открытого контейнера: сколько дочерних элементов осталось и является ли он структурой
+    uint16_t remaining[ATTR_VALUE_MAX_DEPTH + 1];
+    bool is_struct[ATTR_VALUE_MAX_DEPTH + 1];
+    int depth = -1;
+    char tag_key[11];
+
+    for (size_t i = 0; i < value->node_count; i++)
+    {
+        const attr_value_node_t *node = &nodes[i];
+
+        const char *node_key = key;
+        if (depth >= 0)
+        {
+            node_key = nullptr;
+            if (is_struct[depth])
+            {
+                snprintf(tag_key, sizeof(tag_key), "%" PRIu32, node->tag);
+                node_key = tag_key;
+            }
+            remaining[depth]--;
+        }
+
+        switch (node->type)
+        {
+        case ATTR_VALUE_NULL:
+            json_stream_null(js, node_key);
+            break;
+        case ATTR_VALUE_BOOL:
+            json_stream_bool(js, node_key, node->v.b);
+            break;
+        case ATTR_VALUE_INT:
+            json_stream_int(js, node_key, node->v.i);
+            break;
+        case ATTR_VALUE_UINT:
+            json_stream_uint(js, node_key, node->v.u);
+            break;
+        case ATTR_VALUE_DOUBLE:
+            json_stream_double(js, node_key, node->v.d);
+            break;
+        case ATTR_VALUE_STRING:
+            json_stream_string_len(js, node_key, pool + node->v.offset, node->count);
+            break;
+        case ATTR_VALUE_BYTES:
+            json_stream_hex(js, node_key, reinterpret_cast<const uint8_t *>(pool + node->v.offset), node->count);
+            break;
+        case ATTR_VALUE_STRUCT:
+        case ATTR_VALUE_ARRAY:
+        case ATTR_VALUE_LIST:
+            if (depth + 1 > ATTR_VALUE_MAX_DEPTH)
+            {
+                js->error = ESP_ERR_INVALID_STATE;
+                return;
+            }
+            if (node->type == ATTR_VALUE_STRUCT)
+                json_stream_object_begin(js, node_key);
+            else
+                json_stream_array_begin(js, node_key);
+            depth++;
+            remaining[depth] = node->count;
+            is_struct[depth] = node->type == ATTR_VALUE_STRUCT;
+            break;
+        }
+
+        // Закрываем все контейнеры, у которых закончились элементы
+        while (depth >= 0 && remaining[depth] == 0)
+        {
+            if (is_struct[depth])
+                json_stream_object_end(js);
+            else
+                json_stream_array_end(js);
+            depth--;
+        }
+    }
+}
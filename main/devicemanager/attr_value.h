@@ -0,0 +1,116 @@
+#ifndef ATTR_VALUE_H
+#define ATTR_VALUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "json_stream.h"
+
+// Ограничения на одно значение атрибута
+#define ATTR_VALUE_MAX_NODES 256
+#define ATTR_VALUE_MAX_POOL 2048
+#define ATTR_VALUE_MAX_DEPTH 8
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        ATTR_VALUE_NULL = 0,
+        ATTR_VALUE_BOOL,
+        ATTR_VALUE_INT,
+        ATTR_VALUE_UINT,
+        ATTR_VALUE_DOUBLE,
+        ATTR_VALUE_STRING,
+        ATTR_VALUE_BYTES,
+        ATTR_VALUE_STRUCT,
+        ATTR_VALUE_ARRAY,
+        ATTR_VALUE_LIST,
+    } attr_value_type_t;
+
+    // Элемент дерева значений. Элементы лежат подряд в порядке обхода (pre-order),
+    // у контейнера count дочерних элементов, у строки count байт в пуле
+    typedef struct
+    {
+        uint8_t type;    // attr_value_type_t
+        uint8_t has_tag; // поле структуры с контекстным тегом
+        uint16_t count;
+        uint32_t tag;
+        union
+        {
+            int64_t i;
+            uint64_t u;
+            double d;
+            bool b;
+            uint32_t offset; // смещение строки в пуле
+        } v;
+    } attr_value_node_t;
+
+    // Полное значение атрибута (вложенные списки, структуры, null, 64-битные числа) в одном блоке памяти:
+    // заголовок, затем node_count элементов, затем пул байтов строк
+    typedef struct attr_value
+    {
+        uint16_t node_count;
+        uint16_t pool_size;
+        uint32_t reserved; // выравнивание элементов на 8 байт
+    } attr_value_t;
+
+    static inline const attr_value_node_t *attr_value_nodes(const attr_value_t *value)
+    {
+        return (const attr_value_node_t *)(value + 1);
+    }
+
+    static inline const char *attr_value_pool(const attr_value_t *value)
+    {
+        return (const char *)(attr_value_nodes(value) + value->node_count);
+    }
+
+    static inline const attr_value_node_t *attr_value_root(const attr_value_t *value)
+    {
+        return attr_value_nodes(value);
+    }
+
+    // Общий размер блока в байтах
+    size_t attr_value_size(const attr_value_t *value);
+
+    void attr_value_free(attr_value_t *value);
+
+    // Побайтовое сравнение двух значений (NULL равен только NULL)
+    bool attr_value_equal(const attr_value_t *a, const attr_value_t *b);
+
+    /**
+     * @brief Запись значения в JSON. Структуры пишутся объектами с номерами полей в качестве ключей,
+     *        списки и массивы - массивами, байтовые строки - hex-строками
+     *
+     * @param value Значение
+     * @param js Потоковый writer
+     * @param key Ключ (NULL внутри массива)
+     */
+    void attr_value_write_json(const attr_value_t *value, json_stream_t *js, const char *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+#include <memory>
+#include <lib/core/TLVReader.h>
+
+/**
+ * @brief Декодирование элемента TLV, на котором стоит reader. Сам reader не сдвигается
+ *
+ * @return attr_value_t* Значение или nullptr, если элемент превышает лимиты или не читается
+ */
+attr_value_t *attr_value_decode(const chip::TLV::TLVReader &reader);
+
+struct attr_value_deleter
+{
+    void operator()(attr_value_t *value) const { attr_value_free(value); }
+};
+using attr_value_ptr = std::unique_ptr<attr_value_t, attr_value_deleter>;
+#endif
+
+#endif // ATTR_VALUE_H
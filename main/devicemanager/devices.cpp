@@ -9,10 +9,20 @@
 #include "matter_command.h"
 #include "mqtt.h"
 #include "matter_callbacks.h"
+#include "report_coalescer.h"
+#include "mqtt_topics.h"
+#include "group_registry.h"
+#include "payload_codec.h"
+#include "fd_report.h"
+#include "node_reachability.h"
 #include <esp_matter_controller_subscribe_command.h>
 #include <set>
+#include <map>
+#include <inttypes.h>
+#include <esp_timer.h>
 #include "app_priv.h"
 #include "app_matter_ctrl.h"
+#include "matter_controller_device_mgr.h"
 #define NVS_NAMESPACE "matter_devices"
 #define NVS_KEY "devices_list"
 
@@ -52,6 +62,7 @@ void matter_controller_init(matter_controller_t *controller, uint64_t controller
     {
         ESP_LOGW(TAG_device, "No saved devices found in NVS (err: 0x%x)", load_err);
     }
+    group_registry_load();
     //  log_controller_structure(&g_controller);
 }
 
@@ -85,6 +96,7 @@ matter_device_t *add_node(matter_controller_t *controller, uint64_t node_id, con
     new_node->next = controller->nodes_list;
     controller->nodes_list = new_node;
     controller->nodes_count++;
+    esp_matter::controller::device_mgr::notify_change(esp_matter::controller::device_mgr::REGISTRY_CHANGE_NODE_ADDED);
     return new_node;
 }
 
@@ -206,7 +218,18 @@ static const ClusterHandler cluster_handlers[] = {
     {0xFC00, {0x0003, 0x000A, 0x000E}, 3} // Voltage, Power, Energy
 };
 
+// Совпадает ли новое значение с сохраненным в атрибуте
+static bool attribute_value_same(const matter_attribute_t *attr, const esp_matter_attr_val_t *value, const attr_value_t *tlv_value)
+{
+    if (attr->current_value.type != value->type)
+        return false;
+    if (attr->tlv_value || tlv_value)
+        return attr_value_equal(attr->tlv_value, tlv_value);
+    return memcmp(&attr->current_value.val, &value->val, sizeof(value->val)) == 0;
+}
+
 // Обработка отчета об атрибуте
+
 /**
  * @brief Обработка отчета об атрибуте
  *
@@ -216,11 +239,15 @@ static const ClusterHandler cluster_handlers[] = {
  * @param cluster_id Идентификатор кластера
  * @param attribute_id Идентификатор атрибута (0 для пропуска атрибутов)
  * @param value Указатель на значение атрибута (nullptr для пропуска обновления)
+ * @param tlv_value Полное значение атрибута, освобождается здесь, если не сохранено в реестре
  */
 void handle_attribute_report(matter_controller_t *controller, uint64_t node_id,
                              uint16_t endpoint_id, uint32_t cluster_id,
-                             uint32_t attribute_id, esp_matter_attr_val_t *value, std::optional<bool> need_subscribe)
+                             uint32_t attribute_id, esp_matter_attr_val_t *value, std::optional<bool> need_subscribe,
+                             attr_value_t *tlv_value)
 {
+    attr_value_ptr owned_value(tlv_value);
+
     // Проверка валидности указателя контроллера
     //    if (!controller || controller->magic != CONTROLLER_MAGIC)
     if (!controller)
@@ -262,6 +289,7 @@ void handle_attribute_report(matter_controller_t *controller, uint64_t node_id,
             return;
         }
         ESP_LOGI(TAG_device, "Added endpoint %d to node 0x%016llX", endpoint_id, node_id);
+        esp_matter::controller::device_mgr::notify_change(esp_matter::controller::device_mgr::REGISTRY_CHANGE_TOPOLOGY);
     }
 
     // Если cluster_id = 0, пропускаем обработку кластера
@@ -296,6 +324,7 @@ void handle_attribute_report(matter_controller_t *controller, uint64_t node_id,
             return;
         }
         ESP_LOGI(TAG_device, "Added new cluster 0x%04X (%s)", cluster_id, ClusterIdToText(cluster_id));
+        esp_matter::controller::device_mgr::notify_change(esp_matter::controller::device_mgr::REGISTRY_CHANGE_TOPOLOGY);
     }
 
     // Если attribute_id = 0, пропускаем обработку атрибутов
@@ -326,6 +355,7 @@ void handle_attribute_report(matter_controller_t *controller, uint64_t node_id,
             return;
         }
         ESP_LOGI(TAG_device, "Added new attribute 0x%04X (%s)", attribute_id, AttributeIdToText(cluster_id, attribute_id));
+        esp_matter::controller::device_mgr::notify_change(esp_matter::controller::device_mgr::REGISTRY_CHANGE_TOPOLOGY);
         // Для нового атрибута устанавливаем флаг подписки по умолчанию
         const ClusterHandler *handler = nullptr;
         for (size_t i = 0; i < sizeof(cluster_handlers) / sizeof(ClusterHandler); i++)
@@ -370,6 +400,9 @@ void handle_attribute_report(matter_controller_t *controller, uint64_t node_id,
     // если указано значение need_subscribe устанавливаем флаг подписки на атрибут если значение в функцию не передано то не меняем флаг подписки
     if (need_subscribe.has_value())
     {
+        // список подписок обновляется только при смене флага
+        if (attribute->subscribe != *need_subscribe)
+            esp_matter::controller::device_mgr::notify_change(esp_matter::controller::device_mgr::REGISTRY_CHANGE_SUBSCRIBE);
         if (*need_subscribe)
         {
             attribute->subscribe = true;
@@ -407,9 +440,16 @@ void handle_attribute_report(matter_controller_t *controller, uint64_t node_id,
         //             AttributeIdToText(cluster_id, attribute_id) ? AttributeIdToText(cluster_id, attribute_id) : "Unknown",
         //             attribute_id);
     }
-    // Обновляем значение атрибута
+    // Обновляем значение атрибута. Строки value указывают в owned_value, поэтому старое значение
+    // освобождается только после копирования
+    attr_value_t *old_value = attribute->tlv_value;
+    if (!attribute_value_same(attribute, value, owned_value.get()))
+        attribute->changed = true;
     memcpy(&attribute->current_value, value, sizeof(esp_matter_attr_val_t));
-    publish_fd(&g_controller, node_id, endpoint_id, cluster_id, attribute_id);
+    attribute->tlv_value = owned_value.release();
+    attr_value_free(old_value);
+    // отчет подписки приходит по одному атрибуту за вызов, публикация endpoint'а - по окончании окна
+    report_coalescer_push(node_id, endpoint_id);
 }
 
 esp_err_t remove_device(matter_controller_t *controller, uint64_t node_id)
@@ -456,41 +496,16 @@ esp_err_t remove_device(matter_controller_t *controller, uint64_t node_id)
     // Очистка ресурсов устройства
     ESP_LOGI(TAG_device, "Removing device 0x%016llX", node_id);
 
-    // 1. Удаляем endpoint'ы
-    if (current->endpoints)
-    {
-        free(current->endpoints);
-    }
-
-    // 2. Удаляем серверные кластеры
-    for (uint16_t i = 0; i < current->server_clusters_count; i++)
-    {
-        if (current->server_clusters[i].attributes)
-        {
-            free(current->server_clusters[i].attributes);
-        }
-    }
-    if (current->server_clusters)
-    {
-        free(current->server_clusters);
-    }
+    // Удаляем endpoint'ы, кластеры и атрибуты
+    free_node_topology(current);
+    mqtt_topics_forget_node(node_id);
+    group_registry_forget_node(node_id);
+    node_reachability_forget(node_id);
 
-    // 3. Удаляем клиентские кластеры
-    for (uint16_t i = 0; i < current->client_clusters_count; i++)
-    {
-        if (current->client_clusters[i].attributes)
-        {
-            free(current->client_clusters[i].attributes);
-        }
-    }
-    if (current->client_clusters)
-    {
-        free(current->client_clusters);
-    }
-
-    // 4. Освобождаем сам узел
+    // Освобождаем сам узел
     free(current);
     controller->nodes_count--;
+    esp_matter::controller::device_mgr::notify_change(esp_matter::controller::device_mgr::REGISTRY_CHANGE_NODE_REMOVED);
 
     // Сохраняем изменения в NVS
     esp_err_t save_err = save_devices_to_nvs(controller);
@@ -504,6 +519,59 @@ esp_err_t remove_device(matter_controller_t *controller, uint64_t node_id)
     return ESP_OK;
 }
 
+static void free_cluster_attributes(matter_cluster_t *cluster)
+{
+    if (!cluster->attributes)
+        return;
+    for (uint16_t i = 0; i < cluster->attributes_count; i++)
+        attr_value_free(cluster->attributes[i].tlv_value);
+    free(cluster->attributes);
+    cluster->attributes = NULL;
+}
+
+// Освобождение endpoint'ов, кластеров и атрибутов узла (сам узел не освобождается)
+void free_node_topology(matter_device_t *node)
+{
+    if (!node)
+        return;
+
+    if (node->endpoints)
+        free(node->endpoints);
+    node->endpoints = NULL;
+    node->endpoints_count = 0;
+
+    for (uint16_t i = 0; i < node->server_clusters_count; i++)
+        free_cluster_attributes(&node->server_clusters[i]);
+    if (node->server_clusters)
+        free(node->server_clusters);
+    node->server_clusters = NULL;
+    node->server_clusters_count = 0;
+
+    for (uint16_t i = 0; i < node->client_clusters_count; i++)
+        free_cluster_attributes(&node->client_clusters[i]);
+    if (node->client_clusters)
+        free(node->client_clusters);
+    node->client_clusters = NULL;
+    node->client_clusters_count = 0;
+}
+
+void detach_attribute_values(matter_attribute_t *attributes, uint16_t count)
+{
+    for (uint16_t i = 0; attributes && i < count; i++)
+    {
+        matter_attribute_t *attr = &attributes[i];
+        if (!attr->tlv_value)
+            continue;
+        attr->tlv_value = NULL;
+        if (attr->current_value.type == ESP_MATTER_VAL_TYPE_CHAR_STRING ||
+            attr->current_value.type == ESP_MATTER_VAL_TYPE_OCTET_STRING)
+        {
+            attr->current_value.val.a.b = NULL;
+            attr->current_value.val.a.s = 0;
+        }
+    }
+}
+
 // Освобождение памяти
 void matter_controller_free(matter_controller_t *controller)
 {
@@ -512,35 +580,13 @@ void matter_controller_free(matter_controller_t *controller)
     {
         matter_device_t *next = current->next;
 
-        // Освобождаем endpoints
-        if (current->endpoints)
-            free(current->endpoints);
-
-        // Освобождаем серверные кластеры
-        for (uint16_t i = 0; i < current->server_clusters_count; i++)
-        {
-            if (current->server_clusters[i].attributes)
-            {
-                free(current->server_clusters[i].attributes);
-            }
-        }
-        if (current->server_clusters)
-            free(current->server_clusters);
-
-        // Освобождаем клиентские кластеры
-        for (uint16_t i = 0; i < current->client_clusters_count; i++)
-        {
-            if (current->client_clusters[i].attributes)
-            {
-                free(current->client_clusters[i].attributes);
-            }
-        }
-        if (current->client_clusters)
-            free(current->client_clusters);
+        free_node_topology(current);
 
         free(current);
         current = next;
     }
+    if (controller->nodes_list)
+        esp_matter::controller::device_mgr::notify_change(esp_matter::controller::device_mgr::REGISTRY_CHANGE_NODE_REMOVED);
     controller->nodes_list = NULL;
     controller->nodes_count = 0;
 }
@@ -585,6 +631,15 @@ const char *attr_val_to_char_str(const esp_matter_attr_val_t *val, char *buf, si
     return buf;
 }
 
+static fd_publish_stats_t fd_stats = {};
+// Время последней полной публикации endpoint'а (режим delta)
+static std::map<std::pair<uint64_t, uint16_t>, int64_t> fd_last_full_us;
+
+const fd_publish_stats_t *publish_fd_get_stats(void)
+{
+    return &fd_stats;
+}
+
 esp_err_t publish_fd(matter_controller_t *controller, uint64_t node_id,
                      uint16_t endpoint_id, uint32_t cluster_id,
                      uint32_t attribute_id)
@@ -592,10 +647,17 @@ esp_err_t publish_fd(matter_controller_t *controller, uint64_t node_id,
     if (!controller)
         return ESP_ERR_INVALID_ARG;
 
-#define MAX_TOPIC_LEN 256
-#define MAX_MSG_LEN 2048
-    char fdTopic[MAX_TOPIC_LEN];
-    char value_str[64]; // Буфер для значений атрибутов
+    int64_t started_us = esp_timer_get_time();
+    fd_stats.reports++;
+
+    // В режиме delta публикуются только изменившиеся атрибуты, полное состояние - раз в full_interval
+    bool full = sys_settings.report.mode != REPORT_MODE_DELTA;
+    if (!full && sys_settings.report.full_interval > 0)
+    {
+        auto last = fd_last_full_us.find({node_id, endpoint_id});
+        full = last == fd_last_full_us.end() ||
+               started_us - last->second >= static_cast<int64_t>(sys_settings.report.full_interval) * 1000000;
+    }
 
     matter_device_t *node = controller->nodes_list;
     while (node)
@@ -607,115 +669,52 @@ esp_err_t publish_fd(matter_controller_t *controller, uint64_t node_id,
             continue;
         }
 
-        cJSON *root = cJSON_CreateObject();
-        bool has_data = false;
-
-        for (uint16_t ep_idx = 0; ep_idx < node->endpoints_count; ++ep_idx)
+        // Сообщение пишется сразу в буфер из пула, без промежуточного дерева cJSON, в JSON или CBOR
+        uint8_t format = sys_settings.payload.fd_format;
+        char *msg = json_stream_buf_acquire();
+        if (!msg)
         {
-            endpoint_entry_t *ep = &node->endpoints[ep_idx];
-
-            // Проверяем endpoint_id
-            if (ep->endpoint_id != endpoint_id)
-            {
-                continue;
-            }
-
-            for (uint8_t cl_idx = 0; cl_idx < ep->cluster_count; ++cl_idx)
-            {
-                uint32_t current_cluster_id = ep->clusters[cl_idx];
-
-                // Поиск кластера среди server_clusters
-                for (uint16_t s = 0; s < node->server_clusters_count; ++s)
-                {
-                    matter_cluster_t *cluster = &node->server_clusters[s];
-                    if (cluster->cluster_id == current_cluster_id && cluster->attributes)
-                    {
-                        const char *cluster_name = ClusterIdToText((chip::ClusterId)cluster->cluster_id);
-                        cJSON *cluster_obj = NULL;
-
-                        for (uint16_t a = 0; a < cluster->attributes_count; ++a)
-                        {
-                            matter_attribute_t *attr = &cluster->attributes[a];
-
-                            if (attr->current_value.type)
-                            {
-                                if (!cluster_obj)
-                                {
-                                    // Создаем объект кластера
-                                    cluster_obj = cJSON_GetObjectItemCaseSensitive(root, cluster_name);
-                                    if (!cluster_obj)
-                                    {
-                                        cluster_obj = cJSON_CreateObject();
-                                        cJSON_AddItemToObject(root, cluster_name, cluster_obj);
-                                    }
-                                    has_data = true;
-                                }
-
-                                // Получаем название атрибута
-                                const char *attr_name = AttributeIdToText(
-                                    (chip::ClusterId)cluster->cluster_id,
-                                    (chip::AttributeId)attr->attribute_id);
-
-                                // Преобразуем значение в строку
-                                attr_val_to_char_str(&attr->current_value, value_str, sizeof(value_str));
-
-                                // Добавляем в JSON в зависимости от типа
-                                switch (attr->current_value.type)
-                                {
-                                case ESP_MATTER_VAL_TYPE_BOOLEAN:
-                                    cJSON_AddBoolToObject(cluster_obj, attr_name, attr->current_value.val.b);
-                                    break;
-                                case ESP_MATTER_VAL_TYPE_INT32:
-                                    cJSON_AddNumberToObject(cluster_obj, attr_name, attr->current_value.val.i32);
-                                    break;
-                                case ESP_MATTER_VAL_TYPE_UINT32:
-                                    cJSON_AddNumberToObject(cluster_obj, attr_name, attr->current_value.val.u32);
-                                    break;
-                                case ESP_MATTER_VAL_TYPE_INT64:
-                                    cJSON_AddNumberToObject(cluster_obj, attr_name, (double)attr->current_value.val.i64);
-                                    break;
-                                case ESP_MATTER_VAL_TYPE_UINT64:
-                                    cJSON_AddNumberToObject(cluster_obj, attr_name, (double)attr->current_value.val.u64);
-                                    break;
-                                case ESP_MATTER_VAL_TYPE_FLOAT:
-                                    cJSON_AddNumberToObject(cluster_obj, attr_name, attr->current_value.val.f);
-                                    break;
-                                case ESP_MATTER_VAL_TYPE_CHAR_STRING:
-                                    cJSON_AddStringToObject(cluster_obj, attr_name, (const char *)attr->current_value.val.a.b);
-                                    break;
-                                default:
-                                    // Для остальных типов используем строковое представление
-                                    cJSON_AddStringToObject(cluster_obj, attr_name, value_str);
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+            ESP_LOGE(TAG_device, "No buffer for fd message");
+            return ESP_ERR_NO_MEM;
         }
+        json_stream_t js;
+        payload_encoder_init(&js, format, msg, JSON_STREAM_POOL_BUF_SIZE);
+        bool has_data = fd_report_write(node, endpoint_id, full, &js);
 
         // Публикуем данные, если они есть
         if (has_data)
         {
-            const char *mqttPrefix = sys_settings.mqtt.prefix;
-            snprintf(fdTopic, MAX_TOPIC_LEN, "%s/fd/matter_csa_name/%llu/%u", mqttPrefix, node->node_id, endpoint_id);
-            char *json_str = cJSON_PrintUnformatted(root);
-            if (json_str)
+            const char *fdTopic = mqtt_topic_fd(node->node_id, endpoint_id);
+            esp_err_t err = json_stream_finish(&js);
+            int64_t cpu_us = esp_timer_get_time() - started_us;
+            fd_stats.cpu_us += cpu_us;
+            if (err == ESP_OK)
+                payload_note_encoded(format, js.len, cpu_us);
+            if (err == ESP_OK && fdTopic)
             {
-                if (strlen(json_str) < MAX_MSG_LEN)
+                if (mqtt_publish_state_len(fdTopic, msg, js.len) == ESP_OK)
                 {
-                    mqtt_publish_data(fdTopic, json_str);
-                }
-                else
-                {
-                    ESP_LOGE("MQTT", "Message too large for topic %s", fdTopic);
+                    fd_report_commit();
+                    fd_stats.publishes++;
+                    fd_stats.bytes += js.len;
+                    if (full)
+                    {
+                        fd_stats.full_publishes++;
+                        fd_last_full_us[{node_id, endpoint_id}] = started_us;
+                    }
                 }
-                free(json_str);
             }
+            else if (err != ESP_OK)
+            {
+                ESP_LOGE("MQTT", "Message too large for node %llu endpoint %u", node->node_id, endpoint_id);
+            }
+        }
+        else
+        {
+            fd_stats.skipped++;
         }
 
-        cJSON_Delete(root);
+        json_stream_buf_release(msg);
         node = node->next;
     }
     return ESP_OK;
@@ -725,6 +724,8 @@ esp_err_t publish_fd(matter_controller_t *controller, uint64_t node_id,
 void subscribe_done(uint64_t node_id, uint32_t subscription_id)
 {
     ESP_LOGI(TAG_device, "Successfully subscribed, node %llu, subscription id 0x%08X", node_id, subscription_id);
+    // вызывается и после каждой повторной подписки (auto resubscribe): узел снова отвечает
+    node_reachability_alive(node_id);
 }
 
 // Колбэк для неудачной подписки
@@ -837,6 +838,17 @@ void log_cluster_info(const matter_cluster_t *cluster, bool is_client)
                  attr_name,
                  attr->subscribe ? "✅" : "➖");
 
+        if (attr->tlv_value)
+        {
+            char value_buf[128];
+            json_stream_t js;
+            json_stream_init(&js, value_buf, sizeof(value_buf), NULL, NULL);
+            attr_value_write_json(attr->tlv_value, &js, NULL);
+            bool truncated = json_stream_finish(&js) != ESP_OK;
+            ESP_LOGI(TAG_device, "      Value: %s%s", value_buf, truncated ? "..." : "");
+            continue;
+        }
+
         switch (attr->current_value.type)
         {
         case ESP_MATTER_VAL_TYPE_BOOLEAN:
@@ -915,6 +927,202 @@ void log_controller_structure(const matter_controller_t *controller)
     ESP_LOGI(TAG_device, "===== End of Structure =====");
 }
 
+// --- Сериализация узла (общий формат для devices_list и шаблонов опроса) ---
+static size_t cluster_list_blob_size(const matter_cluster_t *clusters, uint16_t count)
+{
+    size_t size = sizeof(uint16_t); // clusters_count
+    for (uint16_t c = 0; c < count; c++)
+    {
+        size += sizeof(uint32_t) + 32 + sizeof(bool) + sizeof(uint16_t);
+        size += clusters[c].attributes_count * (sizeof(uint32_t) + 32 + sizeof(bool));
+    }
+    return size;
+}
+
+size_t node_blob_size(const matter_device_t *node)
+{
+    size_t size = sizeof(uint64_t) + sizeof(bool) + 32 + 64 + 32 + sizeof(uint32_t) + 32 + sizeof(uint16_t);
+    size += sizeof(uint16_t); // endpoints_count
+    size += node->endpoints_count * (sizeof(uint16_t) + 32 + sizeof(uint8_t) + sizeof(uint16_t) * 16);
+    size += cluster_list_blob_size(node->server_clusters, node->server_clusters_count);
+    size += cluster_list_blob_size(node->client_clusters, node->client_clusters_count);
+    return size;
+}
+
+static uint8_t *cluster_list_blob_write(const matter_cluster_t *clusters, uint16_t count, uint8_t *ptr)
+{
+    *((uint16_t *)ptr) = count;
+    ptr += sizeof(uint16_t);
+    for (uint16_t c = 0; c < count; c++)
+    {
+        const matter_cluster_t *cl = &clusters[c];
+        *((uint32_t *)ptr) = cl->cluster_id;
+        ptr += sizeof(uint32_t);
+        memcpy(ptr, cl->cluster_name, 32);
+        ptr += 32;
+        *((bool *)ptr) = cl->is_client;
+        ptr += sizeof(bool);
+        *((uint16_t *)ptr) = cl->attributes_count;
+        ptr += sizeof(uint16_t);
+        for (uint16_t a = 0; a < cl->attributes_count; a++)
+        {
+            const matter_attribute_t *attr = &cl->attributes[a];
+            *((uint32_t *)ptr) = attr->attribute_id;
+            ptr += sizeof(uint32_t);
+            memcpy(ptr, attr->attribute_name, 32);
+            ptr += 32;
+            *((bool *)ptr) = attr->subscribe;
+            ptr += sizeof(bool);
+        }
+    }
+    return ptr;
+}
+
+uint8_t *node_blob_write(const matter_device_t *node, uint8_t *ptr)
+{
+    *((uint64_t *)ptr) = node->node_id;
+    ptr += sizeof(uint64_t);
+    *((bool *)ptr) = node->is_online;
+    ptr += sizeof(bool);
+    memcpy(ptr, node->model_name, 32);
+    ptr += 32;
+    memcpy(ptr, node->description, 64);
+    ptr += 64;
+    memcpy(ptr, node->vendor_name, 32);
+    ptr += 32;
+    *((uint32_t *)ptr) = node->vendor_id;
+    ptr += sizeof(uint32_t);
+    memcpy(ptr, node->firmware_version, 32);
+    ptr += 32;
+    *((uint16_t *)ptr) = node->product_id;
+    ptr += sizeof(uint16_t);
+
+    // endpoints
+    *((uint16_t *)ptr) = node->endpoints_count;
+    ptr += sizeof(uint16_t);
+    for (uint16_t e = 0; e < node->endpoints_count; e++)
+    {
+        const endpoint_entry_t *ep = &node->endpoints[e];
+        *((uint16_t *)ptr) = ep->endpoint_id;
+        ptr += sizeof(uint16_t);
+        memcpy(ptr, ep->endpoint_name, 32);
+        ptr += 32;
+        *((uint8_t *)ptr) = ep->cluster_count;
+        ptr += sizeof(uint8_t);
+        memcpy(ptr, ep->clusters, sizeof(uint16_t) * 16);
+        ptr += sizeof(uint16_t) * 16;
+    }
+
+    ptr = cluster_list_blob_write(node->server_clusters, node->server_clusters_count, ptr);
+    ptr = cluster_list_blob_write(node->client_clusters, node->client_clusters_count, ptr);
+    return ptr;
+}
+
+// Проверка, что в буфере осталось не меньше n байт
+#define BLOB_NEED(ptr, end, n) \
+    if ((size_t)((end) - (ptr)) < (size_t)(n)) \
+        return NULL;
+
+static const uint8_t *cluster_list_blob_read(matter_cluster_t **clusters, uint16_t *count, const uint8_t *ptr, const uint8_t *end)
+{
+    BLOB_NEED(ptr, end, sizeof(uint16_t));
+    *count = *((const uint16_t *)ptr);
+    ptr += sizeof(uint16_t);
+    if (*count == 0)
+        return ptr;
+
+    *clusters = (matter_cluster_t *)calloc(*count, sizeof(matter_cluster_t));
+    if (!*clusters)
+    {
+        *count = 0;
+        return NULL;
+    }
+    for (uint16_t c = 0; c < *count; c++)
+    {
+        matter_cluster_t *cl = &(*clusters)[c];
+        BLOB_NEED(ptr, end, sizeof(uint32_t) + 32 + sizeof(bool) + sizeof(uint16_t));
+        cl->cluster_id = *((const uint32_t *)ptr);
+        ptr += sizeof(uint32_t);
+        memcpy(cl->cluster_name, ptr, 32);
+        ptr += 32;
+        cl->is_client = *((const bool *)ptr);
+        ptr += sizeof(bool);
+        uint16_t attributes_count = *((const uint16_t *)ptr);
+        ptr += sizeof(uint16_t);
+        if (attributes_count > 0)
+        {
+            cl->attributes = (matter_attribute_t *)calloc(attributes_count, sizeof(matter_attribute_t));
+            if (!cl->attributes)
+                return NULL;
+            cl->attributes_count = attributes_count;
+            for (uint16_t a = 0; a < attributes_count; a++)
+            {
+                matter_attribute_t *attr = &cl->attributes[a];
+                BLOB_NEED(ptr, end, sizeof(uint32_t) + 32 + sizeof(bool));
+                attr->attribute_id = *((const uint32_t *)ptr);
+                ptr += sizeof(uint32_t);
+                memcpy(attr->attribute_name, ptr, 32);
+                ptr += 32;
+                attr->subscribe = *((const bool *)ptr);
+                ptr += sizeof(bool);
+            }
+        }
+    }
+    return ptr;
+}
+
+const uint8_t *node_blob_read(matter_device_t *node, const uint8_t *ptr, const uint8_t *end)
+{
+    BLOB_NEED(ptr, end, sizeof(uint64_t) + sizeof(bool) + 32 + 64 + 32 + sizeof(uint32_t) + 32 + sizeof(uint16_t) * 2);
+    node->node_id = *((const uint64_t *)ptr);
+    ptr += sizeof(uint64_t);
+    node->is_online = *((const bool *)ptr);
+    ptr += sizeof(bool);
+    memcpy(node->model_name, ptr, 32);
+    ptr += 32;
+    memcpy(node->description, ptr, 64);
+    ptr += 64;
+    memcpy(node->vendor_name, ptr, 32);
+    ptr += 32;
+    node->vendor_id = *((const uint32_t *)ptr);
+    ptr += sizeof(uint32_t);
+    memcpy(node->firmware_version, ptr, 32);
+    ptr += 32;
+    node->product_id = *((const uint16_t *)ptr);
+    ptr += sizeof(uint16_t);
+
+    // endpoints
+    uint16_t endpoints_count = *((const uint16_t *)ptr);
+    ptr += sizeof(uint16_t);
+    if (endpoints_count > 0)
+    {
+        node->endpoints = (endpoint_entry_t *)calloc(endpoints_count, sizeof(endpoint_entry_t));
+        if (!node->endpoints)
+            return NULL;
+        node->endpoints_count = endpoints_count;
+        for (uint16_t e = 0; e < endpoints_count; e++)
+        {
+            endpoint_entry_t *ep = &node->endpoints[e];
+            BLOB_NEED(ptr, end, sizeof(uint16_t) + 32 + sizeof(uint8_t) + sizeof(uint16_t) * 16);
+            ep->endpoint_id = *((const uint16_t *)ptr);
+            ptr += sizeof(uint16_t);
+            memcpy(ep->endpoint_name, ptr, 32);
+            ptr += 32;
+            ep->cluster_count = *((const uint8_t *)ptr);
+            ptr += sizeof(uint8_t);
+            memcpy(ep->clusters, ptr, sizeof(uint16_t) * 16);
+            ptr += sizeof(uint16_t) * 16;
+        }
+    }
+
+    ptr = cluster_list_blob_read(&node->server_clusters, &node->server_clusters_count, ptr, end);
+    if (!ptr)
+        return NULL;
+    return cluster_list_blob_read(&node->client_clusters, &node->client_clusters_count, ptr, end);
+}
+
+#undef BLOB_NEED
+
 // --- Сохранение устройств в NVS с полной структурой ---
 esp_err_t save_devices_to_nvs(matter_controller_t *controller)
 {
@@ -933,30 +1141,7 @@ esp_err_t save_devices_to_nvs(matter_controller_t *controller)
     matter_device_t *current = controller->nodes_list;
     while (current)
     {
-        required_size += sizeof(uint64_t) + sizeof(bool) + 32 + 64 + 32 + sizeof(uint32_t) + 32 + sizeof(uint16_t);
-        required_size += sizeof(uint16_t); // endpoints_count
-        for (uint16_t e = 0; e < current->endpoints_count; e++)
-        {
-            required_size += sizeof(uint16_t) + 32 + sizeof(uint8_t) + sizeof(uint16_t) * 16;
-        }
-        required_size += sizeof(uint16_t); // server_clusters_count
-        for (uint16_t sc = 0; sc < current->server_clusters_count; sc++)
-        {
-            required_size += sizeof(uint32_t) + 32 + sizeof(bool) + sizeof(uint16_t);
-            for (uint16_t a = 0; a < current->server_clusters[sc].attributes_count; a++)
-            {
-                required_size += sizeof(uint32_t) + 32 + sizeof(bool);
-            }
-        }
-        required_size += sizeof(uint16_t); // client_clusters_count
-        for (uint16_t cc = 0; cc < current->client_clusters_count; cc++)
-        {
-            required_size += sizeof(uint32_t) + 32 + sizeof(bool) + sizeof(uint16_t);
-            for (uint16_t a = 0; a < current->client_clusters[cc].attributes_count; a++)
-            {
-                required_size += sizeof(uint32_t) + 32 + sizeof(bool);
-            }
-        }
+        required_size += node_blob_size(current);
         current = current->next;
     }
 
@@ -974,91 +1159,7 @@ esp_err_t save_devices_to_nvs(matter_controller_t *controller)
     current = controller->nodes_list;
     while (current)
     {
-        *((uint64_t *)ptr) = current->node_id;
-        ptr += sizeof(uint64_t);
-        *((bool *)ptr) = current->is_online;
-        ptr += sizeof(bool);
-        memcpy(ptr, current->model_name, 32);
-        ptr += 32;
-        memcpy(ptr, current->description, 64);
-        ptr += 64;
-        memcpy(ptr, current->vendor_name, 32);
-        ptr += 32;
-        *((uint32_t *)ptr) = current->vendor_id;
-        ptr += sizeof(uint32_t);
-        memcpy(ptr, current->firmware_version, 32);
-        ptr += 32;
-        *((uint16_t *)ptr) = current->product_id;
-        ptr += sizeof(uint16_t);
-
-        // endpoints
-        *((uint16_t *)ptr) = current->endpoints_count;
-        ptr += sizeof(uint16_t);
-        for (uint16_t e = 0; e < current->endpoints_count; e++)
-        {
-            endpoint_entry_t *ep = &current->endpoints[e];
-            *((uint16_t *)ptr) = ep->endpoint_id;
-            ptr += sizeof(uint16_t);
-            memcpy(ptr, ep->endpoint_name, 32);
-            ptr += 32;
-            *((uint8_t *)ptr) = ep->cluster_count;
-            ptr += sizeof(uint8_t);
-            memcpy(ptr, ep->clusters, sizeof(uint16_t) * 16);
-            ptr += sizeof(uint16_t) * 16;
-        }
-
-        // server_clusters
-        *((uint16_t *)ptr) = current->server_clusters_count;
-        ptr += sizeof(uint16_t);
-        for (uint16_t sc = 0; sc < current->server_clusters_count; sc++)
-        {
-            matter_cluster_t *cl = &current->server_clusters[sc];
-            *((uint32_t *)ptr) = cl->cluster_id;
-            ptr += sizeof(uint32_t);
-            memcpy(ptr, cl->cluster_name, 32);
-            ptr += 32;
-            *((bool *)ptr) = cl->is_client;
-            ptr += sizeof(bool);
-            *((uint16_t *)ptr) = cl->attributes_count;
-            ptr += sizeof(uint16_t);
-            for (uint16_t a = 0; a < cl->attributes_count; a++)
-            {
-                matter_attribute_t *attr = &cl->attributes[a];
-                *((uint32_t *)ptr) = attr->attribute_id;
-                ptr += sizeof(uint32_t);
-                memcpy(ptr, attr->attribute_name, 32);
-                ptr += 32;
-                *((bool *)ptr) = attr->subscribe;
-                ptr += sizeof(bool);
-            }
-        }
-
-        // client_clusters
-        *((uint16_t *)ptr) = current->client_clusters_count;
-        ptr += sizeof(uint16_t);
-        for (uint16_t cc = 0; cc < current->client_clusters_count; cc++)
-        {
-            matter_cluster_t *cl = &current->client_clusters[cc];
-            *((uint32_t *)ptr) = cl->cluster_id;
-            ptr += sizeof(uint32_t);
-            memcpy(ptr, cl->cluster_name, 32);
-            ptr += 32;
-            *((bool *)ptr) = cl->is_client;
-            ptr += sizeof(bool);
-            *((uint16_t *)ptr) = cl->attributes_count;
-            ptr += sizeof(uint16_t);
-            for (uint16_t a = 0; a < cl->attributes_count; a++)
-            {
-                matter_attribute_t *attr = &cl->attributes[a];
-                *((uint32_t *)ptr) = attr->attribute_id;
-                ptr += sizeof(uint32_t);
-                memcpy(ptr, attr->attribute_name, 32);
-                ptr += 32;
-                *((bool *)ptr) = attr->subscribe;
-                ptr += sizeof(bool);
-            }
-        }
-
+        ptr = node_blob_write(current, ptr);
         current = current->next;
     }
 
@@ -1112,8 +1213,9 @@ esp_err_t load_devices_from_nvs(matter_controller_t *controller)
         return err;
     }
 
-    uint8_t *ptr = buffer;
-    uint16_t nodes_count = *((uint16_t *)ptr);
+    const uint8_t *ptr = buffer;
+    const uint8_t *end = buffer + required_size;
+    uint16_t nodes_count = *((const uint16_t *)ptr);
     ptr += sizeof(uint16_t);
 
     for (uint16_t i = 0; i < nodes_count; i++)
@@ -1125,116 +1227,21 @@ esp_err_t load_devices_from_nvs(matter_controller_t *controller)
             return ESP_ERR_NO_MEM;
         }
 
-        node->node_id = *((uint64_t *)ptr);
-        ptr += sizeof(uint64_t);
-        node->is_online = *((bool *)ptr);
-        ptr += sizeof(bool);
-        memcpy(node->model_name, ptr, 32);
-        ptr += 32;
-        memcpy(node->description, ptr, 64);
-        ptr += 64;
-        memcpy(node->vendor_name, ptr, 32);
-        ptr += 32;
-        node->vendor_id = *((uint32_t *)ptr);
-        ptr += sizeof(uint32_t);
-        memcpy(node->firmware_version, ptr, 32);
-        ptr += 32;
-        node->product_id = *((uint16_t *)ptr);
-        ptr += sizeof(uint16_t);
-
-        // endpoints
-        node->endpoints_count = *((uint16_t *)ptr);
-        ptr += sizeof(uint16_t);
-        if (node->endpoints_count > 0)
-        {
-            node->endpoints = (endpoint_entry_t *)calloc(node->endpoints_count, sizeof(endpoint_entry_t));
-            for (uint16_t e = 0; e < node->endpoints_count; e++)
-            {
-                endpoint_entry_t *ep = &node->endpoints[e];
-                ep->endpoint_id = *((uint16_t *)ptr);
-                ptr += sizeof(uint16_t);
-                memcpy(ep->endpoint_name, ptr, 32);
-                ptr += 32;
-                ep->cluster_count = *((uint8_t *)ptr);
-                ptr += sizeof(uint8_t);
-                memcpy(ep->clusters, ptr, sizeof(uint16_t) * 16);
-                ptr += sizeof(uint16_t) * 16;
-            }
-        }
-
-        // server_clusters
-        node->server_clusters_count = *((uint16_t *)ptr);
-        ptr += sizeof(uint16_t);
-        if (node->server_clusters_count > 0)
-        {
-            node->server_clusters = (matter_cluster_t *)calloc(node->server_clusters_count, sizeof(matter_cluster_t));
-            for (uint16_t sc = 0; sc < node->server_clusters_count; sc++)
-            {
-                matter_cluster_t *cl = &node->server_clusters[sc];
-                cl->cluster_id = *((uint32_t *)ptr);
-                ptr += sizeof(uint32_t);
-                memcpy(cl->cluster_name, ptr, 32);
-                ptr += 32;
-                cl->is_client = *((bool *)ptr);
-                ptr += sizeof(bool);
-                cl->attributes_count = *((uint16_t *)ptr);
-                ptr += sizeof(uint16_t);
-                if (cl->attributes_count > 0)
-                {
-                    cl->attributes = (matter_attribute_t *)calloc(cl->attributes_count, sizeof(matter_attribute_t));
-                    for (uint16_t a = 0; a < cl->attributes_count; a++)
-                    {
-                        matter_attribute_t *attr = &cl->attributes[a];
-                        attr->attribute_id = *((uint32_t *)ptr);
-                        ptr += sizeof(uint32_t);
-                        memcpy(attr->attribute_name, ptr, 32);
-                        ptr += 32;
-                        attr->subscribe = *((bool *)ptr);
-                        ptr += sizeof(bool);
-                    }
-                }
-            }
-        }
-
-        // client_clusters
-        node->client_clusters_count = *((uint16_t *)ptr);
-        ptr += sizeof(uint16_t);
-        if (node->client_clusters_count > 0)
+        ptr = node_blob_read(node, ptr, end);
+        if (!ptr)
         {
-            node->client_clusters = (matter_cluster_t *)calloc(node->client_clusters_count, sizeof(matter_cluster_t));
-            for (uint16_t cc = 0; cc < node->client_clusters_count; cc++)
-            {
-                matter_cluster_t *cl = &node->client_clusters[cc];
-                cl->cluster_id = *((uint32_t *)ptr);
-                ptr += sizeof(uint32_t);
-                memcpy(cl->cluster_name, ptr, 32);
-                ptr += 32;
-                cl->is_client = *((bool *)ptr);
-                ptr += sizeof(bool);
-                cl->attributes_count = *((uint16_t *)ptr);
-                ptr += sizeof(uint16_t);
-                if (cl->attributes_count > 0)
-                {
-                    cl->attributes = (matter_attribute_t *)calloc(cl->attributes_count, sizeof(matter_attribute_t));
-                    for (uint16_t a = 0; a < cl->attributes_count; a++)
-                    {
-                        matter_attribute_t *attr = &cl->attributes[a];
-                        attr->attribute_id = *((uint32_t *)ptr);
-                        ptr += sizeof(uint32_t);
-                        memcpy(attr->attribute_name, ptr, 32);
-                        ptr += 32;
-                        attr->subscribe = *((bool *)ptr);
-                        ptr += sizeof(bool);
-                    }
-                }
-            }
+            ESP_LOGE(TAG_device, "Devices blob is truncated at node %u", i);
+            free_node_topology(node);
+            free(node);
+            free(buffer);
+            return ESP_ERR_INVALID_SIZE;
         }
 
         node->next = controller->nodes_list;
         controller->nodes_list = node;
+        controller->nodes_count++;
     }
 
-    controller->nodes_count = nodes_count;
     free(buffer);
     return ESP_OK;
 }
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "esp_matter.h"
+#include "attr_value.h"
 
 #define CONTROLLER_MAGIC 0x4D415454
 
@@ -18,8 +19,10 @@ extern "C"
         uint32_t attribute_id;
         char attribute_name[32];
         esp_matter_attr_val_t current_value;
+        attr_value_t *tlv_value; // полное значение (строки, списки, структуры, null); строки current_value указывают в него
         bool subscribe;
         bool is_subscribed;
+        bool changed; // значение изменилось после последней публикации
         uint32_t subs_min_interval;
         uint32_t subs_max_interval;
 
@@ -152,10 +155,13 @@ extern "C"
      * @param cluster_id Идентификатор кластера
      * @param attribute_id Идентификатор атрибута
      * @param value Указатель на значение атрибута
+     * @param need_subscribe Установить флаг подписки атрибута
+     * @param tlv_value Полное значение атрибута, владение передается в реестр (может быть NULL)
      */
     void handle_attribute_report(matter_controller_t *controller, uint64_t node_id,
                                  uint16_t endpoint_id, uint32_t cluster_id,
-                                 uint32_t attribute_id, esp_matter_attr_val_t *value, std::optional<bool> need_subscribe = std::nullopt);
+                                 uint32_t attribute_id, esp_matter_attr_val_t *value, std::optional<bool> need_subscribe = std::nullopt,
+                                 attr_value_t *tlv_value = nullptr);
 
     /**
      * @brief Освобождение ресурсов контроллера
@@ -172,7 +178,8 @@ extern "C"
     void log_controller_structure(const matter_controller_t *controller);
 
     /**
-     * @brief Удаление устройства из контроллера
+     * @brief Удаление устройства из контроллера. Только на потоке CHIP: кэш топиков fd,
+     *        реестр групп и уведомление device_mgr принадлежат ему
      *
      * @param controller Указатель на контроллер
      * @param node_id ID узла для удаления
@@ -195,10 +202,76 @@ extern "C"
      */
     void log_cluster_info(const matter_cluster_t *cluster, bool is_client);
 
+    /**
+     * @brief Освобождение endpoint'ов, кластеров и атрибутов узла (сам узел не освобождается)
+     *
+     * @param node Указатель на узел
+     */
+    void free_node_topology(matter_device_t *node);
+
+    /**
+     * @brief Запись значения атрибута в JSON: полное значение tlv_value или скаляр current_value
+     *
+     * @param attr Атрибут
+     * @param js Потоковый writer
+     * @param key Ключ (NULL внутри массива)
+     */
+    void attribute_value_write_json(const matter_attribute_t *attr, json_stream_t *js, const char *key);
+
+    /**
+     * @brief Отвязка значений от скопированного через memcpy массива атрибутов: копия не владеет
+     *        tlv_value, а строки current_value указывали бы в память оригинала
+     *
+     * @param attributes Массив атрибутов копии
+     * @param count Количество атрибутов
+     */
+    void detach_attribute_values(matter_attribute_t *attributes, uint16_t count);
+
+    /**
+     * @brief Размер узла в формате blob, который используется для хранения в NVS
+     *
+     * @param node Указатель на узел
+     * @return size_t Размер в байтах
+     */
+    size_t node_blob_size(const matter_device_t *node);
+
+    /**
+     * @brief Сериализация узла (без значений атрибутов) в буфер размером не меньше node_blob_size()
+     *
+     * @param node Указатель на узел
+     * @param ptr Позиция записи
+     * @return uint8_t* Позиция сразу после записанных данных
+     */
+    uint8_t *node_blob_write(const matter_device_t *node, uint8_t *ptr);
+
+    /**
+     * @brief Чтение узла из буфера. Память под endpoint'ы и кластеры выделяется внутри,
+     *        при ошибке уже выделенное освобождается через free_node_topology()
+     *
+     * @param node Обнуленная структура узла
+     * @param ptr Позиция чтения
+     * @param end Конец буфера
+     * @return const uint8_t* Позиция сразу после прочитанных данных или NULL, если буфер поврежден
+     */
+    const uint8_t *node_blob_read(matter_device_t *node, const uint8_t *ptr, const uint8_t *end);
+
     esp_err_t save_devices_to_nvs(matter_controller_t *controller);
     esp_err_t load_devices_from_nvs(matter_controller_t *controller);
     void clear_devices_in_nvs();
     esp_err_t subscribe_all_marked_attributes(matter_controller_t *controller);
+    // Статистика публикаций значений атрибутов с момента загрузки
+    typedef struct
+    {
+        uint32_t reports;        // вызовов publish_fd
+        uint32_t publishes;      // отправленных сообщений
+        uint32_t full_publishes; // из них с полным состоянием endpoint'а
+        uint32_t skipped;        // delta: нечего публиковать
+        uint64_t bytes;          // отправлено байт
+        uint64_t cpu_us;         // время формирования сообщений
+    } fd_publish_stats_t;
+
+    const fd_publish_stats_t *publish_fd_get_stats(void);
+
     esp_err_t publish_fd(matter_controller_t *controller, uint64_t node_id,
                          uint16_t endpoint_id, uint32_t cluster_id,
                          uint32_t attribute_id);
@@ -0,0 +1,151 @@
+#include "fd_report.h"
+#include "EntryToText.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <vector>
+
+// Атрибуты последнего сообщения: флаг changed снимается только после успешной отправки.
+// Поток CHIP, емкость сохраняется между вызовами
+static std::vector<matter_attribute_t *> fd_written;
+
+void attribute_value_write_json(const matter_attribute_t *attr, json_stream_t *js, const char *key)
+{
+    if (attr->tlv_value)
+    {
+        attr_value_write_json(attr->tlv_value, js, key);
+        return;
+    }
+
+    const esp_matter_attr_val_t *val = &attr->current_value;
+    switch (val->type)
+    {
+    case ESP_MATTER_VAL_TYPE_BOOLEAN:
+        json_stream_bool(js, key, val->val.b);
+        break;
+    case ESP_MATTER_VAL_TYPE_INTEGER:
+        json_stream_int(js, key, val->val.i);
+        break;
+    case ESP_MATTER_VAL_TYPE_INT8:
+        json_stream_int(js, key, val->val.i8);
+        break;
+    case ESP_MATTER_VAL_TYPE_INT16:
+        json_stream_int(js, key, val->val.i16);
+        break;
+    case ESP_MATTER_VAL_TYPE_INT32:
+        json_stream_int(js, key, val->val.i32);
+        break;
+    case ESP_MATTER_VAL_TYPE_INT64:
+        json_stream_int(js, key, val->val.i64);
+        break;
+    case ESP_MATTER_VAL_TYPE_UINT8:
+    case ESP_MATTER_VAL_TYPE_ENUM8:
+    case ESP_MATTER_VAL_TYPE_BITMAP8:
+        json_stream_uint(js, key, val->val.u8);
+        break;
+    case ESP_MATTER_VAL_TYPE_UINT16:
+    case ESP_MATTER_VAL_TYPE_ENUM16:
+    case ESP_MATTER_VAL_TYPE_BITMAP16:
+        json_stream_uint(js, key, val->val.u16);
+        break;
+    case ESP_MATTER_VAL_TYPE_UINT32:
+    case ESP_MATTER_VAL_TYPE_BITMAP32:
+        json_stream_uint(js, key, val->val.u32);
+        break;
+    case ESP_MATTER_VAL_TYPE_UINT64:
+        json_stream_uint(js, key, val->val.u64);
+        break;
+    case ESP_MATTER_VAL_TYPE_FLOAT:
+        json_stream_double(js, key, val->val.f);
+        break;
+    case ESP_MATTER_VAL_TYPE_CHAR_STRING:
+    case ESP_MATTER_VAL_TYPE_LONG_CHAR_STRING:
+        json_stream_string_len(js, key, val->val.a.b ? (const char *)val->val.a.b : "", val->val.a.b ? val->val.a.s : 0);
+        break;
+    case ESP_MATTER_VAL_TYPE_OCTET_STRING:
+    case ESP_MATTER_VAL_TYPE_LONG_OCTET_STRING:
+        json_stream_hex(js, key, val->val.a.b, val->val.a.b ? val->val.a.s : 0);
+        break;
+    default:
+        json_stream_null(js, key);
+        break;
+    }
+}
+
+bool fd_report_write(matter_device_t *node, uint16_t endpoint_id, bool full, json_stream_t *js)
+{
+    char key[12]; // имя неизвестного кластера или атрибута в hex
+    bool has_data = false;
+    fd_written.clear();
+
+    json_stream_object_begin(js, NULL);
+    for (uint16_t ep_idx = 0; ep_idx < node->endpoints_count; ++ep_idx)
+    {
+        endpoint_entry_t *ep = &node->endpoints[ep_idx];
+
+        // Проверяем endpoint_id
+        if (ep->endpoint_id != endpoint_id)
+        {
+            continue;
+        }
+
+        for (uint8_t cl_idx = 0; cl_idx < ep->cluster_count; ++cl_idx)
+        {
+            uint32_t current_cluster_id = ep->clusters[cl_idx];
+
+            // Поиск кластера среди server_clusters
+            for (uint16_t s = 0; s < node->server_clusters_count; ++s)
+            {
+                matter_cluster_t *cluster = &node->server_clusters[s];
+                if (cluster->cluster_id == current_cluster_id && cluster->attributes)
+                {
+                    bool cluster_open = false;
+
+                    for (uint16_t a = 0; a < cluster->attributes_count; ++a)
+                    {
+                        matter_attribute_t *attr = &cluster->attributes[a];
+
+                        if ((attr->current_value.type || attr->tlv_value) && (full || attr->changed))
+                        {
+                            fd_written.push_back(attr);
+                            if (!cluster_open)
+                            {
+                                // Объект кластера открывается только при первом атрибуте
+                                const char *cluster_name = ClusterIdToText((chip::ClusterId)cluster->cluster_id);
+                                if (!cluster_name)
+                                {
+                                    snprintf(key, sizeof(key), "0x%04" PRIX32, cluster->cluster_id);
+                                    cluster_name = key;
+                                }
+                                json_stream_object_begin(js, cluster_name);
+                                cluster_open = true;
+                                has_data = true;
+                            }
+
+                            // Получаем название атрибута
+                            const char *attr_name = AttributeIdToText(
+                                (chip::ClusterId)cluster->cluster_id,
+                                (chip::AttributeId)attr->attribute_id);
+                            if (!attr_name)
+                            {
+                                snprintf(key, sizeof(key), "0x%04" PRIX32, attr->attribute_id);
+                                attr_name = key;
+                            }
+                            attribute_value_write_json(attr, js, attr_name);
+                        }
+                    }
+                    if (cluster_open)
+                        json_stream_object_end(js);
+                }
+            }
+        }
+    }
+    json_stream_object_end(js);
+    return has_data;
+}
+
+void fd_report_commit(void)
+{
+    for (matter_attribute_t *attr : fd_written)
+        attr->changed = false;
+    fd_written.clear();
+}
@@ -0,0 +1,35 @@
+#ifndef FD_REPORT_H
+#define FD_REPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "devices.h"
+#include "json_stream.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Сообщение fd одного endpoint'а узла: объекты кластеров endpoint'а с атрибутами, у которых есть
+     *        значение, при full == false только атрибуты с флагом changed. Объект кластера открывается только
+     *        при первом атрибуте. Флаги не снимаются: после успешной отправки вызывается fd_report_commit(),
+     *        иначе изменения попадут в следующее сообщение. Только на потоке CHIP
+     *
+     * @param node Узел
+     * @param endpoint_id ID endpoint'а
+     * @param full Полное состояние endpoint'а
+     * @param js Writer, инициализированный вызывающим (формат и буфер)
+     * @return bool В сообщении есть атрибуты
+     */
+    bool fd_report_write(matter_device_t *node, uint16_t endpoint_id, bool full, json_stream_t *js);
+
+    // Сообщение последнего fd_report_write() отправлено: снятие флагов changed его атрибутов
+    void fd_report_commit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FD_REPORT_H
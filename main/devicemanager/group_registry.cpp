@@ -0,0 +1,199 @@
+#include "group_registry.h"
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <nvs_flash.h>
+#include <nvs.h>
+
+#define NVS_GROUPS_NAMESPACE "matter_grp"
+#define NVS_GROUPS_KEY "groups"
+#define GROUP_REGISTRY_MAGIC 0x47525031 // "GRP1"
+
+static const char *TAG = "group_registry";
+
+// Blob в NVS: заголовок и count групп, хранится прямо в виде этой структуры
+typedef struct
+{
+    uint32_t magic;
+    uint8_t count;
+    matter_group_t groups[GROUP_REGISTRY_MAX_GROUPS];
+} groups_store_t;
+
+static groups_store_t store;
+
+static size_t store_size(uint8_t count)
+{
+    return offsetof(groups_store_t, groups) + count * sizeof(matter_group_t);
+}
+
+esp_err_t group_registry_load(void)
+{
+    memset(&store, 0, sizeof(store));
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_GROUPS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+        return ESP_ERR_NOT_FOUND;
+
+    size_t size = sizeof(store);
+    err = nvs_get_blob(handle, NVS_GROUPS_KEY, &store, &size);
+    nvs_close(handle);
+    if (err != ESP_OK)
+    {
+        memset(&store, 0, sizeof(store));
+        return err;
+    }
+    if (store.magic != GROUP_REGISTRY_MAGIC || store.count > GROUP_REGISTRY_MAX_GROUPS || size != store_size(store.count))
+    {
+        ESP_LOGE(TAG, "Stored groups are corrupted, ignored");
+        memset(&store, 0, sizeof(store));
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (uint8_t i = 0; i < store.count; i++)
+    {
+        if (store.groups[i].member_count > GROUP_REGISTRY_MAX_MEMBERS)
+            store.groups[i].member_count = GROUP_REGISTRY_MAX_MEMBERS;
+        store.groups[i].name[GROUP_REGISTRY_NAME_MAX - 1] = '\0';
+    }
+    ESP_LOGI(TAG, "Loaded %u groups", store.count);
+    return ESP_OK;
+}
+
+esp_err_t group_registry_save(void)
+{
+    store.magic = GROUP_REGISTRY_MAGIC;
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_GROUPS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return err;
+    err = nvs_set_blob(handle, NVS_GROUPS_KEY, &store, store_size(store.count));
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Failed to save groups: %s", esp_err_to_name(err));
+    return err;
+}
+
+matter_group_t *group_registry_find(uint16_t group_id)
+{
+    for (uint8_t i = 0; i < store.count; i++)
+    {
+        if (store.groups[i].group_id == group_id)
+            return &store.groups[i];
+    }
+    return NULL;
+}
+
+matter_group_t *group_registry_add(uint16_t group_id, uint16_t keyset_id, const char *name, const uint8_t *epoch_key)
+{
+    matter_group_t *group = group_registry_find(group_id);
+    if (!group)
+    {
+        if (store.count == GROUP_REGISTRY_MAX_GROUPS)
+            return NULL;
+        group = &store.groups[store.count++];
+        memset(group, 0, sizeof(*group));
+        group->group_id = group_id;
+    }
+    group->keyset_id = keyset_id;
+    strlcpy(group->name, name ? name : "", sizeof(group->name));
+    memcpy(group->epoch_key, epoch_key, GROUP_REGISTRY_EPOCH_KEY_LEN);
+    return group;
+}
+
+esp_err_t group_registry_remove(uint16_t group_id)
+{
+    matter_group_t *group = group_registry_find(group_id);
+    if (!group)
+        return ESP_ERR_NOT_FOUND;
+    size_t index = group - store.groups;
+    memmove(&store.groups[index], &store.groups[index + 1], (store.count - index - 1) * sizeof(matter_group_t));
+    store.count--;
+    return ESP_OK;
+}
+
+static int member_index(const matter_group_t *group, uint64_t node_id, uint16_t endpoint_id)
+{
+    for (uint8_t i = 0; i < group->member_count; i++)
+    {
+        if (group->members[i].node_id == node_id && group->members[i].endpoint_id == endpoint_id)
+            return i;
+    }
+    return -1;
+}
+
+esp_err_t group_registry_add_member(matter_group_t *group, uint64_t node_id, uint16_t endpoint_id)
+{
+    if (member_index(group, node_id, endpoint_id) >= 0)
+        return ESP_OK;
+    if (group->member_count == GROUP_REGISTRY_MAX_MEMBERS)
+        return ESP_ERR_NO_MEM;
+    group->members[group->member_count++] = {node_id, endpoint_id};
+    return ESP_OK;
+}
+
+esp_err_t group_registry_remove_member(matter_group_t *group, uint64_t node_id, uint16_t endpoint_id)
+{
+    int index = member_index(group, node_id, endpoint_id);
+    if (index < 0)
+        return ESP_ERR_NOT_FOUND;
+    memmove(&group->members[index], &group->members[index + 1],
+            (group->member_count - index - 1) * sizeof(group_member_t));
+    group->member_count--;
+    return ESP_OK;
+}
+
+bool group_registry_has_node(const matter_group_t *group, uint64_t node_id)
+{
+    for (uint8_t i = 0; i < group->member_count; i++)
+    {
+        if (group->members[i].node_id == node_id)
+            return true;
+    }
+    return false;
+}
+
+void group_registry_forget_node(uint64_t node_id)
+{
+    bool changed = false;
+    for (uint8_t g = 0; g < store.count; g++)
+    {
+        matter_group_t *group = &store.groups[g];
+        uint8_t kept = 0;
+        for (uint8_t i = 0; i < group->member_count; i++)
+        {
+            if (group->members[i].node_id != node_id)
+                group->members[kept++] = group->members[i];
+        }
+        changed |= kept != group->member_count;
+        group->member_count = kept;
+    }
+    if (changed)
+    {
+        ESP_LOGI(TAG, "Node 0x%016" PRIX64 " removed from groups", node_id);
+        group_registry_save();
+    }
+}
+
+uint8_t group_registry_count(void)
+{
+    return store.count;
+}
+
+matter_group_t *group_registry_get(uint8_t index)
+{
+    return index < store.count ? &store.groups[index] : NULL;
+}
+
+void group_registry_clear(void)
+{
+    store.count = 0;
+    nvs_handle_t handle;
+    if (nvs_open(NVS_GROUPS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        nvs_erase_all(handle);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
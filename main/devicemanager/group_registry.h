@@ -0,0 +1,83 @@
+#ifndef GROUP_REGISTRY_H
+#define GROUP_REGISTRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Групп на контроллере не больше
+#define GROUP_REGISTRY_MAX_GROUPS 8
+// Endpoint'ов в группе не больше
+#define GROUP_REGISTRY_MAX_MEMBERS 24
+// Длина имени группы (Groups AddGroup допускает до 16 символов)
+#define GROUP_REGISTRY_NAME_MAX 17
+// Длина эпохального ключа набора ключей группы
+#define GROUP_REGISTRY_EPOCH_KEY_LEN 16
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        uint64_t node_id;
+        uint16_t endpoint_id;
+    } group_member_t;
+
+    // Группа Matter: набор ключей и endpoint'ы, которые добавлены в группу на устройствах
+    typedef struct
+    {
+        uint16_t group_id;
+        uint16_t keyset_id;
+        char name[GROUP_REGISTRY_NAME_MAX];
+        uint8_t epoch_key[GROUP_REGISTRY_EPOCH_KEY_LEN]; // ставится на каждый новый узел группы (KeySetWrite)
+        uint8_t member_count;
+        group_member_t members[GROUP_REGISTRY_MAX_MEMBERS];
+    } matter_group_t;
+
+    // Загрузка групп из NVS, вызывается при инициализации реестра устройств
+    esp_err_t group_registry_load(void);
+
+    esp_err_t group_registry_save(void);
+
+    // Группа по id или NULL
+    matter_group_t *group_registry_find(uint16_t group_id);
+
+    /**
+     * @brief Добавление группы. Для существующей группы обновляются имя, набор ключей и ключ, участники остаются
+     *
+     * @param epoch_key GROUP_REGISTRY_EPOCH_KEY_LEN байт
+     * @return matter_group_t* Группа или NULL, если групп уже GROUP_REGISTRY_MAX_GROUPS
+     */
+    matter_group_t *group_registry_add(uint16_t group_id, uint16_t keyset_id, const char *name, const uint8_t *epoch_key);
+
+    esp_err_t group_registry_remove(uint16_t group_id);
+
+    /**
+     * @brief Добавление endpoint'а в группу (повторное добавление ничего не меняет)
+     *
+     * @return esp_err_t ESP_ERR_NO_MEM - в группе GROUP_REGISTRY_MAX_MEMBERS endpoint'ов
+     */
+    esp_err_t group_registry_add_member(matter_group_t *group, uint64_t node_id, uint16_t endpoint_id);
+
+    esp_err_t group_registry_remove_member(matter_group_t *group, uint64_t node_id, uint16_t endpoint_id);
+
+    bool group_registry_has_node(const matter_group_t *group, uint64_t node_id);
+
+    // Удаление узла из всех групп с сохранением в NVS (узел удален из реестра)
+    void group_registry_forget_node(uint64_t node_id);
+
+    uint8_t group_registry_count(void);
+
+    // Группа по порядковому номеру 0..group_registry_count()-1
+    matter_group_t *group_registry_get(uint8_t index);
+
+    // Удаление всех групп, в том числе из NVS. Вызывается на потоке CHIP
+    void group_registry_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GROUP_REGISTRY_H
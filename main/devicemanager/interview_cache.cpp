@@ -0,0 +1,361 @@
+#include "interview_cache.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <nvs_flash.h>
+#include <nvs.h>
+
+#define NVS_TEMPLATES_NAMESPACE "matter_tmpl"
+#define NVS_TEMPLATES_INDEX_KEY "index"
+#define INTERVIEW_TEMPLATE_MAGIC 0x54504C31 // "TPL1"
+#define TEMPLATE_KEY_LEN 16                 // NVS: не более 15 символов + '\0'
+
+static const char *TAG_tmpl = "interview_cache";
+
+// Заголовок blob'а шаблона, за ним идет узел в формате node_blob_write()
+typedef struct
+{
+    uint32_t magic;
+    uint32_t vendor_id;
+    uint16_t product_id;
+    char firmware_version[32];
+    uint32_t interview_ms;
+} template_header_t;
+
+// Порядок ключей: от самого давнего к самому свежему
+typedef struct
+{
+    uint8_t count;
+    char keys[INTERVIEW_TEMPLATES_MAX][TEMPLATE_KEY_LEN];
+} template_index_t;
+
+static interview_cache_stats_t s_stats = {};
+
+// FNV-1a, в ключ идут младшие 24 бита
+static uint32_t fw_hash(const char *str)
+{
+    uint32_t hash = 2166136261u;
+    while (str && *str)
+    {
+        hash ^= (uint8_t)*str++;
+        hash *= 16777619u;
+    }
+    return hash & 0xFFFFFF;
+}
+
+static void make_key(uint32_t vendor_id, uint16_t product_id, const char *firmware_version, char *key)
+{
+    snprintf(key, TEMPLATE_KEY_LEN, "%04" PRIX16 "%04" PRIX16 "%06" PRIX32,
+             (uint16_t)vendor_id, product_id, fw_hash(firmware_version));
+}
+
+static void load_index(nvs_handle_t handle, template_index_t *index)
+{
+    size_t size = sizeof(*index);
+    if (nvs_get_blob(handle, NVS_TEMPLATES_INDEX_KEY, index, &size) != ESP_OK || size != sizeof(*index) ||
+        index->count > INTERVIEW_TEMPLATES_MAX)
+    {
+        memset(index, 0, sizeof(*index));
+    }
+}
+
+// Переносит ключ в конец индекса, при переполнении возвращает вытесненный ключ в evicted
+static void touch_index(template_index_t *index, const char *key, char *evicted)
+{
+    evicted[0] = '\0';
+    for (uint8_t i = 0; i < index->count; i++)
+    {
+        if (strncmp(index->keys[i], key, TEMPLATE_KEY_LEN) == 0)
+        {
+            memmove(index->keys[i], index->keys[i + 1], (index->count - i - 1) * TEMPLATE_KEY_LEN);
+            index->count--;
+            break;
+        }
+    }
+    if (index->count == INTERVIEW_TEMPLATES_MAX)
+    {
+        strlcpy(evicted, index->keys[0], TEMPLATE_KEY_LEN);
+        memmove(index->keys[0], index->keys[1], (INTERVIEW_TEMPLATES_MAX - 1) * TEMPLATE_KEY_LEN);
+        index->count--;
+    }
+    strlcpy(index->keys[index->count++], key, TEMPLATE_KEY_LEN);
+}
+
+esp_err_t interview_template_load(uint32_t vendor_id, uint16_t product_id, const char *firmware_version,
+                                  interview_template_t *tmpl)
+{
+    if (!tmpl || !firmware_version)
+        return ESP_ERR_INVALID_ARG;
+    memset(tmpl, 0, sizeof(*tmpl));
+
+    char key[TEMPLATE_KEY_LEN];
+    make_key(vendor_id, product_id, firmware_version, key);
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_TEMPLATES_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+        return ESP_ERR_NOT_FOUND;
+
+    size_t size = 0;
+    err = nvs_get_blob(handle, key, NULL, &size);
+    if (err != ESP_OK || size < sizeof(template_header_t))
+    {
+        nvs_close(handle);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint8_t *buffer = (uint8_t *)malloc(size);
+    if (!buffer)
+    {
+        nvs_close(handle);
+        return ESP_ERR_NO_MEM;
+    }
+    err = nvs_get_blob(handle, key, buffer, &size);
+    nvs_close(handle);
+    if (err != ESP_OK)
+    {
+        free(buffer);
+        return err;
+    }
+
+    template_header_t header;
+    memcpy(&header, buffer, sizeof(header));
+    // Ключ содержит только хэш версии прошивки, поэтому сверяем полные значения
+    if (header.magic != INTERVIEW_TEMPLATE_MAGIC || header.vendor_id != vendor_id || header.product_id != product_id ||
+        strncmp(header.firmware_version, firmware_version, sizeof(header.firmware_version)) != 0)
+    {
+        ESP_LOGW(TAG_tmpl, "Template %s does not belong to VID 0x%04" PRIX32 " PID 0x%04" PRIX16 " FW '%s'",
+                 key, vendor_id, product_id, firmware_version);
+        free(buffer);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (!node_blob_read(&tmpl->topology, buffer + sizeof(header), buffer + size))
+    {
+        ESP_LOGE(TAG_tmpl, "Template %s is corrupted", key);
+        free_node_topology(&tmpl->topology);
+        free(buffer);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    free(buffer);
+
+    tmpl->vendor_id = header.vendor_id;
+    tmpl->product_id = header.product_id;
+    memcpy(tmpl->firmware_version, header.firmware_version, sizeof(tmpl->firmware_version));
+    tmpl->firmware_version[sizeof(tmpl->firmware_version) - 1] = '\0';
+    tmpl->interview_ms = header.interview_ms;
+    tmpl->topology.next = NULL;
+
+    ESP_LOGI(TAG_tmpl, "Loaded template %s: %u endpoints, %u server clusters, interview %" PRIu32 " ms",
+             key, tmpl->topology.endpoints_count, tmpl->topology.server_clusters_count, tmpl->interview_ms);
+    return ESP_OK;
+}
+
+esp_err_t interview_template_save(const matter_device_t *node, uint32_t interview_ms)
+{
+    if (!node)
+        return ESP_ERR_INVALID_ARG;
+    if (node->endpoints_count == 0 || node->firmware_version[0] == '\0')
+    {
+        ESP_LOGW(TAG_tmpl, "Node 0x%016llX has no topology or firmware version, template not saved", node->node_id);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    char key[TEMPLATE_KEY_LEN];
+    make_key(node->vendor_id, node->product_id, node->firmware_version, key);
+
+    template_header_t header = {};
+    header.magic = INTERVIEW_TEMPLATE_MAGIC;
+    header.vendor_id = node->vendor_id;
+    header.product_id = node->product_id;
+    strlcpy(header.firmware_version, node->firmware_version, sizeof(header.firmware_version));
+    header.interview_ms = interview_ms;
+
+    size_t size = sizeof(header) + node_blob_size(node);
+    uint8_t *buffer = (uint8_t *)malloc(size);
+    if (!buffer)
+        return ESP_ERR_NO_MEM;
+    memcpy(buffer, &header, sizeof(header));
+    node_blob_write(node, buffer + sizeof(header));
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_TEMPLATES_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        free(buffer);
+        return err;
+    }
+
+    template_index_t index;
+    char evicted[TEMPLATE_KEY_LEN];
+    load_index(handle, &index);
+    touch_index(&index, key, evicted);
+    if (evicted[0])
+    {
+        ESP_LOGI(TAG_tmpl, "Evicting template %s", evicted);
+        nvs_erase_key(handle, evicted);
+    }
+
+    err = nvs_set_blob(handle, key, buffer, size);
+    free(buffer);
+    if (err == ESP_OK)
+        err = nvs_set_blob(handle, NVS_TEMPLATES_INDEX_KEY, &index, sizeof(index));
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+
+    if (err == ESP_OK)
+    {
+        s_stats.stored++;
+        ESP_LOGI(TAG_tmpl, "Saved template %s (%u bytes) for VID 0x%04" PRIX32 " PID 0x%04" PRIX16 " FW '%s'",
+                 key, (unsigned)size, node->vendor_id, node->product_id, node->firmware_version);
+    }
+    else
+    {
+        ESP_LOGE(TAG_tmpl, "Failed to save template %s: %s", key, esp_err_to_name(err));
+    }
+    return err;
+}
+
+bool interview_template_matches(const interview_template_t *tmpl, const uint16_t *endpoint_ids, size_t count)
+{
+    if (!tmpl || (!endpoint_ids && count))
+        return false;
+
+    // Endpoint 0 в PartsList не входит, но может оказаться в реестре
+    size_t template_count = 0;
+    for (uint16_t i = 0; i < tmpl->topology.endpoints_count; i++)
+    {
+        if (tmpl->topology.endpoints[i].endpoint_id != 0)
+            template_count++;
+    }
+    if (template_count != count)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        bool found = false;
+        for (uint16_t e = 0; e < tmpl->topology.endpoints_count; e++)
+        {
+            if (tmpl->topology.endpoints[e].endpoint_id == endpoint_ids[i])
+            {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+static esp_err_t copy_clusters(matter_cluster_t **dst, uint16_t *dst_count, const matter_cluster_t *src, uint16_t count)
+{
+    *dst = NULL;
+    *dst_count = 0;
+    if (count == 0)
+        return ESP_OK;
+
+    *dst = (matter_cluster_t *)calloc(count, sizeof(matter_cluster_t));
+    if (!*dst)
+        return ESP_ERR_NO_MEM;
+    *dst_count = count;
+
+    for (uint16_t c = 0; c < count; c++)
+    {
+        matter_cluster_t *cl = &(*dst)[c];
+        memcpy(cl, &src[c], sizeof(matter_cluster_t));
+        cl->attributes = NULL;
+        cl->attributes_count = 0;
+        if (src[c].attributes_count == 0)
+            continue;
+
+        cl->attributes = (matter_attribute_t *)calloc(src[c].attributes_count, sizeof(matter_attribute_t));
+        if (!cl->attributes)
+            return ESP_ERR_NO_MEM;
+        cl->attributes_count = src[c].attributes_count;
+        for (uint16_t a = 0; a < cl->attributes_count; a++)
+        {
+            // Значения и состояние подписки берутся с самого устройства
+            cl->attributes[a].attribute_id = src[c].attributes[a].attribute_id;
+            memcpy(cl->attributes[a].attribute_name, src[c].attributes[a].attribute_name,
+                   sizeof(cl->attributes[a].attribute_name));
+            cl->attributes[a].subscribe = src[c].attributes[a].subscribe;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t interview_template_apply(const interview_template_t *tmpl, matter_device_t *node)
+{
+    if (!tmpl || !node)
+        return ESP_ERR_INVALID_ARG;
+
+    free_node_topology(node);
+
+    esp_err_t err = ESP_OK;
+    if (tmpl->topology.endpoints_count > 0)
+    {
+        node->endpoints = (endpoint_entry_t *)calloc(tmpl->topology.endpoints_count, sizeof(endpoint_entry_t));
+        if (!node->endpoints)
+            return ESP_ERR_NO_MEM;
+        memcpy(node->endpoints, tmpl->topology.endpoints, tmpl->topology.endpoints_count * sizeof(endpoint_entry_t));
+        node->endpoints_count = tmpl->topology.endpoints_count;
+    }
+
+    err = copy_clusters(&node->server_clusters, &node->server_clusters_count,
+                        tmpl->topology.server_clusters, tmpl->topology.server_clusters_count);
+    if (err == ESP_OK)
+    {
+        err = copy_clusters(&node->client_clusters, &node->client_clusters_count,
+                            tmpl->topology.client_clusters, tmpl->topology.client_clusters_count);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG_tmpl, "Failed to apply template to node 0x%016llX", node->node_id);
+        free_node_topology(node);
+    }
+    return err;
+}
+
+void interview_template_free(interview_template_t *tmpl)
+{
+    if (!tmpl)
+        return;
+    free_node_topology(&tmpl->topology);
+    memset(tmpl, 0, sizeof(*tmpl));
+}
+
+void interview_cache_record(bool hit, bool mismatch, uint32_t saved_ms)
+{
+    if (hit)
+    {
+        s_stats.hits++;
+        s_stats.saved_ms += saved_ms;
+    }
+    else
+    {
+        s_stats.misses++;
+        if (mismatch)
+            s_stats.mismatches++;
+    }
+}
+
+const interview_cache_stats_t *interview_cache_get_stats(void)
+{
+    return &s_stats;
+}
+
+void interview_cache_clear(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(NVS_TEMPLATES_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        nvs_erase_all(handle);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    memset(&s_stats, 0, sizeof(s_stats));
+}
@@ -0,0 +1,99 @@
+#ifndef INTERVIEW_CACHE_H
+#define INTERVIEW_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "devices.h"
+
+// Сколько шаблонов хранить в NVS, самый давний вытесняется
+#define INTERVIEW_TEMPLATES_MAX 6
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Шаблон опроса: топология узла (endpoint'ы, кластеры, атрибуты и флаги подписки),
+    // снятая с первого устройства данной модели и прошивки
+    typedef struct
+    {
+        uint32_t vendor_id;
+        uint16_t product_id;
+        char firmware_version[32];
+        uint32_t interview_ms;    // длительность полного опроса, с которого снят шаблон
+        matter_device_t topology; // node_id и поля Basic Information не используются
+    } interview_template_t;
+
+    // Статистика использования шаблонов с момента загрузки
+    typedef struct
+    {
+        uint32_t hits;       // топология взята из шаблона
+        uint32_t misses;     // шаблона не было, выполнен полный опрос
+        uint32_t mismatches; // шаблон найден, но PartsList не совпал
+        uint32_t stored;     // сохранено новых шаблонов
+        uint64_t saved_ms;   // суммарно сэкономленное время опроса
+    } interview_cache_stats_t;
+
+    /**
+     * @brief Поиск шаблона для модели устройства
+     *
+     * @param vendor_id VendorID из Basic Information
+     * @param product_id ProductID из Basic Information
+     * @param firmware_version SoftwareVersionString из Basic Information
+     * @param tmpl Структура для результата, освобождается через interview_template_free()
+     * @return esp_err_t ESP_OK если шаблон найден, ESP_ERR_NOT_FOUND если нет
+     */
+    esp_err_t interview_template_load(uint32_t vendor_id, uint16_t product_id, const char *firmware_version,
+                                      interview_template_t *tmpl);
+
+    /**
+     * @brief Сохранение топологии опрошенного узла как шаблона для его модели
+     *
+     * @param node Полностью опрошенный узел
+     * @param interview_ms Длительность полного опроса
+     * @return esp_err_t ESP_OK при успехе
+     */
+    esp_err_t interview_template_save(const matter_device_t *node, uint32_t interview_ms);
+
+    /**
+     * @brief Сравнение списка endpoint'ов из Descriptor->PartsList с шаблоном
+     *
+     * @param tmpl Шаблон
+     * @param endpoint_ids Endpoint'ы из PartsList
+     * @param count Количество endpoint'ов
+     * @return true если набор endpoint'ов совпадает
+     */
+    bool interview_template_matches(const interview_template_t *tmpl, const uint16_t *endpoint_ids, size_t count);
+
+    /**
+     * @brief Перенос топологии шаблона в узел. Текущие endpoint'ы и кластеры узла заменяются
+     *
+     * @param tmpl Шаблон
+     * @param node Узел реестра
+     * @return esp_err_t ESP_OK при успехе
+     */
+    esp_err_t interview_template_apply(const interview_template_t *tmpl, matter_device_t *node);
+
+    void interview_template_free(interview_template_t *tmpl);
+
+    /**
+     * @brief Учет результата опроса в статистике
+     *
+     * @param hit Топология взята из шаблона
+     * @param mismatch Шаблон был найден, но не подошел
+     * @param saved_ms Сэкономленное время (для hit)
+     */
+    void interview_cache_record(bool hit, bool mismatch, uint32_t saved_ms);
+
+    const interview_cache_stats_t *interview_cache_get_stats(void);
+
+    // Удаление всех шаблонов из NVS
+    void interview_cache_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INTERVIEW_CACHE_H
@@ -0,0 +1,334 @@
+#include "registry_export.h"
+#include "devices.h"
+#include "settings.h"
+#include "mqtt.h"
+#include "mqtt_topics.h"
+#include "EntryToText.h"
+#include <esp_log.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <platform/PlatformManager.h>
+
+static const char *TAG = "registry_export";
+extern matter_controller_t g_controller;
+
+// Узел с наименьшим node_id >= from
+static const matter_device_t *next_node(uint64_t from)
+{
+    const matter_device_t *best = NULL;
+    for (const matter_device_t *node = g_controller.nodes_list; node; node = node->next)
+    {
+        if (node->node_id >= from && (!best || node->node_id < best->node_id))
+            best = node;
+    }
+    return best;
+}
+
+// endpoint узла с наименьшим endpoint_id >= from
+static const endpoint_entry_t *next_endpoint(const matter_device_t *node, uint32_t from)
+{
+    const endpoint_entry_t *best = NULL;
+    for (uint16_t i = 0; i < node->endpoints_count; i++)
+    {
+        const endpoint_entry_t *ep = &node->endpoints[i];
+        if (ep->endpoint_id >= from && (!best || ep->endpoint_id < best->endpoint_id))
+            best = ep;
+    }
+    return best;
+}
+
+static const matter_cluster_t *find_server_cluster(const matter_device_t *node, uint32_t cluster_id)
+{
+    for (uint16_t i = 0; i < node->server_clusters_count; i++)
+    {
+        if (node->server_clusters[i].cluster_id == cluster_id)
+            return &node->server_clusters[i];
+    }
+    return NULL;
+}
+
+static void write_endpoint(json_stream_t *js, const matter_device_t *node, const endpoint_entry_t *ep)
+{
+    char key[12];
+
+    json_stream_object_begin(js, NULL);
+    json_stream_uint(js, "id", ep->endpoint_id);
+    json_stream_uint(js, "device_type", ep->device_type_id);
+    if (ep->device_name[0])
+        json_stream_string(js, "name", ep->device_name);
+
+    json_stream_object_begin(js, "clusters");
+    for (uint8_t c = 0; c < ep->cluster_count; c++)
+    {
+        const matter_cluster_t *cluster = find_server_cluster(node, ep->clusters[c]);
+        if (!cluster)
+            continue;
+
+        const char *cluster_name = ClusterIdToText((chip::ClusterId)cluster->cluster_id);
+        if (!cluster_name)
+        {
+            snprintf(key, sizeof(key), "0x%04" PRIX32, cluster->cluster_id);
+            cluster_name = key;
+        }
+        json_stream_object_begin(js, cluster_name);
+        for (uint16_t a = 0; a < cluster->attributes_count; a++)
+        {
+            const matter_attribute_t *attr = &cluster->attributes[a];
+            const char *attr_name = AttributeIdToText((chip::ClusterId)cluster->cluster_id, (chip::AttributeId)attr->attribute_id);
+            if (!attr_name)
+            {
+                snprintf(key, sizeof(key), "0x%04" PRIX32, attr->attribute_id);
+                attr_name = key;
+            }
+            attribute_value_write_json(attr, js, attr_name);
+        }
+        json_stream_object_end(js);
+    }
+    json_stream_object_end(js);
+    json_stream_object_end(js);
+}
+
+static void write_node_header(json_stream_t *js, const matter_device_t *node)
+{
+    json_stream_object_begin(js, NULL);
+    json_stream_uint(js, "node_id", node->node_id);
+    json_stream_uint(js, "vendor_id", node->vendor_id);
+    json_stream_uint(js, "product_id", node->product_id);
+    json_stream_string(js, "vendor", node->vendor_name);
+    json_stream_string(js, "model", node->model_name);
+    json_stream_string(js, "firmware", node->firmware_version);
+    json_stream_bool(js, "online", node->is_online);
+    json_stream_array_begin(js, "endpoints");
+}
+
+esp_err_t registry_export_page(const registry_export_cursor_t *start, uint16_t limit,
+                               char *chunk, size_t chunk_size, json_stream_flush_t sink, void *ctx,
+                               registry_export_cursor_t *next, bool *done)
+{
+    if (!chunk || !sink || !next || !done)
+        return ESP_ERR_INVALID_ARG;
+
+    json_stream_t js;
+    json_stream_init(&js, chunk, chunk_size, sink, ctx);
+    json_stream_object_begin(&js, NULL);
+    json_stream_array_begin(&js, "nodes");
+
+    uint32_t ep_from = start ? start->endpoint_id : 0;
+    uint32_t count = 0;
+    bool more = false;
+
+    const matter_device_t *node = next_node(start ? start->node_id : 0);
+    while (node && js.error == ESP_OK)
+    {
+        const endpoint_entry_t *ep = next_endpoint(node, ep_from);
+        // узел без endpoint'ов выгружается один раз, с начала
+        if (ep || ep_from == 0)
+        {
+            if (limit && count >= limit)
+            {
+                more = true;
+                next->node_id = node->node_id;
+                next->endpoint_id = ep ? ep->endpoint_id : 0;
+                break;
+            }
+
+            write_node_header(&js, node);
+            if (!ep)
+                count++;
+            while (ep)
+            {
+                if (limit && count >= limit)
+                {
+                    more = true;
+                    next->node_id = node->node_id;
+                    next->endpoint_id = ep->endpoint_id;
+                    break;
+                }
+                write_endpoint(&js, node, ep);
+                count++;
+                ep = next_endpoint(node, (uint32_t)ep->endpoint_id + 1);
+            }
+            json_stream_array_end(&js);
+            json_stream_object_end(&js);
+            if (more)
+                break;
+        }
+
+        if (node->node_id == UINT64_MAX)
+            break;
+        node = next_node(node->node_id + 1);
+        ep_from = 0;
+    }
+    json_stream_array_end(&js);
+
+    if (more)
+    {
+        char cursor[REGISTRY_EXPORT_CURSOR_LEN];
+        registry_export_cursor_format(next, cursor, sizeof(cursor));
+        json_stream_string(&js, "cursor", cursor);
+    }
+    else
+    {
+        json_stream_null(&js, "cursor");
+    }
+    json_stream_object_end(&js);
+
+    *done = !more;
+    return json_stream_finish(&js);
+}
+
+void registry_export_cursor_format(const registry_export_cursor_t *cursor, char *buf, size_t size)
+{
+    snprintf(buf, size, "%016" PRIX64 ":%u", cursor->node_id, (unsigned)cursor->endpoint_id);
+}
+
+esp_err_t registry_export_cursor_parse(const char *str, registry_export_cursor_t *cursor)
+{
+    if (!str || !cursor)
+        return ESP_ERR_INVALID_ARG;
+
+    char *end = NULL;
+    unsigned long long node_id = strtoull(str, &end, 16);
+    if (end == str || *end != ':')
+        return ESP_ERR_INVALID_ARG;
+
+    const char *ep_str = end + 1;
+    unsigned long endpoint_id = strtoul(ep_str, &end, 10);
+    if (end == ep_str || *end != '\0' || endpoint_id > UINT16_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    cursor->node_id = node_id;
+    cursor->endpoint_id = (uint16_t)endpoint_id;
+    return ESP_OK;
+}
+
+typedef struct
+{
+    registry_export_target_t target;
+    bool has_cursor;
+    registry_export_cursor_t cursor;
+    uint16_t limit;
+} export_job_t;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t parts;
+    size_t bytes;
+} export_mqtt_ctx_t;
+
+static esp_err_t mqtt_sink(const char *data, size_t len, void *ctx)
+{
+    export_mqtt_ctx_t *mqtt = (export_mqtt_ctx_t *)ctx;
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/export/%" PRIu32 "/%" PRIu32, sys_settings.mqtt.prefix, mqtt->id, mqtt->parts);
+    esp_err_t err = mqtt_publish_data_len(topic, data, len);
+    if (err == ESP_OK)
+    {
+        mqtt->parts++;
+        mqtt->bytes += len;
+    }
+    return err;
+}
+
+static esp_err_t console_sink(const char *data, size_t len, void *ctx)
+{
+    return fwrite(data, 1, len, stdout) == len ? ESP_OK : ESP_FAIL;
+}
+
+static void export_job_run(intptr_t arg)
+{
+    export_job_t *job = (export_job_t *)arg;
+    static uint32_t export_id = 0;
+
+    char *chunk = (char *)malloc(REGISTRY_EXPORT_CHUNK_SIZE);
+    if (!chunk)
+    {
+        ESP_LOGE(TAG, "Failed to allocate export chunk");
+        free(job);
+        return;
+    }
+
+    registry_export_cursor_t next = {};
+    bool done = false;
+    char cursor[REGISTRY_EXPORT_CURSOR_LEN];
+
+    if (job->target == REGISTRY_EXPORT_TO_MQTT)
+    {
+        export_mqtt_ctx_t mqtt = {++export_id, 0, 0};
+        esp_err_t err = registry_export_page(job->has_cursor ? &job->cursor : NULL, job->limit,
+                                             chunk, REGISTRY_EXPORT_CHUNK_SIZE, mqtt_sink, &mqtt, &next, &done);
+
+        // итог в топик событий, части собираются клиентом по номеру в топике
+        char msg[192];
+        json_stream_t js;
+        json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "action", "export");
+        json_stream_string(&js, "status", err == ESP_OK ? "done" : esp_err_to_name(err));
+        json_stream_uint(&js, "id", mqtt.id);
+        json_stream_uint(&js, "parts", mqtt.parts);
+        json_stream_uint(&js, "bytes", mqtt.bytes);
+        if (err == ESP_OK && !done)
+        {
+            registry_export_cursor_format(&next, cursor, sizeof(cursor));
+            json_stream_string(&js, "cursor", cursor);
+        }
+        else
+        {
+            json_stream_null(&js, "cursor");
+        }
+        json_stream_object_end(&js);
+        if (json_stream_finish(&js) == ESP_OK)
+            mqtt_publish_data(mqtt_topic(MQTT_TOPIC_EVENT), msg);
+
+        ESP_LOGI(TAG, "Export %" PRIu32 ": %" PRIu32 " parts, %u bytes, %s", mqtt.id, mqtt.parts, (unsigned)mqtt.bytes,
+                 err != ESP_OK ? esp_err_to_name(err) : (done ? "complete" : "more pages"));
+    }
+    else
+    {
+        esp_err_t err = registry_export_page(job->has_cursor ? &job->cursor : NULL, job->limit,
+                                             chunk, REGISTRY_EXPORT_CHUNK_SIZE, console_sink, NULL, &next, &done);
+        printf("\n");
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Export failed: %s", esp_err_to_name(err));
+        }
+        else if (!done)
+        {
+            registry_export_cursor_format(&next, cursor, sizeof(cursor));
+            printf("next cursor: %s\n", cursor);
+        }
+    }
+
+    free(chunk);
+    free(job);
+}
+
+esp_err_t registry_export_schedule(registry_export_target_t target, const char *cursor, uint16_t limit)
+{
+    export_job_t *job = (export_job_t *)calloc(1, sizeof(export_job_t));
+    if (!job)
+        return ESP_ERR_NO_MEM;
+
+    job->target = target;
+    job->limit = limit ? limit : REGISTRY_EXPORT_DEFAULT_LIMIT;
+    if (cursor && cursor[0])
+    {
+        if (registry_export_cursor_parse(cursor, &job->cursor) != ESP_OK)
+        {
+            free(job);
+            return ESP_ERR_INVALID_ARG;
+        }
+        job->has_cursor = true;
+    }
+
+    if (chip::DeviceLayer::PlatformMgr().ScheduleWork(export_job_run, (intptr_t)job) != CHIP_NO_ERROR)
+    {
+        free(job);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,74 @@
+#ifndef REGISTRY_EXPORT_H
+#define REGISTRY_EXPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "json_stream.h"
+
+// Размер буфера одной части экспорта (и одного MQTT-сообщения)
+#define REGISTRY_EXPORT_CHUNK_SIZE 1024
+// Endpoint'ов на страницу по умолчанию
+#define REGISTRY_EXPORT_DEFAULT_LIMIT 16
+// Длина строки курсора: 16 hex-цифр узла, ':', endpoint
+#define REGISTRY_EXPORT_CURSOR_LEN 24
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Позиция в реестре: следующий endpoint для выгрузки. Узлы и endpoint'ы обходятся по возрастанию ID,
+    // поэтому курсор остается действительным при добавлении и удалении устройств между страницами
+    typedef struct
+    {
+        uint64_t node_id;
+        uint16_t endpoint_id;
+    } registry_export_cursor_t;
+
+    typedef enum
+    {
+        REGISTRY_EXPORT_TO_MQTT = 0, // части в <prefix>/export/<id>/<n>, итог в <prefix>/event/matter/
+        REGISTRY_EXPORT_TO_CONSOLE,  // stdout
+    } registry_export_target_t;
+
+    /**
+     * @brief Выгрузка одной страницы реестра в приемник. Документ страницы:
+     *        {"nodes":[{"node_id":..,"endpoints":[{"id":..,"clusters":{..}}]}],"cursor":"..."|null}
+     *        Узел, не поместившийся в страницу, продолжается на следующей с оставшимися endpoint'ами.
+     *        Должна вызываться на потоке CHIP
+     *
+     * @param start Курсор начала страницы (NULL - с начала)
+     * @param limit Максимум endpoint'ов на страницу (0 - без ограничения)
+     * @param chunk Буфер части, пиковая память экспорта определяется его размером
+     * @param chunk_size Размер буфера
+     * @param sink Приемник частей
+     * @param ctx Контекст приемника
+     * @param next Курсор следующей страницы
+     * @param done true, если выгружен конец реестра
+     * @return esp_err_t ESP_OK или ошибка приемника
+     */
+    esp_err_t registry_export_page(const registry_export_cursor_t *start, uint16_t limit,
+                                   char *chunk, size_t chunk_size, json_stream_flush_t sink, void *ctx,
+                                   registry_export_cursor_t *next, bool *done);
+
+    /**
+     * @brief Постановка выгрузки страницы в очередь потока CHIP
+     *
+     * @param target Куда выгружать
+     * @param cursor Строка курсора из предыдущей страницы (NULL или "" - с начала)
+     * @param limit Максимум endpoint'ов на страницу (0 - REGISTRY_EXPORT_DEFAULT_LIMIT)
+     * @return esp_err_t ESP_OK, если выгрузка запланирована, ESP_ERR_INVALID_ARG для неверного курсора
+     */
+    esp_err_t registry_export_schedule(registry_export_target_t target, const char *cursor, uint16_t limit);
+
+    void registry_export_cursor_format(const registry_export_cursor_t *cursor, char *buf, size_t size);
+
+    esp_err_t registry_export_cursor_parse(const char *str, registry_export_cursor_t *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REGISTRY_EXPORT_H
@@ -0,0 +1,135 @@
+#include "report_coalescer.h"
+#include "devices.h"
+#include "settings.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <inttypes.h>
+#include <platform/CHIPDeviceLayer.h>
+
+static const char *TAG = "report_coalescer";
+extern matter_controller_t g_controller;
+
+typedef struct
+{
+    uint64_t node_id;
+    uint16_t endpoint_id;
+    uint16_t updates;
+    int64_t deadline_us; // конец окна
+} pending_endpoint_t;
+
+static pending_endpoint_t pending[REPORT_COALESCER_MAX_PENDING];
+static uint8_t pending_count = 0;
+static bool timer_running = false;
+static report_coalescer_stats_t stats = {};
+
+static void coalesce_timer_cb(chip::System::Layer *aLayer, void *appState);
+
+static void flush_at(uint8_t index)
+{
+    pending_endpoint_t entry = pending[index];
+    // порядок не важен, на место удаленного ставим последний
+    pending[index] = pending[--pending_count];
+    stats.flushes++;
+    publish_fd(&g_controller, entry.node_id, entry.endpoint_id, 0, 0);
+}
+
+// Таймер на ближайший конец окна
+static void arm_timer(int64_t now_us)
+{
+    if (timer_running || pending_count == 0)
+        return;
+
+    int64_t next_us = pending[0].deadline_us;
+    for (uint8_t i = 1; i < pending_count; i++)
+    {
+        if (pending[i].deadline_us < next_us)
+            next_us = pending[i].deadline_us;
+    }
+    uint32_t delay_ms = next_us > now_us ? (uint32_t)((next_us - now_us + 999) / 1000) : 0;
+    timer_running = chip::DeviceLayer::SystemLayer().StartTimer(
+                        chip::System::Clock::Milliseconds32(delay_ms), coalesce_timer_cb, nullptr) == CHIP_NO_ERROR;
+    if (!timer_running)
+    {
+        ESP_LOGW(TAG, "Failed to start coalescing timer, publishing now");
+        report_coalescer_flush_all();
+    }
+}
+
+static void coalesce_timer_cb(chip::System::Layer *aLayer, void *appState)
+{
+    timer_running = false;
+    int64_t now_us = esp_timer_get_time();
+    for (uint8_t i = 0; i < pending_count;)
+    {
+        if (pending[i].deadline_us <= now_us)
+            flush_at(i); // на место i встал другой элемент, индекс не сдвигаем
+        else
+            i++;
+    }
+    arm_timer(now_us);
+}
+
+void report_coalescer_push(uint64_t node_id, uint16_t endpoint_id)
+{
+    stats.updates++;
+    uint16_t window_ms = sys_settings.report.coalesce_ms;
+    if (window_ms == 0)
+    {
+        stats.flushes++;
+        publish_fd(&g_controller, node_id, endpoint_id, 0, 0);
+        return;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    for (uint8_t i = 0; i < pending_count; i++)
+    {
+        if (pending[i].node_id == node_id && pending[i].endpoint_id == endpoint_id)
+        {
+            pending[i].updates++;
+            if (sys_settings.report.coalesce_max && pending[i].updates >= sys_settings.report.coalesce_max)
+            {
+                stats.size_flushes++;
+                flush_at(i);
+            }
+            return;
+        }
+    }
+
+    if (pending_count == REPORT_COALESCER_MAX_PENDING)
+    {
+        // освобождаем место: раньше всех закрывается окно, открытое раньше всех
+        uint8_t oldest = 0;
+        for (uint8_t i = 1; i < pending_count; i++)
+        {
+            if (pending[i].deadline_us < pending[oldest].deadline_us)
+                oldest = i;
+        }
+        stats.overflow_flushes++;
+        flush_at(oldest);
+    }
+
+    pending_endpoint_t *entry = &pending[pending_count++];
+    entry->node_id = node_id;
+    entry->endpoint_id = endpoint_id;
+    entry->updates = 1;
+    entry->deadline_us = now_us + (int64_t)window_ms * 1000;
+
+    if (sys_settings.report.coalesce_max == 1)
+    {
+        stats.size_flushes++;
+        flush_at(pending_count - 1);
+        return;
+    }
+    arm_timer(now_us);
+}
+
+void report_coalescer_flush_all(void)
+{
+    while (pending_count > 0)
+        flush_at(pending_count - 1);
+}
+
+const report_coalescer_stats_t *report_coalescer_get_stats(void)
+{
+    return &stats;
+}
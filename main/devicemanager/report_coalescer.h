@@ -0,0 +1,44 @@
+#ifndef REPORT_COALESCER_H
+#define REPORT_COALESCER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Сколько endpoint'ов может одновременно ждать публикации, при переполнении сбрасывается самый старый
+#define REPORT_COALESCER_MAX_PENDING 32
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        uint32_t updates;          // обновлений атрибутов передано в окно
+        uint32_t flushes;          // публикаций endpoint'ов
+        uint32_t size_flushes;     // из них досрочно по числу обновлений
+        uint32_t overflow_flushes; // из них досрочно из-за переполнения очереди
+    } report_coalescer_stats_t;
+
+    /**
+     * @brief Обновление атрибута endpoint'а. Все обновления endpoint'а за окно sys_settings.report.coalesce_ms
+     *        публикуются одним сообщением publish_fd(). Окно закрывается досрочно, когда обновлений
+     *        набралось sys_settings.report.coalesce_max. При окне 0 публикация сразу.
+     *        Должна вызываться на потоке CHIP (или под LockChipStack)
+     *
+     * @param node_id ID узла
+     * @param endpoint_id ID endpoint'а
+     */
+    void report_coalescer_push(uint64_t node_id, uint16_t endpoint_id);
+
+    // Немедленная публикация всех ожидающих endpoint'ов
+    void report_coalescer_flush_all(void);
+
+    const report_coalescer_stats_t *report_coalescer_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REPORT_COALESCER_H
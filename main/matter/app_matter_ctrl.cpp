@@ -21,6 +21,7 @@
 #include <esp_matter_core.h>
 #include <led_driver.h>
 #include <matter_controller_device_mgr.h>
+#include <platform/CHIPDeviceLayer.h>
 
 #include "app_matter_ctrl.h"
 
@@ -82,6 +83,9 @@ static uint32_t max_interval = 60;
 static SemaphoreHandle_t device_list_mutex = NULL;
 static local_device_subscribe_list_t *local_subscribe_list = NULL;
 static const char *TAG = "app_matter_ctrl";
+// Повтор неудавшихся подписок (таймер идет, только пока есть неудачи)
+static const uint16_t SUBSCRIBE_RETRY_SEC = 40;
+static bool subscribe_retry_armed = false;
 static matter_device_t *m_device_ptr = NULL;
 device_to_control_t device_to_control = {0, 0, NULL};
 // extern TaskHandle_t xRefresh_Ui_Handle;
@@ -119,6 +123,22 @@ static node_endpoint_id_list_t *get_tail_device(node_endpoint_id_list_t *dev_lis
 }
 */
 
+static void subscribe_retry_cb(chip::System::Layer *aLayer, void *appState)
+{
+    subscribe_retry_armed = false;
+    matter_ctrl_subscribe_device_state(SUBSCRIBE_LOCAL_DEVICE);
+}
+
+static void schedule_subscribe_retry()
+{
+    if (subscribe_retry_armed)
+        return;
+    subscribe_retry_armed = chip::DeviceLayer::SystemLayer().StartTimer(
+                                chip::System::Clock::Seconds32(SUBSCRIBE_RETRY_SEC), subscribe_retry_cb, nullptr) == CHIP_NO_ERROR;
+    if (!subscribe_retry_armed)
+        ESP_LOGE(TAG, "Failed to start subscribe retry timer");
+}
+
 /* be called when subscribe connecting failed */
 static void subscribe_failed_cb(void *subscribe_cmd)
 {
@@ -144,6 +164,7 @@ static void subscribe_failed_cb(void *subscribe_cmd)
                              AttributeIdToText(cluster->cluster_id, attr->attribute_id));
                     attr->subscribe_ptr = NULL;
                     attr->is_subscribed = false;
+                    schedule_subscribe_retry();
                 }
                 attr = attr->next;
             }
@@ -455,15 +476,69 @@ static subscribed_cluster_t *process_clusters(matter_cluster_t *clusters, uint16
     return head;
 }
 
-esp_err_t matter_ctrl_get_device(void *dev_list)
+static void free_subscribe_list(local_device_subscribe_list_t *list)
 {
-    if (!dev_list)
+    while (list)
     {
-        ESP_LOGE(TAG, "Invalid device list pointer");
-        return ESP_ERR_INVALID_ARG;
+        local_device_subscribe_list_t *next = list->next;
+        free_cluster_list(list->server_clusters);
+        free_cluster_list(list->client_clusters);
+        free(list);
+        list = next;
     }
+}
 
+static const subscribed_attribute_t *find_subscribed_attribute(const local_device_subscribe_list_t *list,
+                                                               uint64_t node_id, uint16_t endpoint_id,
+                                                               uint32_t cluster_id, uint32_t attribute_id)
+{
+    for (; list; list = list->next)
+    {
+        if (list->node_id != node_id || list->endpoint_id != endpoint_id)
+            continue;
+        for (const subscribed_cluster_t *cluster = list->server_clusters; cluster; cluster = cluster->next)
+        {
+            if (cluster->cluster_id != cluster_id)
+                continue;
+            for (const subscribed_attribute_t *attr = cluster->attributes; attr; attr = attr->next)
+            {
+                if (attr->attribute_id == attribute_id)
+                    return attr;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Отправленные подписки переходят в новый список: повторно подписываются только новые атрибуты
+// и атрибуты с новым флагом подписки
+static void carry_over_subscriptions(local_device_subscribe_list_t *fresh, const local_device_subscribe_list_t *old)
+{
+    for (; fresh; fresh = fresh->next)
+    {
+        for (subscribed_cluster_t *cluster = fresh->server_clusters; cluster; cluster = cluster->next)
+        {
+            for (subscribed_attribute_t *attr = cluster->attributes; attr; attr = attr->next)
+            {
+                if (!attr->subscribe)
+                    continue;
+                const subscribed_attribute_t *prev = find_subscribed_attribute(old, fresh->node_id, fresh->endpoint_id,
+                                                                               cluster->cluster_id, attr->attribute_id);
+                if (prev && prev->is_subscribed)
+                {
+                    attr->is_subscribed = true;
+                    attr->subscribe_ptr = prev->subscribe_ptr;
+                }
+            }
+        }
+    }
+}
+
+// Список подписок строится заново по списку устройств (NULL - устройств нет)
+esp_err_t matter_ctrl_get_device(void *dev_list)
+{
     matter_device_t *dev = (matter_device_t *)dev_list;
+    local_device_subscribe_list_t *fresh = NULL;
     device_list_lock my_device_lock; // Автоматическая блокировка/разблокировка
 
     // Проходим по всем устройствам в списке
@@ -481,6 +556,7 @@ esp_err_t matter_ctrl_get_device(void *dev_list)
             if (!new_sub)
             {
                 ESP_LOGE(TAG, "Failed to allocate subscription entry");
+                free_subscribe_list(fresh);
                 return ESP_ERR_NO_MEM;
             }
 
@@ -498,14 +574,18 @@ esp_err_t matter_ctrl_get_device(void *dev_list)
             new_sub->client_clusters = process_clusters(dev->client_clusters, dev->client_clusters_count);
 
             // Добавляем в список подписок
-            new_sub->next = local_subscribe_list;
-            local_subscribe_list = new_sub;
+            new_sub->next = fresh;
+            fresh = new_sub;
 
-            ESP_LOGI(TAG, "Added subscription for endpoint %d (%s)",
+            ESP_LOGD(TAG, "Added subscription for endpoint %d (%s)",
                      endpoint->endpoint_id, endpoint->endpoint_name);
         }
 
         dev = dev->next;
     }
+
+    carry_over_subscriptions(fresh, local_subscribe_list);
+    free_subscribe_list(local_subscribe_list);
+    local_subscribe_list = fresh;
     return ESP_OK;
 }
@@ -0,0 +1,138 @@
+#include "chip_work.h"
+#include <atomic>
+#include <string.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <platform/CHIPDeviceLayer.h>
+
+static const char *TAG = "chip_work";
+
+static_assert((CHIP_WORK_QUEUE_DEPTH & (CHIP_WORK_QUEUE_DEPTH - 1)) == 0, "CHIP_WORK_QUEUE_DEPTH must be a power of two");
+
+// Запись очереди. Номер записи (seq + индекс записи) == позиция - свободна для производителя с этой позицией,
+// == позиция + 1 - заполнена и ждет потока CHIP. Хранится за вычетом индекса, чтобы нулевая инициализация
+// давала свободную очередь
+typedef struct
+{
+    std::atomic<uint32_t> seq;
+    chip_work_fn_t fn;
+    alignas(8) uint8_t arg[CHIP_WORK_ARG_SIZE];
+} work_cell_t;
+
+static work_cell_t cells[CHIP_WORK_QUEUE_DEPTH];
+static std::atomic<uint32_t> enqueue_pos{0};
+static std::atomic<uint32_t> dequeue_pos{0}; // меняет только поток CHIP
+static std::atomic<bool> drain_scheduled{false};
+
+static std::atomic<uint32_t> stat_posted{0};
+static std::atomic<uint32_t> stat_executed{0};
+static std::atomic<uint32_t> stat_full{0};
+static std::atomic<uint32_t> stat_max_depth{0};
+static std::atomic<uint32_t> stat_wakeups{0};
+static std::atomic<uint32_t> stat_wakeup_failures{0};
+
+static inline uint32_t cell_index(uint32_t pos)
+{
+    return pos & (CHIP_WORK_QUEUE_DEPTH - 1);
+}
+
+static void drain_work(intptr_t arg);
+
+// Один обработчик на все записи: ScheduleWork только при переходе флага из false в true
+static void schedule_drain(void)
+{
+    if (drain_scheduled.exchange(true))
+        return;
+    stat_wakeups.fetch_add(1, std::memory_order_relaxed);
+    if (chip::DeviceLayer::PlatformMgr().ScheduleWork(drain_work, 0) != CHIP_NO_ERROR)
+    {
+        // записи останутся в очереди до следующей постановки
+        drain_scheduled.store(false);
+        stat_wakeup_failures.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGE(TAG, "Failed to schedule queue drain");
+    }
+}
+
+// Первая заполненная запись: выполняется на месте, затем освобождается для производителей
+static bool run_next(void)
+{
+    uint32_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    work_cell_t *cell = &cells[cell_index(pos)];
+    if (cell->seq.load() + cell_index(pos) != pos + 1)
+        return false;
+    cell->fn(cell->arg);
+    cell->seq.store(pos + CHIP_WORK_QUEUE_DEPTH - cell_index(pos), std::memory_order_release);
+    dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+    stat_executed.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+static void drain_work(intptr_t arg)
+{
+    // флаг снимается до чтения очереди: запись, поставленная после проверки, поставит новый обработчик
+    drain_scheduled.store(false);
+    for (int i = 0; i < CHIP_WORK_DRAIN_BATCH; i++)
+    {
+        if (!run_next())
+            return;
+    }
+    schedule_drain();
+}
+
+esp_err_t chip_work_post(chip_work_fn_t fn, const void *arg, size_t size)
+{
+    if (!fn || size > CHIP_WORK_ARG_SIZE || (size && !arg))
+        return size > CHIP_WORK_ARG_SIZE ? ESP_ERR_INVALID_SIZE : ESP_ERR_INVALID_ARG;
+
+    // позиция занимается CAS, запись заполняется без блокировок и публикуется через seq
+    uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    work_cell_t *cell;
+    for (;;)
+    {
+        cell = &cells[cell_index(pos)];
+        int32_t diff = (int32_t)(cell->seq.load(std::memory_order_acquire) + cell_index(pos) - pos);
+        if (diff == 0)
+        {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // запись еще не выполнена потоком CHIP: очередь заполнена
+            uint32_t full = stat_full.fetch_add(1, std::memory_order_relaxed) + 1;
+            ESP_LOGW(TAG, "Queue full (%" PRIu32 " rejected)", full);
+            return ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->fn = fn;
+    if (size)
+        memcpy(cell->arg, arg, size);
+    cell->seq.store(pos + 1 - cell_index(pos));
+    stat_posted.fetch_add(1, std::memory_order_relaxed);
+
+    // поток CHIP мог уже выполнить эту и следующие записи
+    int32_t depth = (int32_t)(pos + 1 - dequeue_pos.load(std::memory_order_relaxed));
+    uint32_t max_depth = stat_max_depth.load(std::memory_order_relaxed);
+    while (depth > (int32_t)max_depth &&
+           !stat_max_depth.compare_exchange_weak(max_depth, (uint32_t)depth, std::memory_order_relaxed))
+    {
+    }
+
+    schedule_drain();
+    return ESP_OK;
+}
+
+void chip_work_get_stats(chip_work_stats_t *stats)
+{
+    stats->posted = stat_posted.load(std::memory_order_relaxed);
+    stats->executed = stat_executed.load(std::memory_order_relaxed);
+    stats->full = stat_full.load(std::memory_order_relaxed);
+    stats->max_depth = stat_max_depth.load(std::memory_order_relaxed);
+    stats->wakeups = stat_wakeups.load(std::memory_order_relaxed);
+    stats->wakeup_failures = stat_wakeup_failures.load(std::memory_order_relaxed);
+}
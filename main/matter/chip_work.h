@@ -0,0 +1,100 @@
+#ifndef CHIP_WORK_H
+#define CHIP_WORK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "esp_err.h"
+
+// Записей в очереди на поток CHIP (степень двойки)
+#define CHIP_WORK_QUEUE_DEPTH 32
+// Аргументы записи, байт не больше (копируются в запись)
+#define CHIP_WORK_ARG_SIZE 208
+// Записей за один проход потока CHIP, остальные - следующим ScheduleWork, чтобы не задерживать события стека
+#define CHIP_WORK_DRAIN_BATCH 8
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Работа на потоке CHIP. arg - копия аргументов в записи очереди, действительна до возврата
+    typedef void (*chip_work_fn_t)(void *arg);
+
+    typedef struct
+    {
+        uint32_t posted;           // записей принято
+        uint32_t executed;         // выполнено на потоке CHIP
+        uint32_t full;             // отклонено: очередь заполнена
+        uint32_t max_depth;        // наибольшее число записей в очереди
+        uint32_t wakeups;          // ScheduleWork обработчика очереди
+        uint32_t wakeup_failures;  // ScheduleWork не принят, записи ждут следующей постановки
+    } chip_work_stats_t;
+
+    /**
+     * @brief Постановка работы на поток CHIP без блокировки стека и без выделения памяти: аргументы копируются
+     *        в заранее выделенную запись ограниченной очереди (несколько производителей, один потребитель).
+     *        Записи выполняются по порядку одним обработчиком, который ставится через ScheduleWork только если
+     *        еще не поставлен. Можно вызывать из любой задачи, в том числе с потока CHIP
+     *
+     * @param fn Обработчик
+     * @param arg Аргументы (копируются) или NULL
+     * @param size Размер аргументов, не больше CHIP_WORK_ARG_SIZE
+     * @return esp_err_t ESP_ERR_NO_MEM - очередь заполнена, ESP_ERR_INVALID_SIZE - аргументы не помещаются в запись.
+     *         ESP_OK - запись в очереди: если ScheduleWork обработчика не принят, она выполнится со следующей
+     *         постановкой (счетчик wakeup_failures, см. chip_work_get_stats()), вызывающему повторять не нужно
+     */
+    esp_err_t chip_work_post(chip_work_fn_t fn, const void *arg, size_t size);
+
+    void chip_work_get_stats(chip_work_stats_t *stats);
+
+#ifdef __cplusplus
+}
+
+#include <atomic>
+
+// Заранее выделенные объекты для работы, которая не помещается в запись очереди или живет дольше нее
+// (ждет ответов устройства): производитель занимает объект, передает указатель через chip_work_post(),
+// поток CHIP возвращает объект после итога. Занятость - битовая маска, без блокировок и выделения памяти
+template <typename T, unsigned N>
+class chip_work_pool
+{
+    static_assert(N > 0 && N <= 32, "chip_work_pool holds up to 32 objects");
+
+public:
+    // Свободный объект, обнуленный, или nullptr - все заняты
+    T *acquire()
+    {
+        uint32_t busy = m_busy.load();
+        for (;;)
+        {
+            if (busy == all_busy())
+                return nullptr;
+            unsigned index = (unsigned)__builtin_ctz(~busy);
+            if (m_busy.compare_exchange_weak(busy, busy | (1u << index)))
+            {
+                memset(static_cast<void *>(&m_items[index]), 0, sizeof(T));
+                return &m_items[index];
+            }
+        }
+    }
+
+    void release(T *item)
+    {
+        unsigned index = (unsigned)(item - m_items);
+        if (index < N)
+            m_busy.fetch_and(~(1u << index));
+    }
+
+    unsigned in_use() const { return (unsigned)__builtin_popcount(m_busy.load()); }
+
+private:
+    static constexpr uint32_t all_busy() { return N == 32 ? UINT32_MAX : (1u << N) - 1; }
+
+    T m_items[N];
+    std::atomic<uint32_t> m_busy{0};
+};
+
+#endif
+
+#endif // CHIP_WORK_H
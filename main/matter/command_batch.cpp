@@ -0,0 +1,413 @@
+#include "command_batch.h"
+#include "mqtt.h"
+#include "mqtt_topics.h"
+#include "json_stream.h"
+#include "command_tracker.h"
+#include "node_reachability.h"
+#include "chip_work.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <atomic>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_matter.h>
+#include <esp_matter_controller_cluster_command.h>
+#include <esp_matter_controller_write_command.h>
+#include <platform/CHIPDeviceLayer.h>
+
+static const char *TAG = "command_batch";
+
+typedef struct batch batch_t;
+
+typedef struct
+{
+    command_op_t target;
+    const char *value;  // в пуле пакета, "" - без данных
+    batch_t *batch;
+    esp_err_t result;   // итог по ответу устройства (command_tracker)
+    uint32_t sent_us;   // от приема пакета до отправки операции
+    uint32_t done_us;   // от приема пакета до итога
+} batch_op_t;
+
+// Пакет: заголовок, затем count операций, затем пул строк value
+struct batch
+{
+    char id[32];
+    uint8_t count;
+    uint8_t next;     // следующая операция к отправке
+    uint8_t parallel; // операций, ожидающих ответа, не больше
+    uint8_t inflight;
+    uint8_t done;
+    bool pumping; // идет проход pump(), итоги операций только считаются
+    int64_t started_us;
+};
+
+static std::atomic<int> active_batches{0};
+
+static inline batch_op_t *batch_ops(batch_t *batch)
+{
+    return reinterpret_cast<batch_op_t *>(batch + 1);
+}
+
+bool command_batch_read_id(const cJSON *item, uint64_t max, uint64_t *out)
+{
+    if (cJSON_IsNumber(item))
+    {
+        double value = item->valuedouble;
+        if (value < 0 || value != floor(value) || value > (double)max || value > 9007199254740992.0)
+            return false;
+        *out = (uint64_t)value;
+        return true;
+    }
+    if (cJSON_IsString(item) && item->valuestring[0])
+    {
+        char *end;
+        uint64_t value = strtoull(item->valuestring, &end, 0);
+        if (*end != '\0' || value > max)
+            return false;
+        *out = value;
+        return true;
+    }
+    return false;
+}
+
+// value строкой или объектом (печатается в строку), NULL - нет value. Возвращаемая строка освобождается вызывающим
+static char *read_value(const cJSON *item)
+{
+    if (!item)
+        return NULL;
+    if (cJSON_IsString(item))
+        return strdup(item->valuestring);
+    if (!cJSON_IsObject(item))
+        return NULL;
+    char *printed = cJSON_PrintUnformatted(item);
+    char *copy = printed ? strdup(printed) : NULL;
+    cJSON_free(printed);
+    return copy;
+}
+
+const char *command_batch_parse_op(const cJSON *item, command_op_t *op, char **value_out)
+{
+    const cJSON *command = cJSON_GetObjectItem(item, "command");
+    const cJSON *attribute = cJSON_GetObjectItem(item, "attribute");
+    uint64_t node_id, endpoint_id, cluster_id, op_id;
+    *value_out = NULL;
+
+    if (!cJSON_IsObject(item))
+        return "not an object";
+    if (!command_batch_read_id(cJSON_GetObjectItem(item, "node"), UINT64_MAX, &node_id))
+        return "invalid node";
+    if (!command_batch_read_id(cJSON_GetObjectItem(item, "endpoint"), UINT16_MAX, &endpoint_id))
+        return "invalid endpoint";
+    if (!command_batch_read_id(cJSON_GetObjectItem(item, "cluster"), UINT32_MAX, &cluster_id))
+        return "invalid cluster";
+    if ((command != nullptr) == (attribute != nullptr))
+        return "exactly one of command, attribute";
+    if (!command_batch_read_id(command ? command : attribute, UINT32_MAX, &op_id))
+        return command ? "invalid command" : "invalid attribute";
+
+    const cJSON *value = cJSON_GetObjectItem(item, "value");
+    char *text = read_value(value);
+    size_t value_len = text ? strlen(text) : 0;
+    const char *error = NULL;
+    if (value && !text)
+        error = "value must be a string or an object";
+    else if (value_len >= COMMAND_BATCH_MAX_VALUE)
+        error = "value too long";
+    else if (attribute && value_len == 0)
+        error = "attribute write needs a value";
+    if (error)
+    {
+        free(text);
+        return error;
+    }
+    op->node_id = node_id;
+    op->endpoint_id = (uint16_t)endpoint_id;
+    op->cluster_id = (uint32_t)cluster_id;
+    op->id = (uint32_t)op_id;
+    op->write = attribute != nullptr;
+    *value_out = text;
+    return NULL;
+}
+
+// Пакет не выполняется: status "invalid" с ошибками операций, "busy" или "failed" (не поставлен на поток CHIP)
+static void publish_errors(const char *batch_id, const char *status,
+                           const char *const *errors, uint8_t count)
+{
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+        return;
+    json_stream_t js;
+    json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "batch");
+    if (batch_id)
+        json_stream_string(&js, "id", batch_id);
+    json_stream_string(&js, "status", status);
+    json_stream_array_begin(&js, "errors");
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (!errors[i])
+            continue;
+        json_stream_object_begin(&js, NULL);
+        json_stream_uint(&js, "index", i);
+        json_stream_string(&js, "error", errors[i]);
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data_len(mqtt_topic(MQTT_TOPIC_EVENT), msg, js.len);
+    json_stream_buf_release(msg);
+}
+
+static void publish_result(batch_t *batch)
+{
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+    {
+        ESP_LOGE(TAG, "No buffer for result of batch '%s'", batch->id);
+        return;
+    }
+    uint8_t failed = 0;
+    for (uint8_t i = 0; i < batch->count; i++)
+    {
+        if (batch_ops(batch)[i].result != ESP_OK)
+            failed++;
+    }
+
+    json_stream_t js;
+    json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "batch");
+    json_stream_string(&js, "id", batch->id);
+    json_stream_string(&js, "status", failed ? "partial" : "done");
+    json_stream_uint(&js, "ok", batch->count - failed);
+    json_stream_uint(&js, "failed", failed);
+    json_stream_uint(&js, "elapsed_us", (uint64_t)(esp_timer_get_time() - batch->started_us));
+    json_stream_array_begin(&js, "results");
+    for (uint8_t i = 0; i < batch->count; i++)
+    {
+        const batch_op_t *op = &batch_ops(batch)[i];
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "status", esp_err_to_name(op->result));
+        json_stream_uint(&js, "us", op->done_us);
+        json_stream_uint(&js, "latency_us", op->done_us - op->sent_us);
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data_len(mqtt_topic(MQTT_TOPIC_EVENT), msg, js.len);
+    else
+        ESP_LOGE(TAG, "Result of batch '%s' does not fit", batch->id);
+    json_stream_buf_release(msg);
+}
+
+esp_err_t command_batch_send_op(const command_op_t *op, const char *value)
+{
+    if (!op->write)
+    {
+        return command_tracker_send_invoke(op->node_id, op->endpoint_id, op->cluster_id, op->id,
+                                           value && value[0] ? value : nullptr, 0);
+    }
+
+    if (!node_reachability_admit(op->node_id))
+        return ESP_ERR_INVALID_STATE;
+    chip::Platform::ScopedMemoryBufferWithSize<uint16_t> endpoint_ids;
+    chip::Platform::ScopedMemoryBufferWithSize<uint32_t> cluster_ids;
+    chip::Platform::ScopedMemoryBufferWithSize<uint32_t> attribute_ids;
+    if (!endpoint_ids.Alloc(1) || !cluster_ids.Alloc(1) || !attribute_ids.Alloc(1))
+        return ESP_ERR_NO_MEM;
+    endpoint_ids[0] = op->endpoint_id;
+    cluster_ids[0] = op->cluster_id;
+    attribute_ids[0] = op->id;
+    return esp_matter::controller::send_write_attr_command(op->node_id, endpoint_ids, cluster_ids, attribute_ids,
+                                                           value, chip::MakeOptional(1000));
+}
+
+static void finish_batch(batch_t *batch)
+{
+    publish_result(batch);
+    free(batch);
+    active_batches--;
+}
+
+static void pump(batch_t *batch);
+
+static void complete_op(batch_op_t *op, esp_err_t result)
+{
+    batch_t *batch = op->batch;
+    op->result = result;
+    op->done_us = (uint32_t)(esp_timer_get_time() - batch->started_us);
+    batch->done++;
+    if (result != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Batch '%s' op %u failed: %s", batch->id, (unsigned)(op - batch_ops(batch)),
+                 esp_err_to_name(result));
+    }
+}
+
+// Итог операции от command_tracker: ответ устройства, таймаут или ошибка отправки
+static void op_done(void *ctx, esp_err_t result)
+{
+    batch_op_t *op = static_cast<batch_op_t *>(ctx);
+    batch_t *batch = op->batch;
+    batch->inflight--;
+    complete_op(op, result);
+    if (!batch->pumping)
+        pump(batch);
+}
+
+// Отправка операции. false - command_tracker заполнен, операция ждет ответа на одну из отправленных
+static bool send_op(batch_op_t *op)
+{
+    batch_t *batch = op->batch;
+    const command_op_t *target = &op->target;
+    command_track_t track = {};
+    track.kind = target->write ? COMMAND_TRACK_WRITE : COMMAND_TRACK_INVOKE;
+    track.node_id = target->node_id;
+    track.endpoint_id = target->endpoint_id;
+    track.cluster_id = target->cluster_id;
+    track.item_id = target->id;
+    track.action = "batch";
+    track.done = op_done;
+    track.done_ctx = op;
+
+    uint32_t token = command_tracker_begin(&track);
+    if (!token)
+    {
+        if (batch->inflight)
+            return false;
+        complete_op(op, ESP_ERR_NO_MEM);
+        return true;
+    }
+    op->sent_us = (uint32_t)(esp_timer_get_time() - batch->started_us);
+    batch->inflight++;
+    // ошибка отправки и команда группе завершаются сразу, через op_done
+    command_tracker_sent(token, command_batch_send_op(target, op->value));
+    return true;
+}
+
+// Отправка операций по порядку, пока ответа ждут меньше parallel. Следующие уходят из op_done,
+// пакет завершается итогом последней операции
+static void pump(batch_t *batch)
+{
+    batch->pumping = true;
+    while (batch->next < batch->count && batch->inflight < batch->parallel)
+    {
+        if (!send_op(&batch_ops(batch)[batch->next]))
+            break;
+        batch->next++;
+    }
+    batch->pumping = false;
+    if (batch->done == batch->count)
+        finish_batch(batch);
+}
+
+// arg - указатель на пакет
+static void run_batch_work(void *arg)
+{
+    batch_t *batch = *static_cast<batch_t **>(arg);
+    pump(batch);
+}
+
+esp_err_t command_batch_submit(const cJSON *json)
+{
+    const cJSON *id = cJSON_GetObjectItem(json, "id");
+    const char *batch_id = cJSON_IsString(id) ? id->valuestring : "";
+    const cJSON *ops = cJSON_GetObjectItem(json, "ops");
+    int count = cJSON_IsArray(ops) ? cJSON_GetArraySize(ops) : 0;
+    if (count <= 0 || count > COMMAND_BATCH_MAX_OPS)
+    {
+        const char *error = "ops must be an array of 1..32 operations";
+        publish_errors(batch_id, "invalid", &error, 1);
+        return ESP_ERR_INVALID_ARG;
+    }
+    const cJSON *parallel = cJSON_GetObjectItem(json, "parallel");
+    uint64_t parallel_value = COMMAND_BATCH_DEFAULT_PARALLEL;
+    if (parallel &&
+        (!command_batch_read_id(parallel, COMMAND_BATCH_MAX_PARALLEL, &parallel_value) || parallel_value == 0))
+    {
+        const char *error = "parallel must be 1..16";
+        publish_errors(batch_id, "invalid", &error, 1);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Проверка всех операций до отправки первой
+    batch_op_t parsed[COMMAND_BATCH_MAX_OPS] = {};
+    char *values[COMMAND_BATCH_MAX_OPS] = {};
+    const char *errors[COMMAND_BATCH_MAX_OPS] = {};
+    size_t pool_size = 0;
+    bool valid = true;
+    for (int i = 0; i < count; i++)
+    {
+        errors[i] = command_batch_parse_op(cJSON_GetArrayItem(ops, i), &parsed[i].target, &values[i]);
+        if (!errors[i])
+            pool_size += (values[i] ? strlen(values[i]) : 0) + 1;
+        if (errors[i])
+            valid = false;
+    }
+
+    batch_t *batch = nullptr;
+    esp_err_t ret = ESP_OK;
+    if (!valid)
+    {
+        publish_errors(batch_id, "invalid", errors, (uint8_t)count);
+        ret = ESP_ERR_INVALID_ARG;
+    }
+    else if (++active_batches > COMMAND_BATCH_MAX_ACTIVE)
+    {
+        active_batches--;
+        ret = ESP_ERR_NO_MEM;
+    }
+    else if (!(batch = (batch_t *)malloc(sizeof(batch_t) + count * sizeof(batch_op_t) + pool_size)))
+    {
+        active_batches--;
+        ret = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        memset(batch, 0, sizeof(*batch));
+        strlcpy(batch->id, batch_id, sizeof(batch->id));
+        batch->count = (uint8_t)count;
+        batch->parallel = (uint8_t)parallel_value;
+        batch->started_us = esp_timer_get_time();
+        char *pool = reinterpret_cast<char *>(batch_ops(batch) + count);
+        for (int i = 0; i < count; i++)
+        {
+            batch_op_t *op = &batch_ops(batch)[i];
+            *op = parsed[i];
+            op->batch = batch;
+            size_t value_len = values[i] ? strlen(values[i]) : 0;
+            memcpy(pool, values[i] ? values[i] : "", value_len + 1);
+            op->value = pool;
+            op->result = ESP_ERR_INVALID_STATE;
+            pool += value_len + 1;
+        }
+        // все операции пакета выполняются на потоке CHIP, начиная с одной записи chip_work. Пакет переменной
+        // длины (операции и value) остается одним выделением на пакет, в записи - только указатель
+        esp_err_t err = chip_work_post(run_batch_work, &batch, sizeof(batch));
+        if (err != ESP_OK)
+        {
+            free(batch);
+            active_batches--;
+            ESP_LOGE(TAG, "Failed to queue batch '%s': %s", batch_id, esp_err_to_name(err));
+            const char *error =
+                err == ESP_ERR_NO_MEM ? "CHIP work queue is full" : "failed to queue on the CHIP thread";
+            publish_errors(batch_id, "failed", &error, 1);
+            ret = ESP_FAIL;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+        free(values[i]);
+    if (ret == ESP_ERR_NO_MEM)
+    {
+        ESP_LOGW(TAG, "Batch '%s' rejected: too many active batches or no memory", batch_id);
+        const char *error = "too many active batches or no memory";
+        publish_errors(batch_id, "busy", &error, 1);
+    }
+    return ret;
+}
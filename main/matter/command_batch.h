@@ -0,0 +1,80 @@
+#ifndef COMMAND_BATCH_H
+#define COMMAND_BATCH_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+// Операций в одном пакете не больше
+#define COMMAND_BATCH_MAX_OPS 32
+// Длина value одной операции (данные команды или значение атрибута в формате esp_matter)
+#define COMMAND_BATCH_MAX_VALUE 128
+// Операций пакета, одновременно ожидающих ответа устройства
+#define COMMAND_BATCH_DEFAULT_PARALLEL 4
+#define COMMAND_BATCH_MAX_PARALLEL 16
+// Пакетов, выполняющихся одновременно
+#define COMMAND_BATCH_MAX_ACTIVE 4
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Операция: команда или запись атрибута одному endpoint'у
+    typedef struct
+    {
+        uint64_t node_id;
+        uint32_t cluster_id;
+        uint32_t id; // команда или атрибут
+        uint16_t endpoint_id;
+        bool write; // запись атрибута
+    } command_op_t;
+
+    /**
+     * @brief Номер (узла, endpoint'а, кластера...) числом или строкой (десятичной или 0x...). Числом - не больше
+     *        2^53, иначе double уже теряет точность; больший ID узла передается строкой
+     *
+     * @param max Наибольшее допустимое значение
+     * @return bool false - нет значения, не целое, отрицательное или больше max
+     */
+    bool command_batch_read_id(const cJSON *item, uint64_t max, uint64_t *out);
+
+    /**
+     * @brief Разбор операции {"node":..,"endpoint":..,"cluster":..,"command"|"attribute":..,"value":..}.
+     *        Числа - числом или строкой (десятичной или 0x...), value - строкой или объектом в формате esp_matter
+     *
+     * @param value Строка value (освобождается вызывающим) или NULL, если value нет
+     * @return const char* NULL или описание ошибки
+     */
+    const char *command_batch_parse_op(const cJSON *item, command_op_t *op, char **value);
+
+    /**
+     * @brief Отправка операции на потоке CHIP (отслеживание - у вызывающего, см. command_tracker_begin()).
+     *        Ответ на команду приходит в command_tracker, запись подтверждается только отчетом об атрибуте
+     *
+     * @param value Данные команды или значение атрибута в формате esp_matter, NULL или "" - команда без данных
+     * @return esp_err_t ESP_ERR_INVALID_STATE - узел недоступен (node_reachability), операция не отправлена
+     */
+    esp_err_t command_batch_send_op(const command_op_t *op, const char *value);
+
+    /**
+     * @brief Проверка и запуск пакета операций
+     *        {"id":"room","parallel":4,"ops":[{"node":1,"endpoint":1,"cluster":6,"command":1},
+     *        {"node":2,"endpoint":1,"cluster":8,"command":0,"value":"{\"0:U8\":100,\"1:U16\":0,\"2:U8\":0,\"3:U8\":0}"},
+     *        {"node":3,"endpoint":1,"cluster":513,"attribute":18,"value":"{\"0:I16\":2100}"}]}.
+     *        Все операции проверяются до отправки: при ошибке пакет не выполняется и в топик событий
+     *        уходит {"action":"batch","status":"invalid","errors":[...]}. Иначе операции отправляются на потоке CHIP
+     *        по порядку, ответа ждут не больше parallel. После итога последней операции (ответ устройства, таймаут
+     *        или ошибка отправки, см. command_tracker) в топик событий публикуется один ответ со статусом и
+     *        задержкой каждой операции
+     *
+     * @param json Пакет
+     * @return esp_err_t ESP_OK, если пакет принят
+     */
+    esp_err_t command_batch_submit(const cJSON *json);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMMAND_BATCH_H
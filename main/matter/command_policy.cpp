@@ -0,0 +1,334 @@
+#include "command_policy.h"
+#include "settings.h"
+#include "mqtt.h"
+#include "json_stream.h"
+#include <string.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <nvs.h>
+#include <app/MessageDef/StatusIB.h>
+#include <lib/core/CHIPError.h>
+#include <lib/support/TypeTraits.h>
+#include <protocols/interaction_model/StatusCode.h>
+
+static const char *TAG = "command_policy";
+
+#define NVS_POLICY_NAMESPACE "matter_policy"
+#define NVS_POLICY_NODES_KEY "nodes"
+
+using chip::Protocols::InteractionModel::Status;
+
+// Команды, повтор которых не меняет итог: абсолютное значение или остановка. Toggle, Move, Step и т. п. - нет
+typedef struct
+{
+    uint32_t cluster_id;
+    uint32_t command_id;
+} idempotent_command_t;
+
+static const idempotent_command_t idempotent_commands[] = {
+    {0x0004, 0x00}, // Groups AddGroup
+    {0x0004, 0x03}, // Groups RemoveGroup
+    {0x0006, 0x00}, // OnOff Off
+    {0x0006, 0x01}, // OnOff On
+    {0x0008, 0x00}, // LevelControl MoveToLevel
+    {0x0008, 0x03}, // LevelControl Stop
+    {0x0008, 0x04}, // LevelControl MoveToLevelWithOnOff
+    {0x0008, 0x07}, // LevelControl StopWithOnOff
+    {0x0102, 0x00}, // WindowCovering UpOrOpen
+    {0x0102, 0x01}, // WindowCovering DownOrClose
+    {0x0102, 0x02}, // WindowCovering StopMotion
+    {0x0102, 0x05}, // WindowCovering GoToLiftPercentage
+    {0x0102, 0x08}, // WindowCovering GoToTiltPercentage
+    {0x0300, 0x00}, // ColorControl MoveToHue
+    {0x0300, 0x03}, // ColorControl MoveToSaturation
+    {0x0300, 0x06}, // ColorControl MoveToHueAndSaturation
+    {0x0300, 0x07}, // ColorControl MoveToColor
+    {0x0300, 0x0A}, // ColorControl MoveToColorTemperature
+    {0x0300, 0x47}, // ColorControl StopMoveStep
+};
+
+typedef struct
+{
+    uint64_t node_id;
+    uint16_t timeout_ms;
+    uint8_t retries;
+    uint8_t reserved;
+} node_policy_t;
+
+typedef struct
+{
+    uint32_t retried;       // команд с повторами
+    uint32_t retries;       // повторов всего
+    uint32_t retry_success; // команд, успешных после повтора
+    uint32_t classes[COMMAND_FAILURE_ERROR + 1];
+} policy_stats_t;
+
+static const char *const failure_names[] = {"none", "timeout", "unreachable", "offline", "busy",
+                                            "unsupported", "invalid", "rejected", "error"};
+static_assert(sizeof(failure_names) / sizeof(failure_names[0]) == COMMAND_FAILURE_ERROR + 1,
+              "failure_names does not match command_failure_t");
+
+static node_policy_t node_policies[COMMAND_POLICY_MAX_NODES];
+static uint8_t node_policy_count;
+static policy_stats_t stats;
+
+static const node_policy_t *find_node_policy(uint64_t node_id)
+{
+    for (uint8_t i = 0; i < node_policy_count; i++)
+    {
+        if (node_policies[i].node_id == node_id)
+            return &node_policies[i];
+    }
+    return nullptr;
+}
+
+static bool idempotent(uint32_t cluster_id, uint32_t command_id)
+{
+    for (const idempotent_command_t &command : idempotent_commands)
+    {
+        if (command.cluster_id == cluster_id && command.command_id == command_id)
+            return true;
+    }
+    return false;
+}
+
+esp_err_t command_policy_load(void)
+{
+    size_t size = sizeof(node_policies);
+    nvs_handle_t handle;
+    node_policy_count = 0;
+    esp_err_t err = nvs_open(NVS_POLICY_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    if (nvs_get_blob(handle, NVS_POLICY_NODES_KEY, node_policies, &size) == ESP_OK)
+        node_policy_count = size / sizeof(node_policies[0]);
+    nvs_close(handle);
+    ESP_LOGI(TAG, "%u nodes with own command policy", node_policy_count);
+    return ESP_OK;
+}
+
+static esp_err_t save_node_policies(void)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_POLICY_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return err;
+    err = node_policy_count
+              ? nvs_set_blob(handle, NVS_POLICY_NODES_KEY, node_policies, node_policy_count * sizeof(node_policies[0]))
+              : nvs_erase_key(handle, NVS_POLICY_NODES_KEY);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        err = ESP_OK;
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+uint16_t command_policy_timeout_ms(uint64_t node_id)
+{
+    const node_policy_t *node = find_node_policy(node_id);
+    if (node && node->timeout_ms)
+        return node->timeout_ms;
+    return sys_settings.command.timeout_ms ? sys_settings.command.timeout_ms : DEFAULT_COMMAND_TIMEOUT_MS;
+}
+
+void command_policy_get(uint64_t node_id, uint32_t cluster_id, uint32_t item_id, bool write, command_policy_t *policy)
+{
+    const node_policy_t *node = find_node_policy(node_id);
+    policy->timeout_ms = command_policy_timeout_ms(node_id);
+    policy->backoff_ms = sys_settings.command.backoff_ms;
+    // запись атрибута - абсолютное значение, повтор безопасен
+    if (write || idempotent(cluster_id, item_id))
+        policy->retries = node ? node->retries : sys_settings.command.retries;
+    else
+        policy->retries = 0;
+    if (policy->retries > COMMAND_POLICY_MAX_RETRIES)
+        policy->retries = COMMAND_POLICY_MAX_RETRIES;
+}
+
+bool command_policy_transient(command_failure_t failure)
+{
+    return failure == COMMAND_FAILURE_TIMEOUT || failure == COMMAND_FAILURE_UNREACHABLE ||
+           failure == COMMAND_FAILURE_BUSY;
+}
+
+uint32_t command_policy_backoff_ms(const command_policy_t *policy, uint8_t attempt)
+{
+    uint32_t delay_ms = policy->backoff_ms;
+    for (uint8_t i = 1; i < attempt && delay_ms < COMMAND_POLICY_MAX_BACKOFF_MS; i++)
+        delay_ms *= 2;
+    return delay_ms < COMMAND_POLICY_MAX_BACKOFF_MS ? delay_ms : COMMAND_POLICY_MAX_BACKOFF_MS;
+}
+
+command_failure_t command_policy_classify_status(uint8_t im_status)
+{
+    switch (static_cast<Status>(im_status))
+    {
+    case Status::Success:
+        return COMMAND_FAILURE_NONE;
+    case Status::Timeout:
+        return COMMAND_FAILURE_TIMEOUT;
+    case Status::Busy:
+    case Status::ResourceExhausted:
+    case Status::PathsExhausted:
+        return COMMAND_FAILURE_BUSY;
+    case Status::UnsupportedAccess:
+    case Status::UnsupportedEndpoint:
+    case Status::UnsupportedCommand:
+    case Status::UnsupportedAttribute:
+    case Status::UnsupportedWrite:
+    case Status::UnsupportedRead:
+    case Status::UnsupportedCluster:
+    case Status::UnsupportedEvent:
+    case Status::UnreportableAttribute:
+        return COMMAND_FAILURE_UNSUPPORTED;
+    case Status::InvalidAction:
+    case Status::InvalidCommand:
+    case Status::ConstraintError:
+    case Status::InvalidDataType:
+    case Status::NeedsTimedInteraction:
+        return COMMAND_FAILURE_INVALID;
+    default:
+        return COMMAND_FAILURE_REJECTED;
+    }
+}
+
+command_failure_t command_policy_classify_chip_error(uint32_t chip_error)
+{
+    chip::ChipError error(static_cast<chip::ChipError::StorageType>(chip_error));
+    if (error == CHIP_NO_ERROR)
+        return COMMAND_FAILURE_NONE;
+    if (error.IsIMStatus())
+        return command_policy_classify_status(chip::to_underlying(chip::app::StatusIB(error).mStatus));
+    if (error == CHIP_ERROR_TIMEOUT)
+        return COMMAND_FAILURE_TIMEOUT;
+    if (error == CHIP_ERROR_NO_MEMORY || error == CHIP_ERROR_BUSY)
+        return COMMAND_FAILURE_BUSY;
+    // после отправки остальные ошибки - поиск адреса, CASE, транспорт
+    return COMMAND_FAILURE_UNREACHABLE;
+}
+
+command_failure_t command_policy_classify_send_error(esp_err_t err)
+{
+    switch (err)
+    {
+    case ESP_OK:
+        return COMMAND_FAILURE_NONE;
+    case ESP_ERR_INVALID_STATE:
+        return COMMAND_FAILURE_OFFLINE;
+    case ESP_ERR_NO_MEM:
+        return COMMAND_FAILURE_BUSY;
+    case ESP_ERR_INVALID_ARG:
+    case ESP_ERR_INVALID_SIZE:
+        return COMMAND_FAILURE_INVALID;
+    case ESP_ERR_TIMEOUT:
+        return COMMAND_FAILURE_TIMEOUT;
+    default:
+        return COMMAND_FAILURE_ERROR;
+    }
+}
+
+const char *command_policy_failure_name(command_failure_t failure)
+{
+    return failure <= COMMAND_FAILURE_ERROR ? failure_names[failure] : "error";
+}
+
+esp_err_t command_policy_set_node(uint64_t node_id, uint16_t timeout_ms, uint8_t retries)
+{
+    if (node_id == 0)
+        return ESP_ERR_INVALID_ARG;
+    node_policy_t *node = const_cast<node_policy_t *>(find_node_policy(node_id));
+    node_policy_t previous = {};
+    if (node)
+    {
+        previous = *node;
+    }
+    else
+    {
+        if (node_policy_count == COMMAND_POLICY_MAX_NODES)
+            return ESP_ERR_NO_MEM;
+        node = &node_policies[node_policy_count++];
+    }
+    *node = {node_id, timeout_ms, retries, 0};
+    esp_err_t err = save_node_policies();
+    if (err != ESP_OK)
+    {
+        if (previous.node_id)
+            *node = previous;
+        else
+            node_policy_count--;
+    }
+    return err;
+}
+
+esp_err_t command_policy_remove_node(uint64_t node_id)
+{
+    node_policy_t *node = const_cast<node_policy_t *>(find_node_policy(node_id));
+    if (!node)
+        return ESP_ERR_NOT_FOUND;
+    *node = node_policies[--node_policy_count];
+    return save_node_policies();
+}
+
+void command_policy_clear(void)
+{
+    node_policy_count = 0;
+    nvs_handle_t handle;
+    if (nvs_open(NVS_POLICY_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        nvs_erase_all(handle);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
+
+void command_policy_record(uint8_t retries, command_failure_t failure)
+{
+    if (retries)
+    {
+        stats.retried++;
+        stats.retries += retries;
+        if (failure == COMMAND_FAILURE_NONE)
+            stats.retry_success++;
+    }
+    if (failure != COMMAND_FAILURE_NONE && failure <= COMMAND_FAILURE_ERROR)
+        stats.classes[failure]++;
+}
+
+esp_err_t command_policy_publish(const char *topic)
+{
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+        return ESP_ERR_NO_MEM;
+
+    json_stream_t js;
+    json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "command-policy");
+    json_stream_uint(&js, "timeout_ms", sys_settings.command.timeout_ms);
+    json_stream_uint(&js, "retries", sys_settings.command.retries);
+    json_stream_uint(&js, "backoff_ms", sys_settings.command.backoff_ms);
+    json_stream_array_begin(&js, "nodes");
+    for (uint8_t i = 0; i < node_policy_count; i++)
+    {
+        json_stream_object_begin(&js, NULL);
+        json_stream_uint(&js, "node", node_policies[i].node_id);
+        json_stream_uint(&js, "timeout_ms", node_policies[i].timeout_ms);
+        json_stream_uint(&js, "retries", node_policies[i].retries);
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+    json_stream_uint(&js, "retried", stats.retried);
+    json_stream_uint(&js, "retry_count", stats.retries);
+    json_stream_uint(&js, "retry_success", stats.retry_success);
+    json_stream_object_begin(&js, "classes");
+    for (int i = COMMAND_FAILURE_TIMEOUT; i <= COMMAND_FAILURE_ERROR; i++)
+        json_stream_uint(&js, failure_names[i], stats.classes[i]);
+    json_stream_object_end(&js);
+    json_stream_object_end(&js);
+    esp_err_t err = json_stream_finish(&js);
+    if (err == ESP_OK)
+        err = mqtt_publish_data_len(topic, msg, js.len);
+    json_stream_buf_release(msg);
+    return err;
+}
@@ -0,0 +1,104 @@
+#ifndef COMMAND_POLICY_H
+#define COMMAND_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Узлов со своим таймаутом и числом повторов (хранятся в NVS)
+#define COMMAND_POLICY_MAX_NODES 8
+// Задержка перед повтором растет вдвое, но не больше
+#define COMMAND_POLICY_MAX_BACKOFF_MS 4000
+// Повторов команды не больше, сколько бы ни было задано
+#define COMMAND_POLICY_MAX_RETRIES 5
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        uint16_t timeout_ms; // срок итога команды с учетом всех повторов
+        uint8_t retries;     // повторов не больше, 0 - без повторов (неидемпотентная команда)
+        uint16_t backoff_ms; // задержка перед первым повтором, затем удваивается
+    } command_policy_t;
+
+    // Класс неудачи в итоге команды ("class")
+    typedef enum
+    {
+        COMMAND_FAILURE_NONE = 0,
+        COMMAND_FAILURE_TIMEOUT,     // нет ответа за срок (MRP, таймаут команды, статус Timeout)
+        COMMAND_FAILURE_UNREACHABLE, // нет CASE-сессии или ошибка транспорта
+        COMMAND_FAILURE_OFFLINE,     // узел недоступен (node_reachability), команда не отправлена
+        COMMAND_FAILURE_BUSY,        // устройство (Busy, ResourceExhausted) или контроллер (нет памяти, очередь) заняты
+        COMMAND_FAILURE_UNSUPPORTED, // команда, атрибут, кластер или endpoint не поддерживаются
+        COMMAND_FAILURE_INVALID,     // неверные данные команды (ConstraintError, InvalidCommand, ...)
+        COMMAND_FAILURE_REJECTED,    // другой статус IM с ошибкой
+        COMMAND_FAILURE_ERROR,       // прочие ошибки
+    } command_failure_t;
+
+    /**
+     * @brief Загрузка политик узлов из NVS. Вызывается при запуске до первых команд
+     */
+    esp_err_t command_policy_load(void);
+
+    /**
+     * @brief Политика команды: таймаут и повторы узла (или sys_settings.command), повторы только для идемпотентных
+     *        команд по таблице кластеров (OnOff On/Off, LevelControl MoveToLevel, ColorControl MoveTo..., запись
+     *        атрибута). Toggle, Step и другие относительные команды не повторяются. На потоке CHIP
+     *
+     * @param write Запись атрибута (item_id - атрибут), иначе команда
+     */
+    void command_policy_get(uint64_t node_id, uint32_t cluster_id, uint32_t item_id, bool write,
+                            command_policy_t *policy);
+
+    // Таймаут команд узла, мс (для command_tracker_begin() без своего срока)
+    uint16_t command_policy_timeout_ms(uint64_t node_id);
+
+    // Повторная отправка поможет: нет ответа, нет сессии, устройство занято
+    bool command_policy_transient(command_failure_t failure);
+
+    // Задержка перед повтором attempt (1 - первый повтор)
+    uint32_t command_policy_backoff_ms(const command_policy_t *policy, uint8_t attempt);
+
+    // Класс неудачи по статусу IM ответа устройства
+    command_failure_t command_policy_classify_status(uint8_t im_status);
+
+    // Класс неудачи по коду CHIP_ERROR (статус IM внутри ошибки разбирается как ответ устройства)
+    command_failure_t command_policy_classify_chip_error(uint32_t chip_error);
+
+    // Класс неудачи отправки по esp_err_t (ESP_ERR_INVALID_STATE - узел недоступен, см. node_reachability_admit())
+    command_failure_t command_policy_classify_send_error(esp_err_t err);
+
+    const char *command_policy_failure_name(command_failure_t failure);
+
+    /**
+     * @brief Таймаут и повторы узла (сохраняются в NVS), например больше для спящих устройств.
+     *        На потоке CHIP (или под LockChipStack)
+     *
+     * @return esp_err_t ESP_ERR_NO_MEM - уже COMMAND_POLICY_MAX_NODES узлов
+     */
+    esp_err_t command_policy_set_node(uint64_t node_id, uint16_t timeout_ms, uint8_t retries);
+
+    // ESP_ERR_NOT_FOUND - у узла нет своей политики
+    esp_err_t command_policy_remove_node(uint64_t node_id);
+
+    // Очистка политик узлов, в том числе в NVS (factoryreset). Вызывается на потоке CHIP
+    void command_policy_clear(void);
+
+    /**
+     * @brief Публикация {"action":"command-policy","timeout_ms":..,"retries":..,"backoff_ms":..,
+     *        "nodes":[{"node":..,"timeout_ms":..,"retries":..}],"retried":..,"retry_success":..,
+     *        "classes":{"timeout":..,"unreachable":..,...}}. На потоке CHIP (или под LockChipStack)
+     */
+    esp_err_t command_policy_publish(const char *topic);
+
+    // Учет итога для статистики: повторов у команды, класс неудачи (COMMAND_FAILURE_NONE - успех)
+    void command_policy_record(uint8_t retries, command_failure_t failure);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMMAND_POLICY_H
@@ -0,0 +1,309 @@
+#include "command_sequence.h"
+#include "mqtt.h"
+#include "mqtt_topics.h"
+#include "json_stream.h"
+#include "chip_work.h"
+#include <string.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char *TAG = "command_sequence";
+
+typedef struct latest_slot latest_slot_t;
+
+typedef struct
+{
+    command_sequence_t seq;
+    uint8_t next;    // шаг, ожидающий ответа
+    uint8_t skipped; // необязательных шагов с ошибкой
+    int64_t started_us;
+    latest_slot_t *slot; // цель latest_wins или NULL
+} sequence_run_t;
+
+struct latest_slot
+{
+    uint64_t node_id;
+    uint16_t endpoint_id;
+    uint32_t cluster_id;
+    uint32_t command_id;
+    sequence_run_t *running; // выполняется
+    sequence_run_t *pending; // ждет завершения running, новая заменяет
+    uint32_t sent;
+    uint32_t coalesced;
+    int64_t last_us; // 0 - цель свободна
+};
+
+static latest_slot_t latest_slots[COMMAND_SEQUENCE_LATEST_SLOTS];
+static chip_work_pool<sequence_run_t, COMMAND_SEQUENCE_MAX_RUNS> runs;
+
+void command_sequence_init(command_sequence_t *seq, uint64_t node_id, uint16_t endpoint_id, const char *id,
+                           const char *action)
+{
+    memset(seq, 0, sizeof(*seq));
+    seq->node_id = node_id;
+    seq->endpoint_id = endpoint_id;
+    strlcpy(seq->id, id ? id : "", sizeof(seq->id));
+    strlcpy(seq->action, action ? action : "sequence", sizeof(seq->action));
+}
+
+esp_err_t command_sequence_add(command_sequence_t *seq, uint32_t cluster_id, uint32_t command_id,
+                               const typed_field_t *fields, uint8_t field_count, uint16_t timeout_ms, bool optional)
+{
+    if (seq->count == COMMAND_SEQUENCE_MAX_STEPS)
+        return ESP_ERR_NO_MEM;
+    command_step_t *step = &seq->steps[seq->count];
+    step->data_len = 0;
+    if (fields && field_count)
+    {
+        size_t len;
+        esp_err_t err = typed_command_encode_fields(fields, field_count, step->data, sizeof(step->data), &len);
+        if (err != ESP_OK)
+            return err;
+        step->data_len = (uint8_t)len;
+    }
+    step->cluster_id = cluster_id;
+    step->command_id = command_id;
+    step->timeout_ms = timeout_ms;
+    step->optional = optional;
+    seq->count++;
+    return ESP_OK;
+}
+
+static void publish_result(const sequence_run_t *run, const char *status, esp_err_t err)
+{
+    const command_sequence_t *seq = &run->seq;
+    char msg[320];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", seq->action);
+    json_stream_string(&js, "id", seq->id);
+    json_stream_uint(&js, "node", seq->node_id);
+    json_stream_uint(&js, "endpoint", seq->endpoint_id);
+    json_stream_string(&js, "status", status);
+    json_stream_uint(&js, "steps", seq->count);
+    json_stream_uint(&js, "completed", run->next);
+    json_stream_uint(&js, "skipped", run->skipped);
+    if (err != ESP_OK)
+    {
+        json_stream_uint(&js, "failed_step", run->next);
+        json_stream_string(&js, "error", esp_err_to_name(err));
+    }
+    json_stream_uint(&js, "elapsed_ms", (uint64_t)((esp_timer_get_time() - run->started_us) / 1000));
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data_len(mqtt_topic(MQTT_TOPIC_EVENT), msg, js.len);
+}
+
+static void begin_run(sequence_run_t *run);
+
+static void finish(sequence_run_t *run, esp_err_t err)
+{
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "%s to node 0x%" PRIx64 " aborted at step %u/%u: %s", run->seq.action, run->seq.node_id,
+                 run->next + 1, run->seq.count, esp_err_to_name(err));
+    }
+    if (run->seq.id[0])
+        publish_result(run, err == ESP_OK ? "done" : "aborted", err);
+    latest_slot_t *slot = run->slot;
+    runs.release(run);
+
+    // у цели ждет самое новое значение
+    if (slot)
+    {
+        slot->running = nullptr;
+        sequence_run_t *next = slot->pending;
+        slot->pending = nullptr;
+        if (next)
+            begin_run(next);
+    }
+}
+
+static void step_done(void *ctx, esp_err_t result);
+
+// Отправка текущего шага. После command_tracker_sent() run может быть уже освобожден (ошибка отправки
+// или команда группе завершаются сразу, в step_done)
+static void send_step(sequence_run_t *run)
+{
+    const command_step_t *step = &run->seq.steps[run->next];
+    command_track_t track = {};
+    track.kind = COMMAND_TRACK_INVOKE;
+    track.node_id = run->seq.node_id;
+    track.endpoint_id = run->seq.endpoint_id;
+    track.cluster_id = step->cluster_id;
+    track.item_id = step->command_id;
+    track.action = run->seq.action;
+    track.timeout_ms = step->timeout_ms ? step->timeout_ms : COMMAND_SEQUENCE_STEP_TIMEOUT_MS;
+    track.done = step_done;
+    track.done_ctx = run;
+
+    uint32_t token = command_tracker_begin(&track);
+    if (!token)
+    {
+        // без отслеживания ответа следующий шаг не начать
+        finish(run, ESP_ERR_NO_MEM);
+        return;
+    }
+    esp_err_t err = typed_command_invoke(run->seq.node_id, run->seq.endpoint_id, step->cluster_id, step->command_id,
+                                         step->data, step->data_len, token);
+    command_tracker_sent(token, err);
+}
+
+static void step_done(void *ctx, esp_err_t result)
+{
+    sequence_run_t *run = static_cast<sequence_run_t *>(ctx);
+    if (result != ESP_OK)
+    {
+        if (!run->seq.steps[run->next].optional)
+        {
+            finish(run, result);
+            return;
+        }
+        run->skipped++;
+    }
+    if (++run->next == run->seq.count)
+    {
+        finish(run, ESP_OK);
+        return;
+    }
+    send_step(run);
+}
+
+static void begin_run(sequence_run_t *run)
+{
+    if (run->slot)
+    {
+        run->slot->running = run;
+        run->slot->sent++;
+    }
+    send_step(run);
+}
+
+static void write_target(json_stream_t *js, const latest_slot_t *slot)
+{
+    json_stream_object_begin(js, NULL);
+    json_stream_uint(js, "node", slot->node_id);
+    json_stream_uint(js, "endpoint", slot->endpoint_id);
+    json_stream_uint(js, "cluster", slot->cluster_id);
+    json_stream_uint(js, "command", slot->command_id);
+    json_stream_uint(js, "sent", slot->sent);
+    json_stream_uint(js, "coalesced", slot->coalesced);
+    json_stream_bool(js, "busy", slot->running != nullptr);
+    json_stream_object_end(js);
+}
+
+// Итог вытесняемой цели: счетчики не пропадают вместе с ней
+static void publish_evicted(const latest_slot_t *slot)
+{
+    char msg[224];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "coalescing");
+    json_stream_bool(&js, "evicted", true);
+    json_stream_array_begin(&js, "targets");
+    write_target(&js, slot);
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data_len(mqtt_topic(MQTT_TOPIC_EVENT), msg, js.len);
+}
+
+// Цель последовательности: найденная, свободная или давно не использованная без выполняемых.
+// NULL - все цели заняты, последовательность выполняется без вытеснения
+static latest_slot_t *latest_slot(const command_sequence_t *seq, int64_t now_us)
+{
+    const command_step_t *last = &seq->steps[seq->count - 1];
+    latest_slot_t *victim = nullptr;
+    for (latest_slot_t &slot : latest_slots)
+    {
+        if (slot.last_us && slot.node_id == seq->node_id && slot.endpoint_id == seq->endpoint_id &&
+            slot.cluster_id == last->cluster_id && slot.command_id == last->command_id)
+        {
+            slot.last_us = now_us;
+            return &slot;
+        }
+        if (!slot.running && !slot.pending && (!victim || slot.last_us < victim->last_us))
+            victim = &slot;
+    }
+    if (!victim)
+        return nullptr;
+    // вытесняется только простаивающая цель, ее счетчики публикуются перед сбросом
+    if (victim->last_us && (victim->sent || victim->coalesced))
+        publish_evicted(victim);
+    memset(victim, 0, sizeof(*victim));
+    victim->node_id = seq->node_id;
+    victim->endpoint_id = seq->endpoint_id;
+    victim->cluster_id = last->cluster_id;
+    victim->command_id = last->command_id;
+    victim->last_us = now_us;
+    return victim;
+}
+
+// arg - указатель на запуск из пула
+static void start_work(void *arg)
+{
+    sequence_run_t *run = *static_cast<sequence_run_t **>(arg);
+    // время ожидания своей очереди входит в elapsed_ms
+    run->started_us = esp_timer_get_time();
+    latest_slot_t *slot = run->seq.latest_wins ? latest_slot(&run->seq, run->started_us) : nullptr;
+    if (slot && slot->running)
+    {
+        // устаревшее ждущее значение не отправляется
+        if (slot->pending)
+        {
+            slot->coalesced++;
+            if (slot->pending->seq.id[0])
+                publish_result(slot->pending, "superseded", ESP_OK);
+            runs.release(slot->pending);
+        }
+        run->slot = slot;
+        slot->pending = run;
+        return;
+    }
+    run->slot = slot;
+    begin_run(run);
+}
+
+esp_err_t command_sequence_start(const command_sequence_t *seq)
+{
+    if (!seq || seq->count == 0)
+        return ESP_ERR_INVALID_ARG;
+    sequence_run_t *run = runs.acquire();
+    if (!run)
+        return ESP_ERR_NO_MEM;
+    run->seq = *seq;
+    esp_err_t err = chip_work_post(start_work, &run, sizeof(run));
+    if (err != ESP_OK)
+        runs.release(run);
+    return err;
+}
+
+esp_err_t command_sequence_publish_coalescing(const char *topic)
+{
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+        return ESP_ERR_NO_MEM;
+
+    json_stream_t js;
+    json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "coalescing");
+    json_stream_array_begin(&js, "targets");
+    for (const latest_slot_t &slot : latest_slots)
+    {
+        if (!slot.last_us)
+            continue;
+        write_target(&js, &slot);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+
+    esp_err_t err = json_stream_finish(&js);
+    if (err == ESP_OK)
+        err = mqtt_publish_data_len(topic, msg, js.len);
+    json_stream_buf_release(msg);
+    return err;
+}
@@ -0,0 +1,91 @@
+#ifndef COMMAND_SEQUENCE_H
+#define COMMAND_SEQUENCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "command_tracker.h"
+#include "typed_command.h"
+
+// Шагов в последовательности не больше
+#define COMMAND_SEQUENCE_MAX_STEPS 6
+// Длина данных команды шага (TLV)
+#define COMMAND_SEQUENCE_MAX_DATA 24
+// Ожидание ответа на шаг, если у шага не задано свое
+#define COMMAND_SEQUENCE_STEP_TIMEOUT_MS 5000
+// Целей (узел, endpoint, кластер, команда) с вытеснением устаревших значений, при переполнении
+// заменяется давно не использованная свободная цель
+#define COMMAND_SEQUENCE_LATEST_SLOTS 16
+// Последовательностей, запущенных и ждущих своей очереди, одновременно (заранее выделены)
+#define COMMAND_SEQUENCE_MAX_RUNS 16
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        uint32_t cluster_id;
+        uint32_t command_id;
+        uint8_t data[COMMAND_SEQUENCE_MAX_DATA]; // поля команды в TLV
+        uint8_t data_len;                        // 0 - команда без данных
+        uint16_t timeout_ms;                  // 0 - COMMAND_SEQUENCE_STEP_TIMEOUT_MS
+        bool optional;                        // ошибка шага не прерывает последовательность
+    } command_step_t;
+
+    // Команды одному endpoint'у, каждая отправляется после ответа на предыдущую
+    typedef struct
+    {
+        uint64_t node_id;
+        uint16_t endpoint_id;
+        char id[COMMAND_TRACKER_ID_MAX]; // "" - итог не публикуется
+        char action[24];
+        // Вытеснение устаревших значений (ползунки): пока выполняется последовательность той же цели
+        // (узел, endpoint, кластер и команда последнего шага), новая ждет, а следующая заменяет ждущую
+        bool latest_wins;
+        uint8_t count;
+        command_step_t steps[COMMAND_SEQUENCE_MAX_STEPS];
+    } command_sequence_t;
+
+    void command_sequence_init(command_sequence_t *seq, uint64_t node_id, uint16_t endpoint_id, const char *id,
+                               const char *action);
+
+    /**
+     * @brief Добавление шага
+     *
+     * @param fields Поля команды (кодируются в TLV сразу) или NULL
+     * @param field_count Число полей
+     * @param timeout_ms Ожидание ответа, 0 - COMMAND_SEQUENCE_STEP_TIMEOUT_MS
+     * @param optional Ошибка или отсутствие ответа не прерывают последовательность
+     * @return esp_err_t ESP_ERR_NO_MEM - шагов больше COMMAND_SEQUENCE_MAX_STEPS, ESP_ERR_INVALID_SIZE - длинные данные
+     */
+    esp_err_t command_sequence_add(command_sequence_t *seq, uint32_t cluster_id, uint32_t command_id,
+                                   const typed_field_t *fields, uint8_t field_count, uint16_t timeout_ms, bool optional);
+
+    /**
+     * @brief Запуск последовательности на потоке CHIP, можно вызывать из любой задачи (не блокирует).
+     *        Следующий шаг отправляется из колбэка ответа на предыдущий (command_tracker), ошибка или таймаут
+     *        обязательного шага прерывают последовательность. Для последовательности с id в топик событий публикуется
+     *        {"action":..,"id":..,"node":..,"endpoint":..,"status":"done"|"aborted"|"superseded","steps":..,
+     *        "completed":..,"skipped":..,"failed_step":..,"error":..,"elapsed_ms":..}. "superseded" - последовательность
+     *        с latest_wins заменена более новой до начала выполнения
+     *
+     * @param seq Последовательность (копируется)
+     * @return esp_err_t ESP_ERR_NO_MEM - заняты все COMMAND_SEQUENCE_MAX_RUNS или очередь chip_work заполнена
+     */
+    esp_err_t command_sequence_start(const command_sequence_t *seq);
+
+    /**
+     * @brief Публикация счетчиков по целям latest_wins: {"action":"coalescing","targets":[{"node":..,"endpoint":..,
+     *        "cluster":..,"command":..,"sent":..,"coalesced":..,"busy":..}]}.
+     *        Цель, вытесняемая новой, публикует свои счетчики в событиях тем же сообщением с "evicted":true.
+     *        Должна вызываться на потоке CHIP (или под LockChipStack)
+     */
+    esp_err_t command_sequence_publish_coalescing(const char *topic);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMMAND_SEQUENCE_H
@@ -0,0 +1,472 @@
+#include "command_tracker.h"
+#include "node_reachability.h"
+#include "command_policy.h"
+#include "typed_command.h"
+#include "cJSON.h"
+#include "mqtt.h"
+#include "mqtt_topics.h"
+#include "json_stream.h"
+#include <string.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_matter.h>
+#include <json_to_tlv.h>
+#include <lib/core/TLV.h>
+#include <lib/core/NodeId.h>
+#include <platform/CHIPDeviceLayer.h>
+
+static const char *TAG = "command_tracker";
+
+typedef struct
+{
+    uint32_t token; // 0 - запись свободна
+    command_track_kind_t kind;
+    bool sent;      // отправка прошла, ждем ответа
+    bool bound;     // итог по номеру (command_tracker_complete), не по пути ответа
+    uint8_t retries; // повторных отправок (command_tracker_retry)
+    uint64_t node_id;
+    uint16_t endpoint_id;
+    uint32_t cluster_id;
+    uint32_t item_id;
+    int64_t started_us;
+    int64_t deadline_us;
+    command_tracker_done_t done;
+    void *done_ctx;
+    char id[COMMAND_TRACKER_ID_MAX];
+    char action[24];
+} pending_command_t;
+
+typedef enum
+{
+    RESULT_SUCCESS,
+    RESULT_FAILED,   // ошибка CHIP (нет сессии, нет ответа MRP), code - CHIP_ERROR
+    RESULT_REJECTED, // ответ устройства со статусом IM
+    RESULT_NOT_SENT, // ошибка отправки, code - esp_err_t
+    RESULT_TIMEOUT,
+    RESULT_UNCONFIRMED,
+} command_result_t;
+
+static const char *result_names[] = {"success", "failed", "failed", "failed", "timeout", "unconfirmed"};
+
+typedef struct
+{
+    uint64_t node_id;
+    uint32_t cluster_id;
+    uint32_t count; // успешных команд всего
+    uint32_t failed;
+    uint32_t timeouts;
+    uint8_t head;   // куда писать следующую задержку
+    uint8_t filled;
+    int64_t last_us; // 0 - пара свободна
+    uint32_t samples_ms[COMMAND_TRACKER_LATENCY_SAMPLES];
+} latency_slot_t;
+
+static pending_command_t pending[COMMAND_TRACKER_MAX_PENDING];
+static uint8_t pending_count = 0;
+static uint32_t next_token = 1;
+static bool timer_running = false;
+static int64_t timer_deadline_us = 0;
+static latency_slot_t latency[COMMAND_TRACKER_LATENCY_SLOTS];
+static command_tracker_stats_t stats = {};
+
+static latency_slot_t *latency_slot(uint64_t node_id, uint32_t cluster_id, int64_t now_us)
+{
+    latency_slot_t *victim = &latency[0];
+    for (latency_slot_t &slot : latency)
+    {
+        if (slot.last_us && slot.node_id == node_id && slot.cluster_id == cluster_id)
+        {
+            slot.last_us = now_us;
+            return &slot;
+        }
+        if (slot.last_us < victim->last_us)
+            victim = &slot;
+    }
+    memset(victim, 0, sizeof(*victim));
+    victim->node_id = node_id;
+    victim->cluster_id = cluster_id;
+    victim->last_us = now_us;
+    return victim;
+}
+
+static void publish_result(const pending_command_t *cmd, const char *status, const char *error, int64_t code,
+                           command_failure_t failure, uint32_t latency_ms)
+{
+    char msg[384];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", cmd->action);
+    json_stream_string(&js, "id", cmd->id);
+    json_stream_uint(&js, "node", cmd->node_id);
+    json_stream_uint(&js, "endpoint", cmd->endpoint_id);
+    json_stream_uint(&js, "cluster", cmd->cluster_id);
+    json_stream_string(&js, "status", status);
+    if (error)
+    {
+        json_stream_string(&js, "error", error);
+        json_stream_int(&js, "code", code);
+    }
+    if (failure != COMMAND_FAILURE_NONE)
+        json_stream_string(&js, "class", command_policy_failure_name(failure));
+    json_stream_uint(&js, "attempts", cmd->retries + 1);
+    json_stream_uint(&js, "latency_ms", latency_ms);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data_len(mqtt_topic(MQTT_TOPIC_EVENT), msg, js.len);
+    else
+        ESP_LOGE(TAG, "Result of command '%s' does not fit", cmd->id);
+}
+
+// Итог команды: статистика, задержка пары (узел, кластер), публикация для команд с id. Запись освобождается
+static void complete_at(uint8_t index, command_result_t result, const char *error, int64_t code)
+{
+    const char *status = result_names[result];
+    pending_command_t cmd = pending[index];
+    // порядок записей важен для сопоставления ответов, сдвигаем хвост
+    memmove(&pending[index], &pending[index + 1], (pending_count - index - 1) * sizeof(pending[0]));
+    pending_count--;
+
+    int64_t now_us = esp_timer_get_time();
+    uint32_t latency_ms = (uint32_t)((now_us - cmd.started_us) / 1000);
+    latency_slot_t *slot = latency_slot(cmd.node_id, cmd.cluster_id, now_us);
+    esp_err_t done_result = ESP_OK;
+    command_failure_t failure = COMMAND_FAILURE_NONE;
+    switch (result)
+    {
+    case RESULT_SUCCESS:
+        stats.succeeded++;
+        slot->count++;
+        slot->samples_ms[slot->head] = latency_ms;
+        slot->head = (slot->head + 1) % COMMAND_TRACKER_LATENCY_SAMPLES;
+        if (slot->filled < COMMAND_TRACKER_LATENCY_SAMPLES)
+            slot->filled++;
+        break;
+    case RESULT_TIMEOUT:
+        stats.timeouts++;
+        slot->timeouts++;
+        done_result = ESP_ERR_TIMEOUT;
+        failure = COMMAND_FAILURE_TIMEOUT;
+        break;
+    case RESULT_UNCONFIRMED:
+        stats.unconfirmed++;
+        done_result = ESP_ERR_TIMEOUT;
+        break;
+    case RESULT_FAILED:
+    case RESULT_REJECTED:
+    case RESULT_NOT_SENT:
+        stats.failed++;
+        slot->failed++;
+        done_result = result == RESULT_NOT_SENT ? (esp_err_t)code : ESP_FAIL;
+        failure = result == RESULT_NOT_SENT   ? command_policy_classify_send_error((esp_err_t)code)
+                  : result == RESULT_REJECTED ? command_policy_classify_status((uint8_t)code)
+                                              : command_policy_classify_chip_error((uint32_t)code);
+        break;
+    }
+    command_policy_record(cmd.retries, failure);
+
+    // ответ устройства, даже с ошибкой, - признак доступности; ошибка отправки и запись без отчета - нет
+    if (result == RESULT_SUCCESS || result == RESULT_REJECTED)
+        node_reachability_alive(cmd.node_id);
+    else if (result == RESULT_FAILED || result == RESULT_TIMEOUT)
+        node_reachability_failed(cmd.node_id, NODE_REACHABILITY_COMMAND);
+
+    if (result != RESULT_SUCCESS)
+    {
+        ESP_LOGW(TAG, "%s to node 0x%" PRIx64 " cluster 0x%" PRIx32 ": %s%s%s after %" PRIu32 " ms, %u attempts",
+                 cmd.action, cmd.node_id, cmd.cluster_id, status, error ? " " : "", error ? error : "", latency_ms,
+                 cmd.retries + 1);
+    }
+    if (cmd.id[0])
+        publish_result(&cmd, status, error, code, failure, latency_ms);
+    // последним: колбэк может начать следующую команду
+    if (cmd.done)
+        cmd.done(cmd.done_ctx, done_result);
+}
+
+static int find_token(uint32_t token)
+{
+    for (uint8_t i = 0; i < pending_count; i++)
+    {
+        if (pending[i].token == token)
+            return i;
+    }
+    return -1;
+}
+
+static void scan_timer_cb(chip::System::Layer *aLayer, void *appState);
+
+// Таймер на ближайший срок ответа. Перезапускается, когда добавлена команда с более ранним сроком
+static void arm_timer(int64_t now_us)
+{
+    if (pending_count == 0)
+        return;
+    int64_t next_us = pending[0].deadline_us;
+    for (uint8_t i = 1; i < pending_count; i++)
+    {
+        if (pending[i].deadline_us < next_us)
+            next_us = pending[i].deadline_us;
+    }
+    if (timer_running && next_us >= timer_deadline_us)
+        return;
+    if (timer_running)
+        chip::DeviceLayer::SystemLayer().CancelTimer(scan_timer_cb, nullptr);
+    uint32_t delay_ms = next_us > now_us ? (uint32_t)((next_us - now_us + 999) / 1000) : 0;
+    timer_running = chip::DeviceLayer::SystemLayer().StartTimer(
+                        chip::System::Clock::Milliseconds32(delay_ms), scan_timer_cb, nullptr) == CHIP_NO_ERROR;
+    timer_deadline_us = next_us;
+    if (!timer_running)
+    {
+        ESP_LOGW(TAG, "Failed to start timeout timer");
+    }
+}
+
+static void scan_timer_cb(chip::System::Layer *aLayer, void *appState)
+{
+    timer_running = false;
+    int64_t now_us = esp_timer_get_time();
+    for (uint8_t i = 0; i < pending_count;)
+    {
+        if (pending[i].deadline_us <= now_us)
+            // запись удалена, на ее месте следующая
+            complete_at(i, pending[i].kind == COMMAND_TRACK_WRITE ? RESULT_UNCONFIRMED : RESULT_TIMEOUT, nullptr, 0);
+        else
+            i++;
+    }
+    arm_timer(now_us);
+}
+
+uint32_t command_tracker_begin(const command_track_t *track)
+{
+    if (!track || track->kind == COMMAND_TRACK_NONE)
+        return 0;
+    if (pending_count == COMMAND_TRACKER_MAX_PENDING)
+    {
+        stats.untracked++;
+        ESP_LOGW(TAG, "Too many pending commands, %s to node 0x%" PRIx64 " is not tracked",
+                 track->action ? track->action : "command", track->node_id);
+        return 0;
+    }
+
+    pending_command_t *cmd = &pending[pending_count++];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->token = next_token++;
+    if (next_token == 0)
+        next_token = 1;
+    cmd->kind = track->kind;
+    cmd->node_id = track->node_id;
+    cmd->endpoint_id = track->endpoint_id;
+    cmd->cluster_id = track->cluster_id;
+    cmd->item_id = track->item_id;
+    cmd->started_us = esp_timer_get_time();
+    // без своего срока - таймаут узла или общий из command_policy
+    uint16_t timeout_ms = track->timeout_ms ? track->timeout_ms : command_policy_timeout_ms(track->node_id);
+    cmd->deadline_us = cmd->started_us + (int64_t)timeout_ms * 1000;
+    cmd->done = track->done;
+    cmd->done_ctx = track->done_ctx;
+    strlcpy(cmd->id, track->id ? track->id : "", sizeof(cmd->id));
+    strlcpy(cmd->action, track->action ? track->action : "command", sizeof(cmd->action));
+    stats.tracked++;
+    arm_timer(cmd->started_us);
+    return cmd->token;
+}
+
+void command_tracker_sent(uint32_t token, esp_err_t err)
+{
+    int index = token ? find_token(token) : -1;
+    if (index < 0)
+        return;
+    if (err != ESP_OK)
+    {
+        bool offline = err == ESP_ERR_INVALID_STATE && !node_reachability_online(pending[index].node_id);
+        complete_at(index, RESULT_NOT_SENT, offline ? "NODE_OFFLINE" : esp_err_to_name(err), err);
+        return;
+    }
+    // на команду группе ответа не будет
+    if (pending[index].kind == COMMAND_TRACK_INVOKE && chip::IsGroupId(pending[index].node_id))
+    {
+        complete_at(index, RESULT_SUCCESS, nullptr, 0);
+        return;
+    }
+    pending[index].sent = true;
+}
+
+// Самая новая отслеживаемая, еще не отправленная команда: ее только что начали перед command_tracker_send_invoke()
+static uint32_t unsent_invoke_token(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t command_id)
+{
+    for (int i = pending_count - 1; i >= 0; i--)
+    {
+        const pending_command_t &cmd = pending[i];
+        if (cmd.kind == COMMAND_TRACK_INVOKE && !cmd.sent && !cmd.bound && cmd.node_id == node_id &&
+            cmd.endpoint_id == endpoint_id && cmd.cluster_id == cluster_id && cmd.item_id == command_id)
+            return cmd.token;
+    }
+    return 0;
+}
+
+// Данные esp_matter ("{\"0:U8\": 1}") в TLV typed_command: плоские поля - typed_command_fields_from_json(),
+// вложенные структуры и списки - json_to_tlv() esp_matter
+static esp_err_t encode_invoke_data(const char *data, uint8_t *tlv, size_t size, size_t *len)
+{
+    *len = 0;
+    if (!data || !data[0])
+        return ESP_OK;
+    cJSON *json = cJSON_Parse(data);
+    bool ok = json && typed_command_fields_from_json(json, tlv, size, len) == ESP_OK;
+    cJSON_Delete(json);
+    if (ok)
+        return ESP_OK;
+
+    chip::TLV::TLVWriter writer;
+    writer.Init(tlv, size);
+    if (esp_matter::json_to_tlv(data, writer, chip::TLV::AnonymousTag()) != ESP_OK ||
+        writer.Finalize() != CHIP_NO_ERROR)
+        return ESP_ERR_INVALID_ARG;
+    *len = writer.GetLengthWritten();
+    return ESP_OK;
+}
+
+esp_err_t command_tracker_send_invoke(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t command_id,
+                                      const char *data, uint16_t timed_invoke_timeout_ms)
+{
+    // все команды идут через typed_command: ответ приходит в объект запроса и завершает только свой номер,
+    // поэтому неудача на одном узле не засчитывается другому (node_reachability)
+    uint8_t tlv[TYPED_COMMAND_MAX_INVOKE_TLV];
+    size_t len;
+    esp_err_t err = encode_invoke_data(data, tlv, sizeof(tlv), &len);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to encode data of command 0x%" PRIx32 ": %s", command_id, data);
+        return err;
+    }
+    uint32_t token = chip::IsGroupId(node_id) ? 0 : unsent_invoke_token(node_id, endpoint_id, cluster_id, command_id);
+    return typed_command_invoke_timed(node_id, endpoint_id, cluster_id, command_id, len ? tlv : nullptr, len,
+                                      timed_invoke_timeout_ms, token);
+}
+
+bool command_tracker_retry(uint32_t token)
+{
+    int index = token ? find_token(token) : -1;
+    if (index < 0)
+        return false;
+    if (pending[index].retries < UINT8_MAX)
+        pending[index].retries++;
+    return true;
+}
+
+int64_t command_tracker_deadline_us(uint32_t token)
+{
+    int index = token ? find_token(token) : -1;
+    return index < 0 ? 0 : pending[index].deadline_us;
+}
+
+void command_tracker_bind(uint32_t token)
+{
+    int index = token ? find_token(token) : -1;
+    if (index >= 0)
+        pending[index].bound = true;
+}
+
+void command_tracker_complete(uint32_t token, bool success, const char *error, int64_t code)
+{
+    int index = token ? find_token(token) : -1;
+    if (index < 0)
+        return;
+    if (success)
+        complete_at(index, RESULT_SUCCESS, nullptr, 0);
+    else if (error && strcmp(error, COMMAND_TRACKER_IM_STATUS) == 0)
+        complete_at(index, RESULT_REJECTED, error, code);
+    else
+        complete_at(index, RESULT_FAILED, error, code);
+}
+
+void command_tracker_on_attribute(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    for (uint8_t i = 0; i < pending_count;)
+    {
+        const pending_command_t &cmd = pending[i];
+        if ((cmd.kind == COMMAND_TRACK_READ || cmd.kind == COMMAND_TRACK_WRITE) && cmd.sent && cmd.node_id == node_id &&
+            cmd.endpoint_id == endpoint_id && cmd.cluster_id == cluster_id && cmd.item_id == attribute_id)
+            complete_at(i, RESULT_SUCCESS, nullptr, 0);
+        else
+            i++;
+    }
+}
+
+static uint32_t percentile(const uint32_t *sorted, uint8_t count, uint8_t p)
+{
+    // nearest-rank
+    uint32_t rank = ((uint32_t)p * count + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+esp_err_t command_tracker_publish_latency(const char *topic, uint64_t node_id)
+{
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+        return ESP_ERR_NO_MEM;
+
+    json_stream_t js;
+    json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "latency");
+    json_stream_uint(&js, "tracked", stats.tracked);
+    json_stream_uint(&js, "succeeded", stats.succeeded);
+    json_stream_uint(&js, "failed", stats.failed);
+    json_stream_uint(&js, "timeouts", stats.timeouts);
+    json_stream_uint(&js, "unconfirmed", stats.unconfirmed);
+    json_stream_uint(&js, "untracked", stats.untracked);
+    json_stream_uint(&js, "pending", pending_count);
+    json_stream_array_begin(&js, "paths");
+    for (const latency_slot_t &slot : latency)
+    {
+        if (!slot.last_us || (node_id && slot.node_id != node_id))
+            continue;
+        json_stream_object_begin(&js, NULL);
+        json_stream_uint(&js, "node", slot.node_id);
+        json_stream_uint(&js, "cluster", slot.cluster_id);
+        json_stream_uint(&js, "count", slot.count);
+        json_stream_uint(&js, "failed", slot.failed);
+        json_stream_uint(&js, "timeouts", slot.timeouts);
+        if (slot.filled)
+        {
+            // сортировка вставками: выборок не больше COMMAND_TRACKER_LATENCY_SAMPLES
+            uint32_t sorted[COMMAND_TRACKER_LATENCY_SAMPLES];
+            for (uint8_t i = 0; i < slot.filled; i++)
+            {
+                uint32_t value = slot.samples_ms[i];
+                uint8_t j = i;
+                for (; j > 0 && sorted[j - 1] > value; j--)
+                    sorted[j] = sorted[j - 1];
+                sorted[j] = value;
+            }
+            json_stream_uint(&js, "p50_ms", percentile(sorted, slot.filled, 50));
+            json_stream_uint(&js, "p90_ms", percentile(sorted, slot.filled, 90));
+            json_stream_uint(&js, "p99_ms", percentile(sorted, slot.filled, 99));
+            json_stream_uint(&js, "max_ms", sorted[slot.filled - 1]);
+        }
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+
+    esp_err_t err = json_stream_finish(&js);
+    if (err == ESP_OK)
+        err = mqtt_publish_data_len(topic, msg, js.len);
+    else
+        ESP_LOGE(TAG, "Latency report does not fit");
+    json_stream_buf_release(msg);
+    return err;
+}
+
+void command_tracker_reset_latency(void)
+{
+    memset(latency, 0, sizeof(latency));
+    memset(&stats, 0, sizeof(stats));
+}
+
+const command_tracker_stats_t *command_tracker_get_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,144 @@
+#ifndef COMMAND_TRACKER_H
+#define COMMAND_TRACKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Команд, одновременно ожидающих ответа устройства
+#define COMMAND_TRACKER_MAX_PENDING 16
+// Длина id команды
+#define COMMAND_TRACKER_ID_MAX 40
+// Пар (узел, кластер) со статистикой задержки, при переполнении заменяется давно не использованная
+#define COMMAND_TRACKER_LATENCY_SLOTS 16
+// Последних задержек в каждой паре, по ним считаются процентили
+#define COMMAND_TRACKER_LATENCY_SAMPLES 32
+// error итога, когда устройство ответило статусом IM с ошибкой (узел доступен)
+#define COMMAND_TRACKER_IM_STATUS "IM_STATUS"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        COMMAND_TRACK_NONE = 0,
+        COMMAND_TRACK_INVOKE, // завершается ответом на команду или ошибкой
+        COMMAND_TRACK_WRITE,  // завершается отчетом о записанном атрибуте
+        COMMAND_TRACK_READ,   // завершается данными атрибута
+    } command_track_kind_t;
+
+    /**
+     * @brief Итог команды для вызывающего, на потоке CHIP. Из колбэка можно отправлять следующую команду
+     *
+     * @param ctx done_ctx команды
+     * @param result ESP_OK, ESP_ERR_TIMEOUT (нет ответа или отчета о записи), ESP_FAIL (ответ с ошибкой)
+     *               или ошибка отправки
+     */
+    typedef void (*command_tracker_done_t)(void *ctx, esp_err_t result);
+
+    typedef struct
+    {
+        command_track_kind_t kind;
+        uint64_t node_id;
+        uint16_t endpoint_id;
+        uint32_t cluster_id;
+        uint32_t item_id;   // команда или атрибут
+        const char *id;     // id из входящего сообщения, NULL или "" - итог не публикуется, учитывается только задержка
+        const char *action; // action в итоговом сообщении
+        uint16_t timeout_ms; // 0 - таймаут узла из command_policy (sys_settings.command.timeout_ms)
+        command_tracker_done_t done; // может быть NULL
+        void *done_ctx;
+    } command_track_t;
+
+    typedef struct
+    {
+        uint32_t tracked;     // команд принято к отслеживанию
+        uint32_t succeeded;
+        uint32_t failed;      // ошибка отправки или ответ с ошибкой
+        uint32_t timeouts;    // ответа нет за таймаут команды
+        uint32_t unconfirmed; // запись без отчета об атрибуте за таймаут команды
+        uint32_t untracked;   // не отслежены: все записи заняты
+    } command_tracker_stats_t;
+
+    /**
+     * @brief Начало отслеживания команды, вызывается перед отправкой. Итог команды с id публикуется в топик событий:
+     *        {"action":..,"id":..,"node":..,"endpoint":..,"cluster":..,"status":"success"|"failed"|"timeout"|"unconfirmed",
+     *        "error":..,"code":..,"class":..,"attempts":..,"latency_ms":..}, class - command_policy_failure_name(). Должна вызываться на потоке CHIP (или под LockChipStack)
+     *
+     * @param track Команда (строки копируются)
+     * @return uint32_t Номер для command_tracker_sent() или 0, если команда не отслеживается (done не будет вызван)
+     */
+    uint32_t command_tracker_begin(const command_track_t *track);
+
+    /**
+     * @brief Результат отправки команды. При ошибке итог публикуется (и done вызывается) сразу, команды группам
+     *        (ответа нет) завершаются со статусом "success" в момент отправки. ESP_ERR_INVALID_STATE для недоступного
+     *        узла (node_reachability) публикуется как "error":"NODE_OFFLINE"
+     *
+     * @param token Номер из command_tracker_begin() (0 - ничего не делает)
+     * @param err Результат отправки
+     */
+    void command_tracker_sent(uint32_t token, esp_err_t err);
+
+    /**
+     * @brief Отправка команды кластера с итогом для command_tracker. Замена
+     *        esp_matter::controller::send_invoke_cluster_command(), вызывается на потоке CHIP.
+     *        Данные esp_matter кодируются в TLV, команда уходит через typed_command_invoke_timed(): итог команды,
+     *        начатой command_tracker_begin(), приходит по ее номеру, повторы - по command_policy
+     *
+     * @param timed_invoke_timeout_ms 0 - обычная (не timed) команда
+     * @return esp_err_t ESP_ERR_INVALID_STATE - узел недоступен, команда не отправлена (node_reachability_admit()),
+     *         ESP_ERR_INVALID_ARG - данные не разобраны или длиннее TYPED_COMMAND_MAX_INVOKE_TLV
+     */
+    esp_err_t command_tracker_send_invoke(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t command_id,
+                                          const char *data, uint16_t timed_invoke_timeout_ms);
+
+    /**
+     * @brief Повторная отправка команды (command_policy): счетчик попыток в итоге
+     *
+     * @return bool false - команда уже завершена (например по таймауту), повторять не нужно
+     */
+    bool command_tracker_retry(uint32_t token);
+
+    // Срок итога команды (esp_timer_get_time()), 0 - команда не отслеживается или завершена
+    int64_t command_tracker_deadline_us(uint32_t token);
+
+    /**
+     * @brief Ответ на команду придет через command_tracker_complete() по номеру (отправитель знает свою команду,
+     *        typed_command), ответы esp_matter по пути endpoint/кластер к ней не относятся
+     */
+    void command_tracker_bind(uint32_t token);
+
+    /**
+     * @brief Итог команды по номеру: ответ устройства или ошибка после отправки
+     *
+     * @param error Описание ошибки (при success == false), COMMAND_TRACKER_IM_STATUS - ответ устройства с ошибкой
+     * @param code Статус IM или код CHIP_ERROR
+     */
+    void command_tracker_complete(uint32_t token, bool success, const char *error, int64_t code);
+
+    // Данные атрибута от узла (чтение или подписка): завершает ожидающие чтение и запись этого атрибута
+    void command_tracker_on_attribute(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id);
+
+    /**
+     * @brief Публикация задержек по парам (узел, кластер): {"action":"latency",...,"paths":[{"node":..,"cluster":..,
+     *        "count":..,"failed":..,"timeouts":..,"p50_ms":..,"p90_ms":..,"p99_ms":..,"max_ms":..}]}.
+     *        Процентили по последним COMMAND_TRACKER_LATENCY_SAMPLES успешным командам пары.
+     *        Должна вызываться на потоке CHIP (или под LockChipStack)
+     *
+     * @param topic Топик
+     * @param node_id Только этот узел, 0 - все
+     */
+    esp_err_t command_tracker_publish_latency(const char *topic, uint64_t node_id);
+
+    void command_tracker_reset_latency(void);
+
+    const command_tracker_stats_t *command_tracker_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMMAND_TRACKER_H
@@ -0,0 +1,484 @@
+#include "group_control.h"
+#include "command_tracker.h"
+#include "matter_command.h"
+#include "devices.h"
+#include "mqtt.h"
+#include "mqtt_topics.h"
+#include "json_stream.h"
+#include "chip_work.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_matter_controller_cluster_command.h>
+#include <esp_matter_controller_write_command.h>
+#ifndef CONFIG_ESP_MATTER_ENABLE_MATTER_SERVER
+#include <esp_matter_controller_group_settings.h>
+#endif
+#include <lib/core/NodeId.h>
+#include <platform/CHIPDeviceLayer.h>
+
+static const char *TAG = "group_control";
+
+extern matter_controller_t g_controller;
+
+#define GROUP_KEY_MANAGEMENT_CLUSTER_ID 0x003F
+#define GROUP_KEY_MAP_ATTRIBUTE_ID 0x0000
+#define KEY_SET_WRITE_COMMAND_ID 0x00
+#define GROUPS_CLUSTER_ID 0x0004
+#define ADD_GROUP_COMMAND_ID 0x00
+#define REMOVE_GROUP_COMMAND_ID 0x03
+
+// Шаги изменения участника группы, по порядку
+typedef enum
+{
+    MEMBER_STEP_KEYSET,    // KeySetWrite на endpoint 0
+    MEMBER_STEP_KEYMAP,    // запись GroupKeyMap на endpoint 0, подтверждается чтением
+    MEMBER_STEP_ADD_GROUP, // Groups AddGroup на endpoint
+    MEMBER_STEP_REMOVE_GROUP,
+} member_step_t;
+
+static const char *step_names[] = {"keyset", "keymap", "add-group", "remove-group"};
+
+typedef struct
+{
+    uint16_t group_id;
+    uint64_t node_id;
+    uint16_t endpoint_id;
+    bool remove;
+    uint8_t step;
+    int64_t started_us;
+    char id[COMMAND_TRACKER_ID_MAX];
+} member_change_t;
+
+static chip_work_pool<member_change_t, GROUP_CONTROL_MAX_CHANGES> changes;
+
+static void hex_encode(const uint8_t *data, size_t len, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++)
+    {
+        out[i * 2] = digits[data[i] >> 4];
+        out[i * 2 + 1] = digits[data[i] & 0x0F];
+    }
+    out[len * 2] = '\0';
+}
+
+esp_err_t group_control_create(uint16_t group_id, const char *name, uint16_t keyset_id, const uint8_t *epoch_key)
+{
+#ifndef CONFIG_ESP_MATTER_ENABLE_MATTER_SERVER
+    if (group_registry_find(group_id))
+        return ESP_ERR_INVALID_STATE;
+    if (group_registry_count() == GROUP_REGISTRY_MAX_GROUPS)
+        return ESP_ERR_NO_MEM;
+
+    char group_name[GROUP_REGISTRY_NAME_MAX];
+    char key_hex[GROUP_REGISTRY_EPOCH_KEY_LEN * 2 + 1];
+    strlcpy(group_name, name, sizeof(group_name));
+    hex_encode(epoch_key, GROUP_REGISTRY_EPOCH_KEY_LEN, key_hex);
+
+    esp_err_t err = esp_matter::controller::group_settings::add_group(group_name, group_id);
+    if (err == ESP_OK)
+        err = esp_matter::controller::group_settings::add_keyset(keyset_id, 0, GROUP_CONTROL_EPOCH_START_TIME, key_hex);
+    if (err == ESP_OK)
+        err = esp_matter::controller::group_settings::bind_keyset(group_id, keyset_id);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create group 0x%04X on controller: %s", group_id, esp_err_to_name(err));
+        esp_matter::controller::group_settings::remove_group(group_id);
+        return err;
+    }
+
+    group_registry_add(group_id, keyset_id, name, epoch_key);
+    ESP_LOGI(TAG, "Group 0x%04X '%s' created with keyset %u", group_id, name, keyset_id);
+    return group_registry_save();
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t group_control_delete(uint16_t group_id)
+{
+#ifndef CONFIG_ESP_MATTER_ENABLE_MATTER_SERVER
+    matter_group_t *group = group_registry_find(group_id);
+    if (!group)
+        return ESP_ERR_NOT_FOUND;
+
+    char data[24];
+    snprintf(data, sizeof(data), "{\"0:U16\":%u}", group_id);
+    for (uint8_t i = 0; i < group->member_count; i++)
+    {
+        esp_matter::controller::send_invoke_cluster_command(group->members[i].node_id, group->members[i].endpoint_id,
+                                                            GROUPS_CLUSTER_ID, REMOVE_GROUP_COMMAND_ID, data);
+    }
+
+    // набор ключей может быть общим с другой группой
+    uint16_t keyset_id = group->keyset_id;
+    bool keyset_shared = false;
+    for (uint8_t i = 0; i < group_registry_count(); i++)
+    {
+        const matter_group_t *other = group_registry_get(i);
+        keyset_shared |= other != group && other->keyset_id == keyset_id;
+    }
+    esp_matter::controller::group_settings::unbind_keyset(group_id, keyset_id);
+    if (!keyset_shared)
+        esp_matter::controller::group_settings::remove_keyset(keyset_id);
+    esp_matter::controller::group_settings::remove_group(group_id);
+
+    group_registry_remove(group_id);
+    ESP_LOGI(TAG, "Group 0x%04X deleted", group_id);
+    return group_registry_save();
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+static void publish_member_result(const member_change_t *change, esp_err_t err)
+{
+    char msg[320];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "group");
+    json_stream_string(&js, "op", change->remove ? "remove" : "add");
+    if (change->id[0])
+        json_stream_string(&js, "id", change->id);
+    json_stream_uint(&js, "group", change->group_id);
+    json_stream_uint(&js, "node", change->node_id);
+    json_stream_uint(&js, "endpoint", change->endpoint_id);
+    json_stream_string(&js, "status", err == ESP_OK ? "done" : "failed");
+    if (err != ESP_OK)
+    {
+        json_stream_string(&js, "step", step_names[change->step]);
+        json_stream_string(&js, "error", esp_err_to_name(err));
+    }
+    json_stream_uint(&js, "elapsed_ms", (uint64_t)((esp_timer_get_time() - change->started_us) / 1000));
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data_len(mqtt_topic(MQTT_TOPIC_EVENT), msg, js.len);
+}
+
+static void finish_member_change(member_change_t *change, esp_err_t err)
+{
+    matter_group_t *group = group_registry_find(change->group_id);
+    if (err == ESP_OK && !group)
+        err = ESP_ERR_NOT_FOUND; // группу удалили, пока шли шаги
+    if (err == ESP_OK)
+    {
+        err = change->remove ? group_registry_remove_member(group, change->node_id, change->endpoint_id)
+                             : group_registry_add_member(group, change->node_id, change->endpoint_id);
+        if (err == ESP_ERR_NOT_FOUND)
+            err = ESP_OK; // на устройстве группа удалена, в реестре ее и не было
+        if (err == ESP_OK)
+            err = group_registry_save();
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Group 0x%04X %s node 0x%" PRIx64 "/%u failed at %s: %s", change->group_id,
+                 change->remove ? "remove" : "add", change->node_id, change->endpoint_id, step_names[change->step],
+                 esp_err_to_name(err));
+    }
+    publish_member_result(change, err);
+    changes.release(change);
+}
+
+// GroupKeyMap узла целиком (список заменяется при записи): все группы реестра с этим узлом и новая группа
+static esp_err_t build_key_map(const member_change_t *change, char *buf, size_t size)
+{
+    size_t len = snprintf(buf, size, "{\"0:ARR-OBJ\":[");
+    bool first = true;
+    for (uint8_t i = 0; i < group_registry_count() && len < size; i++)
+    {
+        const matter_group_t *group = group_registry_get(i);
+        if (group->group_id != change->group_id && !group_registry_has_node(group, change->node_id))
+            continue;
+        len += snprintf(buf + len, size - len, "%s{\"1:U16\":%u,\"2:U16\":%u}", first ? "" : ",", group->group_id,
+                        group->keyset_id);
+        first = false;
+    }
+    if (len < size)
+        len += snprintf(buf + len, size - len, "]}");
+    return len < size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static esp_err_t write_key_map(const member_change_t *change)
+{
+    char data[GROUP_REGISTRY_MAX_GROUPS * 32 + 24];
+    esp_err_t err = build_key_map(change, data, sizeof(data));
+    if (err != ESP_OK)
+        return err;
+
+    chip::Platform::ScopedMemoryBufferWithSize<uint16_t> endpoint_ids;
+    chip::Platform::ScopedMemoryBufferWithSize<uint32_t> cluster_ids;
+    chip::Platform::ScopedMemoryBufferWithSize<uint32_t> attribute_ids;
+    endpoint_ids.Alloc(1);
+    cluster_ids.Alloc(1);
+    attribute_ids.Alloc(1);
+    if (!endpoint_ids.Get() || !cluster_ids.Get() || !attribute_ids.Get())
+        return ESP_ERR_NO_MEM;
+    endpoint_ids[0] = 0;
+    cluster_ids[0] = GROUP_KEY_MANAGEMENT_CLUSTER_ID;
+    attribute_ids[0] = GROUP_KEY_MAP_ATTRIBUTE_ID;
+
+    err = esp_matter::controller::send_write_attr_command(change->node_id, endpoint_ids, cluster_ids, attribute_ids, data,
+                                                          chip::MakeOptional(1000));
+    if (err != ESP_OK)
+        return err;
+    // ответа на запись у send_write_attr_command нет: запись подтверждается чтением, запрос уходит следом
+    // в той же сессии
+    return esp_matter::command::controller_request_attribute(change->node_id, 0, GROUP_KEY_MANAGEMENT_CLUSTER_ID,
+                                                             GROUP_KEY_MAP_ATTRIBUTE_ID,
+                                                             esp_matter::controller::READ_ATTRIBUTE);
+}
+
+static void member_step_done(void *ctx, esp_err_t result);
+
+// Отправка текущего шага. После command_tracker_sent() change может быть уже освобожден
+static void send_member_step(member_change_t *change)
+{
+    const matter_group_t *group = group_registry_find(change->group_id);
+    if (!group)
+    {
+        finish_member_change(change, ESP_ERR_NOT_FOUND);
+        return;
+    }
+
+    command_track_t track = {};
+    track.kind = change->step == MEMBER_STEP_KEYMAP ? COMMAND_TRACK_READ : COMMAND_TRACK_INVOKE;
+    track.node_id = change->node_id;
+    track.action = "group";
+    track.timeout_ms = GROUP_CONTROL_STEP_TIMEOUT_MS;
+    track.done = member_step_done;
+    track.done_ctx = change;
+
+    char data[192];
+    switch (change->step)
+    {
+    case MEMBER_STEP_KEYSET:
+    {
+        char key_hex[GROUP_REGISTRY_EPOCH_KEY_LEN * 2 + 1];
+        hex_encode(group->epoch_key, GROUP_REGISTRY_EPOCH_KEY_LEN, key_hex);
+        // GroupKeySetStruct: политика TrustFirst, одна эпоха
+        snprintf(data, sizeof(data),
+                 "{\"0:OBJ\":{\"0:U16\":%u,\"1:U8\":0,\"2:BYT\":\"%s\",\"3:U64\":%u,\"4:NULL\":null,\"5:NULL\":null,"
+                 "\"6:NULL\":null,\"7:NULL\":null}}",
+                 group->keyset_id, key_hex, GROUP_CONTROL_EPOCH_START_TIME);
+        track.endpoint_id = 0;
+        track.cluster_id = GROUP_KEY_MANAGEMENT_CLUSTER_ID;
+        track.item_id = KEY_SET_WRITE_COMMAND_ID;
+        break;
+    }
+    case MEMBER_STEP_KEYMAP:
+        track.endpoint_id = 0;
+        track.cluster_id = GROUP_KEY_MANAGEMENT_CLUSTER_ID;
+        track.item_id = GROUP_KEY_MAP_ATTRIBUTE_ID;
+        break;
+    case MEMBER_STEP_ADD_GROUP:
+        snprintf(data, sizeof(data), "{\"0:U16\":%u,\"1:STR\":\"%s\"}", group->group_id, group->name);
+        track.endpoint_id = change->endpoint_id;
+        track.cluster_id = GROUPS_CLUSTER_ID;
+        track.item_id = ADD_GROUP_COMMAND_ID;
+        break;
+    default:
+        snprintf(data, sizeof(data), "{\"0:U16\":%u}", group->group_id);
+        track.endpoint_id = change->endpoint_id;
+        track.cluster_id = GROUPS_CLUSTER_ID;
+        track.item_id = REMOVE_GROUP_COMMAND_ID;
+        break;
+    }
+
+    uint32_t token = command_tracker_begin(&track);
+    if (!token)
+    {
+        finish_member_change(change, ESP_ERR_NO_MEM);
+        return;
+    }
+    esp_err_t err = change->step == MEMBER_STEP_KEYMAP
+                        ? write_key_map(change)
+                        : command_tracker_send_invoke(change->node_id, track.endpoint_id, track.cluster_id,
+                                                      track.item_id, data, 0);
+    command_tracker_sent(token, err);
+}
+
+static void member_step_done(void *ctx, esp_err_t result)
+{
+    member_change_t *change = static_cast<member_change_t *>(ctx);
+    if (result != ESP_OK || change->remove || change->step == MEMBER_STEP_ADD_GROUP)
+    {
+        finish_member_change(change, result);
+        return;
+    }
+    change->step++;
+    send_member_step(change);
+}
+
+// arg - указатель на изменение из пула
+static void start_member_change(void *arg)
+{
+    member_change_t *change = *static_cast<member_change_t **>(arg);
+    change->started_us = esp_timer_get_time();
+    send_member_step(change);
+}
+
+static esp_err_t schedule_member_change(uint16_t group_id, uint64_t node_id, uint16_t endpoint_id, bool remove,
+                                        const char *id)
+{
+    if (chip::IsGroupId(node_id) || node_id == 0)
+        return ESP_ERR_INVALID_ARG;
+    member_change_t *change = changes.acquire();
+    if (!change)
+        return ESP_ERR_NO_MEM;
+    change->group_id = group_id;
+    change->node_id = node_id;
+    change->endpoint_id = endpoint_id;
+    change->remove = remove;
+    change->step = remove ? MEMBER_STEP_REMOVE_GROUP : MEMBER_STEP_KEYSET;
+    strlcpy(change->id, id ? id : "", sizeof(change->id));
+    esp_err_t err = chip_work_post(start_member_change, &change, sizeof(change));
+    if (err != ESP_OK)
+        changes.release(change);
+    return err;
+}
+
+esp_err_t group_control_add_member(uint16_t group_id, uint64_t node_id, uint16_t endpoint_id, const char *id)
+{
+    return schedule_member_change(group_id, node_id, endpoint_id, false, id);
+}
+
+esp_err_t group_control_remove_member(uint16_t group_id, uint64_t node_id, uint16_t endpoint_id, const char *id)
+{
+    return schedule_member_change(group_id, node_id, endpoint_id, true, id);
+}
+
+esp_err_t group_control_invoke(uint16_t group_id, uint32_t cluster_id, uint32_t command_id, const char *data,
+                               const char *id)
+{
+    if (!group_registry_find(group_id))
+        return ESP_ERR_NOT_FOUND;
+
+    // endpoint у групповой команды не используется
+    uint64_t node_id = chip::NodeIdFromGroupId(group_id);
+    command_track_t track = {COMMAND_TRACK_INVOKE, node_id, 0, cluster_id, command_id, id, "td-group"};
+    uint32_t token = command_tracker_begin(&track);
+    esp_err_t err = command_tracker_send_invoke(node_id, 0, cluster_id, command_id, data, 0);
+    command_tracker_sent(token, err);
+    return err;
+}
+
+esp_err_t group_control_invoke_fields(uint16_t group_id, uint32_t cluster_id, uint32_t command_id,
+                                      const typed_field_t *fields, uint8_t field_count, const char *id)
+{
+    if (!group_registry_find(group_id))
+        return ESP_ERR_NOT_FOUND;
+    uint8_t data[TYPED_COMMAND_MAX_TLV];
+    size_t len = 0;
+    if (field_count)
+    {
+        esp_err_t err = typed_command_encode_fields(fields, field_count, data, sizeof(data), &len);
+        if (err != ESP_OK)
+            return err;
+    }
+
+    uint64_t node_id = chip::NodeIdFromGroupId(group_id);
+    command_track_t track = {COMMAND_TRACK_INVOKE, node_id, 0, cluster_id, command_id, id, "td-group"};
+    uint32_t token = command_tracker_begin(&track);
+    esp_err_t err = typed_command_invoke(node_id, 0, cluster_id, command_id, data, len, token);
+    command_tracker_sent(token, err);
+    return err;
+}
+
+// Логическое значение атрибута из реестра (кластеры в реестре общие для всех endpoint'ов узла)
+static bool cached_bool(matter_device_t *node, uint32_t cluster_id, uint32_t attribute_id, bool *value)
+{
+    for (uint16_t c = 0; c < node->server_clusters_count; c++)
+    {
+        const matter_cluster_t *cluster = &node->server_clusters[c];
+        if (cluster->cluster_id != cluster_id)
+            continue;
+        for (uint16_t a = 0; a < cluster->attributes_count; a++)
+        {
+            const matter_attribute_t *attr = &cluster->attributes[a];
+            if (attr->attribute_id == attribute_id && attr->current_value.type == ESP_MATTER_VAL_TYPE_BOOLEAN)
+            {
+                *value = attr->current_value.val.b;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void group_control_apply(uint16_t group_id, uint32_t cluster_id, uint32_t attribute_id,
+                         const esp_matter_attr_val_t *value)
+{
+    const matter_group_t *group = group_registry_find(group_id);
+    if (!group)
+        return;
+    for (uint8_t i = 0; i < group->member_count; i++)
+    {
+        const group_member_t *member = &group->members[i];
+        matter_device_t *node = find_node(&g_controller, member->node_id);
+        if (!node)
+            continue;
+        esp_matter_attr_val_t val;
+        if (value)
+        {
+            val = *value;
+        }
+        else
+        {
+            bool current;
+            if (!cached_bool(node, cluster_id, attribute_id, &current))
+                continue; // прежнее значение неизвестно, ждем отчета
+            val = esp_matter_bool(!current);
+        }
+        handle_attribute_report(&g_controller, member->node_id, member->endpoint_id, cluster_id, attribute_id, &val);
+    }
+}
+
+esp_err_t group_control_publish_list(const char *topic)
+{
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+        return ESP_ERR_NO_MEM;
+
+    // по сообщению на группу (все группы с участниками в один буфер не помещаются), без групп - одно с count 0
+    esp_err_t err = ESP_OK;
+    uint8_t count = group_registry_count();
+    for (uint8_t g = 0; g == 0 || g < count; g++)
+    {
+        const matter_group_t *group = group_registry_get(g);
+        json_stream_t js;
+        json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "action", "group");
+        json_stream_string(&js, "op", "list");
+        json_stream_uint(&js, "count", count);
+        if (group)
+        {
+            json_stream_uint(&js, "index", g);
+            json_stream_uint(&js, "group", group->group_id);
+            json_stream_string(&js, "name", group->name);
+            json_stream_uint(&js, "keyset", group->keyset_id);
+            json_stream_array_begin(&js, "members");
+            for (uint8_t i = 0; i < group->member_count; i++)
+            {
+                json_stream_object_begin(&js, NULL);
+                json_stream_uint(&js, "node", group->members[i].node_id);
+                json_stream_uint(&js, "endpoint", group->members[i].endpoint_id);
+                json_stream_object_end(&js);
+            }
+            json_stream_array_end(&js);
+        }
+        json_stream_object_end(&js);
+        err = json_stream_finish(&js);
+        if (err == ESP_OK)
+            err = mqtt_publish_data_len(topic, msg, js.len);
+        if (err != ESP_OK || !group)
+            break;
+    }
+    json_stream_buf_release(msg);
+    return err;
+}
@@ -0,0 +1,90 @@
+#ifndef GROUP_CONTROL_H
+#define GROUP_CONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_matter.h"
+#include "group_registry.h"
+#include "typed_command.h"
+
+// Действие ключа группы (KeySetWrite), мкс от начала эпохи Matter
+#define GROUP_CONTROL_EPOCH_START_TIME 2220000
+// Ожидание ответа на шаг добавления узла в группу
+#define GROUP_CONTROL_STEP_TIMEOUT_MS 10000
+// Изменений участников групп, выполняющихся одновременно (заранее выделены)
+#define GROUP_CONTROL_MAX_CHANGES 8
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Создание группы на контроллере (группа, набор ключей, привязка) и в реестре групп.
+     *        Должна вызываться на потоке CHIP (или под LockChipStack)
+     *
+     * @param name Имя до 16 символов без кавычек и '\'
+     * @param epoch_key GROUP_REGISTRY_EPOCH_KEY_LEN байт
+     * @return esp_err_t ESP_ERR_INVALID_STATE - группа уже есть, ESP_ERR_NO_MEM - групп GROUP_REGISTRY_MAX_GROUPS
+     */
+    esp_err_t group_control_create(uint16_t group_id, const char *name, uint16_t keyset_id, const uint8_t *epoch_key);
+
+    /**
+     * @brief Удаление группы с контроллера и из реестра. Участникам отправляется Groups RemoveGroup
+     *        (без ожидания ответа). Должна вызываться на потоке CHIP (или под LockChipStack)
+     */
+    esp_err_t group_control_delete(uint16_t group_id);
+
+    /**
+     * @brief Добавление endpoint'а в группу: KeySetWrite и запись GroupKeyMap на endpoint 0 узла, затем
+     *        Groups AddGroup на endpoint. Каждый шаг после ответа на предыдущий, в реестр endpoint попадает после
+     *        успешного AddGroup. Итог публикуется в топик событий: {"action":"group","op":"add","id":..,"group":..,
+     *        "node":..,"endpoint":..,"status":"done"|"failed","step":..,"error":..,"elapsed_ms":..}.
+     *        Можно вызывать из любой задачи (не блокирует)
+     *
+     * @param id id из входящего сообщения или NULL
+     * @return esp_err_t ESP_ERR_NO_MEM - выполняются GROUP_CONTROL_MAX_CHANGES изменений или очередь chip_work
+     *         заполнена
+     */
+    esp_err_t group_control_add_member(uint16_t group_id, uint64_t node_id, uint16_t endpoint_id, const char *id);
+
+    /**
+     * @brief Удаление endpoint'а из группы: Groups RemoveGroup на endpoint, после ответа - из реестра.
+     *        Итог - как у group_control_add_member() с "op":"remove". Можно вызывать из любой задачи
+     */
+    esp_err_t group_control_remove_member(uint16_t group_id, uint64_t node_id, uint16_t endpoint_id, const char *id);
+
+    /**
+     * @brief Одна групповая команда всем endpoint'ам группы (ответа у групповых команд нет, итог с id -
+     *        "success" в момент отправки). Должна вызываться на потоке CHIP (или под LockChipStack)
+     *
+     * @param data Данные команды в формате esp_matter или NULL
+     * @param id id из входящего сообщения или NULL
+     */
+    esp_err_t group_control_invoke(uint16_t group_id, uint32_t cluster_id, uint32_t command_id, const char *data,
+                                   const char *id);
+
+    // То же с полями команды, кодированными в TLV без JSON (typed_command)
+    esp_err_t group_control_invoke_fields(uint16_t group_id, uint32_t cluster_id, uint32_t command_id,
+                                          const typed_field_t *fields, uint8_t field_count, const char *id);
+
+    /**
+     * @brief Оптимистичное обновление значения атрибута у всех участников группы в реестре устройств
+     *        (с публикацией fd), не дожидаясь отчетов. Узлы, которых нет в реестре, пропускаются.
+     *        Должна вызываться на потоке CHIP (или под LockChipStack)
+     *
+     * @param value Новое значение, NULL - инверсия известного логического значения (Toggle)
+     */
+    void group_control_apply(uint16_t group_id, uint32_t cluster_id, uint32_t attribute_id,
+                             const esp_matter_attr_val_t *value);
+
+    // Публикация групп и участников: {"action":"group","op":"list","groups":[{"group":..,"name":..,"keyset":..,
+    // "members":[{"node":..,"endpoint":..}]}]}. Должна вызываться на потоке CHIP (или под LockChipStack)
+    esp_err_t group_control_publish_list(const char *topic);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GROUP_CONTROL_H
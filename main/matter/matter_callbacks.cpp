@@ -1,6 +1,8 @@
 #include "matter_callbacks.h"
 #include "esp_log.h"
 #include "mqtt.h"
+#include "json_stream.h"
+#include "mqtt_topics.h"
 #include "settings.h"
 #include "cJSON.h"
 #include <app-common/zap-generated/ids/Clusters.h>
@@ -9,6 +11,11 @@
 #include "devices.h"
 #include "matter_command.h"
 #include "EntryToText.h"
+#include "interview_cache.h"
+#include "command_tracker.h"
+#include "chip_work.h"
+#include "node_reachability.h"
+#include "matter_controller_device_mgr.h"
 
 #include <queue>
 #include <mutex>
@@ -21,6 +28,8 @@
 #include <cstdio>
 #include <inttypes.h>
 #include <platform/PlatformManager.h>
+#include <platform/CHIPDeviceLayer.h>
+#include <esp_timer.h>
 
 static const char *TAG = "AttributeCallback";
 
@@ -34,6 +43,13 @@ static void handleClusterList(uint64_t node_id, const chip::app::ConcreteDataAtt
 static esp_err_t readAttributesForCluster(uint64_t node_id, uint16_t endpoint_id,
                                           uint32_t cluster_id, matter_controller_t *controller);
 static esp_err_t readBasicInformation(uint64_t node_id);
+static bool isValueCluster(uint16_t endpoint_id, uint32_t cluster_id);
+static void interview_read_scheduled(uint64_t node_id);
+static void interview_read_finished(uint64_t node_id);
+static void OnInterviewReadDone(uint64_t node_id,
+                                const chip::Platform::ScopedMemoryBufferWithSize<chip::app::AttributePathParams> &attr_paths,
+                                const chip::Platform::ScopedMemoryBufferWithSize<chip::app::EventPathParams> &event_paths);
+static bool interview_handle_parts_list(uint64_t node_id, const std::vector<uint16_t> &endpoints);
 
 // Constants
 static constexpr uint32_t DESCRIPTOR_CLUSTER_ID = 0x001D;
@@ -41,26 +57,395 @@ static constexpr uint32_t BASIC_CLUSTER_ID = 0x0028;
 
 static std::unordered_map<uint64_t, std::unordered_set<uint16_t>> processed_endpoints;
 
+// Чтение атрибута или события в записи очереди chip_work
+typedef struct
+{
+    uint64_t node_id;
+    uint16_t endpoint_id;
+    uint32_t cluster_id;
+    uint32_t attribute_or_event_id;
+    esp_matter::controller::read_command_type_t command_type;
+} attribute_request_t;
+
+static void run_attribute_request(void *arg)
+{
+    const attribute_request_t *request = static_cast<const attribute_request_t *>(arg);
+    esp_err_t err = esp_matter::command::controller_request_attribute(request->node_id, request->endpoint_id,
+                                                                       request->cluster_id,
+                                                                       request->attribute_or_event_id,
+                                                                       request->command_type, OnInterviewReadDone);
+    if (err != ESP_OK)
+    {
+        // OnReadDone для этого запроса уже не придет
+        interview_read_finished(request->node_id);
+    }
+}
+
 // schedule_controller_request_attribute(node_id, endpoint_id, cluster_id, attribute_id, command_type);
 void schedule_controller_request_attribute(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_or_event_id, esp_matter::controller::read_command_type_t command_type)
 {
-    // Копируем параметры в heap, чтобы они были доступны внутри лямбды
-    auto *params = new std::tuple<uint64_t, uint16_t, uint32_t, uint32_t, esp_matter::controller::read_command_type_t>(
-        node_id, endpoint_id, cluster_id, attribute_or_event_id, command_type);
+    attribute_request_t request = {node_id, endpoint_id, cluster_id, attribute_or_event_id, command_type};
+
+    // Учитываем чтение сразу, иначе OnReadDone текущего запроса может завершить опрос раньше времени
+    interview_read_scheduled(node_id);
+
+    // Параметры копируются в запись очереди, выделения памяти нет
+    if (chip_work_post(run_attribute_request, &request, sizeof(request)) == ESP_OK)
+        return;
+
+    // Очередь заполнена (опрос узла с большим числом кластеров): чтение не теряется, копия в heap
+    auto *params = new attribute_request_t(request);
+    if (chip::DeviceLayer::PlatformMgr().ScheduleWork(
+            [](intptr_t arg)
+            {
+                auto *params = reinterpret_cast<attribute_request_t *>(arg);
+                run_attribute_request(params);
+                delete params;
+            },
+            reinterpret_cast<intptr_t>(params)) != CHIP_NO_ERROR)
+    {
+        delete params;
+        interview_read_finished(node_id);
+    }
+}
+
+// ---------------- опрос нового узла с использованием шаблонов ----------------
+// Порядок: Basic Information -> поиск шаблона по (VendorID, ProductID, SoftwareVersionString) ->
+// PartsList. Если PartsList совпал с шаблоном, топология берется из шаблона и читаются только значения,
+// иначе выполняется полный опрос дескрипторов, по результатам которого сохраняется новый шаблон.
+
+static constexpr uint32_t INTERVIEW_TIMEOUT_SEC = 120;
+static constexpr uint32_t INTERVIEW_SWEEP_SEC = 5;
+static constexpr size_t INTERVIEW_MAX_PATHS_PER_READ = 9; // минимум, который обязан поддерживать узел Matter
+
+enum class interview_stage_t
+{
+    PROBE,   // чтение Basic Information
+    CONFIRM, // проверочное чтение PartsList для найденного шаблона
+    FULL,    // полный опрос дескрипторов
+    VALUES,  // топология из шаблона, читаются только значения
+};
+
+struct interview_state_t
+{
+    interview_stage_t stage;
+    int64_t started_us;
+    uint16_t pending_reads;
+    bool has_template;
+    bool mismatch;
+    interview_template_t tmpl;
+};
+
+static std::unordered_map<uint64_t, interview_state_t> interviews;
+static bool interview_sweep_running = false;
+
+static esp_err_t send_interview_read(uint64_t node_id, chip::Platform::ScopedMemoryBufferWithSize<chip::app::AttributePathParams> &&attr_paths)
+{
+    esp_matter::controller::read_command *cmd = chip::Platform::New<esp_matter::controller::read_command>(
+        node_id, std::move(attr_paths), chip::Platform::ScopedMemoryBufferWithSize<chip::app::EventPathParams>(),
+        OnAttributeData, OnInterviewReadDone, nullptr);
+    if (!cmd)
+    {
+        ESP_LOGE(TAG, "Failed to alloc memory for read_command");
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = cmd->send_command();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to send interview read to node %" PRIu64 ": %s", node_id, esp_err_to_name(err));
+        return err;
+    }
+    interview_read_scheduled(node_id);
+    return ESP_OK;
+}
+
+static esp_err_t readBasicInformationProbe(uint64_t node_id)
+{
+    static const uint32_t attributes[] = {0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x000a};
+    chip::Platform::ScopedMemoryBufferWithSize<chip::app::AttributePathParams> attr_paths;
+    attr_paths.Calloc(sizeof(attributes) / sizeof(attributes[0]));
+    if (!attr_paths.Get())
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < attr_paths.AllocatedSize(); i++)
+    {
+        attr_paths[i] = chip::app::AttributePathParams(0x0000, BASIC_CLUSTER_ID, attributes[i]);
+    }
+    return send_interview_read(node_id, std::move(attr_paths));
+}
+
+static esp_err_t readPartsList(uint64_t node_id)
+{
+    chip::Platform::ScopedMemoryBufferWithSize<chip::app::AttributePathParams> attr_paths;
+    attr_paths.Calloc(1);
+    if (!attr_paths.Get())
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    attr_paths[0] = chip::app::AttributePathParams(0x0000, DESCRIPTOR_CLUSTER_ID, 0x0003);
+    return send_interview_read(node_id, std::move(attr_paths));
+}
+
+// Чтение значений всех кластеров узла пачками путей вместо отдельного запроса на кластер
+static void readValuesForNode(const matter_device_t *node)
+{
+    std::vector<chip::app::AttributePathParams> paths;
+    for (uint16_t e = 0; e < node->endpoints_count; e++)
+    {
+        const endpoint_entry_t *ep = &node->endpoints[e];
+        for (uint8_t c = 0; c < ep->cluster_count; c++)
+        {
+            if (isValueCluster(ep->endpoint_id, ep->clusters[c]))
+            {
+                paths.emplace_back(ep->endpoint_id, ep->clusters[c]);
+            }
+        }
+    }
+
+    for (size_t offset = 0; offset < paths.size(); offset += INTERVIEW_MAX_PATHS_PER_READ)
+    {
+        size_t count = std::min(INTERVIEW_MAX_PATHS_PER_READ, paths.size() - offset);
+        chip::Platform::ScopedMemoryBufferWithSize<chip::app::AttributePathParams> attr_paths;
+        attr_paths.Calloc(count);
+        if (!attr_paths.Get())
+        {
+            ESP_LOGE(TAG, "Failed to alloc attribute paths for node %" PRIu64, node->node_id);
+            return;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            attr_paths[i] = paths[offset + i];
+        }
+        send_interview_read(node->node_id, std::move(attr_paths));
+    }
+    ESP_LOGI(TAG, "Reading values of %u clusters on node %" PRIu64, (unsigned)paths.size(), node->node_id);
+}
+
+static void interview_finish(uint64_t node_id, interview_state_t &state, bool timed_out)
+{
+    uint32_t duration_ms = static_cast<uint32_t>((esp_timer_get_time() - state.started_us) / 1000);
+    uint32_t saved_ms = 0;
+    const char *result = "miss";
+
+    matter_device_t *node = find_node(&g_controller, node_id);
+    if (timed_out)
+    {
+        result = "timeout";
+    }
+    else if (state.stage == interview_stage_t::VALUES)
+    {
+        result = "hit";
+        saved_ms = state.tmpl.interview_ms > duration_ms ? state.tmpl.interview_ms - duration_ms : 0;
+        interview_cache_record(true, false, saved_ms);
+    }
+    else
+    {
+        result = state.mismatch ? "mismatch" : "miss";
+        interview_cache_record(false, state.mismatch, 0);
+        if (state.stage == interview_stage_t::FULL && node)
+        {
+            interview_template_save(node, duration_ms);
+        }
+    }
+
+    if (node)
+    {
+        esp_err_t save_err = save_devices_to_nvs(&g_controller);
+        if (save_err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to save devices: 0x%x", save_err);
+        }
+        // топология из шаблона опроса заменяется целиком, без уведомлений по отдельным атрибутам
+        esp_matter::controller::device_mgr::notify_change(esp_matter::controller::device_mgr::REGISTRY_CHANGE_TOPOLOGY);
+    }
+
+    const interview_cache_stats_t *stats = interview_cache_get_stats();
+    ESP_LOGI(TAG, "Interview of node %" PRIu64 " finished in %" PRIu32 " ms, template %s, saved %" PRIu32 " ms "
+                  "(hits %" PRIu32 ", misses %" PRIu32 ", total saved %llu ms)",
+             node_id, duration_ms, result, saved_ms, stats->hits, stats->misses, stats->saved_ms);
+
+    char device[17];
+    char json_str[192];
+    snprintf(device, sizeof(device), "%" PRIX64, node_id);
+    json_stream_t js;
+    json_stream_init(&js, json_str, sizeof(json_str), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "device", device);
+    json_stream_string(&js, "status", "interviewed");
+    json_stream_string(&js, "template", result);
+    json_stream_uint(&js, "duration_ms", duration_ms);
+    json_stream_uint(&js, "saved_ms", saved_ms);
+    json_stream_uint(&js, "hits", stats->hits);
+    json_stream_uint(&js, "total_saved_ms", stats->saved_ms);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data(mqtt_topic(MQTT_TOPIC_EVENT), json_str);
+
+    if (node)
+    {
+        log_controller_structure(&g_controller);
+    }
+
+    interview_template_free(&state.tmpl);
+    interviews.erase(node_id);
+}
 
-    chip::DeviceLayer::PlatformMgr().ScheduleWork(
-        [](intptr_t arg)
+static void interview_advance(uint64_t node_id, interview_state_t &state)
+{
+    switch (state.stage)
+    {
+    case interview_stage_t::PROBE:
+    {
+        matter_device_t *node = find_node(&g_controller, node_id);
+        if (node && node->vendor_id != 0 &&
+            interview_template_load(node->vendor_id, node->product_id, node->firmware_version, &state.tmpl) == ESP_OK)
         {
-            auto *params = reinterpret_cast<std::tuple<uint64_t, uint16_t, uint32_t, uint32_t, esp_matter::controller::read_command_type_t> *>(arg);
-            esp_matter::command::controller_request_attribute(
-                std::get<0>(*params),
-                std::get<1>(*params),
-                std::get<2>(*params),
-                std::get<3>(*params),
-                std::get<4>(*params));
-            delete params;
-        },
-        reinterpret_cast<intptr_t>(params));
+            state.has_template = true;
+            state.stage = interview_stage_t::CONFIRM;
+            ESP_LOGI(TAG, "Template found for node %" PRIu64 ", confirming PartsList", node_id);
+        }
+        else
+        {
+            state.stage = interview_stage_t::FULL;
+            ESP_LOGI(TAG, "No template for node %" PRIu64 ", running full interview", node_id);
+        }
+        if (readPartsList(node_id) != ESP_OK)
+        {
+            interview_finish(node_id, state, true);
+        }
+        break;
+    }
+    case interview_stage_t::CONFIRM:
+        // PartsList так и не пришел
+        ESP_LOGW(TAG, "No PartsList from node %" PRIu64 " during template confirmation", node_id);
+        interview_finish(node_id, state, true);
+        break;
+    case interview_stage_t::FULL:
+    case interview_stage_t::VALUES:
+        interview_finish(node_id, state, false);
+        break;
+    }
+}
+
+static void interview_read_scheduled(uint64_t node_id)
+{
+    auto it = interviews.find(node_id);
+    if (it != interviews.end())
+    {
+        it->second.pending_reads++;
+    }
+}
+
+static void interview_read_finished(uint64_t node_id)
+{
+    auto it = interviews.find(node_id);
+    if (it == interviews.end())
+    {
+        return;
+    }
+    if (it->second.pending_reads > 0)
+    {
+        it->second.pending_reads--;
+    }
+    if (it->second.pending_reads == 0)
+    {
+        interview_advance(node_id, it->second);
+    }
+}
+
+// Возвращает true, если PartsList обработан по шаблону и полный опрос не нужен
+static bool interview_handle_parts_list(uint64_t node_id, const std::vector<uint16_t> &endpoints)
+{
+    auto it = interviews.find(node_id);
+    if (it == interviews.end() || it->second.stage != interview_stage_t::CONFIRM)
+    {
+        return false;
+    }
+    interview_state_t &state = it->second;
+
+    matter_device_t *node = find_node(&g_controller, node_id);
+    if (node && interview_template_matches(&state.tmpl, endpoints.data(), endpoints.size()) &&
+        interview_template_apply(&state.tmpl, node) == ESP_OK)
+    {
+        state.stage = interview_stage_t::VALUES;
+        for (uint16_t e = 0; e < node->endpoints_count; e++)
+        {
+            processed_endpoints[node_id].insert(node->endpoints[e].endpoint_id);
+        }
+        ESP_LOGI(TAG, "Node %" PRIu64 " matches template, topology reused (%u endpoints)", node_id, node->endpoints_count);
+        readValuesForNode(node);
+        return true;
+    }
+
+    ESP_LOGW(TAG, "Node %" PRIu64 " does not match its template, running full interview", node_id);
+    state.stage = interview_stage_t::FULL;
+    state.mismatch = true;
+    return false;
+}
+
+static void interview_sweep_cb(chip::System::Layer *aLayer, void *appState)
+{
+    int64_t now = esp_timer_get_time();
+    std::vector<uint64_t> expired;
+    for (auto &item : interviews)
+    {
+        if (now - item.second.started_us > static_cast<int64_t>(INTERVIEW_TIMEOUT_SEC) * 1000000)
+        {
+            expired.push_back(item.first);
+        }
+    }
+    for (uint64_t node_id : expired)
+    {
+        ESP_LOGW(TAG, "Interview of node %" PRIu64 " timed out", node_id);
+        interview_finish(node_id, interviews[node_id], true);
+    }
+
+    interview_sweep_running = !interviews.empty();
+    if (interview_sweep_running)
+    {
+        chip::DeviceLayer::SystemLayer().StartTimer(chip::System::Clock::Seconds32(INTERVIEW_SWEEP_SEC), interview_sweep_cb, nullptr);
+    }
+}
+
+// Вызывается в потоке CHIP (колбэк успешного commissioning)
+void start_node_interview(uint64_t node_id)
+{
+    auto it = interviews.find(node_id);
+    if (it != interviews.end())
+    {
+        interview_template_free(&it->second.tmpl);
+        interviews.erase(it);
+    }
+    processed_endpoints.erase(node_id);
+
+    if (!find_node(&g_controller, node_id) && !add_node(&g_controller, node_id, "Unknown Model", "Unknown Vendor"))
+    {
+        ESP_LOGE(TAG, "Failed to create node %" PRIu64, node_id);
+        return;
+    }
+
+    interview_state_t &state = interviews[node_id];
+    state = {};
+    state.stage = interview_stage_t::PROBE;
+    state.started_us = esp_timer_get_time();
+
+    if (readBasicInformationProbe(node_id) != ESP_OK)
+    {
+        // без Basic Information шаблон не найти, сразу полный опрос
+        state.stage = interview_stage_t::FULL;
+        if (readPartsList(node_id) != ESP_OK)
+        {
+            interviews.erase(node_id);
+            return;
+        }
+    }
+
+    if (!interview_sweep_running)
+    {
+        interview_sweep_running = chip::DeviceLayer::SystemLayer().StartTimer(
+                                      chip::System::Clock::Seconds32(INTERVIEW_SWEEP_SEC), interview_sweep_cb, nullptr) == CHIP_NO_ERROR;
+    }
 }
 
 // ---------------- очередь запросов на чтение атрибутов ----------------
@@ -150,6 +535,16 @@ extern "C" void OnReadDone(
                  path.mEndpointId, path.mClusterId, path.mAttributeId);
     }
 }
+
+// Завершение чтения, отправленного опросом узла. Чтения пользователя и подтверждения групп приходят
+// в OnReadDone и счетчик опроса не уменьшают, иначе опрос завершится раньше и сохранит неполный шаблон
+static void OnInterviewReadDone(uint64_t node_id,
+                                const chip::Platform::ScopedMemoryBufferWithSize<chip::app::AttributePathParams> &attr_paths,
+                                const chip::Platform::ScopedMemoryBufferWithSize<chip::app::EventPathParams> &event_paths)
+{
+    OnReadDone(node_id, attr_paths, event_paths);
+    interview_read_finished(node_id);
+}
 // Основной обработчик атрибутов
 void OnAttributeData(uint64_t node_id,
                      const chip::app::ConcreteDataAttributePath &path,
@@ -163,6 +558,11 @@ void OnAttributeData(uint64_t node_id,
              AttributeIdToText(path.mClusterId, path.mAttributeId) ? AttributeIdToText(path.mClusterId, path.mAttributeId) : "Unknown",
              path.mAttributeId);
 
+    // завершает ожидающие чтение и запись этого атрибута
+    command_tracker_on_attribute(node_id, path.mEndpointId, path.mClusterId, path.mAttributeId);
+    // отчет подписки или данные чтения: узел на связи
+    node_reachability_alive(node_id);
+
     if (!data)
     {
         ESP_LOGW(TAG, "TLVReader is null");
@@ -245,7 +645,7 @@ void OnAttributeData(uint64_t node_id,
                         ESP_LOGE(TAG, "Target buffer for %s is NULL or size is zero!", field_name);
                     }
 
-                    if (path.mAttributeId == 0x000a)
+                    if (path.mAttributeId == 0x000a && interviews.find(node_id) == interviews.end())
                     {
                         log_controller_structure(&g_controller);
 
@@ -312,7 +712,10 @@ void OnAttributeData(uint64_t node_id,
     }
 
     // Handle attribute values
+    // Скаляры кладутся в attr_val, все остальное (строки, null, списки, структуры) декодируется
+    // целиком в tlv_value, который передается в реестр
     esp_matter_attr_val_t attr_val = {};
+    attr_value_ptr tlv_value;
     CHIP_ERROR err = CHIP_NO_ERROR;
 
     switch (data->GetType())
@@ -323,8 +726,16 @@ void OnAttributeData(uint64_t node_id,
         if ((err = data->Get(value)) == CHIP_NO_ERROR)
         {
             ESP_LOGI(TAG, "  Value (Signed): %lld", value);
-            attr_val.type = ESP_MATTER_VAL_TYPE_INT32;
-            attr_val.val.i32 = static_cast<int32_t>(value);
+            if (value >= INT32_MIN && value <= INT32_MAX)
+            {
+                attr_val.type = ESP_MATTER_VAL_TYPE_INT32;
+                attr_val.val.i32 = static_cast<int32_t>(value);
+            }
+            else
+            {
+                attr_val.type = ESP_MATTER_VAL_TYPE_INT64;
+                attr_val.val.i64 = value;
+            }
         }
         break;
     }
@@ -334,8 +745,16 @@ void OnAttributeData(uint64_t node_id,
         if ((err = data->Get(value)) == CHIP_NO_ERROR)
         {
             ESP_LOGI(TAG, "  Value (Unsigned): %llu", value);
-            attr_val.type = ESP_MATTER_VAL_TYPE_UINT32;
-            attr_val.val.u32 = static_cast<uint32_t>(value);
+            if (value <= UINT32_MAX)
+            {
+                attr_val.type = ESP_MATTER_VAL_TYPE_UINT32;
+                attr_val.val.u32 = static_cast<uint32_t>(value);
+            }
+            else
+            {
+                attr_val.type = ESP_MATTER_VAL_TYPE_UINT64;
+                attr_val.val.u64 = value;
+            }
         }
         break;
     }
@@ -358,58 +777,64 @@ void OnAttributeData(uint64_t node_id,
             ESP_LOGI(TAG, "  Value (Float): %f", value);
             attr_val.type = ESP_MATTER_VAL_TYPE_FLOAT;
             attr_val.val.f = static_cast<float>(value);
+            // double, не представимый во float, сохраняем без потери точности
+            if (static_cast<double>(attr_val.val.f) != value)
+                tlv_value.reset(attr_value_decode(*data));
         }
         break;
     }
     case chip::TLV::kTLVType_UTF8String:
+    case chip::TLV::kTLVType_ByteString:
     {
-        chip::CharSpan value;
-        if ((err = data->Get(value)) == CHIP_NO_ERROR)
+        // Данные TLV живут только до конца колбэка, строку копируем в tlv_value
+        tlv_value.reset(attr_value_decode(*data));
+        if (!tlv_value)
         {
-            ESP_LOGI(TAG, "  Value (String): %.*s", static_cast<int>(value.size()), value.data());
+            err = CHIP_ERROR_NO_MEMORY;
+            break;
+        }
+        const attr_value_node_t *root = attr_value_root(tlv_value.get());
+        const char *str = attr_value_pool(tlv_value.get()) + root->v.offset;
+        if (root->type == ATTR_VALUE_STRING)
+        {
+            ESP_LOGI(TAG, "  Value (String): %.*s", static_cast<int>(root->count), str);
             attr_val.type = ESP_MATTER_VAL_TYPE_CHAR_STRING;
-            attr_val.val.a.b = reinterpret_cast<uint8_t *>(const_cast<char *>(value.data()));
-            attr_val.val.a.s = value.size();
-            attr_val.val.a.n = value.size();
-            attr_val.val.a.t = value.size();
         }
-        break;
-    }
-    case chip::TLV::kTLVType_ByteString:
-    {
-        chip::ByteSpan value;
-        if ((err = data->Get(value)) == CHIP_NO_ERROR)
+        else
         {
-            ESP_LOGI(TAG, "  Value (ByteString, len=%u)", static_cast<unsigned>(value.size()));
+            ESP_LOGI(TAG, "  Value (ByteString, len=%u)", static_cast<unsigned>(root->count));
             attr_val.type = ESP_MATTER_VAL_TYPE_OCTET_STRING;
-            attr_val.val.a.b = const_cast<uint8_t *>(value.data());
-            attr_val.val.a.s = value.size();
-            attr_val.val.a.n = value.size();
-            attr_val.val.a.t = value.size();
         }
+        attr_val.val.a.b = reinterpret_cast<uint8_t *>(const_cast<char *>(str));
+        attr_val.val.a.s = root->count;
+        attr_val.val.a.n = root->count;
+        attr_val.val.a.t = root->count;
         break;
     }
     case chip::TLV::kTLVType_Null:
     {
         ESP_LOGI(TAG, "  Value: NULL");
         attr_val.type = ESP_MATTER_VAL_TYPE_INVALID;
+        tlv_value.reset(attr_value_decode(*data));
+        if (!tlv_value)
+            err = CHIP_ERROR_NO_MEMORY;
         break;
     }
     case chip::TLV::kTLVType_Structure:
     case chip::TLV::kTLVType_Array:
     case chip::TLV::kTLVType_List:
     {
-        ESP_LOGI(TAG, "  Container type: %d", data->GetType());
-        chip::TLV::TLVType containerType;
-        if (data->EnterContainer(containerType) == CHIP_NO_ERROR)
+        tlv_value.reset(attr_value_decode(*data));
+        if (!tlv_value)
         {
-            while (data->Next() == CHIP_NO_ERROR)
-            {
-                // Process nested TLV data if needed
-            }
-            data->ExitContainer(containerType);
+            err = CHIP_ERROR_NO_MEMORY;
+            break;
         }
-        return;
+        ESP_LOGI(TAG, "  Container type: %d, %u elements, %u bytes", data->GetType(),
+                 static_cast<unsigned>(attr_value_root(tlv_value.get())->count),
+                 static_cast<unsigned>(attr_value_size(tlv_value.get())));
+        attr_val.type = ESP_MATTER_VAL_TYPE_ARRAY;
+        break;
     }
     default:
         ESP_LOGI(TAG, "  Unhandled TLV type: %d", data->GetType());
@@ -418,7 +843,6 @@ void OnAttributeData(uint64_t node_id,
 
     if (err == CHIP_NO_ERROR)
     {
-        // Сначала проверяем wildcard
         // Сначала проверяем wildcard
         if (path.mAttributeId == 0xFFFFFFFF)
         {
@@ -426,16 +850,8 @@ void OnAttributeData(uint64_t node_id,
             return;
         }
 
-        // Защита: если строка пуста, не передавать nullptr
-        if ((attr_val.type == ESP_MATTER_VAL_TYPE_CHAR_STRING || attr_val.type == ESP_MATTER_VAL_TYPE_OCTET_STRING) &&
-            (attr_val.val.a.b == nullptr || attr_val.val.a.s == 0))
-        {
-            ESP_LOGW(TAG, "Skip handle_attribute_report: empty string or null pointer");
-            return;
-        }
-
         handle_attribute_report(&g_controller, node_id, path.mEndpointId,
-                                path.mClusterId, path.mAttributeId, &attr_val);
+                                path.mClusterId, path.mAttributeId, &attr_val, std::nullopt, tlv_value.release());
     }
     else
     {
@@ -481,7 +897,7 @@ static void handleEPlist(uint64_t node_id,
         return;
     }
 
-    int idx = 0;
+    std::vector<uint16_t> endpoints;
     while (data->Next() == CHIP_NO_ERROR)
     {
         if (data->GetType() == chip::TLV::kTLVType_UnsignedInteger)
@@ -489,24 +905,34 @@ static void handleEPlist(uint64_t node_id,
             uint16_t endpoint = 0;
             if (data->Get(endpoint) == CHIP_NO_ERROR)
             {
-                ESP_LOGI(TAG, "  [%d] Endpoint ID: %u", ++idx, endpoint);
-
-                // Read Server clusters
-                if (readClustersForEndpoint(node_id, endpoint, "0x0001") != ESP_OK)
-                {
-                    ESP_LOGE(TAG, "Failed to read server clusters for endpoint %u", endpoint);
-                }
-
-                // Read Client clusters
-                if (readClustersForEndpoint(node_id, endpoint, "0x0002") != ESP_OK)
-                {
-                    ESP_LOGE(TAG, "Failed to read client clusters for endpoint %u", endpoint);
-                }
+                ESP_LOGI(TAG, "  [%u] Endpoint ID: %u", (unsigned)endpoints.size() + 1, endpoint);
+                endpoints.push_back(endpoint);
             }
         }
     }
 
     data->ExitContainer(outerType);
+
+    // Узел той же модели уже опрашивался: дескрипторы endpoint'ов не читаем
+    if (interview_handle_parts_list(node_id, endpoints))
+    {
+        return;
+    }
+
+    for (uint16_t endpoint : endpoints)
+    {
+        // Read Server clusters
+        if (readClustersForEndpoint(node_id, endpoint, "0x0001") != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to read server clusters for endpoint %u", endpoint);
+        }
+
+        // Read Client clusters
+        if (readClustersForEndpoint(node_id, endpoint, "0x0002") != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to read client clusters for endpoint %u", endpoint);
+        }
+    }
 }
 
 static esp_err_t readClustersForEndpoint(uint64_t node_id, uint16_t endpoint, const char *cluster_type)
@@ -560,6 +986,13 @@ static void read_all_clusters_for_endpoint(uint64_t node_id, uint16_t endpoint_i
     }
 }
 
+// Кластеры, значения атрибутов которых читаются при опросе
+static bool isValueCluster(uint16_t endpoint_id, uint32_t cluster_id)
+{
+    return endpoint_id > 0 && cluster_id != DESCRIPTOR_CLUSTER_ID && cluster_id != BASIC_CLUSTER_ID &&
+           cluster_id != 0x0003 && cluster_id != 0x0004 && cluster_id != 0x0062;
+}
+
 static esp_err_t readAttributesForCluster(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, matter_controller_t *controller)
 {
     if (!controller)
@@ -607,7 +1040,7 @@ static void handleClusterList(uint64_t node_id,
 
                     handle_attribute_report(&g_controller, node_id, path.mEndpointId, cluster_id, 0x9999, nullptr, false);
 
-                    if (path.mEndpointId > 0 && cluster_id != DESCRIPTOR_CLUSTER_ID && cluster_id != BASIC_CLUSTER_ID && cluster_id != 0x0003 && cluster_id != 0x0004 && cluster_id != 0x0062)
+                    if (isValueCluster(path.mEndpointId, cluster_id))
                     {
                         ESP_LOGI(TAG, "Reading attributes for cluster 0x%04X (%s) on endpoint %u ", cluster_id, ClusterIdToText(cluster_id), path.mEndpointId);
                         readAttributesForCluster(node_id, path.mEndpointId, cluster_id, controller);
@@ -640,7 +1073,9 @@ static void handleClusterList(uint64_t node_id,
                 break;
             }
         }
-        if (readBasicInformation(node_id) != ESP_OK)
+        // При опросе после commissioning Basic Information уже прочитан первым запросом
+        if (node->firmware_version[0] == '\0' && interviews.find(node_id) == interviews.end() &&
+            readBasicInformation(node_id) != ESP_OK)
         {
             ESP_LOGE(TAG, "Failed to read Basic Information for node %" PRIu64, node_id);
         }
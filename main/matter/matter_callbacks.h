@@ -21,6 +21,10 @@ extern "C"
         const chip::Platform::ScopedMemoryBufferWithSize<chip::app::AttributePathParams> &attr_paths,
         const chip::Platform::ScopedMemoryBufferWithSize<chip::app::EventPathParams> &event_paths);
 
+    // Опрос узла после commissioning: Basic Information, шаблон модели или полный опрос дескрипторов.
+    // Вызывать в потоке CHIP
+    void start_node_interview(uint64_t node_id);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -37,7 +37,10 @@
 #include <protocols/user_directed_commissioning/UserDirectedCommissioning.h>
 #include "matter_command.h"
 #include "matter_callbacks.h"
+#include "command_tracker.h"
 #include "mqtt.h"
+#include "json_stream.h"
+#include "mqtt_topics.h"
 #include <esp_matter.h>
 #include <esp_matter_core.h>
 #include <esp_matter_client.h>
@@ -96,31 +99,22 @@ namespace esp_matter
                      fabricIndex, fabricIndex, nodeId, nodeId);
 
             // MQTT notification in format {"device":"40:4c:ca:ff:fe:4e:e9:58","event":"deviceJoined"}
+            char device[17];
             char json_str[64];
-            snprintf(json_str, sizeof(json_str), "{\"device\":\"%" PRIX64 "\",\"status\":\"deviceJoined\"}", nodeId);
-
-            // Form topic
-            const char *mqttPrefix = sys_settings.mqtt.prefix;
-            const char *envtopic = "/event/matter/";
-            char eventTopic[128];
-            snprintf(eventTopic, sizeof(eventTopic), "%s%s", mqttPrefix, envtopic);
-
-            mqtt_publish_data(eventTopic, json_str);
-
-            // Read attribute 0x0003 from cluster 0x001D endpoint 0x0000
-            int argc = 4;
-            char nodeIdStr[32];
-            snprintf(nodeIdStr, sizeof(nodeIdStr), "%" PRIu64, nodeId);
-            char *argv[] = {nodeIdStr, (char *)"0x0000", (char *)"0x001D", (char *)"0x0003"};
-            esp_err_t result = esp_matter::command::controller_read_attr(argc, argv);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(TAG, "Failed to read Node structure for node 0x%" PRIX64 ": %s", nodeId, esp_err_to_name(result));
-            }
-            else
-            {
-                ESP_LOGI(TAG, "read Node structure for node 0x%" PRIu64, nodeId);
-            }
+            snprintf(device, sizeof(device), "%" PRIX64, nodeId);
+            json_stream_t js;
+            json_stream_init(&js, json_str, sizeof(json_str), NULL, NULL);
+            json_stream_object_begin(&js, NULL);
+            json_stream_string(&js, "device", device);
+            json_stream_string(&js, "status", "deviceJoined");
+            json_stream_object_end(&js);
+
+            if (json_stream_finish(&js) == ESP_OK)
+                mqtt_publish_data(mqtt_topic(MQTT_TOPIC_EVENT), json_str);
+
+            // Опрос структуры узла: Basic Information, затем шаблон модели или Descriptor->PartsList
+            start_node_interview(nodeId);
+            ESP_LOGI(TAG, "read Node structure for node 0x%" PRIX64, nodeId);
         }
 
         void on_commissioning_failure_callback(
@@ -135,16 +129,23 @@ namespace esp_matter
                      nodeId, fabricIndex, static_cast<int>(stage), error.Format());
 
             // MQTT уведомление
-            const char *mqttPrefix = sys_settings.mqtt.prefix;
-            const char *envtopic = "/event/matter/";
-            char eventTopic[128];
-            snprintf(eventTopic, sizeof(eventTopic), "%s%s", mqttPrefix, envtopic);
-
-            char json_str[128];
-            snprintf(json_str, sizeof(json_str),
-                     "{\"device\":\"%" PRIX64 "\",\"status\":\"JoinFailed\",\"error\":\"%s\",\"stage\":%d}",
-                     nodeId, chip::ErrorStr(error), static_cast<int>(stage));
-            mqtt_publish_data(eventTopic, json_str);
+            // текст ошибки CHIP может быть длинным и содержать кавычки: экранируется writer'ом,
+            // не влезшее сообщение не публикуется обрезанным
+            char device[17];
+            char json_str[256];
+            snprintf(device, sizeof(device), "%" PRIX64, nodeId);
+            json_stream_t js;
+            json_stream_init(&js, json_str, sizeof(json_str), NULL, NULL);
+            json_stream_object_begin(&js, NULL);
+            json_stream_string(&js, "device", device);
+            json_stream_string(&js, "status", "JoinFailed");
+            json_stream_string(&js, "error", chip::ErrorStr(error));
+            json_stream_int(&js, "stage", static_cast<int>(stage));
+            json_stream_object_end(&js);
+            if (json_stream_finish(&js) == ESP_OK)
+                mqtt_publish_data(mqtt_topic(MQTT_TOPIC_EVENT), json_str);
+            else
+                ESP_LOGE(TAG, "JoinFailed event for node 0x%" PRIX64 " does not fit", nodeId);
         }
 
         // --------------------Колбэки для PairingCommand----------------
@@ -645,26 +646,20 @@ namespace esp_matter
             uint32_t cluster_id = string_to_uint32(argv[2]);
             uint32_t command_id = string_to_uint32(argv[3]);
 
-            if (argc > 5)
-            {
-                uint16_t timed_invoke_timeout_ms = string_to_uint16(argv[5]);
-                if (timed_invoke_timeout_ms > 0)
-                {
-                    return controller::send_invoke_cluster_command(node_id, endpoint_id, cluster_id, command_id, argv[4],
-                                                                   chip::MakeOptional(timed_invoke_timeout_ms));
-                }
-            }
-
-            return controller::send_invoke_cluster_command(node_id, endpoint_id, cluster_id, command_id,
-                                                           argc > 4 ? argv[4] : NULL);
+            // ответ устройства приходит в command_tracker
+            uint16_t timed_invoke_timeout_ms = argc > 5 ? string_to_uint16(argv[5]) : 0;
+            return command_tracker_send_invoke(node_id, endpoint_id, cluster_id, command_id, argc > 4 ? argv[4] : NULL,
+                                               timed_invoke_timeout_ms);
         }
 
         // -------------------------- Чтение атрибутов с колбэками без  AttributePathParams -------------------------- //
         esp_err_t controller_request_attribute(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_or_event_id,
-                                               esp_matter::controller::read_command_type_t command_type)
+                                               esp_matter::controller::read_command_type_t command_type,
+                                               read_done_fn_t read_done)
         {
             esp_matter::controller::read_command *cmd = chip::Platform::New<esp_matter::controller::read_command>(
-                node_id, endpoint_id, cluster_id, attribute_or_event_id, command_type, OnAttributeData, OnReadDone, nullptr);
+                node_id, endpoint_id, cluster_id, attribute_or_event_id, command_type, OnAttributeData,
+                read_done ? read_done : OnReadDone, nullptr);
             if (!cmd)
             {
                 ESP_LOGE(TAG, "Failed to alloc memory for read_command");
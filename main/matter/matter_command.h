@@ -16,8 +16,16 @@ extern "C"
             esp_err_t controller_group_settings(int argc, char **argv);
             esp_err_t open_commissioning_window(int argc, char **argv);
             esp_err_t controller_invoke_command(int argc, char **argv);
+            // Завершение чтения. По нему отличают свои чтения: опрос узла считает только отправленные им
+            typedef void (*read_done_fn_t)(
+                uint64_t node_id,
+                const chip::Platform::ScopedMemoryBufferWithSize<chip::app::AttributePathParams> &attr_paths,
+                const chip::Platform::ScopedMemoryBufferWithSize<chip::app::EventPathParams> &event_paths);
+
+            // read_done - NULL: OnReadDone
             esp_err_t controller_request_attribute(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_or_event_id,
-                                                   esp_matter::controller::read_command_type_t command_type);
+                                                   esp_matter::controller::read_command_type_t command_type,
+                                                   read_done_fn_t read_done = nullptr);
             esp_err_t controller_read_attr(int argc, char **argv);
             esp_err_t controller_write_attr(int argc, char **argv);
             esp_err_t controller_read_event(int argc, char **argv);
@@ -16,7 +16,11 @@
 #include <esp_matter_controller_utils.h>
 #include <matter_controller_cluster.h>
 #include <lib/support/ScopedBuffer.h>
+#include <platform/CHIPDeviceLayer.h>
+#include <nvs.h>
+#include <atomic>
 #include "matter_controller_device_mgr.h"
+#include "settings.h"
 
 using chip::Platform::ScopedMemoryBufferWithSize;
 using namespace esp_matter::cluster::matter_controller::attribute;
@@ -37,6 +41,12 @@ namespace esp_matter
       static QueueHandle_t s_task_queue = NULL;
       static TaskHandle_t s_device_mgr_task = NULL;
       static SemaphoreHandle_t s_device_mgr_mutex = NULL;
+      // обновление по изменению реестра уже в очереди: следующие изменения войдут в него
+      static std::atomic<bool> s_update_pending{false};
+      // сигнатура реестра на момент последнего обновления, для сверки
+      static std::atomic<uint32_t> s_list_signature{0};
+      static bool s_sweep_running = false;
+      static registry_stats_t s_stats = {};
 
       typedef esp_err_t (*esp_matter_device_mgr_task_t)(void *);
 
@@ -180,6 +190,7 @@ namespace esp_matter
                 memcpy(new_node->server_clusters[i].attributes,
                        current->server_clusters[i].attributes,
                        current->server_clusters[i].attributes_count * sizeof(matter_attribute_t));
+                detach_attribute_values(new_node->server_clusters[i].attributes, current->server_clusters[i].attributes_count);
               }
             }
           }
@@ -211,6 +222,7 @@ namespace esp_matter
                 memcpy(new_node->client_clusters[i].attributes,
                        current->client_clusters[i].attributes,
                        current->client_clusters[i].attributes_count * sizeof(matter_attribute_t));
+                detach_attribute_values(new_node->client_clusters[i].attributes, current->client_clusters[i].attributes_count);
               }
             }
           }
@@ -281,6 +293,7 @@ namespace esp_matter
               memcpy(dst->server_clusters[i].attributes,
                      src->server_clusters[i].attributes,
                      src->server_clusters[i].attributes_count * sizeof(matter_attribute_t));
+              detach_attribute_values(dst->server_clusters[i].attributes, src->server_clusters[i].attributes_count);
             }
           }
         }
@@ -311,6 +324,7 @@ namespace esp_matter
               memcpy(dst->client_clusters[i].attributes,
                      src->client_clusters[i].attributes,
                      src->client_clusters[i].attributes_count * sizeof(matter_attribute_t));
+              detach_attribute_values(dst->client_clusters[i].attributes, src->client_clusters[i].attributes_count);
             }
           }
         }
@@ -318,49 +332,83 @@ namespace esp_matter
         return dst;
       }
 
-      static esp_err_t update_device_list_task(void *endpoint_id_ptr)
+      // FNV-1a по составу реестра: узлы, endpoint'ы, кластеры, атрибуты и флаги подписки (без значений)
+      static uint32_t signature_add(uint32_t hash, uint64_t value)
       {
-        if (!endpoint_id_ptr)
+        for (int i = 0; i < 8; i++)
         {
-          ESP_LOGE(TAG, "endpoint_id_ptr is NULL");
-          return ESP_ERR_INVALID_ARG;
+          hash ^= (uint8_t)(value >> (i * 8));
+          hash *= 16777619u;
         }
+        return hash;
+      }
 
-                if (esp_get_minimum_free_heap_size() < 1024 * 10)
+      static uint32_t signature_clusters(uint32_t hash, const matter_cluster_t *clusters, uint16_t count)
+      {
+        hash = signature_add(hash, count);
+        for (uint16_t i = 0; clusters && i < count; i++)
         {
+          hash = signature_add(hash, clusters[i].cluster_id);
+          hash = signature_add(hash, clusters[i].attributes_count);
+          for (uint16_t j = 0; clusters[i].attributes && j < clusters[i].attributes_count; j++)
+          {
+            const matter_attribute_t &attr = clusters[i].attributes[j];
+            hash = signature_add(hash, ((uint64_t)attr.attribute_id << 1) | attr.subscribe);
+          }
+        }
+        return hash;
+      }
+
+      uint32_t registry_signature(const matter_device_t *list)
+      {
+        uint32_t hash = 2166136261u;
+        for (const matter_device_t *node = list; node; node = node->next)
+        {
+          hash = signature_add(hash, node->node_id);
+          hash = signature_add(hash, node->endpoints_count);
+          for (uint16_t i = 0; node->endpoints && i < node->endpoints_count; i++)
+            hash = signature_add(hash, node->endpoints[i].endpoint_id);
+          hash = signature_clusters(hash, node->server_clusters, node->server_clusters_count);
+          hash = signature_clusters(hash, node->client_clusters, node->client_clusters_count);
+        }
+        return hash;
+      }
+
+      // Копия реестра для подписчиков списка устройств и колбэк обновления
+      static esp_err_t refresh_device_list()
+      {
+        if (esp_get_minimum_free_heap_size() < 1024 * 10)
+        {
+          // изменение не теряется: сверка найдет расхождение сигнатур (если включена)
           ESP_LOGW(TAG, "Low memory, skipping update");
-          free(endpoint_id_ptr);
           vTaskDelay(pdMS_TO_TICKS(1000));
           return ESP_OK;
         }
 
-        uint16_t endpoint_id = *(uint16_t *)endpoint_id_ptr;
-        free(endpoint_id_ptr);
-
-        scoped_device_mgr_lock lock;
+        // реестр меняется на потоке CHIP (отчеты перевыделяют массивы атрибутов): копия снимается под
+        // блокировкой стека, до блокировки device_mgr, чтобы не держать обе сразу
+        matter_node *new_list = NULL;
+        chip::DeviceLayer::PlatformMgr().LockChipStack();
+        bool empty = g_controller.nodes_list == NULL;
+        if (!empty)
+          new_list = copy_device_list(g_controller.nodes_list);
+        chip::DeviceLayer::PlatformMgr().UnlockChipStack();
 
-        if (!g_controller.nodes_list)
+        if (empty)
         {
           ESP_LOGW(TAG, "No devices found in controller list");
-          // free_matter_device_list((matter_node *)s_matter_device_list);
-          // s_matter_device_list = nullptr;
-
-          if (s_device_list_update_cb)
-          {
-            s_device_list_update_cb();
-          }
-          return ESP_OK;
         }
-
-        matter_node *new_list = copy_device_list(g_controller.nodes_list);
-        if (!new_list)
+        else if (!new_list)
         {
           ESP_LOGE(TAG, "Failed to copy device list");
           return ESP_ERR_NO_MEM;
         }
 
+        scoped_device_mgr_lock lock;
         free_matter_device_list((matter_node *)s_matter_device_list);
         s_matter_device_list = new_list;
+        s_list_signature.store(registry_signature(new_list));
+        s_stats.updates++;
 
         if (s_device_list_update_cb)
         {
@@ -370,6 +418,26 @@ namespace esp_matter
         return ESP_OK;
       }
 
+      static esp_err_t update_device_list_task(void *endpoint_id_ptr)
+      {
+        if (!endpoint_id_ptr)
+        {
+          ESP_LOGE(TAG, "endpoint_id_ptr is NULL");
+          return ESP_ERR_INVALID_ARG;
+        }
+        free(endpoint_id_ptr);
+        return refresh_device_list();
+      }
+
+      // Обновление по изменению реестра: изменения за DEVICE_MGR_SETTLE_MS (опрос узла, группа отчетов)
+      // объединяются в одно копирование
+      static esp_err_t registry_changed_task(void *arg)
+      {
+        vTaskDelay(pdMS_TO_TICKS(DEVICE_MGR_SETTLE_MS));
+        s_update_pending.store(false);
+        return refresh_device_list();
+      }
+
       matter_device_t *get_device_list_clone()
       {
         matter_device_t *ret = NULL;
@@ -416,12 +484,88 @@ namespace esp_matter
           if (ptr->node_id == node_id)
           {
             ptr->reachable = value;
+            ptr->is_online = value;
             break;
           }
           ptr = ptr->next;
         }
       }
 
+      void notify_change(registry_change_t change)
+      {
+        if (change < REGISTRY_CHANGE_COUNT)
+          s_stats.changes[change]++;
+        // до запуска задачи изменения не нужны: она начнет с полной копии
+        if (!s_task_queue)
+          return;
+        if (s_update_pending.exchange(true))
+        {
+          s_stats.coalesced++;
+          return;
+        }
+        task_post_t task_post = {
+            .task = registry_changed_task,
+            .arg = NULL,
+        };
+        // без ожидания: уведомление приходит и с потока CHIP
+        if (xQueueSend(s_task_queue, &task_post, 0) != pdTRUE)
+        {
+          s_update_pending.store(false);
+          ESP_LOGW(TAG, "Device mgr queue is full, registry change is not posted");
+        }
+      }
+
+      static void sweep_timer_cb(chip::System::Layer *layer, void *ctx);
+
+      static void schedule_sweep()
+      {
+        uint16_t minutes = sys_settings.registry.sweep_min;
+        s_sweep_running = minutes &&
+                          chip::DeviceLayer::SystemLayer().StartTimer(chip::System::Clock::Seconds32(minutes * 60),
+                                                                      sweep_timer_cb, nullptr) == CHIP_NO_ERROR;
+        if (minutes && !s_sweep_running)
+        {
+          ESP_LOGE(TAG, "Failed to start registry sweep timer");
+        }
+      }
+
+      // Сверка: изменение реестра без уведомления (или пропущенное обновление) видно по сигнатуре
+      static void sweep_timer_cb(chip::System::Layer *layer, void *ctx)
+      {
+        s_stats.sweeps++;
+        nvs_stats_t nvs_stats;
+        if (nvs_get_stats("nvs", &nvs_stats) == ESP_OK)
+        {
+          ESP_LOGI("NVS", "Used entries: %d, Free entries: %d", nvs_stats.used_entries, nvs_stats.free_entries);
+        }
+        ESP_LOGI("HEAP", "Free heap: %u Kb, min free heap: %u Kb", esp_get_free_heap_size() / 1024,
+                 esp_get_minimum_free_heap_size() / 1024);
+        if (registry_signature(g_controller.nodes_list) != s_list_signature.load())
+        {
+          s_stats.sweep_mismatches++;
+          ESP_LOGW(TAG, "Registry changed without notification, updating device list");
+          notify_change(REGISTRY_CHANGE_SWEEP);
+        }
+        schedule_sweep();
+      }
+
+      esp_err_t set_sweep_interval(uint16_t minutes)
+      {
+        sys_settings.registry.sweep_min = minutes;
+        if (s_sweep_running)
+        {
+          chip::DeviceLayer::SystemLayer().CancelTimer(sweep_timer_cb, nullptr);
+          s_sweep_running = false;
+        }
+        schedule_sweep();
+        return minutes && !s_sweep_running ? ESP_FAIL : ESP_OK;
+      }
+
+      const registry_stats_t *get_stats()
+      {
+        return &s_stats;
+      }
+
       esp_err_t update_device_list(uint16_t endpoint_id)
       {
         if (!s_task_queue)
@@ -20,6 +20,8 @@
 #define ESP_MATTER_DEVICE_MAX_ENDPOINT 8
 #define ESP_MATTER_DEVICE_NAME_MAX_LEN 32
 #define ESP_RAINMAKER_NODE_ID_MAX_LEN 36
+// Изменения реестра за это время объединяются в одно обновление списка устройств
+#define DEVICE_MGR_SETTLE_MS 500
 
 namespace esp_matter
 {
@@ -30,6 +32,26 @@ namespace esp_matter
             // Используем типы напрямую из devices.h, не делаем using для них!
             typedef void (*device_list_update_callback_t)(void);
 
+            // Причина обновления списка устройств
+            typedef enum
+            {
+                REGISTRY_CHANGE_NODE_ADDED = 0,
+                REGISTRY_CHANGE_NODE_REMOVED,
+                REGISTRY_CHANGE_TOPOLOGY,  // endpoint, кластер или атрибут добавлен, топология из шаблона опроса
+                REGISTRY_CHANGE_SUBSCRIBE, // флаг подписки атрибута изменен
+                REGISTRY_CHANGE_SWEEP,     // расхождение, найденное сверкой
+                REGISTRY_CHANGE_COUNT,
+            } registry_change_t;
+
+            typedef struct
+            {
+                uint32_t changes[REGISTRY_CHANGE_COUNT]; // уведомлений по причинам
+                uint32_t coalesced;        // уведомлений, вошедших в уже запланированное обновление
+                uint32_t updates;          // копий реестра (обновлений списка)
+                uint32_t sweeps;
+                uint32_t sweep_mismatches; // сверок, нашедших изменение без уведомления
+            } registry_stats_t;
+
             // Используйте matter_device_t из devices.h везде!
             void free_matter_device_list(matter_device_t *dev_list);
 
@@ -37,8 +59,29 @@ namespace esp_matter
 
             matter_device_t *get_device_clone(uint64_t node_id);
 
+            // Доступность узла в реестре (reachable, is_online), вызывается node_reachability на потоке CHIP
+            void set_device_reachable(uint64_t node_id, bool value);
+
            esp_err_t update_device_list(uint16_t endpoint_id);
 
+            /**
+             * @brief Реестр изменился: обновление списка устройств (копия, колбэк, подписки) через
+             *        DEVICE_MGR_SETTLE_MS, изменения за это время объединяются. Без изменений реестра
+             *        работы нет. Можно вызывать из любой задачи, не блокирует
+             */
+            void notify_change(registry_change_t change);
+
+            // Сигнатура состава реестра (узлы, endpoint'ы, кластеры, атрибуты, флаги подписки)
+            uint32_t registry_signature(const matter_device_t *list);
+
+            /**
+             * @brief Медленная сверка реестра со списком устройств раз в minutes минут (0 - выключена,
+             *        sys_settings.registry.sweep_min). Вызывается на потоке CHIP (или под LockChipStack)
+             */
+            esp_err_t set_sweep_interval(uint16_t minutes);
+
+            const registry_stats_t *get_stats();
+
             esp_err_t init(uint16_t endpoint_id, device_list_update_callback_t dev_list_update_cb);
         } // namespace device_mgr
     } // namespace controller
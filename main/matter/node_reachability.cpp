@@ -0,0 +1,328 @@
+#include "node_reachability.h"
+#include "session_warm.h"
+#include "chip_work.h"
+#include "mqtt.h"
+#include "mqtt_topics.h"
+#include "settings.h"
+#include "json_stream.h"
+#include "devices.h"
+#include "matter_controller_device_mgr.h"
+#include "read_node_info.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lib/core/NodeId.h>
+#include <platform/CHIPDeviceLayer.h>
+
+static const char *TAG = "reachability";
+
+extern matter_controller_t g_controller;
+
+typedef struct
+{
+    uint64_t node_id; // 0 - запись свободна
+    bool online;
+    bool probing;            // идет проверка чтением атрибута
+    uint8_t failures;        // ошибок подряд
+    int64_t last_seen_us;    // последний ответ узла
+    int64_t last_attempt_us; // последняя команда или проверка, пропущенная к недоступному узлу
+    int64_t probe_us;        // начало идущей проверки
+    int64_t offline_us;      // когда узел стал недоступен
+} reach_node_t;
+
+typedef struct
+{
+    uint32_t went_offline;
+    uint32_t went_online;
+    uint32_t fast_failed; // команд недоступным узлам, завершенных без отправки
+    uint32_t probes;
+    uint32_t probe_failures;
+    uint32_t failures[NODE_REACHABILITY_CAUSE_COUNT];
+} reach_stats_t;
+
+static const char *const cause_names[NODE_REACHABILITY_CAUSE_COUNT] = {"command", "session", "read", "probe"};
+
+static reach_node_t nodes[NODE_REACHABILITY_SLOTS];
+static reach_stats_t stats;
+static bool timer_running;
+
+static bool tracked(uint64_t node_id)
+{
+    return node_id != 0 && !chip::IsGroupId(node_id);
+}
+
+static reach_node_t *find_reach(uint64_t node_id)
+{
+    for (reach_node_t &node : nodes)
+    {
+        if (node.node_id == node_id)
+            return &node;
+    }
+    return nullptr;
+}
+
+// Запись узла; при переполнении заменяется доступный узел, дольше всех молчавший. Недоступные не вытесняются:
+// иначе их команды снова ждали бы таймаута
+static reach_node_t *reach_touch(uint64_t node_id, int64_t now_us)
+{
+    reach_node_t *node = find_reach(node_id);
+    if (node)
+        return node;
+    reach_node_t *victim = nullptr;
+    for (reach_node_t &slot : nodes)
+    {
+        if (!slot.node_id)
+        {
+            victim = &slot;
+            break;
+        }
+        if (slot.online && (!victim || slot.last_seen_us < victim->last_seen_us))
+            victim = &slot;
+    }
+    if (!victim)
+        return nullptr;
+    memset(victim, 0, sizeof(*victim));
+    victim->node_id = node_id;
+    victim->online = true;
+    victim->last_seen_us = now_us;
+    return victim;
+}
+
+static void availability_topic(uint64_t node_id, char *topic, size_t size)
+{
+    snprintf(topic, size, "%s%" PRIu64, mqtt_topic(MQTT_TOPIC_AVAILABILITY), node_id);
+}
+
+static void publish_availability(uint64_t node_id, bool online)
+{
+    char topic[sizeof(sys_settings.mqtt.prefix) + 48];
+    availability_topic(node_id, topic, sizeof(topic));
+    const char *state = online ? "online" : "offline";
+    mqtt_publish_retained_len(topic, state, strlen(state));
+}
+
+// Смена доступности: реестр, модель узла read_node_info, retained-топик
+static void set_online(reach_node_t *node, bool online, int64_t now_us, node_reachability_cause_t cause)
+{
+    node->online = online;
+    if (online)
+    {
+        stats.went_online++;
+        ESP_LOGI(TAG, "Node 0x%" PRIx64 " is reachable again after %" PRIu32 " s", node->node_id,
+                 (uint32_t)((now_us - node->offline_us) / 1000000));
+    }
+    else
+    {
+        stats.went_offline++;
+        node->offline_us = now_us;
+        node->last_attempt_us = now_us;
+        ESP_LOGW(TAG, "Node 0x%" PRIx64 " is unreachable: %u failures in a row, last %s", node->node_id,
+                 node->failures, cause_names[cause]);
+    }
+    esp_matter::controller::device_mgr::set_device_reachable(node->node_id, online);
+    change_node_reachability(node->node_id, online);
+    publish_availability(node->node_id, online);
+}
+
+void node_reachability_alive(uint64_t node_id)
+{
+    if (!tracked(node_id))
+        return;
+    int64_t now = esp_timer_get_time();
+    reach_node_t *node = reach_touch(node_id, now);
+    if (!node)
+        return;
+    node->last_seen_us = now;
+    node->failures = 0;
+    node->probing = false;
+    if (!node->online)
+        set_online(node, true, now, NODE_REACHABILITY_COMMAND);
+}
+
+void node_reachability_failed(uint64_t node_id, node_reachability_cause_t cause)
+{
+    if (!tracked(node_id) || cause >= NODE_REACHABILITY_CAUSE_COUNT)
+        return;
+    stats.failures[cause]++;
+    int64_t now = esp_timer_get_time();
+    reach_node_t *node = reach_touch(node_id, now);
+    if (!node)
+        return;
+    if (cause == NODE_REACHABILITY_PROBE)
+    {
+        stats.probe_failures++;
+        node->probing = false;
+    }
+    if (node->failures < UINT8_MAX)
+        node->failures++;
+    uint8_t threshold = sys_settings.reachability.fail_threshold ? sys_settings.reachability.fail_threshold : 1;
+    if (node->online && node->failures >= threshold)
+        set_online(node, false, now, cause);
+}
+
+bool node_reachability_admit(uint64_t node_id)
+{
+    if (!tracked(node_id))
+        return true;
+    reach_node_t *node = find_reach(node_id);
+    if (!node || node->online)
+        return true;
+    int64_t now = esp_timer_get_time();
+    if (now - node->last_attempt_us >= (int64_t)sys_settings.reachability.retry_s * 1000000)
+    {
+        // команда уходит и проверяет узел: ответ вернет его в доступные
+        node->last_attempt_us = now;
+        return true;
+    }
+    stats.fast_failed++;
+    ESP_LOGD(TAG, "Node 0x%" PRIx64 " is unreachable, command not sent", node_id);
+    return false;
+}
+
+bool node_reachability_online(uint64_t node_id)
+{
+    const reach_node_t *node = tracked(node_id) ? find_reach(node_id) : nullptr;
+    return !node || node->online;
+}
+
+static void forget_work(void *arg)
+{
+    uint64_t node_id;
+    memcpy(&node_id, arg, sizeof(node_id));
+    reach_node_t *node = find_reach(node_id);
+    if (node)
+        memset(node, 0, sizeof(*node));
+    // пустое retained-сообщение удаляет его с брокера
+    char topic[sizeof(sys_settings.mqtt.prefix) + 48];
+    availability_topic(node_id, topic, sizeof(topic));
+    mqtt_publish_retained_len(topic, "", 0);
+}
+
+void node_reachability_forget(uint64_t node_id)
+{
+    if (!tracked(node_id))
+        return;
+    if (chip_work_post(forget_work, &node_id, sizeof(node_id)) != ESP_OK)
+        ESP_LOGW(TAG, "Failed to forget node 0x%" PRIx64, node_id);
+}
+
+static void tick_cb(chip::System::Layer *layer, void *ctx);
+
+static void schedule_tick(void)
+{
+    timer_running = chip::DeviceLayer::SystemLayer().StartTimer(chip::System::Clock::Seconds32(NODE_REACHABILITY_TICK_S),
+                                                                tick_cb, nullptr) == CHIP_NO_ERROR;
+    if (!timer_running)
+        ESP_LOGE(TAG, "Failed to start reachability timer");
+}
+
+// Проверка чтением атрибута: доступного узла, молчащего дольше silence_s, и недоступного раз в retry_s
+static void tick_cb(chip::System::Layer *layer, void *ctx)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t silence_us = (int64_t)sys_settings.reachability.silence_s * 1000000;
+    int64_t retry_us = (int64_t)sys_settings.reachability.retry_s * 1000000;
+    uint8_t probes = 0;
+    for (reach_node_t &node : nodes)
+    {
+        if (!node.node_id)
+            continue;
+        if (node.probing)
+        {
+            if (now - node.probe_us <= (int64_t)NODE_REACHABILITY_PROBE_TIMEOUT_S * 1000000)
+                continue;
+            node_reachability_failed(node.node_id, NODE_REACHABILITY_PROBE);
+        }
+        bool due = node.online ? silence_us && now - node.last_seen_us > silence_us
+                               : now - node.last_attempt_us >= retry_us;
+        if (!due || probes == NODE_REACHABILITY_PARALLEL_PROBES)
+            continue;
+        probes++;
+        stats.probes++;
+        node.probing = true;
+        node.probe_us = now;
+        if (!node.online)
+            node.last_attempt_us = now;
+        if (session_warm_probe(node.node_id) != ESP_OK)
+            node.probing = false;
+    }
+    schedule_tick();
+}
+
+esp_err_t node_reachability_start(void)
+{
+    int64_t now = esp_timer_get_time();
+    uint16_t count = 0;
+    for (matter_device_t *dev = g_controller.nodes_list; dev; dev = dev->next)
+    {
+        reach_node_t *node = reach_touch(dev->node_id, now);
+        if (!node)
+            break;
+        node->online = true;
+        node->last_seen_us = now;
+        esp_matter::controller::device_mgr::set_device_reachable(dev->node_id, true);
+        publish_availability(dev->node_id, true);
+        count++;
+    }
+    ESP_LOGI(TAG, "Tracking reachability of %u nodes (threshold %u, retry %u s, silence check %u s)", count,
+             sys_settings.reachability.fail_threshold, sys_settings.reachability.retry_s,
+             sys_settings.reachability.silence_s);
+    if (!timer_running)
+        schedule_tick();
+    return timer_running ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t node_reachability_publish_stats(const char *topic, uint64_t node_id)
+{
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+        return ESP_ERR_NO_MEM;
+
+    int64_t now = esp_timer_get_time();
+    uint32_t offline = 0;
+    for (const reach_node_t &node : nodes)
+    {
+        if (node.node_id && !node.online)
+            offline++;
+    }
+    json_stream_t js;
+    json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "reachability");
+    json_stream_uint(&js, "fail_threshold", sys_settings.reachability.fail_threshold);
+    json_stream_uint(&js, "retry_s", sys_settings.reachability.retry_s);
+    json_stream_uint(&js, "silence_s", sys_settings.reachability.silence_s);
+    json_stream_uint(&js, "offline", offline);
+    json_stream_uint(&js, "went_offline", stats.went_offline);
+    json_stream_uint(&js, "went_online", stats.went_online);
+    json_stream_uint(&js, "fast_failed", stats.fast_failed);
+    json_stream_uint(&js, "probes", stats.probes);
+    json_stream_uint(&js, "probe_failures", stats.probe_failures);
+    json_stream_object_begin(&js, "failures");
+    for (int i = 0; i < NODE_REACHABILITY_CAUSE_COUNT; i++)
+        json_stream_uint(&js, cause_names[i], stats.failures[i]);
+    json_stream_object_end(&js);
+    json_stream_array_begin(&js, "nodes");
+    for (const reach_node_t &node : nodes)
+    {
+        if (!node.node_id || (node_id && node.node_id != node_id))
+            continue;
+        json_stream_object_begin(&js, NULL);
+        json_stream_uint(&js, "node", node.node_id);
+        json_stream_bool(&js, "online", node.online);
+        json_stream_uint(&js, "failures", node.failures);
+        json_stream_uint(&js, "last_seen_s", (uint64_t)((now - node.last_seen_us) / 1000000));
+        if (!node.online)
+            json_stream_uint(&js, "offline_s", (uint64_t)((now - node.offline_us) / 1000000));
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    esp_err_t err = json_stream_finish(&js);
+    if (err == ESP_OK)
+        err = mqtt_publish_data_len(topic, msg, js.len);
+    json_stream_buf_release(msg);
+    return err;
+}
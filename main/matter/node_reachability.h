@@ -0,0 +1,85 @@
+#ifndef NODE_REACHABILITY_H
+#define NODE_REACHABILITY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Узлов с отслеживаемой доступностью, при переполнении заменяется давно не отвечавший доступный узел
+#define NODE_REACHABILITY_SLOTS 32
+// Проход по узлам: проверка молчащих и недоступных
+#define NODE_REACHABILITY_TICK_S 10
+// Проверок узлов за один проход (CASE по Thread дорог)
+#define NODE_REACHABILITY_PARALLEL_PROBES 2
+// Проверка без итога дольше считается неудачной
+#define NODE_REACHABILITY_PROBE_TIMEOUT_S 60
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Источник признака недоступности, для журнала и статистики
+    typedef enum
+    {
+        NODE_REACHABILITY_COMMAND = 0, // команда без ответа или с ошибкой CHIP
+        NODE_REACHABILITY_SESSION,     // не установлена CASE-сессия (session_warm)
+        NODE_REACHABILITY_READ,        // чтение модели узла без ответа
+        NODE_REACHABILITY_PROBE,       // проверка чтением атрибута без ответа
+        NODE_REACHABILITY_CAUSE_COUNT,
+    } node_reachability_cause_t;
+
+    /**
+     * @brief Все узлы реестра считаются доступными до первых ошибок: публикуются retained-сообщения
+     *        <prefix>/availability/matter/<node> "online", запускается проход NODE_REACHABILITY_TICK_S.
+     *        Вызывается на потоке CHIP (или под LockChipStack) после загрузки реестра и запуска стека
+     */
+    esp_err_t node_reachability_start(void);
+
+    /**
+     * @brief Узел ответил: ответ на команду (в том числе со статусом ошибки IM), отчет подписки, данные чтения,
+     *        установленная сессия. Сбрасывает счетчик ошибок, недоступный узел снова становится доступным.
+     *        Вызывается на потоке CHIP
+     */
+    void node_reachability_alive(uint64_t node_id);
+
+    /**
+     * @brief Узел не ответил. После sys_settings.reachability.fail_threshold ошибок подряд узел недоступен:
+     *        реестр (is_online, reachable), retained "offline" в топике доступности. Вызывается на потоке CHIP
+     */
+    void node_reachability_failed(uint64_t node_id, node_reachability_cause_t cause);
+
+    /**
+     * @brief Проверка перед отправкой команды узлу. Команды недоступному узлу не отправляются (итог сразу, без
+     *        ожидания таймаута), кроме одной раз в sys_settings.reachability.retry_s - она же проверка узла.
+     *        Вызывается на потоке CHIP
+     *
+     * @return true - отправлять, false - узел недоступен, отправитель возвращает ESP_ERR_INVALID_STATE
+     */
+    bool node_reachability_admit(uint64_t node_id);
+
+    // Узел доступен (неизвестный узел считается доступным). На потоке CHIP
+    bool node_reachability_online(uint64_t node_id);
+
+    /**
+     * @brief Узел удален из реестра: запись освобождается, retained-сообщение доступности удаляется.
+     *        Можно вызывать из любой задачи (работа ставится на поток CHIP)
+     */
+    void node_reachability_forget(uint64_t node_id);
+
+    /**
+     * @brief Публикация {"action":"reachability","fail_threshold":..,"retry_s":..,"silence_s":..,"offline":..,
+     *        "went_offline":..,"went_online":..,"fast_failed":..,"probes":..,"probe_failures":..,
+     *        "failures":{"command":..,"session":..,"read":..,"probe":..},
+     *        "nodes":[{"node":..,"online":..,"failures":..,"last_seen_s":..,"offline_s":..}]}.
+     *        Вызывается на потоке CHIP (или под LockChipStack)
+     *
+     * @param node_id 0 - все узлы, иначе в nodes только этот узел
+     */
+    esp_err_t node_reachability_publish_stats(const char *topic, uint64_t node_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NODE_REACHABILITY_H
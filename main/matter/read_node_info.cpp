@@ -20,9 +20,12 @@
 
 #include <iostream>
 #include <read_node_info.h>
+#include "node_reachability.h"
 
+#include <deque>
 #include <unordered_map>
 
+#include <esp_timer.h>
 #include "freertos/semphr.h"
 
 #include <json_generator.h>
@@ -37,18 +40,23 @@ using namespace chip::app::Clusters;
 
 static const char *TAG = "read_node_info";
 
-std::unordered_map<uint16_t, data_model *> get_ep_ptr; // virtual device i.e., endpoint
-std::unordered_map<uint64_t, dev_data *> get_dev_ptr;  // actual physical device
+// Одновременных чтений узлов: каждое держит ReadClient и CASE-сессию
+static constexpr size_t READ_NODE_INFO_MAX_INFLIGHT = 4;
+static constexpr uint32_t READ_NODE_INFO_TIMEOUT_SEC = 30;
+static constexpr uint32_t READ_NODE_INFO_SWEEP_SEC = 5;
 
-std::vector<uint64_t> node_id_list;
-int node_id_list_index = 0;
+std::unordered_map<uint64_t, dev_data *> get_dev_ptr; // actual physical device, endpoint'ы внутри узла
 
-std::unordered_map<uint64_t, bool> online_devices;
+static std::deque<uint64_t> pending_nodes;                 // очередь узлов на чтение
+static std::unordered_map<uint64_t, int64_t> inflight_nodes; // node_id -> время запуска чтения
+static size_t refresh_node_count = 0;
+static int64_t refresh_started_us = 0;
+static bool refresh_sweep_running = false;
 
 char *esp_controller_get_datamodel_json(void);
 
 static esp_err_t json_gen(json_gen_str_t *);
-static void _read_node_wild_info(uint64_t);
+static esp_err_t _read_node_wild_info(uint64_t);
 
 void clear_data_model()
 {
@@ -82,7 +90,6 @@ void clear_data_model()
         delete dev_ptr.second;
     }
     get_dev_ptr.clear();
-    get_ep_ptr.clear();
 }
 
 void print_data_model()
@@ -135,8 +142,11 @@ void print_data_model()
 void report_data_model()
 {
     char *json_data = esp_controller_get_datamodel_json();
+    if (!json_data)
+        return;
 
     printf("\njson_data: %s\n", json_data);
+    free(json_data);
 
     //    esp_rmaker_controller_report_status_using_params(json_data);
 }
@@ -178,16 +188,17 @@ esp_err_t change_data_model_attribute(uint64_t node_id, uint16_t endpoint_id, ui
 
     return ESP_OK;
 }
+// Вызывается node_reachability при смене доступности узла
 esp_err_t change_node_reachability(uint64_t node_id, bool updated_val)
 {
-    if (get_dev_ptr.find(node_id) != get_dev_ptr.end())
-    {
-        ESP_LOGI(TAG, "Reachability changed for nodeid: %016llx", node_id);
-        dev_data *dev = get_dev_ptr[node_id];
-        dev->reachable = updated_val;
-    }
+    auto it = get_dev_ptr.find(node_id);
+    if (it == get_dev_ptr.end() || it->second->reachable == updated_val)
+        return ESP_OK;
 
-    report_data_model();
+    ESP_LOGI(TAG, "Reachability changed for nodeid: %016llx", node_id);
+    it->second->reachable = updated_val;
+    if (it->second->update_and_report_reachability)
+        report_data_model();
 
     return ESP_OK;
 }
@@ -249,16 +260,16 @@ static esp_err_t json_gen(json_gen_str_t *jstr)
 
         for (const auto &node_ptr : dev_ptr.second->get_endpoint_ptr)
         {
-            char epid[3];
-            sprintf(epid, "%x", node_ptr.second->endpoint_id);
+            char epid[5];
+            snprintf(epid, sizeof(epid), "%x", node_ptr.second->endpoint_id);
             std::string ep_str = "0x";
             ep_str += epid;
             json_gen_push_object(jstr, (char *)ep_str.c_str());
             // json_gen_push_object(jstr,epid);
             ep_str.clear();
 
-            char dev_type[5];
-            sprintf(dev_type, "%x", node_ptr.second->device_type);
+            char dev_type[9];
+            snprintf(dev_type, sizeof(dev_type), "%" PRIx32, node_ptr.second->device_type);
             json_gen_obj_set_string(jstr, "device_type", dev_type);
 
             if (node_ptr.second->get_cluster_ptr.size() > 0)
@@ -267,8 +278,8 @@ static esp_err_t json_gen(json_gen_str_t *jstr)
                 for (const auto &cluster_ptr : node_ptr.second->get_cluster_ptr)
                 {
 
-                    char cl_id[5];
-                    sprintf(cl_id, "%x", cluster_ptr.second->cluster_id);
+                    char cl_id[9];
+                    snprintf(cl_id, sizeof(cl_id), "%" PRIx32, cluster_ptr.second->cluster_id);
                     std::string val = "0x";
                     val += cl_id;
 
@@ -306,178 +317,234 @@ static esp_err_t json_gen(json_gen_str_t *jstr)
     return ESP_OK;
 }
 
-static void parse_cb_response(cb_data *_data)
+// endpoint узла, создается при первом обращении
+static data_model *get_endpoint(uint64_t node_id, uint16_t endpoint_id)
 {
-    // printf("\nin parse_cb_response\n");
+    auto dev = get_dev_ptr.find(node_id);
+    if (dev == get_dev_ptr.end())
+        return nullptr;
+
+    data_model *&ep = dev->second->get_endpoint_ptr[endpoint_id];
+    if (!ep)
+        ep = new data_model(node_id, endpoint_id);
+    return ep;
+}
 
-    if (_data->attr_path.mEndpointId == 0x0 && _data->attr_path.mClusterId == Descriptor::Id && _data->attr_path.mAttributeId == Descriptor::Attributes::PartsList::Id)
+// Строковое значение скалярного атрибута. Списки, структуры и байтовые строки не декодируются
+static bool decode_scalar(chip::TLV::TLVReader *data, std::string &val)
+{
+    switch (data->GetType())
+    {
+    case chip::TLV::kTLVType_SignedInteger:
+    {
+        int64_t value;
+        if (data->Get(value) != CHIP_NO_ERROR)
+            return false;
+        val = std::to_string(value);
+        return true;
+    }
+    case chip::TLV::kTLVType_UnsignedInteger:
+    {
+        uint64_t value;
+        if (data->Get(value) != CHIP_NO_ERROR)
+            return false;
+        val = std::to_string(value);
+        return true;
+    }
+    case chip::TLV::kTLVType_Boolean:
     {
-        // printf("\ncb_response Node_id: %016llx  Endpoint: %u Cluster: " ChipLogFormatMEI " Attribute " ChipLogFormatMEI "\n",
-        // _data->node_id,_data->attr_path.mEndpointId, ChipLogValueMEI(_data->attr_path.mClusterId), ChipLogValueMEI(_data->attr_path.mAttributeId));
+        bool value;
+        if (data->Get(value) != CHIP_NO_ERROR)
+            return false;
+        val = std::to_string(value);
+        return true;
+    }
+    case chip::TLV::kTLVType_FloatingPointNumber:
+    {
+        double value;
+        if (data->Get(value) != CHIP_NO_ERROR)
+            return false;
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%g", value);
+        val = buf;
+        return true;
+    }
+    case chip::TLV::kTLVType_UTF8String:
+    {
+        chip::CharSpan value;
+        if (data->Get(value) != CHIP_NO_ERROR)
+            return false;
+        val.assign(value.data(), value.size());
+        return true;
+    }
+    case chip::TLV::kTLVType_Null:
+        val = "null";
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void parse_cb_response(uint64_t node_id, const chip::app::ConcreteDataAttributePath &path, chip::TLV::TLVReader *data)
+{
+    if (get_dev_ptr.find(node_id) == get_dev_ptr.end())
+        return; // узел не входит в текущее обновление
 
+    if (path.mEndpointId == 0x0 && path.mClusterId == Descriptor::Id && path.mAttributeId == Descriptor::Attributes::PartsList::Id)
+    {
         chip::app::DataModel::DecodableList<chip::EndpointId> value;
-        CHIP_ERROR err = chip::app::DataModel::Decode(*_data->tlv_data, value);
+        CHIP_ERROR err = chip::app::DataModel::Decode(*data, value);
         if (err != CHIP_NO_ERROR)
-            ESP_LOGE(TAG, "\nparts Decode not OK err %d\n", err);
+        {
+            ESP_LOGE(TAG, "PartsList decode failed for node %016llx: %" CHIP_ERROR_FORMAT, node_id, err.Format());
+            return;
+        }
 
         auto iter = value.begin();
-
         while (iter.Next())
-        {
-
-            chip::EndpointId ep = iter.GetValue();
-            data_model *node_info = new data_model(_data->node_id, ep);
-            get_ep_ptr[ep] = node_info;
-            get_dev_ptr[_data->node_id]->get_endpoint_ptr[ep] = node_info;
-        }
+            get_endpoint(node_id, iter.GetValue());
     }
-    else if (_data->attr_path.mEndpointId != 0x0 && _data->attr_path.mClusterId == Descriptor::Id && _data->attr_path.mAttributeId == Descriptor::Attributes::DeviceTypeList::Id)
+    else if (path.mEndpointId != 0x0 && path.mClusterId == Descriptor::Id && path.mAttributeId == Descriptor::Attributes::DeviceTypeList::Id)
     {
         chip::app::DataModel::DecodableList<chip::app::Clusters::Descriptor::Structs::DeviceTypeStruct::DecodableType> value;
-
-        if (chip::app::DataModel::Decode(*_data->tlv_data, value) != CHIP_NO_ERROR)
+        if (chip::app::DataModel::Decode(*data, value) != CHIP_NO_ERROR)
         {
-            ESP_LOGE(TAG, "\ndevtype Decode OK\n");
+            ESP_LOGE(TAG, "DeviceTypeList decode failed for node %016llx", node_id);
+            return;
         }
 
+        data_model *ep = get_endpoint(node_id, path.mEndpointId);
         auto iter = value.begin();
-
         while (iter.Next())
-        {
-            chip::app::Clusters::Descriptor::Structs::DeviceTypeStruct::DecodableType val = iter.GetValue();
-
-            get_ep_ptr[_data->attr_path.mEndpointId]->device_type = val.deviceType;
-        }
+            ep->device_type = iter.GetValue().deviceType;
     }
-
-    else if (_data->attr_path.mEndpointId != 0x0 && _data->attr_path.mClusterId == Descriptor::Id && _data->attr_path.mAttributeId == Descriptor::Attributes::ServerList::Id)
+    else if (path.mEndpointId != 0x0 && path.mClusterId == Descriptor::Id && path.mAttributeId == Descriptor::Attributes::ServerList::Id)
     {
         chip::app::DataModel::DecodableList<chip::ClusterId> value;
-        if (chip::app::DataModel::Decode(*_data->tlv_data, value) == CHIP_NO_ERROR)
+        if (chip::app::DataModel::Decode(*data, value) != CHIP_NO_ERROR)
         {
-        };
+            ESP_LOGE(TAG, "ServerList decode failed for node %016llx", node_id);
+            return;
+        }
 
+        data_model *ep = get_endpoint(node_id, path.mEndpointId);
         auto iter = value.begin();
-        // size_t i  = 0;
         while (iter.Next())
         {
-
-            chip::ClusterId val = iter.GetValue();
-            ep_cluster *ncluster = new ep_cluster(val);
-            get_ep_ptr[_data->attr_path.mEndpointId]->get_cluster_ptr[val] = ncluster;
+            chip::ClusterId cluster_id = iter.GetValue();
+            if (ep->get_cluster_ptr.find(cluster_id) == ep->get_cluster_ptr.end())
+                ep->get_cluster_ptr[cluster_id] = new ep_cluster(cluster_id);
         }
     }
-    else if (_data->attr_path.mEndpointId != 0x0 && _data->attr_path.mClusterId != 0x1d && _data->attr_path.mAttributeId != 0xFFF8 &&
-             _data->attr_path.mAttributeId != 0xFFF9 && _data->attr_path.mAttributeId != 0xFFFA && _data->attr_path.mAttributeId != 0xFFFB && _data->attr_path.mAttributeId != 0xFFFC && _data->attr_path.mAttributeId != 0xFFFD)
+    else if (path.mEndpointId != 0x0 && path.mClusterId != Descriptor::Id && path.mAttributeId < 0xFFF8)
     {
-        data_model *node_ptr = get_ep_ptr[_data->attr_path.mEndpointId];
+        // глобальные атрибуты (0xFFF8..0xFFFD) в модель не попадают
+        data_model *ep = get_endpoint(node_id, path.mEndpointId);
+        auto cluster = ep->get_cluster_ptr.find(path.mClusterId);
+        if (cluster == ep->get_cluster_ptr.end())
+            return;
 
-        int type = _data->tlv_data->GetType();
         std::string val;
+        if (!decode_scalar(data, val))
+            return;
+
+        cl_attribute *&attr = cluster->second->get_attribute_ptr[path.mAttributeId];
+        if (attr)
+            attr->value = val;
+        else
+            attr = new cl_attribute(path.mAttributeId, val);
+    }
+}
 
-        switch (type)
-        {
-            // case 0x0:
-            // {
-            //     int attribute_value;
-            //     if(chip::app::DataModel::Decode(*_data->tlv_data, attribute_value)==CHIP_NO_ERROR)
-            //     {
-            //         printf("\nattribute decode OK.\n");
-            //         val = std::to_string(attribute_value);
-            //     }
-            //     else
-            //         printf("\nattribute decode not OK.\n");
-            //     break;
-            // }
-
-        case 0x4:
-        {
-            u_int16_t attribute_value;
-            if (chip::app::DataModel::Decode(*_data->tlv_data, attribute_value) == CHIP_NO_ERROR)
-            {
-                val = std::to_string(attribute_value);
-            }
-            else
-                ESP_LOGE(TAG, "\nattribute decode not OK.\n");
-            break;
-        }
-        case 0x8:
-        {
-            bool attribute_value;
-            if (chip::app::DataModel::Decode(*_data->tlv_data, attribute_value) == CHIP_NO_ERROR)
-            {
+static void finish_refresh()
+{
+    uint32_t duration_ms = static_cast<uint32_t>((esp_timer_get_time() - refresh_started_us) / 1000);
+    ESP_LOGI(TAG, "Data model refresh of %u nodes done in %" PRIu32 " ms (up to %u reads in flight)",
+             static_cast<unsigned>(refresh_node_count), duration_ms, static_cast<unsigned>(READ_NODE_INFO_MAX_INFLIGHT));
+    refresh_node_count = 0;
+    print_data_model();
+}
 
-                val = std::to_string(attribute_value);
-            }
-            else
-                ESP_LOGE(TAG, "\nattribute decode not OK.\n");
-            break;
-        }
-        default:
-            val = "Unhandled type";
-            break;
-        }
+static void refresh_sweep_cb(chip::System::Layer *aLayer, void *appState);
 
-        // std::cout<<std::hex<<"\""<<_data->attr_path.mAttributeId<<"\" : "<<val<<std::endl;
-        if (node_ptr->get_cluster_ptr.find(_data->attr_path.mClusterId) != node_ptr->get_cluster_ptr.end())
-        {
+// Запуск чтений из очереди, пока есть свободные слоты
+static void start_pending_reads()
+{
+    while (inflight_nodes.size() < READ_NODE_INFO_MAX_INFLIGHT && !pending_nodes.empty())
+    {
+        uint64_t node_id = pending_nodes.front();
+        pending_nodes.pop_front();
 
-            ep_cluster *curr_cluster = node_ptr->get_cluster_ptr[_data->attr_path.mClusterId];
+        // чтение этого узла из предыдущего обновления еще идет, его данные попадут в новую модель
+        if (inflight_nodes.find(node_id) != inflight_nodes.end())
+            continue;
 
-            cl_attribute *nattribute = new cl_attribute(_data->attr_path.mAttributeId, val);
+        // ошибка запуска чтения - локальная, о доступности узла не говорит
+        if (_read_node_wild_info(node_id) != ESP_OK)
+            continue;
+        inflight_nodes[node_id] = esp_timer_get_time();
+    }
 
-            curr_cluster->get_attribute_ptr[_data->attr_path.mAttributeId] = nattribute;
-        }
+    if (!inflight_nodes.empty() && !refresh_sweep_running)
+    {
+        // при ошибке CASE read_command удаляется без вызова read_done, такие чтения снимаются по таймауту
+        refresh_sweep_running = chip::DeviceLayer::SystemLayer().StartTimer(
+                                    chip::System::Clock::Seconds32(READ_NODE_INFO_SWEEP_SEC), refresh_sweep_cb, nullptr) == CHIP_NO_ERROR;
     }
 
-    delete _data;
+    if (inflight_nodes.empty() && pending_nodes.empty() && refresh_node_count > 0)
+        finish_refresh();
 }
 
-static void attribute_data_read_done(uint64_t remote_node_id, const ScopedMemoryBufferWithSize<AttributePathParams> &attr_path, const ScopedMemoryBufferWithSize<EventPathParams> &event_path)
+static void refresh_sweep_cb(chip::System::Layer *aLayer, void *appState)
 {
-    ESP_LOGI(TAG, "\nRead Info done for Nodeid: %016llx  Endpoint: %u Cluster: " ChipLogFormatMEI " Attribute " ChipLogFormatMEI "\n",
-             remote_node_id, attr_path[0].mEndpointId, ChipLogValueMEI(attr_path[0].mClusterId), ChipLogValueMEI(attr_path[0].mAttributeId));
-
-    node_id_list_index++;
-
-    if (node_id_list_index < node_id_list.size())
-        _read_node_wild_info(node_id_list[node_id_list_index]);
-    else
-        print_data_model();
+    refresh_sweep_running = false;
+    int64_t now = esp_timer_get_time();
+    for (auto it = inflight_nodes.begin(); it != inflight_nodes.end();)
+    {
+        if (now - it->second > static_cast<int64_t>(READ_NODE_INFO_TIMEOUT_SEC) * 1000000)
+        {
+            ESP_LOGW(TAG, "Read of node %016llx timed out", it->first);
+            node_reachability_failed(it->first, NODE_REACHABILITY_READ);
+            it = inflight_nodes.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    start_pending_reads();
 }
 
-static void attribute_data_cb(uint64_t remote_node_id, const chip::app::ConcreteDataAttributePath &path, chip::TLV::TLVReader *data)
+static void attribute_data_read_done(uint64_t remote_node_id, const ScopedMemoryBufferWithSize<AttributePathParams> &attr_path, const ScopedMemoryBufferWithSize<EventPathParams> &event_path)
 {
-    ChipLogProgress(chipTool, "Nodeid: %016llx  Endpoint: %u Cluster: " ChipLogFormatMEI " Attribute " ChipLogFormatMEI " DataVersion: %" PRIu32,
-                    remote_node_id, path.mEndpointId, ChipLogValueMEI(path.mClusterId), ChipLogValueMEI(path.mAttributeId),
-                    path.mDataVersion.ValueOr(0));
+    ESP_LOGI(TAG, "Read info done for node %016llx", remote_node_id);
 
-    if (path.mEndpointId == 0x0 && path.mClusterId == Descriptor::Id && path.mAttributeId == Descriptor::Attributes::PartsList::Id)
+    // чтение завершилось без данных - узел не ответил
+    auto dev = get_dev_ptr.find(remote_node_id);
+    if (dev != get_dev_ptr.end())
     {
-        cb_data *_data = new callback_data(remote_node_id, path, data);
-        parse_cb_response(_data);
+        if (dev->second->get_endpoint_ptr.empty())
+            node_reachability_failed(remote_node_id, NODE_REACHABILITY_READ);
+        else
+            node_reachability_alive(remote_node_id);
     }
 
-    else if (path.mEndpointId != 0x0)
-    {
-        callback_data *_data = new callback_data(remote_node_id, path, data);
-        parse_cb_response(_data);
-    }
+    inflight_nodes.erase(remote_node_id);
+    start_pending_reads();
 }
 
-static void _read_node_info(intptr_t arg)
+static void attribute_data_cb(uint64_t remote_node_id, const chip::app::ConcreteDataAttributePath &path, chip::TLV::TLVReader *data)
 {
-    dev_data *ptr = (dev_data *)arg;
-    if (!ptr)
-    {
-        ESP_LOGE(TAG, "Read device state with null ptr");
-        return;
-    }
+    ChipLogProgress(chipTool, "Nodeid: %016llx  Endpoint: %u Cluster: " ChipLogFormatMEI " Attribute " ChipLogFormatMEI " DataVersion: %" PRIu32,
+                    remote_node_id, path.mEndpointId, ChipLogValueMEI(path.mClusterId), ChipLogValueMEI(path.mAttributeId),
+                    path.mDataVersion.ValueOr(0));
 
-    _read_node_wild_info(node_id_list[node_id_list_index]);
+    if (data)
+        parse_cb_response(remote_node_id, path, data);
 }
 
-static void _read_node_wild_info(uint64_t nodeid)
+static esp_err_t _read_node_wild_info(uint64_t nodeid)
 {
     esp_matter::controller::read_command *cmd = chip::Platform::New<read_command>(nodeid, 0xFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
                                                                                   esp_matter::controller::READ_ATTRIBUTE, attribute_data_cb, attribute_data_read_done, nullptr);
@@ -485,45 +552,57 @@ static void _read_node_wild_info(uint64_t nodeid)
     if (!cmd)
     {
         ESP_LOGE(TAG, "Failed to alloc memory for read_command");
-        return;
+        return ESP_ERR_NO_MEM;
     }
 
-    cmd->send_command();
-    ESP_LOGI(TAG, "\nfetching info of node_id: %016llx\n", node_id_list[node_id_list_index]);
+    esp_err_t err = cmd->send_command();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to read node %016llx: %s", nodeid, esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "fetching info of node_id: %016llx", nodeid);
+    return ESP_OK;
 }
 
-void update_and_report_reachability(std::vector<uint64_t> nodeid_list)
+static void _read_node_info(intptr_t arg)
 {
-    for (auto &node_id : online_devices)
-        node_id.second = false;
-    for (auto &node_id : nodeid_list)
+    std::vector<uint64_t> *nodeid_list = reinterpret_cast<std::vector<uint64_t> *>(arg);
+    if (!nodeid_list)
     {
-        online_devices[node_id] = true;
-        change_node_reachability(node_id, true); // <-- Добавьте эту строку!
+        ESP_LOGE(TAG, "Read device state with null ptr");
+        return;
     }
-    for (auto &node_id : online_devices)
+
+    // Модель пересобирается на потоке CHIP, где приходят и ответы на чтения
+    clear_data_model();
+    pending_nodes.clear();
+    for (uint64_t nodeid : *nodeid_list)
     {
-        if (node_id.second == false)
-        {
-            change_node_reachability(node_id.first, false);
-        }
+        if (get_dev_ptr.find(nodeid) != get_dev_ptr.end())
+            continue;
+        dev_data *dev = new dev_data(nodeid);
+        dev->reachable = node_reachability_online(nodeid);
+        get_dev_ptr[nodeid] = dev;
+        pending_nodes.push_back(nodeid);
     }
+    delete nodeid_list;
+
+    refresh_node_count = pending_nodes.size();
+    refresh_started_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Refreshing data model of %u nodes", static_cast<unsigned>(refresh_node_count));
+    start_pending_reads();
 }
 
 void read_node_info(std::vector<uint64_t> nodeid_list)
 {
-    update_and_report_reachability(nodeid_list);
-    clear_data_model();
-    node_id_list.clear();
-    node_id_list_index = 0;
+    if (nodeid_list.empty())
+        return;
 
-    for (uint64_t nodeid : nodeid_list)
+    std::vector<uint64_t> *list = new std::vector<uint64_t>(std::move(nodeid_list));
+    if (chip::DeviceLayer::PlatformMgr().ScheduleWork(_read_node_info, reinterpret_cast<intptr_t>(list)) != CHIP_NO_ERROR)
     {
-        node_id_list.push_back(nodeid);
-        dev_data *dev_info = new dev_data(nodeid);
-        get_dev_ptr[nodeid] = dev_info;
+        ESP_LOGE(TAG, "Failed to schedule data model refresh");
+        delete list;
     }
-    nodeid_list.clear();
-    dev_data *dev_info = get_dev_ptr[node_id_list[node_id_list_index]];
-    chip::DeviceLayer::PlatformMgr().ScheduleWork(_read_node_info, (intptr_t)dev_info);
 }
@@ -53,16 +53,6 @@ typedef struct dev_data
 
 } dev_data;
 
-typedef struct callback_data
-{
-    uint64_t node_id;
-    chip::app::ConcreteDataAttributePath attr_path;
-    chip::TLV::TLVReader *tlv_data;
-
-    callback_data(uint64_t nodeid, chip::app::ConcreteDataAttributePath attrpath, chip::TLV::TLVReader *tlvdata) : node_id(nodeid), attr_path(attrpath), tlv_data(tlvdata) {}
-
-} cb_data;
-
 void print_data_model();
 
 void clear_data_model();
@@ -73,6 +63,10 @@ esp_err_t change_data_model_attribute(uint64_t node_id, uint16_t endpoint_id, ui
 
 esp_err_t change_node_reachability(uint64_t node_id, bool);
 
+/**
+ * @brief Пересборка модели данных: чтение узлов списка, не более нескольких одновременно.
+ *        Выполняется на потоке CHIP, по завершении модель выводится через report_data_model()
+ */
 void read_node_info(std::vector<uint64_t>);
 
 // #ifdef __cplusplus
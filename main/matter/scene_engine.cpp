@@ -0,0 +1,587 @@
+#include "scene_engine.h"
+#include "command_batch.h"
+#include "command_tracker.h"
+#include "group_control.h"
+#include "mqtt.h"
+#include "mqtt_topics.h"
+#include "json_stream.h"
+#include "chip_work.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <atomic>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <platform/CHIPDeviceLayer.h>
+
+static const char *TAG = "scene_engine";
+
+#define NVS_SCENES_NAMESPACE "matter_scene"
+#define NVS_SCENES_INDEX_KEY "index"
+#define SCENE_BLOB_MAGIC 0x5343 // "SC"
+#define SCENE_KEY_LEN 8
+
+// Цель в NVS: node u64, endpoint u16, cluster u32, команда/атрибут u32, флаги u8, длина value u8, value без '\0'
+#define SCENE_TARGET_HEADER_SIZE (8 + 2 + 4 + 4 + 1 + 1)
+#define SCENE_TARGET_FLAG_WRITE 0x01
+
+typedef struct
+{
+    uint16_t scene_id;
+    uint8_t count;
+    char name[SCENE_ENGINE_NAME_MAX];
+} scene_index_entry_t;
+
+typedef struct
+{
+    uint8_t count;
+    scene_index_entry_t entries[SCENE_ENGINE_MAX_SCENES];
+} scene_index_t;
+
+typedef enum
+{
+    TARGET_PENDING = 0,
+    TARGET_INFLIGHT,
+    TARGET_DONE,
+} target_state_t;
+
+typedef struct scene_recall scene_recall_t;
+
+typedef struct
+{
+    command_op_t op;
+    const char *value; // в пуле вызова, "" - без данных
+    scene_recall_t *recall;
+    uint8_t state;
+} scene_target_t;
+
+// Вызов сцены: заголовок, затем count целей, затем пул строк value
+struct scene_recall
+{
+    uint16_t scene_id;
+    char id[COMMAND_TRACKER_ID_MAX];
+    uint8_t count;
+    uint8_t done;
+    uint8_t inflight;
+    uint8_t groupcasts;
+    uint8_t ok;
+    uint8_t failed;
+    uint8_t timeouts;
+    bool pumping; // идет проход pump(), завершения целей только считаются
+    int64_t started_us;
+    scene_target_t targets[];
+};
+
+static std::atomic<int> active_recalls{0};
+
+static void make_key(uint16_t scene_id, char *key)
+{
+    snprintf(key, SCENE_KEY_LEN, "s%u", scene_id);
+}
+
+static void load_index(nvs_handle_t handle, scene_index_t *index)
+{
+    size_t size = sizeof(*index);
+    if (nvs_get_blob(handle, NVS_SCENES_INDEX_KEY, index, &size) != ESP_OK || size != sizeof(*index) ||
+        index->count > SCENE_ENGINE_MAX_SCENES)
+    {
+        memset(index, 0, sizeof(*index));
+    }
+}
+
+static int index_find(const scene_index_t *index, uint16_t scene_id)
+{
+    for (uint8_t i = 0; i < index->count; i++)
+    {
+        if (index->entries[i].scene_id == scene_id)
+            return i;
+    }
+    return -1;
+}
+
+static void publish_store_reply(const char *topic, uint16_t scene_id, const char *status, const char *error,
+                                int target)
+{
+    char msg[192];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "scene");
+    json_stream_string(&js, "op", "store");
+    json_stream_uint(&js, "scene", scene_id);
+    json_stream_string(&js, "status", status);
+    if (error)
+        json_stream_string(&js, "error", error);
+    if (target >= 0)
+        json_stream_uint(&js, "target", target);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data_len(topic, msg, js.len);
+}
+
+static uint8_t *put(uint8_t *ptr, const void *data, size_t size)
+{
+    memcpy(ptr, data, size);
+    return ptr + size;
+}
+
+esp_err_t scene_engine_store(const cJSON *json, const char *eventTopic)
+{
+    const cJSON *scene = cJSON_GetObjectItem(json, "scene");
+    const cJSON *name = cJSON_GetObjectItem(json, "name");
+    const cJSON *targets = cJSON_GetObjectItem(json, "targets");
+    if (!cJSON_IsNumber(scene) || scene->valuedouble < 1 || scene->valuedouble > UINT16_MAX)
+    {
+        publish_store_reply(eventTopic, 0, "invalid", "scene must be 1..65535", -1);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint16_t scene_id = (uint16_t)scene->valuedouble;
+    if (name && (!cJSON_IsString(name) || strlen(name->valuestring) >= SCENE_ENGINE_NAME_MAX))
+    {
+        publish_store_reply(eventTopic, scene_id, "invalid", "name must be a string up to 16 characters", -1);
+        return ESP_ERR_INVALID_ARG;
+    }
+    int count = cJSON_IsArray(targets) ? cJSON_GetArraySize(targets) : 0;
+    if (count <= 0 || count > SCENE_ENGINE_MAX_TARGETS)
+    {
+        publish_store_reply(eventTopic, scene_id, "invalid", "targets must be an array of 1..32 targets", -1);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // blob собирается по мере проверки целей, value в нем без '\0'
+    uint8_t *blob = (uint8_t *)malloc(3 + count * (SCENE_TARGET_HEADER_SIZE + COMMAND_BATCH_MAX_VALUE));
+    if (!blob)
+    {
+        publish_store_reply(eventTopic, scene_id, esp_err_to_name(ESP_ERR_NO_MEM), NULL, -1);
+        return ESP_ERR_NO_MEM;
+    }
+    uint16_t magic = SCENE_BLOB_MAGIC;
+    uint8_t *ptr = put(blob, &magic, sizeof(magic));
+    *ptr++ = (uint8_t)count;
+    for (int i = 0; i < count; i++)
+    {
+        command_op_t op;
+        char *value;
+        const char *error = command_batch_parse_op(cJSON_GetArrayItem(targets, i), &op, &value);
+        if (error)
+        {
+            free(blob);
+            publish_store_reply(eventTopic, scene_id, "invalid", error, i);
+            return ESP_ERR_INVALID_ARG;
+        }
+        uint8_t flags = op.write ? SCENE_TARGET_FLAG_WRITE : 0;
+        uint8_t value_len = value ? (uint8_t)strlen(value) : 0;
+        ptr = put(ptr, &op.node_id, sizeof(op.node_id));
+        ptr = put(ptr, &op.endpoint_id, sizeof(op.endpoint_id));
+        ptr = put(ptr, &op.cluster_id, sizeof(op.cluster_id));
+        ptr = put(ptr, &op.id, sizeof(op.id));
+        *ptr++ = flags;
+        *ptr++ = value_len;
+        ptr = put(ptr, value ? value : "", value_len);
+        free(value);
+    }
+
+    char key[SCENE_KEY_LEN];
+    make_key(scene_id, key);
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_SCENES_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        scene_index_t index;
+        load_index(handle, &index);
+        int slot = index_find(&index, scene_id);
+        if (slot < 0 && index.count == SCENE_ENGINE_MAX_SCENES)
+        {
+            err = ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            if (slot < 0)
+                slot = index.count++;
+            scene_index_entry_t *entry = &index.entries[slot];
+            entry->scene_id = scene_id;
+            entry->count = (uint8_t)count;
+            strlcpy(entry->name, cJSON_IsString(name) ? name->valuestring : "", sizeof(entry->name));
+            err = nvs_set_blob(handle, key, blob, ptr - blob);
+            if (err == ESP_OK)
+                err = nvs_set_blob(handle, NVS_SCENES_INDEX_KEY, &index, sizeof(index));
+            if (err == ESP_OK)
+                err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    size_t size = ptr - blob;
+    free(blob);
+
+    if (err == ESP_OK)
+        ESP_LOGI(TAG, "Scene %u stored: %d targets, %u bytes", scene_id, count, (unsigned)size);
+    else
+        ESP_LOGE(TAG, "Failed to store scene %u: %s", scene_id, esp_err_to_name(err));
+    publish_store_reply(eventTopic, scene_id, err == ESP_OK ? "done" : esp_err_to_name(err), NULL, -1);
+    return err;
+}
+
+esp_err_t scene_engine_delete(uint16_t scene_id)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_SCENES_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return ESP_ERR_NOT_FOUND;
+    scene_index_t index;
+    load_index(handle, &index);
+    int slot = index_find(&index, scene_id);
+    if (slot < 0)
+    {
+        nvs_close(handle);
+        return ESP_ERR_NOT_FOUND;
+    }
+    memmove(&index.entries[slot], &index.entries[slot + 1], (index.count - slot - 1) * sizeof(scene_index_entry_t));
+    index.count--;
+
+    char key[SCENE_KEY_LEN];
+    make_key(scene_id, key);
+    nvs_erase_key(handle, key);
+    err = nvs_set_blob(handle, NVS_SCENES_INDEX_KEY, &index, sizeof(index));
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t scene_engine_publish_list(const char *topic)
+{
+    scene_index_t index = {};
+    nvs_handle_t handle;
+    if (nvs_open(NVS_SCENES_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        load_index(handle, &index);
+        nvs_close(handle);
+    }
+
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+        return ESP_ERR_NO_MEM;
+    json_stream_t js;
+    json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "scene");
+    json_stream_string(&js, "op", "list");
+    json_stream_array_begin(&js, "scenes");
+    for (uint8_t i = 0; i < index.count; i++)
+    {
+        json_stream_object_begin(&js, NULL);
+        json_stream_uint(&js, "scene", index.entries[i].scene_id);
+        json_stream_string(&js, "name", index.entries[i].name);
+        json_stream_uint(&js, "targets", index.entries[i].count);
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    esp_err_t err = json_stream_finish(&js);
+    if (err == ESP_OK)
+        err = mqtt_publish_data_len(topic, msg, js.len);
+    json_stream_buf_release(msg);
+    return err;
+}
+
+// Сцена из NVS в структуру вызова
+static esp_err_t load_recall(uint16_t scene_id, scene_recall_t **out)
+{
+    char key[SCENE_KEY_LEN];
+    make_key(scene_id, key);
+    nvs_handle_t handle;
+    if (nvs_open(NVS_SCENES_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return ESP_ERR_NOT_FOUND;
+    size_t size = 0;
+    esp_err_t err = nvs_get_blob(handle, key, NULL, &size);
+    uint8_t *blob = err == ESP_OK && size >= 3 ? (uint8_t *)malloc(size) : NULL;
+    if (blob)
+        err = nvs_get_blob(handle, key, blob, &size);
+    nvs_close(handle);
+    if (!blob)
+        return err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : ESP_ERR_NO_MEM;
+    if (err != ESP_OK)
+    {
+        free(blob);
+        return err;
+    }
+
+    uint16_t magic;
+    memcpy(&magic, blob, sizeof(magic));
+    uint8_t count = blob[2];
+    // value в пуле с '\0': пул не больше blob'а плюс count байт
+    scene_recall_t *recall = magic == SCENE_BLOB_MAGIC && count && count <= SCENE_ENGINE_MAX_TARGETS
+                                 ? (scene_recall_t *)calloc(1, sizeof(scene_recall_t) + count * sizeof(scene_target_t) +
+                                                                   size + count)
+                                 : NULL;
+    if (!recall)
+    {
+        free(blob);
+        return magic == SCENE_BLOB_MAGIC ? ESP_ERR_NO_MEM : ESP_ERR_INVALID_SIZE;
+    }
+    recall->scene_id = scene_id;
+    recall->count = count;
+    char *pool = reinterpret_cast<char *>(recall->targets + count);
+    const uint8_t *ptr = blob + 3;
+    const uint8_t *end = blob + size;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        scene_target_t *target = &recall->targets[i];
+        if (end - ptr < SCENE_TARGET_HEADER_SIZE || end - ptr < SCENE_TARGET_HEADER_SIZE + ptr[19])
+        {
+            ESP_LOGE(TAG, "Scene %u is corrupted", scene_id);
+            free(recall);
+            free(blob);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(&target->op.node_id, ptr, 8);
+        memcpy(&target->op.endpoint_id, ptr + 8, 2);
+        memcpy(&target->op.cluster_id, ptr + 10, 4);
+        memcpy(&target->op.id, ptr + 14, 4);
+        target->op.write = ptr[18] & SCENE_TARGET_FLAG_WRITE;
+        uint8_t value_len = ptr[19];
+        memcpy(pool, ptr + SCENE_TARGET_HEADER_SIZE, value_len);
+        pool[value_len] = '\0';
+        target->value = pool;
+        target->recall = recall;
+        pool += value_len + 1;
+        ptr += SCENE_TARGET_HEADER_SIZE + value_len;
+    }
+    free(blob);
+    *out = recall;
+    return ESP_OK;
+}
+
+static void publish_recall_result(const scene_recall_t *recall)
+{
+    char msg[320];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "scene-recall");
+    json_stream_uint(&js, "scene", recall->scene_id);
+    if (recall->id[0])
+        json_stream_string(&js, "id", recall->id);
+    json_stream_string(&js, "status", recall->ok == recall->count ? "done" : "partial");
+    json_stream_uint(&js, "targets", recall->count);
+    json_stream_uint(&js, "groupcasts", recall->groupcasts);
+    json_stream_uint(&js, "ok", recall->ok);
+    json_stream_uint(&js, "failed", recall->failed);
+    json_stream_uint(&js, "timeouts", recall->timeouts);
+    json_stream_uint(&js, "elapsed_ms", (uint64_t)((esp_timer_get_time() - recall->started_us) / 1000));
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data_len(mqtt_topic(MQTT_TOPIC_EVENT), msg, js.len);
+}
+
+static void complete_target(scene_target_t *target, esp_err_t result)
+{
+    scene_recall_t *recall = target->recall;
+    if (target->state == TARGET_INFLIGHT)
+        recall->inflight--;
+    target->state = TARGET_DONE;
+    recall->done++;
+    if (result == ESP_OK)
+        recall->ok++;
+    else if (result == ESP_ERR_TIMEOUT)
+        recall->timeouts++;
+    else
+        recall->failed++;
+}
+
+static void pump(scene_recall_t *recall);
+
+static void target_done(void *ctx, esp_err_t result)
+{
+    scene_target_t *target = static_cast<scene_target_t *>(ctx);
+    scene_recall_t *recall = target->recall;
+    complete_target(target, result);
+    if (!recall->pumping)
+        pump(recall);
+}
+
+static uint8_t node_inflight(const scene_recall_t *recall, uint64_t node_id)
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < recall->count; i++)
+    {
+        if (recall->targets[i].state == TARGET_INFLIGHT && recall->targets[i].op.node_id == node_id)
+            count++;
+    }
+    return count;
+}
+
+// Отправка цели. false - command_tracker заполнен, цель остается в очереди
+static bool send_target(scene_target_t *target)
+{
+    scene_recall_t *recall = target->recall;
+    const command_op_t *op = &target->op;
+    command_track_t track = {};
+    track.kind = op->write ? COMMAND_TRACK_WRITE : COMMAND_TRACK_INVOKE;
+    track.node_id = op->node_id;
+    track.endpoint_id = op->endpoint_id;
+    track.cluster_id = op->cluster_id;
+    track.item_id = op->id;
+    track.action = "scene-recall";
+    track.timeout_ms = SCENE_ENGINE_TARGET_TIMEOUT_MS;
+    track.done = target_done;
+    track.done_ctx = target;
+
+    uint32_t token = command_tracker_begin(&track);
+    if (!token)
+    {
+        if (recall->inflight)
+            return false; // повтор после ответа на одну из отправленных
+        complete_target(target, ESP_ERR_NO_MEM);
+        return true;
+    }
+    target->state = TARGET_INFLIGHT;
+    recall->inflight++;
+    command_tracker_sent(token, command_batch_send_op(op, target->value));
+    return true;
+}
+
+static void finish_recall(scene_recall_t *recall)
+{
+    ESP_LOGI(TAG, "Scene %u recalled: %u/%u ok, %u groupcasts, %" PRIi64 " ms", recall->scene_id, recall->ok,
+             recall->count, recall->groupcasts, (esp_timer_get_time() - recall->started_us) / 1000);
+    publish_recall_result(recall);
+    free(recall);
+    active_recalls--;
+}
+
+// Отправка ждущих целей в пределах ограничений. Завершения внутри прохода (ошибка отправки, команда группе)
+// освобождают места, поэтому проход повторяется, пока что-то отправляется
+static void pump(scene_recall_t *recall)
+{
+    recall->pumping = true;
+    bool progress = true;
+    while (progress && recall->inflight < SCENE_ENGINE_MAX_INFLIGHT)
+    {
+        progress = false;
+        for (uint8_t i = 0; i < recall->count && recall->inflight < SCENE_ENGINE_MAX_INFLIGHT; i++)
+        {
+            scene_target_t *target = &recall->targets[i];
+            if (target->state != TARGET_PENDING ||
+                node_inflight(recall, target->op.node_id) >= SCENE_ENGINE_NODE_PARALLEL)
+                continue;
+            if (!send_target(target))
+                break;
+            progress = true;
+        }
+    }
+    recall->pumping = false;
+    if (recall->done == recall->count)
+        finish_recall(recall);
+}
+
+static bool same_command(const scene_target_t *a, const scene_target_t *b)
+{
+    return !a->op.write && !b->op.write && a->op.cluster_id == b->op.cluster_id && a->op.id == b->op.id &&
+           strcmp(a->value, b->value) == 0;
+}
+
+// Ждущая цель с той же командой для участника группы или NULL
+static scene_target_t *member_target(scene_recall_t *recall, const group_member_t *member, const scene_target_t *like)
+{
+    for (uint8_t i = 0; i < recall->count; i++)
+    {
+        scene_target_t *target = &recall->targets[i];
+        if (target->state == TARGET_PENDING && target->op.node_id == member->node_id &&
+            target->op.endpoint_id == member->endpoint_id && same_command(target, like))
+            return target;
+    }
+    return NULL;
+}
+
+// Групповая команда вместо целей, которые покрывают всех участников группы одной командой. Участники без такой
+// цели получили бы лишнюю команду, поэтому такая группа не используется
+static void send_groupcasts(scene_recall_t *recall)
+{
+    for (uint8_t g = 0; g < group_registry_count(); g++)
+    {
+        const matter_group_t *group = group_registry_get(g);
+        if (group->member_count < 2)
+            continue;
+        for (uint8_t i = 0; i < recall->count; i++)
+        {
+            scene_target_t *like = &recall->targets[i];
+            if (like->state != TARGET_PENDING || like->op.write ||
+                !member_target(recall, &group->members[0], like))
+                continue;
+            bool covered = true;
+            for (uint8_t m = 1; m < group->member_count && covered; m++)
+                covered = member_target(recall, &group->members[m], like) != NULL;
+            if (!covered)
+                continue;
+
+            uint32_t cluster_id = like->op.cluster_id;
+            uint32_t command_id = like->op.id;
+            esp_err_t err = group_control_invoke(group->group_id, cluster_id, command_id,
+                                                 like->value[0] ? like->value : nullptr, nullptr);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Groupcast to 0x%04X failed (%s), sending to members", group->group_id,
+                         esp_err_to_name(err));
+                break;
+            }
+            recall->groupcasts++;
+            // ответов нет, значение On/Off участников известно сразу
+            if (cluster_id == 6 && (command_id == 0 || command_id == 1))
+            {
+                esp_matter_attr_val_t on = esp_matter_bool(command_id == 1);
+                group_control_apply(group->group_id, 6, 0, &on);
+            }
+            const scene_target_t sent = *like;
+            for (uint8_t m = 0; m < group->member_count; m++)
+                complete_target(member_target(recall, &group->members[m], &sent), ESP_OK);
+        }
+    }
+}
+
+// arg - указатель на вызов
+static void start_recall(void *arg)
+{
+    scene_recall_t *recall = *static_cast<scene_recall_t **>(arg);
+    recall->started_us = esp_timer_get_time();
+    send_groupcasts(recall);
+    pump(recall);
+}
+
+esp_err_t scene_engine_recall(uint16_t scene_id, const char *id)
+{
+    if (++active_recalls > SCENE_ENGINE_MAX_ACTIVE)
+    {
+        active_recalls--;
+        return ESP_ERR_NO_MEM;
+    }
+    scene_recall_t *recall = nullptr;
+    esp_err_t err = load_recall(scene_id, &recall);
+    if (err != ESP_OK)
+    {
+        active_recalls--;
+        return err;
+    }
+    strlcpy(recall->id, id ? id : "", sizeof(recall->id));
+    // цели и их value - одно выделение на вызов сцены (до SCENE_ENGINE_MAX_TARGETS), в записи - указатель
+    err = chip_work_post(start_recall, &recall, sizeof(recall));
+    if (err != ESP_OK)
+    {
+        free(recall);
+        active_recalls--;
+    }
+    return err;
+}
+
+void scene_engine_clear(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(NVS_SCENES_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        nvs_erase_all(handle);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef SCENE_ENGINE_H
+#define SCENE_ENGINE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+// Сцен на контроллере не больше
+#define SCENE_ENGINE_MAX_SCENES 16
+// Целей в сцене не больше (как операций в пакете)
+#define SCENE_ENGINE_MAX_TARGETS 32
+// Длина имени сцены
+#define SCENE_ENGINE_NAME_MAX 17
+// Команд одному узлу, ожидающих ответа одновременно (Thread-узлу не выгодно больше)
+#define SCENE_ENGINE_NODE_PARALLEL 2
+// Команд сцены, ожидающих ответа одновременно (остальные записи command_tracker - другим командам)
+#define SCENE_ENGINE_MAX_INFLIGHT 8
+// Ожидание ответа на команду цели
+#define SCENE_ENGINE_TARGET_TIMEOUT_MS 5000
+// Сцен, вызываемых одновременно
+#define SCENE_ENGINE_MAX_ACTIVE 2
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Проверка и сохранение сцены в NVS: {"scene":1,"name":"evening","targets":[{"node":1,"endpoint":1,
+     *        "cluster":6,"command":1},{"node":2,"endpoint":1,"cluster":8,"command":0,"value":{...}}]}.
+     *        Цели - в формате операций пакета (command_batch_parse_op()), сцена с тем же номером заменяется.
+     *        Ответ {"action":"scene","op":"store","scene":..,"status":"done"|"invalid"|<ошибка>,"error":..}
+     *
+     * @param json Сообщение
+     * @param eventTopic Топик для ответа
+     */
+    esp_err_t scene_engine_store(const cJSON *json, const char *eventTopic);
+
+    esp_err_t scene_engine_delete(uint16_t scene_id);
+
+    // Публикация списка сцен: {"action":"scene","op":"list","scenes":[{"scene":..,"name":..,"targets":..}]}
+    esp_err_t scene_engine_publish_list(const char *topic);
+
+    /**
+     * @brief Вызов сцены. Цели, которые покрывают всех участников группы одной и той же командой, отправляются одной
+     *        групповой командой, остальные - параллельно, не больше SCENE_ENGINE_NODE_PARALLEL на узел и
+     *        SCENE_ENGINE_MAX_INFLIGHT всего, следующая - после ответа на предыдущую. После ответов на все цели в топик
+     *        событий публикуется {"action":"scene-recall","scene":..,"id":..,"status":"done"|"partial","targets":..,
+     *        "groupcasts":..,"ok":..,"failed":..,"timeouts":..,"elapsed_ms":..}. Можно вызывать из любой задачи
+     *
+     * @param id id из входящего сообщения или NULL
+     * @return esp_err_t ESP_ERR_NOT_FOUND - нет сцены, ESP_ERR_NO_MEM - уже вызываются SCENE_ENGINE_MAX_ACTIVE сцен
+     *         или очередь chip_work заполнена
+     */
+    esp_err_t scene_engine_recall(uint16_t scene_id, const char *id);
+
+    // Удаление всех сцен из NVS
+    void scene_engine_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCENE_ENGINE_H
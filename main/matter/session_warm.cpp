@@ -0,0 +1,549 @@
+#include "session_warm.h"
+#include "node_reachability.h"
+#include "mqtt.h"
+#include "json_stream.h"
+#include <string.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <app/CASESessionManager.h>
+#include <app/InteractionModelEngine.h>
+#include <app/ReadClient.h>
+#include <app/server/Server.h>
+#include <platform/CHIPDeviceLayer.h>
+#include <transport/raw/PeerAddress.h>
+#include <esp_matter_controller_client.h>
+#if CONFIG_ESP_MATTER_COMMISSIONER_ENABLE
+#include <controller/CHIPDeviceControllerFactory.h>
+#endif
+
+static const char *TAG = "session_warm";
+
+#define NVS_WARM_NAMESPACE "matter_warm"
+#define NVS_WARM_NODES_KEY "nodes"
+
+// Проверка сессии: BasicInformation.DataModelRevision, обязателен на endpoint 0
+#define PROBE_ENDPOINT 0
+#define PROBE_CLUSTER 0x0028
+#define PROBE_ATTRIBUTE 0x0000
+
+typedef struct
+{
+    uint64_t node_id;
+    bool busy;              // идет установка сессии или проверка
+    int64_t last_active_us; // последняя команда или проверка с ответом
+} warm_node_t;
+
+// Узел в кэше: последний адрес сессии и время установки сессий
+typedef struct
+{
+    uint64_t node_id;
+    chip::Transport::PeerAddress address;
+    int64_t address_us; // когда адрес получен, 0 - адреса нет
+    int64_t used_us;    // последнее обращение, для вытеснения
+    uint32_t setups;
+    uint32_t last_setup_ms;
+    uint32_t max_setup_ms;
+} cache_entry_t;
+
+typedef struct
+{
+    uint32_t requests; // команд, запросивших сессию
+    uint32_t hits;     // сессия уже была
+    uint32_t setups;   // сессий установлено (командой или заранее)
+    uint32_t setup_failures;
+    uint64_t setup_total_ms;
+    uint32_t setup_max_ms;
+    uint32_t prewarms; // сессий установлено заранее
+    uint32_t probes;
+    uint32_t probe_failures;
+    uint32_t address_changes;
+} warm_stats_t;
+
+static warm_node_t warm_nodes[SESSION_WARM_MAX_NODES];
+static uint8_t warm_count;
+static cache_entry_t cache[SESSION_WARM_CACHE_SLOTS];
+static warm_stats_t stats;
+static bool timer_running;
+
+static warm_node_t *find_warm(uint64_t node_id)
+{
+    for (uint8_t i = 0; i < warm_count; i++)
+    {
+        if (warm_nodes[i].node_id == node_id)
+            return &warm_nodes[i];
+    }
+    return nullptr;
+}
+
+static cache_entry_t *cache_find(uint64_t node_id)
+{
+    for (cache_entry_t &entry : cache)
+    {
+        if (entry.node_id == node_id)
+            return &entry;
+    }
+    return nullptr;
+}
+
+// Запись узла в кэше, при переполнении - вместо давно не использованной
+static cache_entry_t *cache_touch(uint64_t node_id)
+{
+    cache_entry_t *entry = cache_find(node_id);
+    if (!entry)
+    {
+        entry = &cache[0];
+        for (cache_entry_t &candidate : cache)
+        {
+            if (candidate.node_id == 0)
+            {
+                entry = &candidate;
+                break;
+            }
+            if (candidate.used_us < entry->used_us)
+                entry = &candidate;
+        }
+        *entry = cache_entry_t();
+        entry->node_id = node_id;
+    }
+    entry->used_us = esp_timer_get_time();
+    return entry;
+}
+
+static chip::CASESessionManager *session_manager(chip::FabricIndex *fabric_index)
+{
+#if CONFIG_ESP_MATTER_COMMISSIONER_ENABLE
+    chip::Controller::DeviceCommissioner *commissioner =
+        esp_matter::controller::matter_controller_client::get_instance().get_commissioner();
+    *fabric_index = commissioner->GetFabricIndex();
+    return chip::Controller::DeviceControllerFactory::GetInstance().GetSystemState()->CASESessionMgr();
+#else
+    *fabric_index = esp_matter::controller::matter_controller_client::get_instance().get_fabric_index();
+    return chip::Server::GetInstance().GetCASESessionManager();
+#endif
+}
+
+// Готовая сессия с узлом и ее адрес
+static bool find_session(uint64_t node_id, chip::Transport::PeerAddress *address)
+{
+    chip::FabricIndex fabric_index;
+    chip::CASESessionManager *manager = session_manager(&fabric_index);
+    if (!manager)
+        return false;
+    chip::Optional<chip::SessionHandle> session = manager->FindExistingSession(chip::ScopedNodeId(node_id, fabric_index));
+    if (!session.HasValue())
+        return false;
+    if (address && session.Value()->IsSecureSession())
+        *address = session.Value()->AsSecureSession()->GetPeerAddress();
+    return true;
+}
+
+static void record_setup(uint64_t node_id, int64_t started_us)
+{
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - started_us) / 1000);
+    cache_entry_t *entry = cache_touch(node_id);
+    entry->setups++;
+    entry->last_setup_ms = ms;
+    if (ms > entry->max_setup_ms)
+        entry->max_setup_ms = ms;
+    stats.setups++;
+    stats.setup_total_ms += ms;
+    if (ms > stats.setup_max_ms)
+        stats.setup_max_ms = ms;
+    ESP_LOGI(TAG, "Session with node 0x%" PRIx64 " ready in %" PRIu32 " ms", node_id, ms);
+}
+
+// Адрес готовой сессии в кэш, смена адреса учитывается
+static void record_address(uint64_t node_id)
+{
+    chip::Transport::PeerAddress address;
+    if (!find_session(node_id, &address))
+        return;
+    cache_entry_t *entry = cache_touch(node_id);
+    if (entry->address_us && !(entry->address == address))
+    {
+        stats.address_changes++;
+        char text[chip::Transport::PeerAddress::kMaxToStringSize];
+        address.ToString(text, sizeof(text));
+        ESP_LOGI(TAG, "Node 0x%" PRIx64 " moved to %s", node_id, text);
+    }
+    entry->address = address;
+    entry->address_us = esp_timer_get_time();
+}
+
+static esp_err_t start_task(uint64_t node_id, bool probe);
+
+namespace {
+
+// Установка сессии заранее или проверка готовой сессии чтением атрибута. Объект удаляет себя по завершении
+class warm_task : public chip::app::ReadClient::Callback
+{
+public:
+    warm_task(uint64_t node_id, bool probe)
+        : m_node_id(node_id), m_probe(probe), m_started_us(esp_timer_get_time()), m_on_connected(on_connected, this),
+          m_on_failure(on_failure, this), m_path(PROBE_ENDPOINT, PROBE_CLUSTER, PROBE_ATTRIBUTE)
+    {
+    }
+
+    ~warm_task() { chip::Platform::Delete(m_client); }
+
+    void start()
+    {
+        set_busy(true);
+        if (session_warm_connect(m_node_id, &m_on_connected, &m_on_failure) != CHIP_NO_ERROR)
+            finish(false);
+    }
+
+    void OnAttributeData(const chip::app::ConcreteDataAttributePath &path, chip::TLV::TLVReader *data,
+                         const chip::app::StatusIB &status) override
+    {
+    }
+    void OnError(CHIP_ERROR error) override { m_failed = true; }
+    void OnDone(chip::app::ReadClient *client) override { finish(!m_failed); }
+
+private:
+    static void on_connected(void *ctx, chip::Messaging::ExchangeManager &exchange_mgr,
+                             const chip::SessionHandle &session)
+    {
+        warm_task *task = static_cast<warm_task *>(ctx);
+        if (!task->m_probe)
+        {
+            stats.prewarms++;
+            record_setup(task->m_node_id, task->m_started_us);
+            task->finish(true);
+            return;
+        }
+        task->m_client = chip::Platform::New<chip::app::ReadClient>(
+            chip::app::InteractionModelEngine::GetInstance(), &exchange_mgr, *task,
+            chip::app::ReadClient::InteractionType::Read);
+        CHIP_ERROR err = CHIP_ERROR_NO_MEMORY;
+        if (task->m_client)
+        {
+            chip::app::ReadPrepareParams params(session);
+            params.mpAttributePathParamsList = &task->m_path;
+            params.mAttributePathParamsListSize = 1;
+            err = task->m_client->SendRequest(params);
+        }
+        if (err != CHIP_NO_ERROR)
+        {
+            ESP_LOGW(TAG, "Probe of node 0x%" PRIx64 " not sent: %s", task->m_node_id, chip::ErrorStr(err));
+            task->finish(false);
+        }
+    }
+
+    static void on_failure(void *ctx, const chip::ScopedNodeId &peer, CHIP_ERROR error)
+    {
+        warm_task *task = static_cast<warm_task *>(ctx);
+        ESP_LOGW(TAG, "No session with node 0x%" PRIx64 ": %s", task->m_node_id, chip::ErrorStr(error));
+        stats.setup_failures++;
+        task->finish(false);
+    }
+
+    void set_busy(bool busy)
+    {
+        // узел могли удалить из списка, пока шла установка
+        warm_node_t *node = find_warm(m_node_id);
+        if (node)
+            node->busy = busy;
+    }
+
+    void finish(bool success)
+    {
+        uint64_t node_id = m_node_id;
+        bool probe = m_probe;
+        set_busy(false);
+        if (success)
+        {
+            warm_node_t *node = find_warm(node_id);
+            if (node)
+                node->last_active_us = esp_timer_get_time();
+            record_address(node_id);
+            node_reachability_alive(node_id);
+        }
+        else
+        {
+            if (probe)
+                stats.probe_failures++;
+            node_reachability_failed(node_id, probe ? NODE_REACHABILITY_PROBE : NODE_REACHABILITY_SESSION);
+        }
+        chip::Platform::Delete(this);
+
+        // сессия не ответила на проверку (после таймаута MRP она уже не используется) - новая сразу,
+        // а не при первой команде
+        if (probe && !success && find_warm(node_id))
+            start_task(node_id, false);
+    }
+
+    uint64_t m_node_id;
+    bool m_probe;
+    bool m_failed = false;
+    int64_t m_started_us;
+    chip::app::ReadClient *m_client = nullptr;
+    chip::Callback::Callback<chip::OnDeviceConnected> m_on_connected;
+    chip::Callback::Callback<chip::OnDeviceConnectionFailure> m_on_failure;
+    chip::app::AttributePathParams m_path;
+};
+
+} // namespace
+
+static esp_err_t start_task(uint64_t node_id, bool probe)
+{
+    warm_task *task = chip::Platform::New<warm_task>(node_id, probe);
+    if (!task)
+    {
+        ESP_LOGE(TAG, "No memory to warm node 0x%" PRIx64, node_id);
+        return ESP_ERR_NO_MEM;
+    }
+    if (probe)
+        stats.probes++;
+    task->start();
+    return ESP_OK;
+}
+
+static void tick_cb(chip::System::Layer *layer, void *ctx);
+
+static void schedule_tick(uint32_t seconds)
+{
+    timer_running = chip::DeviceLayer::SystemLayer().StartTimer(chip::System::Clock::Seconds32(seconds), tick_cb,
+                                                                nullptr) == CHIP_NO_ERROR;
+    if (!timer_running)
+        ESP_LOGE(TAG, "Failed to start keep-warm timer");
+}
+
+// Проход по узлам списка: нет сессии - установка, давно без команд или адрес устарел - проверка чтением
+static void tick_cb(chip::System::Layer *layer, void *ctx)
+{
+    int64_t now = esp_timer_get_time();
+    uint8_t setups = 0;
+    for (uint8_t i = 0; i < warm_count; i++)
+    {
+        warm_node_t *node = &warm_nodes[i];
+        if (node->busy)
+            continue;
+        if (!find_session(node->node_id, nullptr))
+        {
+            if (setups < SESSION_WARM_PARALLEL)
+            {
+                setups++;
+                start_task(node->node_id, false);
+            }
+            continue;
+        }
+        const cache_entry_t *entry = cache_find(node->node_id);
+        bool address_stale = !entry || !entry->address_us ||
+                             now - entry->address_us > (int64_t)SESSION_WARM_ADDRESS_TTL_S * 1000000;
+        if (address_stale || now - node->last_active_us > (int64_t)SESSION_WARM_IDLE_S * 1000000)
+            start_task(node->node_id, true);
+    }
+    schedule_tick(SESSION_WARM_TICK_S);
+}
+
+static esp_err_t save_nodes(void)
+{
+    uint64_t ids[SESSION_WARM_MAX_NODES];
+    for (uint8_t i = 0; i < warm_count; i++)
+        ids[i] = warm_nodes[i].node_id;
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_WARM_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return err;
+    err = warm_count ? nvs_set_blob(handle, NVS_WARM_NODES_KEY, ids, warm_count * sizeof(ids[0]))
+                     : nvs_erase_key(handle, NVS_WARM_NODES_KEY);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        err = ESP_OK;
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t session_warm_start(void)
+{
+    uint64_t ids[SESSION_WARM_MAX_NODES];
+    size_t size = sizeof(ids);
+    nvs_handle_t handle;
+    warm_count = 0;
+    if (nvs_open(NVS_WARM_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        if (nvs_get_blob(handle, NVS_WARM_NODES_KEY, ids, &size) == ESP_OK)
+        {
+            for (size_t i = 0; i < size / sizeof(ids[0]); i++)
+                warm_nodes[warm_count++] = {ids[i], false, 0};
+        }
+        nvs_close(handle);
+    }
+    ESP_LOGI(TAG, "%u latency-sensitive nodes, first keep-warm pass in %d s", warm_count, SESSION_WARM_BOOT_DELAY_S);
+    if (!timer_running)
+        schedule_tick(SESSION_WARM_BOOT_DELAY_S);
+    return timer_running ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t session_warm_add(uint64_t node_id)
+{
+    if (node_id == 0)
+        return ESP_ERR_INVALID_ARG;
+    if (find_warm(node_id))
+        return ESP_OK;
+    if (warm_count == SESSION_WARM_MAX_NODES)
+        return ESP_ERR_NO_MEM;
+    warm_nodes[warm_count++] = {node_id, false, esp_timer_get_time()};
+    esp_err_t err = save_nodes();
+    if (err != ESP_OK)
+    {
+        warm_count--;
+        return err;
+    }
+    if (!find_session(node_id, nullptr))
+        start_task(node_id, false);
+    return ESP_OK;
+}
+
+esp_err_t session_warm_remove(uint64_t node_id)
+{
+    warm_node_t *node = find_warm(node_id);
+    if (!node)
+        return ESP_ERR_NOT_FOUND;
+    *node = warm_nodes[--warm_count];
+    return save_nodes();
+}
+
+esp_err_t session_warm_probe(uint64_t node_id)
+{
+    if (node_id == 0)
+        return ESP_ERR_INVALID_ARG;
+    warm_node_t *node = find_warm(node_id);
+    if (node && node->busy)
+        return ESP_ERR_INVALID_STATE;
+    return start_task(node_id, true);
+}
+
+void session_warm_clear(void)
+{
+    warm_count = 0;
+    nvs_handle_t handle;
+    if (nvs_open(NVS_WARM_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        nvs_erase_all(handle);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
+
+bool session_warm_lookup(uint64_t node_id)
+{
+    stats.requests++;
+    bool warm = find_session(node_id, nullptr);
+    if (warm)
+        stats.hits++;
+    return warm;
+}
+
+void session_warm_connected(uint64_t node_id, bool warm, int64_t started_us)
+{
+    if (!warm)
+        record_setup(node_id, started_us);
+    record_address(node_id);
+    warm_node_t *node = find_warm(node_id);
+    if (node)
+        node->last_active_us = esp_timer_get_time();
+}
+
+void session_warm_failed(uint64_t node_id)
+{
+    stats.setup_failures++;
+}
+
+CHIP_ERROR session_warm_connect(uint64_t node_id, chip::Callback::Callback<chip::OnDeviceConnected> *on_connected,
+                                chip::Callback::Callback<chip::OnDeviceConnectionFailure> *on_failure)
+{
+#if CONFIG_ESP_MATTER_COMMISSIONER_ENABLE
+    chip::Controller::DeviceCommissioner *commissioner =
+        esp_matter::controller::matter_controller_client::get_instance().get_commissioner();
+    return commissioner->GetConnectedDevice(node_id, on_connected, on_failure);
+#else
+    chip::FabricIndex fabric_index =
+        esp_matter::controller::matter_controller_client::get_instance().get_fabric_index();
+    chip::Server::GetInstance().GetCASESessionManager()->FindOrEstablishSession(
+        chip::ScopedNodeId(node_id, fabric_index), on_connected, on_failure);
+    return CHIP_NO_ERROR;
+#endif
+}
+
+static void put_node(json_stream_t *js, uint64_t node_id, const cache_entry_t *entry, int64_t now)
+{
+    json_stream_object_begin(js, NULL);
+    json_stream_uint(js, "node", node_id);
+    json_stream_bool(js, "warm", find_warm(node_id) != nullptr);
+    json_stream_bool(js, "session", find_session(node_id, nullptr));
+    if (entry && entry->address_us)
+    {
+        char text[chip::Transport::PeerAddress::kMaxToStringSize];
+        entry->address.ToString(text, sizeof(text));
+        json_stream_string(js, "address", text);
+        json_stream_uint(js, "address_age_s", (uint64_t)((now - entry->address_us) / 1000000));
+    }
+    if (entry)
+    {
+        json_stream_uint(js, "setups", entry->setups);
+        json_stream_uint(js, "last_setup_ms", entry->last_setup_ms);
+        json_stream_uint(js, "max_setup_ms", entry->max_setup_ms);
+    }
+    json_stream_object_end(js);
+}
+
+esp_err_t session_warm_publish_stats(const char *topic, bool reset)
+{
+    char *msg = json_stream_buf_acquire();
+    if (!msg)
+        return ESP_ERR_NO_MEM;
+
+    int64_t now = esp_timer_get_time();
+    json_stream_t js;
+    json_stream_init(&js, msg, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "session-warm");
+    json_stream_string(&js, "op", "stats");
+    json_stream_uint(&js, "requests", stats.requests);
+    json_stream_uint(&js, "warm_hits", stats.hits);
+    json_stream_uint(&js, "hit_rate", stats.requests ? (uint64_t)stats.hits * 100 / stats.requests : 0);
+    json_stream_uint(&js, "setups", stats.setups);
+    json_stream_uint(&js, "setup_failures", stats.setup_failures);
+    json_stream_uint(&js, "setup_avg_ms", stats.setups ? stats.setup_total_ms / stats.setups : 0);
+    json_stream_uint(&js, "setup_max_ms", stats.setup_max_ms);
+    json_stream_uint(&js, "prewarms", stats.prewarms);
+    json_stream_uint(&js, "probes", stats.probes);
+    json_stream_uint(&js, "probe_failures", stats.probe_failures);
+    json_stream_uint(&js, "address_changes", stats.address_changes);
+    json_stream_array_begin(&js, "nodes");
+    for (const cache_entry_t &entry : cache)
+    {
+        if (entry.node_id)
+            put_node(&js, entry.node_id, &entry, now);
+    }
+    // узлы списка, с которыми сессии еще не было
+    for (uint8_t i = 0; i < warm_count; i++)
+    {
+        if (!cache_find(warm_nodes[i].node_id))
+            put_node(&js, warm_nodes[i].node_id, nullptr, now);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    esp_err_t err = json_stream_finish(&js);
+    if (err == ESP_OK)
+        err = mqtt_publish_data_len(topic, msg, js.len);
+    json_stream_buf_release(msg);
+
+    if (reset)
+    {
+        stats = warm_stats_t();
+        for (cache_entry_t &entry : cache)
+        {
+            entry.setups = 0;
+            entry.last_setup_ms = 0;
+            entry.max_setup_ms = 0;
+        }
+    }
+    return err;
+}
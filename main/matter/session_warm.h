@@ -0,0 +1,98 @@
+#ifndef SESSION_WARM_H
+#define SESSION_WARM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Узлов с поддержкой сессии (чувствительных к задержке) не больше
+#define SESSION_WARM_MAX_NODES 8
+// Узлов в кэше адресов и времени установки сессий, при переполнении заменяется давно не использованный
+#define SESSION_WARM_CACHE_SLOTS 12
+// Адрес узла из кэша считается свежим, потом узел с поддержкой сессии проверяется чтением
+#define SESSION_WARM_ADDRESS_TTL_S 300
+// Проход поддержки сессий
+#define SESSION_WARM_TICK_S 30
+// Первый проход после запуска: сеть Thread и стек успевают подняться
+#define SESSION_WARM_BOOT_DELAY_S 15
+// Сессия без команд дольше - проверяется чтением атрибута, неответившая устанавливается заново
+#define SESSION_WARM_IDLE_S 120
+// Установок сессий за один проход (CASE по Thread дорог)
+#define SESSION_WARM_PARALLEL 2
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Загрузка списка узлов из NVS и первый проход через SESSION_WARM_BOOT_DELAY_S: сессии с узлами списка
+     *        устанавливаются заранее, чтобы первая команда не ждала поиска адреса (DNS-SD) и CASE.
+     *        Вызывается на потоке CHIP (или под LockChipStack) после запуска стека
+     */
+    esp_err_t session_warm_start(void);
+
+    /**
+     * @brief Добавление узла в список поддержки сессий (сохраняется в NVS), сессия устанавливается сразу.
+     *        Вызывается на потоке CHIP (или под LockChipStack)
+     *
+     * @return esp_err_t ESP_ERR_NO_MEM - в списке уже SESSION_WARM_MAX_NODES узлов
+     */
+    esp_err_t session_warm_add(uint64_t node_id);
+
+    // ESP_ERR_NOT_FOUND - узла нет в списке
+    esp_err_t session_warm_remove(uint64_t node_id);
+
+    /**
+     * @brief Проверка узла (не обязательно из списка) чтением атрибута через готовую или новую сессию.
+     *        Итог - node_reachability_alive() или node_reachability_failed(). Вызывается на потоке CHIP
+     *
+     * @return esp_err_t ESP_ERR_INVALID_STATE - у узла списка уже идет установка сессии или проверка
+     */
+    esp_err_t session_warm_probe(uint64_t node_id);
+
+    // Очистка списка, в том числе в NVS (factoryreset). Вызывается на потоке CHIP
+    void session_warm_clear(void);
+
+    /**
+     * @brief Поиск готовой сессии перед командой узлу: учитывается попадание в теплый кэш.
+     *        Вызывается на потоке CHIP
+     *
+     * @return true - сессия уже есть, команда уйдет без поиска адреса и CASE
+     */
+    bool session_warm_lookup(uint64_t node_id);
+
+    /**
+     * @brief Сессия для команды получена: время установки (для промаха), адрес узла в кэше
+     *
+     * @param warm Результат session_warm_lookup()
+     * @param started_us esp_timer_get_time() перед запросом сессии
+     */
+    void session_warm_connected(uint64_t node_id, bool warm, int64_t started_us);
+
+    // Сессию для команды установить не удалось
+    void session_warm_failed(uint64_t node_id);
+
+    /**
+     * @brief Публикация {"action":"session-warm","op":"stats","requests":..,"warm_hits":..,"hit_rate":<%>,
+     *        "setups":..,"setup_failures":..,"setup_avg_ms":..,"setup_max_ms":..,"prewarms":..,"probes":..,
+     *        "probe_failures":..,"address_changes":..,"nodes":[{"node":..,"warm":..,"session":..,"address":..,
+     *        "address_age_s":..,"setups":..,"last_setup_ms":..,"max_setup_ms":..}]}. "reset":true очищает счетчики.
+     *        Вызывается на потоке CHIP (или под LockChipStack)
+     */
+    esp_err_t session_warm_publish_stats(const char *topic, bool reset);
+
+#ifdef __cplusplus
+}
+
+#include <app/OperationalSessionSetup.h>
+
+/**
+ * @brief Запрос CASE-сессии с узлом: готовая сессия или поиск адреса и установка. Общий путь для команд и поддержки
+ *        сессий, на потоке CHIP
+ */
+CHIP_ERROR session_warm_connect(uint64_t node_id, chip::Callback::Callback<chip::OnDeviceConnected> *on_connected,
+                                chip::Callback::Callback<chip::OnDeviceConnectionFailure> *on_failure);
+#endif
+
+#endif // SESSION_WARM_H
@@ -0,0 +1,777 @@
+#include "typed_command.h"
+#include "command_tracker.h"
+#include "session_warm.h"
+#include "node_reachability.h"
+#include "command_policy.h"
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+#include <type_traits>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <app-common/zap-generated/cluster-objects.h>
+#include <app/CommandSender.h>
+#include <app/WriteClient.h>
+#include <app/ConcreteAttributePath.h>
+#include <app/data-model/Nullable.h>
+#include <app/server/Server.h>
+#include <app/MessageDef/StatusIB.h>
+#include <lib/core/NodeId.h>
+#include <lib/core/TLV.h>
+#include <lib/support/BitMask.h>
+#include <lib/support/Span.h>
+#include <platform/CHIPDeviceLayer.h>
+#include <transport/GroupSession.h>
+#include <esp_matter_controller_client.h>
+
+static const char *TAG = "typed_command";
+
+using namespace chip::app::Clusters;
+
+// Тип атрибута из zap-generated TypeInfo::Type: перечисления и битовые маски - по типу хранения
+template <typename T, typename = void>
+struct attr_type_of
+{
+    static constexpr uint8_t value = TYPED_ATTR_UNKNOWN;
+};
+template <> struct attr_type_of<bool> { static constexpr uint8_t value = TYPED_ATTR_BOOL; };
+template <> struct attr_type_of<uint8_t> { static constexpr uint8_t value = TYPED_ATTR_U8; };
+template <> struct attr_type_of<uint16_t> { static constexpr uint8_t value = TYPED_ATTR_U16; };
+template <> struct attr_type_of<uint32_t> { static constexpr uint8_t value = TYPED_ATTR_U32; };
+template <> struct attr_type_of<uint64_t> { static constexpr uint8_t value = TYPED_ATTR_U64; };
+template <> struct attr_type_of<int8_t> { static constexpr uint8_t value = TYPED_ATTR_I8; };
+template <> struct attr_type_of<int16_t> { static constexpr uint8_t value = TYPED_ATTR_I16; };
+template <> struct attr_type_of<int32_t> { static constexpr uint8_t value = TYPED_ATTR_I32; };
+template <> struct attr_type_of<int64_t> { static constexpr uint8_t value = TYPED_ATTR_I64; };
+template <> struct attr_type_of<float> { static constexpr uint8_t value = TYPED_ATTR_FLOAT; };
+template <> struct attr_type_of<double> { static constexpr uint8_t value = TYPED_ATTR_DOUBLE; };
+template <> struct attr_type_of<chip::CharSpan> { static constexpr uint8_t value = TYPED_ATTR_STRING; };
+template <typename T>
+struct attr_type_of<T, std::enable_if_t<std::is_enum<T>::value>> : attr_type_of<std::underlying_type_t<T>>
+{
+};
+template <typename E, typename S>
+struct attr_type_of<chip::BitMask<E, S>> : attr_type_of<S>
+{
+};
+template <typename T>
+struct attr_type_of<chip::app::DataModel::Nullable<T>>
+{
+    static constexpr uint8_t value = attr_type_of<T>::value | TYPED_ATTR_NULLABLE;
+};
+
+typedef struct
+{
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+    uint8_t type;
+} attr_meta_t;
+
+#define ATTR_META(cluster, attribute)                                                                                  \
+    {                                                                                                                  \
+        cluster::Id, cluster::Attributes::attribute::Id,                                                               \
+            attr_type_of<cluster::Attributes::attribute::TypeInfo::Type>::value                                        \
+    }
+
+// Записываемые атрибуты устройств, которыми управляет контроллер. Типы берутся из сгенерированных TypeInfo,
+// поэтому совпадают со стеком, на котором собрана прошивка
+static const attr_meta_t attr_meta[] = {
+    ATTR_META(Identify, IdentifyTime),
+    ATTR_META(BasicInformation, NodeLabel),
+    ATTR_META(BasicInformation, Location),
+    ATTR_META(BasicInformation, LocalConfigDisabled),
+    ATTR_META(OnOff, OnTime),
+    ATTR_META(OnOff, OffWaitTime),
+    ATTR_META(OnOff, StartUpOnOff),
+    ATTR_META(LevelControl, Options),
+    ATTR_META(LevelControl, OnOffTransitionTime),
+    ATTR_META(LevelControl, OnLevel),
+    ATTR_META(LevelControl, OnTransitionTime),
+    ATTR_META(LevelControl, OffTransitionTime),
+    ATTR_META(LevelControl, DefaultMoveRate),
+    ATTR_META(LevelControl, StartUpCurrentLevel),
+    ATTR_META(DoorLock, AutoRelockTime),
+    ATTR_META(WindowCovering, Mode),
+    ATTR_META(Thermostat, LocalTemperatureCalibration),
+    ATTR_META(Thermostat, OccupiedCoolingSetpoint),
+    ATTR_META(Thermostat, OccupiedHeatingSetpoint),
+    ATTR_META(Thermostat, UnoccupiedCoolingSetpoint),
+    ATTR_META(Thermostat, UnoccupiedHeatingSetpoint),
+    ATTR_META(Thermostat, MinHeatSetpointLimit),
+    ATTR_META(Thermostat, MaxHeatSetpointLimit),
+    ATTR_META(Thermostat, MinCoolSetpointLimit),
+    ATTR_META(Thermostat, MaxCoolSetpointLimit),
+    ATTR_META(Thermostat, ControlSequenceOfOperation),
+    ATTR_META(Thermostat, SystemMode),
+    ATTR_META(FanControl, FanMode),
+    ATTR_META(FanControl, PercentSetting),
+    ATTR_META(FanControl, SpeedSetting),
+    ATTR_META(ThermostatUserInterfaceConfiguration, TemperatureDisplayMode),
+    ATTR_META(ThermostatUserInterfaceConfiguration, KeypadLockout),
+    ATTR_META(ColorControl, Options),
+    ATTR_META(ColorControl, StartUpColorTemperatureMireds),
+};
+
+uint8_t typed_command_attr_type(uint32_t cluster_id, uint32_t attribute_id)
+{
+    for (const attr_meta_t &meta : attr_meta)
+    {
+        if (meta.cluster_id == cluster_id && meta.attribute_id == attribute_id)
+            return meta.type;
+    }
+    return TYPED_ATTR_UNKNOWN;
+}
+
+typedef struct
+{
+    bool integer;
+    bool negative;
+    uint64_t u;
+    int64_t i;
+    double d;
+} number_t;
+
+// Число из JSON: числом или строкой (десятичной или 0x...)
+static bool read_number(const cJSON *item, number_t *num)
+{
+    memset(num, 0, sizeof(*num));
+    if (cJSON_IsNumber(item))
+    {
+        num->d = item->valuedouble;
+        // целые за пределами 2^53 в double уже неточны
+        num->integer = num->d == floor(num->d) && fabs(num->d) < 9007199254740992.0;
+        num->negative = num->d < 0;
+        if (num->integer)
+        {
+            num->i = (int64_t)num->d;
+            num->u = num->negative ? 0 : (uint64_t)num->d;
+        }
+        return true;
+    }
+    if (!cJSON_IsString(item) || item->valuestring[0] == '\0')
+        return false;
+
+    const char *str = item->valuestring;
+    char *end;
+    errno = 0;
+    if (str[0] == '-')
+    {
+        long long value = strtoll(str, &end, 0);
+        if (*end == '\0' && errno == 0)
+        {
+            num->integer = num->negative = true;
+            num->i = value;
+            num->d = (double)value;
+            return true;
+        }
+    }
+    else
+    {
+        unsigned long long value = strtoull(str, &end, 0);
+        if (*end == '\0' && errno == 0)
+        {
+            num->integer = true;
+            num->u = value;
+            num->i = (int64_t)value;
+            num->d = (double)value;
+            return true;
+        }
+    }
+    num->d = strtod(str, &end);
+    num->negative = num->d < 0;
+    return *end == '\0';
+}
+
+static bool read_bool(const cJSON *item, bool *value)
+{
+    if (cJSON_IsBool(item))
+    {
+        *value = cJSON_IsTrue(item);
+        return true;
+    }
+    if (cJSON_IsString(item))
+    {
+        const char *str = item->valuestring;
+        if (strcasecmp(str, "true") == 0 || strcasecmp(str, "on") == 0 || strcmp(str, "1") == 0)
+            *value = true;
+        else if (strcasecmp(str, "false") == 0 || strcasecmp(str, "off") == 0 || strcmp(str, "0") == 0)
+            *value = false;
+        else
+            return false;
+        return true;
+    }
+    if (cJSON_IsNumber(item) && (item->valuedouble == 0 || item->valuedouble == 1))
+    {
+        *value = item->valuedouble == 1;
+        return true;
+    }
+    return false;
+}
+
+// Число бит целого типа атрибута
+static uint8_t int_bits(uint8_t type)
+{
+    switch (type)
+    {
+    case TYPED_ATTR_U8:
+    case TYPED_ATTR_I8:
+        return 8;
+    case TYPED_ATTR_U16:
+    case TYPED_ATTR_I16:
+        return 16;
+    case TYPED_ATTR_U32:
+    case TYPED_ATTR_I32:
+        return 32;
+    default:
+        return 64;
+    }
+}
+
+esp_err_t typed_command_value_from_json(const cJSON *item, uint8_t attr_type, typed_value_t *value)
+{
+    bool nullable = attr_type & TYPED_ATTR_NULLABLE;
+    uint8_t type = attr_type & ~TYPED_ATTR_NULLABLE;
+    memset(value, 0, sizeof(*value));
+    if (!item)
+        return ESP_ERR_INVALID_ARG;
+    if (cJSON_IsNull(item) || (cJSON_IsString(item) && strcmp(item->valuestring, "null") == 0))
+    {
+        if (type != TYPED_ATTR_UNKNOWN && !nullable)
+            return ESP_ERR_INVALID_ARG;
+        value->kind = TYPED_VALUE_NULL;
+        return ESP_OK;
+    }
+
+    number_t num;
+    switch (type)
+    {
+    case TYPED_ATTR_BOOL:
+        value->kind = TYPED_VALUE_BOOL;
+        return read_bool(item, &value->v.b) ? ESP_OK : ESP_ERR_INVALID_ARG;
+    case TYPED_ATTR_U8:
+    case TYPED_ATTR_U16:
+    case TYPED_ATTR_U32:
+    case TYPED_ATTR_U64:
+    {
+        // у nullable наибольшее значение типа означает null
+        uint8_t bits = int_bits(type);
+        uint64_t max = bits == 64 ? UINT64_MAX : (1ULL << bits) - 1;
+        if (nullable)
+            max--;
+        if (!read_number(item, &num) || !num.integer || num.negative || num.u > max)
+            return ESP_ERR_INVALID_ARG;
+        value->kind = TYPED_VALUE_UINT;
+        value->v.u = num.u;
+        return ESP_OK;
+    }
+    case TYPED_ATTR_I8:
+    case TYPED_ATTR_I16:
+    case TYPED_ATTR_I32:
+    case TYPED_ATTR_I64:
+    {
+        // у nullable наименьшее значение типа означает null
+        uint8_t bits = int_bits(type);
+        int64_t max = bits == 64 ? INT64_MAX : (int64_t)((1ULL << (bits - 1)) - 1);
+        int64_t min = -max - 1;
+        if (nullable)
+            min++;
+        if (!read_number(item, &num) || !num.integer || (!num.negative && num.u > (uint64_t)max) || num.i < min ||
+            num.i > max)
+            return ESP_ERR_INVALID_ARG;
+        value->kind = TYPED_VALUE_INT;
+        value->v.i = num.i;
+        return ESP_OK;
+    }
+    case TYPED_ATTR_FLOAT:
+    case TYPED_ATTR_DOUBLE:
+        if (!read_number(item, &num))
+            return ESP_ERR_INVALID_ARG;
+        value->kind = type == TYPED_ATTR_FLOAT ? TYPED_VALUE_FLOAT : TYPED_VALUE_DOUBLE;
+        value->v.f = num.d;
+        return ESP_OK;
+    case TYPED_ATTR_STRING:
+        if (!cJSON_IsString(item) || strlen(item->valuestring) >= TYPED_COMMAND_MAX_STRING)
+            return ESP_ERR_INVALID_ARG;
+        value->kind = TYPED_VALUE_STRING;
+        value->v.s = item->valuestring;
+        return ESP_OK;
+    default:
+        break;
+    }
+
+    // тип неизвестен: по значению
+    if (cJSON_IsBool(item))
+    {
+        value->kind = TYPED_VALUE_BOOL;
+        value->v.b = cJSON_IsTrue(item);
+        return ESP_OK;
+    }
+    if (read_number(item, &num))
+    {
+        if (!num.integer)
+        {
+            value->kind = TYPED_VALUE_DOUBLE;
+            value->v.f = num.d;
+        }
+        else if (num.negative)
+        {
+            value->kind = TYPED_VALUE_INT;
+            value->v.i = num.i;
+        }
+        else
+        {
+            value->kind = TYPED_VALUE_UINT;
+            value->v.u = num.u;
+        }
+        return ESP_OK;
+    }
+    if (cJSON_IsString(item) && strlen(item->valuestring) < TYPED_COMMAND_MAX_STRING)
+    {
+        value->kind = TYPED_VALUE_STRING;
+        value->v.s = item->valuestring;
+        return ESP_OK;
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+static CHIP_ERROR put_value(chip::TLV::TLVWriter &writer, chip::TLV::Tag tag, const typed_value_t *value)
+{
+    switch (value->kind)
+    {
+    case TYPED_VALUE_NULL:
+        return writer.PutNull(tag);
+    case TYPED_VALUE_BOOL:
+        return writer.PutBoolean(tag, value->v.b);
+    case TYPED_VALUE_INT:
+        return writer.Put(tag, value->v.i);
+    case TYPED_VALUE_UINT:
+        return writer.Put(tag, value->v.u);
+    case TYPED_VALUE_FLOAT:
+        return writer.Put(tag, static_cast<float>(value->v.f));
+    case TYPED_VALUE_DOUBLE:
+        return writer.Put(tag, value->v.f);
+    case TYPED_VALUE_STRING:
+        return writer.PutString(tag, value->v.s);
+    default:
+        return CHIP_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+static esp_err_t finish_encoding(chip::TLV::TLVWriter &writer, CHIP_ERROR err, size_t *len)
+{
+    if (err == CHIP_NO_ERROR)
+        err = writer.Finalize();
+    if (err == CHIP_ERROR_BUFFER_TOO_SMALL || err == CHIP_ERROR_NO_MEMORY)
+        return ESP_ERR_INVALID_SIZE;
+    if (err != CHIP_NO_ERROR)
+        return ESP_ERR_INVALID_ARG;
+    *len = writer.GetLengthWritten();
+    return ESP_OK;
+}
+
+esp_err_t typed_command_encode_value(const typed_value_t *value, uint8_t *buf, size_t size, size_t *len)
+{
+    chip::TLV::TLVWriter writer;
+    writer.Init(buf, size);
+    return finish_encoding(writer, put_value(writer, chip::TLV::AnonymousTag(), value), len);
+}
+
+esp_err_t typed_command_encode_fields(const typed_field_t *fields, uint8_t count, uint8_t *buf, size_t size,
+                                      size_t *len)
+{
+    chip::TLV::TLVWriter writer;
+    chip::TLV::TLVType outer;
+    writer.Init(buf, size);
+    CHIP_ERROR err = writer.StartContainer(chip::TLV::AnonymousTag(), chip::TLV::kTLVType_Structure, outer);
+    for (uint8_t i = 0; i < count && err == CHIP_NO_ERROR; i++)
+        err = put_value(writer, chip::TLV::ContextTag(fields[i].tag), &fields[i].value);
+    if (err == CHIP_NO_ERROR)
+        err = writer.EndContainer(outer);
+    return finish_encoding(writer, err, len);
+}
+
+// Тип поля в формате esp_matter ("0:U16") или TYPED_ATTR_UNKNOWN без типа
+static bool parse_field_type(const char *name, uint8_t *type)
+{
+    static const struct
+    {
+        const char *name;
+        uint8_t type;
+    } types[] = {
+        {"BOOL", TYPED_ATTR_BOOL}, {"U8", TYPED_ATTR_U8},   {"U16", TYPED_ATTR_U16}, {"U32", TYPED_ATTR_U32},
+        {"U64", TYPED_ATTR_U64},   {"I8", TYPED_ATTR_I8},   {"I16", TYPED_ATTR_I16}, {"I32", TYPED_ATTR_I32},
+        {"I64", TYPED_ATTR_I64},   {"FP", TYPED_ATTR_FLOAT}, {"DFP", TYPED_ATTR_DOUBLE}, {"STR", TYPED_ATTR_STRING},
+    };
+    for (const auto &entry : types)
+    {
+        if (strcmp(name, entry.name) == 0)
+        {
+            *type = entry.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t typed_command_fields_from_json(const cJSON *object, uint8_t *buf, size_t size, size_t *len)
+{
+    if (!cJSON_IsObject(object))
+        return ESP_ERR_INVALID_ARG;
+    chip::TLV::TLVWriter writer;
+    chip::TLV::TLVType outer;
+    writer.Init(buf, size);
+    CHIP_ERROR err = writer.StartContainer(chip::TLV::AnonymousTag(), chip::TLV::kTLVType_Structure, outer);
+    const cJSON *item = NULL;
+    cJSON_ArrayForEach(item, object)
+    {
+        if (err != CHIP_NO_ERROR)
+            break;
+        char *end;
+        unsigned long tag = strtoul(item->string, &end, 10);
+        uint8_t type = TYPED_ATTR_UNKNOWN;
+        typed_value_t value;
+        if (end == item->string || tag > UINT8_MAX)
+            return ESP_ERR_INVALID_ARG;
+        if (*end != '\0' && (*end != ':' || !parse_field_type(end + 1, &type)))
+            return ESP_ERR_INVALID_ARG;
+        if (typed_command_value_from_json(item, type, &value) != ESP_OK)
+            return ESP_ERR_INVALID_ARG;
+        err = put_value(writer, chip::TLV::ContextTag((uint8_t)tag), &value);
+    }
+    if (err == CHIP_NO_ERROR)
+        err = writer.EndContainer(outer);
+    return finish_encoding(writer, err, len);
+}
+
+// Поля данных команды из закодированной структуры в CommandSender
+static CHIP_ERROR encode_command(chip::app::CommandSender &sender, const chip::app::CommandPathParams &path,
+                                 const uint8_t *tlv, size_t len,
+                                 const chip::Optional<uint16_t> &timed = chip::Optional<uint16_t>::Missing())
+{
+    ReturnErrorOnFailure(sender.PrepareCommand(path));
+    if (len)
+    {
+        chip::TLV::TLVWriter *writer = sender.GetCommandDataIBTLVWriter();
+        chip::TLV::TLVReader reader;
+        chip::TLV::TLVType outer;
+        VerifyOrReturnError(writer != nullptr, CHIP_ERROR_INCORRECT_STATE);
+        reader.Init(tlv, len);
+        ReturnErrorOnFailure(reader.Next());
+        ReturnErrorOnFailure(reader.EnterContainer(outer));
+        CHIP_ERROR err;
+        while ((err = reader.Next()) == CHIP_NO_ERROR)
+            ReturnErrorOnFailure(writer->CopyElement(reader));
+        VerifyOrReturnError(err == CHIP_END_OF_TLV, err);
+    }
+    return sender.FinishCommand(timed);
+}
+
+namespace {
+
+// Команда или запись одному узлу: CASE-сессия, отправка, итог в command_tracker по номеру.
+// Временная неудача идемпотентной команды (command_policy) повторяется с задержкой в пределах срока команды.
+// Объект удаляет себя после итога: OnDone клиента или ошибки сессии без повтора
+class typed_request : public chip::app::CommandSender::Callback, public chip::app::WriteClient::Callback
+{
+public:
+    typed_request(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t item_id, bool write,
+                  const uint8_t *tlv, size_t len, uint32_t token, uint16_t timed_ms = 0)
+        : m_node_id(node_id), m_endpoint_id(endpoint_id), m_cluster_id(cluster_id), m_item_id(item_id),
+          m_write(write), m_timed_ms(timed_ms), m_token(token), m_len(len), m_on_connected(on_connected, this),
+          m_on_failure(on_failure, this)
+    {
+        if (len)
+            memcpy(m_tlv, tlv, len);
+        command_policy_get(node_id, cluster_id, item_id, write, &m_policy);
+    }
+
+    ~typed_request()
+    {
+        release_client();
+    }
+
+    // При ошибке объект не удаляется: удаляет вызывающий
+    esp_err_t connect()
+    {
+        // готовая сессия (session_warm) - команда уходит без поиска адреса и CASE
+        m_warm = session_warm_lookup(m_node_id);
+        m_connect_us = esp_timer_get_time();
+        return session_warm_connect(m_node_id, &m_on_connected, &m_on_failure) == CHIP_NO_ERROR ? ESP_OK : ESP_FAIL;
+    }
+
+    void OnResponse(chip::app::CommandSender *client, const chip::app::ConcreteCommandPath &path,
+                    const chip::app::StatusIB &status, chip::TLV::TLVReader *data) override
+    {
+        complete_status(status);
+    }
+    void OnError(const chip::app::CommandSender *client, CHIP_ERROR error) override { complete_error(error); }
+    void OnDone(chip::app::CommandSender *client) override { done(); }
+
+    void OnResponse(const chip::app::WriteClient *client, const chip::app::ConcreteDataAttributePath &path,
+                    chip::app::StatusIB status) override
+    {
+        complete_status(status);
+    }
+    void OnError(const chip::app::WriteClient *client, CHIP_ERROR error) override { complete_error(error); }
+    void OnDone(chip::app::WriteClient *client) override { done(); }
+
+private:
+    static void on_connected(void *ctx, chip::Messaging::ExchangeManager &exchange_mgr,
+                             const chip::SessionHandle &session)
+    {
+        typed_request *request = static_cast<typed_request *>(ctx);
+        session_warm_connected(request->m_node_id, request->m_warm, request->m_connect_us);
+        CHIP_ERROR err = request->m_write ? request->send_write(exchange_mgr, session)
+                                          : request->send_invoke(exchange_mgr, session);
+        if (err != CHIP_NO_ERROR)
+        {
+            // ошибка кодирования или нехватка памяти контроллера: повтор не поможет
+            ESP_LOGE(TAG, "Failed to send to node 0x%" PRIx64 ": %s", request->m_node_id, chip::ErrorStr(err));
+            request->complete_error(err, false);
+            chip::Platform::Delete(request);
+        }
+    }
+
+    static void on_failure(void *ctx, const chip::ScopedNodeId &peer, CHIP_ERROR error)
+    {
+        typed_request *request = static_cast<typed_request *>(ctx);
+        ESP_LOGE(TAG, "No session with node 0x%" PRIx64 ": %s", request->m_node_id, chip::ErrorStr(error));
+        session_warm_failed(request->m_node_id);
+        request->complete_error(error);
+        request->finish_attempt();
+    }
+
+    static void retry_timer_cb(chip::System::Layer *layer, void *ctx)
+    {
+        typed_request *request = static_cast<typed_request *>(ctx);
+        // итог уже опубликован трекером (срок команды истек)
+        if (!command_tracker_retry(request->m_token))
+        {
+            chip::Platform::Delete(request);
+            return;
+        }
+        request->m_retry_pending = false;
+        request->m_attempt++;
+        ESP_LOGI(TAG, "Retry %u of %s 0x%" PRIx32 " to node 0x%" PRIx64 " after %s", request->m_attempt,
+                 request->m_write ? "write" : "command", request->m_item_id, request->m_node_id, request->m_error);
+        if (request->connect() != ESP_OK)
+        {
+            request->complete(false, request->m_error, request->m_code);
+            chip::Platform::Delete(request);
+        }
+    }
+
+    CHIP_ERROR send_invoke(chip::Messaging::ExchangeManager &exchange_mgr, const chip::SessionHandle &session)
+    {
+        m_sender = chip::Platform::New<chip::app::CommandSender>(this, &exchange_mgr, m_timed_ms != 0);
+        VerifyOrReturnError(m_sender != nullptr, CHIP_ERROR_NO_MEMORY);
+        chip::app::CommandPathParams path(m_endpoint_id, 0, m_cluster_id, m_item_id,
+                                          chip::app::CommandPathFlags::kEndpointIdValid);
+        chip::Optional<uint16_t> timed =
+            m_timed_ms ? chip::MakeOptional(m_timed_ms) : chip::Optional<uint16_t>::Missing();
+        ReturnErrorOnFailure(encode_command(*m_sender, path, m_tlv, m_len, timed));
+        return m_sender->SendCommandRequest(session);
+    }
+
+    CHIP_ERROR send_write(chip::Messaging::ExchangeManager &exchange_mgr, const chip::SessionHandle &session)
+    {
+        m_writer =
+            chip::Platform::New<chip::app::WriteClient>(&exchange_mgr, this, chip::Optional<uint16_t>::Missing());
+        VerifyOrReturnError(m_writer != nullptr, CHIP_ERROR_NO_MEMORY);
+        chip::TLV::TLVReader reader;
+        reader.Init(m_tlv, m_len);
+        ReturnErrorOnFailure(reader.Next());
+        ReturnErrorOnFailure(m_writer->PutPreencodedAttribute(
+            chip::app::ConcreteDataAttributePath(m_endpoint_id, m_cluster_id, m_item_id), reader));
+        return m_writer->SendWriteRequest(session);
+    }
+
+    void release_client()
+    {
+        chip::Platform::Delete(m_sender);
+        chip::Platform::Delete(m_writer);
+        m_sender = nullptr;
+        m_writer = nullptr;
+    }
+
+    // Повтор после временной неудачи: есть попытки и задержка укладывается в срок команды
+    bool want_retry(command_failure_t failure)
+    {
+        if (!command_policy_transient(failure) || m_attempt >= m_policy.retries)
+            return false;
+        int64_t deadline_us = command_tracker_deadline_us(m_token);
+        m_retry_ms = command_policy_backoff_ms(&m_policy, m_attempt + 1);
+        return deadline_us && esp_timer_get_time() + (int64_t)m_retry_ms * 1000 < deadline_us;
+    }
+
+    void complete(bool success, const char *error, int64_t code)
+    {
+        if (m_completed)
+            return;
+        m_completed = true;
+        command_tracker_complete(m_token, success, error, code);
+    }
+
+    void complete_status(const chip::app::StatusIB &status)
+    {
+        if (m_completed || m_retry_pending)
+            return;
+        int64_t code = (int64_t)chip::to_underlying(status.mStatus);
+        if (!status.IsSuccess() && want_retry(command_policy_classify_status((uint8_t)code)))
+        {
+            m_retry_pending = true;
+            strlcpy(m_error, COMMAND_TRACKER_IM_STATUS, sizeof(m_error));
+            m_code = code;
+            return;
+        }
+        complete(status.IsSuccess(), COMMAND_TRACKER_IM_STATUS, code);
+    }
+
+    void complete_error(CHIP_ERROR error, bool may_retry = true)
+    {
+        if (m_completed || m_retry_pending)
+            return;
+        // статус IM в ошибке клиента - ответ устройства
+        if (error.IsIMStatus())
+        {
+            complete_status(chip::app::StatusIB(error));
+            return;
+        }
+        if (may_retry && want_retry(command_policy_classify_chip_error(error.AsInteger())))
+        {
+            m_retry_pending = true;
+            strlcpy(m_error, chip::ErrorStr(error), sizeof(m_error));
+            m_code = (int64_t)error.AsInteger();
+            return;
+        }
+        complete(false, chip::ErrorStr(error), (int64_t)error.AsInteger());
+    }
+
+    // Конец попытки: повтор по таймеру или удаление
+    void finish_attempt()
+    {
+        if (m_retry_pending)
+        {
+            release_client();
+            if (chip::DeviceLayer::SystemLayer().StartTimer(chip::System::Clock::Milliseconds32(m_retry_ms),
+                                                            retry_timer_cb, this) == CHIP_NO_ERROR)
+                return;
+            complete(false, m_error, m_code);
+        }
+        chip::Platform::Delete(this);
+    }
+
+    void done()
+    {
+        if (!m_completed && !m_retry_pending)
+            complete_error(CHIP_ERROR_TIMEOUT);
+        finish_attempt();
+    }
+
+    uint64_t m_node_id;
+    uint16_t m_endpoint_id;
+    uint32_t m_cluster_id;
+    uint32_t m_item_id;
+    bool m_write;
+    uint16_t m_timed_ms; // 0 - не timed
+    bool m_completed = false;
+    bool m_retry_pending = false; // неудача попытки отложена до повтора
+    bool m_warm = false;
+    uint8_t m_attempt = 0; // повторов выполнено
+    uint32_t m_retry_ms = 0;
+    char m_error[48] = {}; // итог последней попытки, если повторить не удастся (ErrorStr - общий буфер)
+    int64_t m_code = 0;
+    command_policy_t m_policy;
+    int64_t m_connect_us = 0;
+    uint32_t m_token;
+    size_t m_len;
+    uint8_t m_tlv[TYPED_COMMAND_MAX_INVOKE_TLV];
+    chip::app::CommandSender *m_sender = nullptr;
+    chip::app::WriteClient *m_writer = nullptr;
+    chip::Callback::Callback<chip::OnDeviceConnected> m_on_connected;
+    chip::Callback::Callback<chip::OnDeviceConnectionFailure> m_on_failure;
+};
+
+} // namespace
+
+// Команда группе: одно сообщение, ответа нет
+static esp_err_t send_group_invoke(uint16_t group_id, uint32_t cluster_id, uint32_t command_id, const uint8_t *tlv,
+                                   size_t len)
+{
+#if CONFIG_ESP_MATTER_COMMISSIONER_ENABLE
+    chip::Controller::DeviceCommissioner *commissioner =
+        esp_matter::controller::matter_controller_client::get_instance().get_commissioner();
+    chip::Messaging::ExchangeManager *exchange_mgr = commissioner->ExchangeMgr();
+    chip::FabricIndex fabric_index = commissioner->GetFabricIndex();
+#else
+    chip::Messaging::ExchangeManager *exchange_mgr = &chip::Server::GetInstance().GetExchangeManager();
+    chip::FabricIndex fabric_index = esp_matter::controller::matter_controller_client::get_instance().get_fabric_index();
+#endif
+    chip::Transport::OutgoingGroupSession session(group_id, fabric_index);
+    chip::app::CommandSender sender(nullptr, exchange_mgr);
+    chip::app::CommandPathParams path(0, group_id, cluster_id, command_id, chip::app::CommandPathFlags::kGroupIdValid);
+    CHIP_ERROR err = encode_command(sender, path, tlv, len);
+    if (err == CHIP_NO_ERROR)
+        err = sender.SendGroupCommandRequest(chip::SessionHandle(session));
+    if (err != CHIP_NO_ERROR)
+    {
+        ESP_LOGE(TAG, "Failed to send to group 0x%04X: %s", group_id, chip::ErrorStr(err));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t typed_command_invoke(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t command_id,
+                               const uint8_t *tlv, size_t len, uint32_t token)
+{
+    if (len > TYPED_COMMAND_MAX_TLV)
+        return ESP_ERR_INVALID_ARG;
+    return typed_command_invoke_timed(node_id, endpoint_id, cluster_id, command_id, tlv, len, 0, token);
+}
+
+esp_err_t typed_command_invoke_timed(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id,
+                                     uint32_t command_id, const uint8_t *tlv, size_t len,
+                                     uint16_t timed_invoke_timeout_ms, uint32_t token)
+{
+    if (len > TYPED_COMMAND_MAX_INVOKE_TLV || (len && !tlv))
+        return ESP_ERR_INVALID_ARG;
+    if (chip::IsGroupId(node_id))
+    {
+        if (timed_invoke_timeout_ms)
+            return ESP_ERR_NOT_SUPPORTED;
+        return send_group_invoke(chip::GroupIdFromNodeId(node_id), cluster_id, command_id, tlv, len);
+    }
+    if (!node_reachability_admit(node_id))
+        return ESP_ERR_INVALID_STATE;
+
+    typed_request *request = chip::Platform::New<typed_request>(node_id, endpoint_id, cluster_id, command_id, false,
+                                                                tlv, len, token, timed_invoke_timeout_ms);
+    if (!request)
+        return ESP_ERR_NO_MEM;
+    command_tracker_bind(token);
+    esp_err_t err = request->connect();
+    if (err != ESP_OK)
+        chip::Platform::Delete(request);
+    return err;
+}
+
+esp_err_t typed_command_write(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                              const uint8_t *tlv, size_t len, uint32_t token)
+{
+    if (!len || len > TYPED_COMMAND_MAX_TLV || !tlv || chip::IsGroupId(node_id))
+        return ESP_ERR_INVALID_ARG;
+    if (!node_reachability_admit(node_id))
+        return ESP_ERR_INVALID_STATE;
+    typed_request *request =
+        chip::Platform::New<typed_request>(node_id, endpoint_id, cluster_id, attribute_id, true, tlv, len, token);
+    if (!request)
+        return ESP_ERR_NO_MEM;
+    command_tracker_bind(token);
+    esp_err_t err = request->connect();
+    if (err != ESP_OK)
+        chip::Platform::Delete(request);
+    return err;
+}
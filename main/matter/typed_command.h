@@ -0,0 +1,149 @@
+#ifndef TYPED_COMMAND_H
+#define TYPED_COMMAND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+// Закодированные в TLV данные команды или значение атрибута, байт не больше
+#define TYPED_COMMAND_MAX_TLV 64
+// Данные команды из command_tracker_send_invoke() (вложенные структуры и списки esp_matter), байт не больше
+#define TYPED_COMMAND_MAX_INVOKE_TLV 128
+// Длина строки в данных команды или значении атрибута
+#define TYPED_COMMAND_MAX_STRING 32
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        TYPED_VALUE_NULL = 0,
+        TYPED_VALUE_BOOL,
+        TYPED_VALUE_INT,
+        TYPED_VALUE_UINT,
+        TYPED_VALUE_FLOAT,  // float в TLV
+        TYPED_VALUE_DOUBLE, // double в TLV
+        TYPED_VALUE_STRING,
+    } typed_value_kind_t;
+
+    // Значение, уже разобранное из входящего сообщения. Ширина целого в TLV выбирается по значению
+    typedef struct
+    {
+        uint8_t kind; // typed_value_kind_t
+        union
+        {
+            bool b;
+            int64_t i;
+            uint64_t u;
+            double f;
+            const char *s; // не копируется: строка должна жить до кодирования
+        } v;
+    } typed_value_t;
+
+    // Поле данных команды с контекстным тегом
+    typedef struct
+    {
+        uint8_t tag;
+        typed_value_t value;
+    } typed_field_t;
+
+    // Тип атрибута из метаданных кластеров
+    typedef enum
+    {
+        TYPED_ATTR_UNKNOWN = 0,
+        TYPED_ATTR_BOOL,
+        TYPED_ATTR_U8,
+        TYPED_ATTR_U16,
+        TYPED_ATTR_U32,
+        TYPED_ATTR_U64,
+        TYPED_ATTR_I8,
+        TYPED_ATTR_I16,
+        TYPED_ATTR_I32,
+        TYPED_ATTR_I64,
+        TYPED_ATTR_FLOAT,
+        TYPED_ATTR_DOUBLE,
+        TYPED_ATTR_STRING,
+    } typed_attr_type_t;
+
+// Флаг в типе атрибута: допускается null
+#define TYPED_ATTR_NULLABLE 0x80
+
+    static inline typed_field_t typed_field_uint(uint8_t tag, uint64_t value)
+    {
+        typed_field_t field;
+        field.tag = tag;
+        field.value.kind = TYPED_VALUE_UINT;
+        field.value.v.u = value;
+        return field;
+    }
+
+    /**
+     * @brief Тип записываемого атрибута по метаданным кластеров (zap-generated TypeInfo)
+     *
+     * @return uint8_t typed_attr_type_t с TYPED_ATTR_NULLABLE или TYPED_ATTR_UNKNOWN, если атрибута нет в таблице
+     */
+    uint8_t typed_command_attr_type(uint32_t cluster_id, uint32_t attribute_id);
+
+    /**
+     * @brief Значение из JSON по типу атрибута: число, логическое, строка или null. Числа можно передать строкой
+     *        (десятичной или 0x...). Для TYPED_ATTR_UNKNOWN тип выводится из JSON: неотрицательное целое - без знака
+     *
+     * @return esp_err_t ESP_ERR_INVALID_ARG - значение не подходит типу или вне диапазона
+     */
+    esp_err_t typed_command_value_from_json(const cJSON *item, uint8_t attr_type, typed_value_t *value);
+
+    // Кодирование значения атрибута (анонимный элемент TLV)
+    esp_err_t typed_command_encode_value(const typed_value_t *value, uint8_t *buf, size_t size, size_t *len);
+
+    // Кодирование данных команды (анонимная структура TLV с полями по тегам)
+    esp_err_t typed_command_encode_fields(const typed_field_t *fields, uint8_t count, uint8_t *buf, size_t size,
+                                          size_t *len);
+
+    /**
+     * @brief Кодирование данных команды из объекта JSON {"0":1,"1:U16":0}: ключ - тег поля, после ':' можно указать
+     *        тип в формате esp_matter (BOOL, U8..U64, I8..I64, FP, DFP, STR), без типа - как у
+     *        typed_command_value_from_json() для неизвестного атрибута. Вложенные структуры и списки не поддерживаются
+     */
+    esp_err_t typed_command_fields_from_json(const cJSON *object, uint8_t *buf, size_t size, size_t *len);
+
+    /**
+     * @brief Команда с данными в TLV без преобразования в JSON и обратно. Для команды группе (node_id группы)
+     *        отправка синхронная, ответа нет. Итог команды узлу - command_tracker_complete() по token.
+     *        Вызывается на потоке CHIP
+     *
+     * @param tlv Результат typed_command_encode_fields() или NULL - команда без данных
+     * @param token Номер из command_tracker_begin() или 0
+     * @return esp_err_t ESP_ERR_INVALID_STATE - узел недоступен (node_reachability), команда не отправлена
+     */
+    esp_err_t typed_command_invoke(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t command_id,
+                                   const uint8_t *tlv, size_t len, uint32_t token);
+
+    /**
+     * @brief То же, что typed_command_invoke(), для timed-команды (Timed Invoke) и данных до
+     *        TYPED_COMMAND_MAX_INVOKE_TLV байт. Timed-команда группе не отправляется
+     *
+     * @param timed_invoke_timeout_ms 0 - обычная команда
+     * @return esp_err_t ESP_ERR_NOT_SUPPORTED - timed-команда группе
+     */
+    esp_err_t typed_command_invoke_timed(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id,
+                                         uint32_t command_id, const uint8_t *tlv, size_t len,
+                                         uint16_t timed_invoke_timeout_ms, uint32_t token);
+
+    /**
+     * @brief Запись атрибута из TLV. Итог - по ответу на запись (command_tracker_complete()), без ожидания отчета.
+     *        Вызывается на потоке CHIP
+     *
+     * @param tlv Результат typed_command_encode_value()
+     */
+    esp_err_t typed_command_write(uint64_t node_id, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                                  const uint8_t *tlv, size_t len, uint32_t token);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TYPED_COMMAND_H
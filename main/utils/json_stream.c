@@ -0,0 +1,445 @@
+#include "json_stream.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdatomic.h>
+
+static void put(json_stream_t *js, const char *data, size_t len)
+{
+    if (js->error != ESP_OK)
+        return;
+
+    while (len > 0)
+    {
+        // без приемника оставляем место под завершающий '\0'
+        size_t space = js->size - js->len - (js->flush ? 0 : 1);
+        if (space == 0)
+        {
+            if (!js->flush)
+            {
+                js->error = ESP_ERR_NO_MEM;
+                return;
+            }
+            esp_err_t err = js->flush(js->buf, js->len, js->ctx);
+            js->len = 0;
+            if (err != ESP_OK)
+            {
+                js->error = err;
+                return;
+            }
+            continue;
+        }
+        size_t chunk = len < space ? len : space;
+        memcpy(js->buf + js->len, data, chunk);
+        js->len += chunk;
+        js->total += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+static inline void put_char(json_stream_t *js, char c)
+{
+    put(js, &c, 1);
+}
+
+static void put_escaped(json_stream_t *js, const char *str, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    put_char(js, '"');
+    size_t run = 0; // начало участка без экранирования
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        put(js, str + run, i - run);
+        run = i + 1;
+        switch (c)
+        {
+        case '"':
+            put(js, "\\\"", 2);
+            break;
+        case '\\':
+            put(js, "\\\\", 2);
+            break;
+        case '\n':
+            put(js, "\\n", 2);
+            break;
+        case '\r':
+            put(js, "\\r", 2);
+            break;
+        case '\t':
+            put(js, "\\t", 2);
+            break;
+        case '\b':
+            put(js, "\\b", 2);
+            break;
+        case '\f':
+            put(js, "\\f", 2);
+            break;
+        default:
+        {
+            char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F]};
+            put(js, esc, sizeof(esc));
+            break;
+        }
+        }
+    }
+    put(js, str + run, len - run);
+    put_char(js, '"');
+}
+
+// Заголовок элемента CBOR: старший тип и аргумент в самой короткой форме
+static void put_cbor_head(json_stream_t *js, uint8_t major, uint64_t arg)
+{
+    uint8_t head[9];
+    size_t n;
+    major <<= 5;
+    if (arg < 24)
+    {
+        head[0] = major | (uint8_t)arg;
+        n = 1;
+    }
+    else if (arg <= 0xFF)
+    {
+        head[0] = major | 24;
+        n = 2;
+    }
+    else if (arg <= 0xFFFF)
+    {
+        head[0] = major | 25;
+        n = 3;
+    }
+    else if (arg <= 0xFFFFFFFF)
+    {
+        head[0] = major | 26;
+        n = 5;
+    }
+    else
+    {
+        head[0] = major | 27;
+        n = 9;
+    }
+    for (size_t i = 1; i < n; i++)
+        head[i] = (uint8_t)(arg >> (8 * (n - 1 - i)));
+    put(js, (const char *)head, n);
+}
+
+// Запятая перед элементом и ключ, если он есть
+static void begin_value(json_stream_t *js, const char *key)
+{
+    if (js->cbor)
+    {
+        // в CBOR разделителей нет, ключ - text string
+        if (key)
+        {
+            size_t len = strlen(key);
+            put_cbor_head(js, 3, len);
+            put(js, key, len);
+        }
+        return;
+    }
+
+    uint32_t bit = 1u << js->depth;
+    if (js->has_items & bit)
+        put_char(js, ',');
+    js->has_items |= bit;
+
+    if (key)
+    {
+        put_escaped(js, key, strlen(key));
+        put_char(js, ':');
+    }
+}
+
+void json_stream_init(json_stream_t *js, char *buf, size_t size, json_stream_flush_t flush, void *ctx)
+{
+    memset(js, 0, sizeof(*js));
+    js->buf = buf;
+    js->size = size;
+    js->flush = flush;
+    js->ctx = ctx;
+    js->error = (buf && size > (flush ? 0 : 1)) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+void json_stream_init_cbor(json_stream_t *js, char *buf, size_t size, json_stream_flush_t flush, void *ctx)
+{
+    json_stream_init(js, buf, size, flush, ctx);
+    js->cbor = true;
+}
+
+static void open_container(json_stream_t *js, const char *key, char bracket)
+{
+    begin_value(js, key);
+    if (js->cbor)
+        put_char(js, (char)(bracket == '{' ? 0xBF : 0x9F)); // map/array неопределенной длины
+    else
+        put_char(js, bracket);
+    if (js->depth + 1 >= JSON_STREAM_MAX_DEPTH)
+    {
+        js->error = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    js->depth++;
+    js->has_items &= ~(1u << js->depth);
+}
+
+static void close_container(json_stream_t *js, char bracket)
+{
+    if (js->depth == 0)
+    {
+        js->error = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    js->depth--;
+    put_char(js, js->cbor ? (char)0xFF : bracket); // в CBOR - break
+}
+
+void json_stream_object_begin(json_stream_t *js, const char *key)
+{
+    open_container(js, key, '{');
+}
+
+void json_stream_object_end(json_stream_t *js)
+{
+    close_container(js, '}');
+}
+
+void json_stream_array_begin(json_stream_t *js, const char *key)
+{
+    open_container(js, key, '[');
+}
+
+void json_stream_array_end(json_stream_t *js)
+{
+    close_container(js, ']');
+}
+
+void json_stream_string(json_stream_t *js, const char *key, const char *str)
+{
+    json_stream_string_len(js, key, str ? str : "", str ? strlen(str) : 0);
+}
+
+void json_stream_string_len(json_stream_t *js, const char *key, const char *str, size_t len)
+{
+    begin_value(js, key);
+    if (js->cbor)
+    {
+        put_cbor_head(js, 3, len);
+        put(js, str, len);
+        return;
+    }
+    put_escaped(js, str, len);
+}
+
+void json_stream_hex(json_stream_t *js, const char *key, const uint8_t *data, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    begin_value(js, key);
+    if (js->cbor)
+    {
+        put_cbor_head(js, 2, len);
+        put(js, (const char *)data, len);
+        return;
+    }
+    put_char(js, '"');
+    for (size_t i = 0; i < len; i++)
+    {
+        char pair[2] = {hex[data[i] >> 4], hex[data[i] & 0x0F]};
+        put(js, pair, sizeof(pair));
+    }
+    put_char(js, '"');
+}
+
+// Без printf: в newlib-nano нет поддержки %lld
+static size_t format_uint(char *out, uint64_t value)
+{
+    char tmp[20];
+    size_t n = 0;
+    do
+    {
+        tmp[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    for (size_t i = 0; i < n; i++)
+        out[i] = tmp[n - 1 - i];
+    return n;
+}
+
+void json_stream_uint(json_stream_t *js, const char *key, uint64_t value)
+{
+    char num[20];
+    begin_value(js, key);
+    if (js->cbor)
+    {
+        put_cbor_head(js, 0, value);
+        return;
+    }
+    put(js, num, format_uint(num, value));
+}
+
+void json_stream_int(json_stream_t *js, const char *key, int64_t value)
+{
+    if (js->cbor)
+    {
+        begin_value(js, key);
+        if (value < 0)
+            put_cbor_head(js, 1, (uint64_t)(-1 - value));
+        else
+            put_cbor_head(js, 0, (uint64_t)value);
+        return;
+    }
+    char num[21];
+    size_t n = 0;
+    uint64_t magnitude = (uint64_t)value;
+    if (value < 0)
+    {
+        num[n++] = '-';
+        magnitude = 0 - magnitude;
+    }
+    n += format_uint(num + n, magnitude);
+    begin_value(js, key);
+    put(js, num, n);
+}
+
+void json_stream_double(json_stream_t *js, const char *key, double value)
+{
+    if (js->cbor)
+    {
+        // float, если значение в нем представимо без потерь, иначе double
+        uint8_t num[9];
+        size_t n;
+        float single = (float)value;
+        if ((double)single == value || isnan(value))
+        {
+            uint32_t bits;
+            memcpy(&bits, &single, sizeof(bits));
+            num[0] = 0xFA;
+            for (n = 1; n < 5; n++)
+                num[n] = (uint8_t)(bits >> (8 * (4 - n)));
+        }
+        else
+        {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            num[0] = 0xFB;
+            for (n = 1; n < 9; n++)
+                num[n] = (uint8_t)(bits >> (8 * (8 - n)));
+        }
+        begin_value(js, key);
+        put(js, (const char *)num, n);
+        return;
+    }
+    if (isnan(value) || isinf(value))
+    {
+        // в JSON нет NaN/Infinity
+        json_stream_null(js, key);
+        return;
+    }
+    char num[32];
+    int n = snprintf(num, sizeof(num), "%.15g", value);
+    if (strtod(num, NULL) != value)
+        n = snprintf(num, sizeof(num), "%.17g", value);
+    begin_value(js, key);
+    put(js, num, (size_t)n);
+}
+
+void json_stream_bool(json_stream_t *js, const char *key, bool value)
+{
+    begin_value(js, key);
+    if (js->cbor)
+        put_char(js, (char)(value ? 0xF5 : 0xF4));
+    else if (value)
+        put(js, "true", 4);
+    else
+        put(js, "false", 5);
+}
+
+void json_stream_null(json_stream_t *js, const char *key)
+{
+    begin_value(js, key);
+    if (js->cbor)
+        put_char(js, (char)0xF6);
+    else
+        put(js, "null", 4);
+}
+
+void json_stream_raw(json_stream_t *js, const char *key, const char *raw, size_t len)
+{
+    if (js->cbor)
+    {
+        // готовый JSON в CBOR не вставить
+        if (js->error == ESP_OK)
+            js->error = ESP_ERR_NOT_SUPPORTED;
+        return;
+    }
+    begin_value(js, key);
+    put(js, raw, len);
+}
+
+esp_err_t json_stream_finish(json_stream_t *js)
+{
+    if (js->error == ESP_OK && js->depth != 0)
+        js->error = ESP_ERR_INVALID_STATE;
+
+    if (js->flush)
+    {
+        if (js->error == ESP_OK && js->len > 0)
+        {
+            esp_err_t err = js->flush(js->buf, js->len, js->ctx);
+            if (err != ESP_OK)
+                js->error = err;
+        }
+        js->len = 0;
+    }
+    else if (js->buf && js->size > 0)
+    {
+        js->buf[js->len < js->size ? js->len : js->size - 1] = '\0';
+    }
+    return js->error;
+}
+
+static char pool_bufs[JSON_STREAM_POOL_COUNT][JSON_STREAM_POOL_BUF_SIZE];
+static atomic_uint pool_busy; // бит на занятый буфер
+static json_stream_pool_stats_t pool_stats;
+
+char *json_stream_buf_acquire(void)
+{
+    unsigned busy = atomic_load(&pool_busy);
+    for (int i = 0; i < JSON_STREAM_POOL_COUNT; i++)
+    {
+        unsigned bit = 1u << i;
+        if (busy & bit)
+            continue;
+        if (atomic_compare_exchange_strong(&pool_busy, &busy, busy | bit))
+        {
+            pool_stats.acquired++;
+            return pool_bufs[i];
+        }
+        // busy обновлен другой задачей, начинаем сначала
+        i = -1;
+    }
+    pool_stats.fallbacks++;
+    return (char *)malloc(JSON_STREAM_POOL_BUF_SIZE);
+}
+
+void json_stream_buf_release(char *buf)
+{
+    if (!buf)
+        return;
+    if (buf >= pool_bufs[0] && buf < pool_bufs[0] + sizeof(pool_bufs))
+    {
+        unsigned index = (unsigned)((buf - pool_bufs[0]) / JSON_STREAM_POOL_BUF_SIZE);
+        atomic_fetch_and(&pool_busy, ~(1u << index));
+        return;
+    }
+    free(buf);
+}
+
+const json_stream_pool_stats_t *json_stream_pool_get_stats(void)
+{
+    return &pool_stats;
+}
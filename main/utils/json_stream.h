@@ -0,0 +1,101 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Максимальная вложенность объектов и массивов
+#define JSON_STREAM_MAX_DEPTH 32
+// Статический пул буферов для исходящих сообщений: число буферов и размер одного
+#define JSON_STREAM_POOL_COUNT 3
+#define JSON_STREAM_POOL_BUF_SIZE 2048
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Приемник данных: вызывается, когда буфер заполнен, и из json_stream_finish()
+     *
+     * @return ESP_OK, если данные приняты
+     */
+    typedef esp_err_t (*json_stream_flush_t)(const char *data, size_t len, void *ctx);
+
+    // Потоковый JSON writer: пишет в буфер вызывающего, при заполнении сбрасывает его в приемник.
+    // Без приемника весь документ должен поместиться в буфер, иначе выставляется error.
+    // Тот же writer умеет писать CBOR (RFC 8949) с теми же вызовами, см. json_stream_init_cbor()
+    typedef struct
+    {
+        char *buf;
+        size_t size;
+        size_t len;
+        json_stream_flush_t flush;
+        void *ctx;
+        uint8_t depth;
+        uint32_t has_items; // бит на уровень вложенности: уже были элементы, нужна запятая
+        size_t total;       // сколько байт выдано всего
+        esp_err_t error;
+        bool cbor;          // писать CBOR вместо JSON
+    } json_stream_t;
+
+    void json_stream_init(json_stream_t *js, char *buf, size_t size, json_stream_flush_t flush, void *ctx);
+
+    /**
+     * @brief То же для CBOR: объекты и массивы пишутся map и array неопределенной длины, строки - text string,
+     *        json_stream_hex() - byte string, числа - целыми или float/double. json_stream_raw() не поддерживается.
+     *        len после json_stream_finish() - длина документа без завершающего '\0'
+     */
+    void json_stream_init_cbor(json_stream_t *js, char *buf, size_t size, json_stream_flush_t flush, void *ctx);
+
+    // key == NULL для элементов массива и корня документа
+    void json_stream_object_begin(json_stream_t *js, const char *key);
+    void json_stream_object_end(json_stream_t *js);
+    void json_stream_array_begin(json_stream_t *js, const char *key);
+    void json_stream_array_end(json_stream_t *js);
+
+    void json_stream_string(json_stream_t *js, const char *key, const char *str);
+    void json_stream_string_len(json_stream_t *js, const char *key, const char *str, size_t len);
+    void json_stream_hex(json_stream_t *js, const char *key, const uint8_t *data, size_t len);
+    void json_stream_int(json_stream_t *js, const char *key, int64_t value);
+    void json_stream_uint(json_stream_t *js, const char *key, uint64_t value);
+    void json_stream_double(json_stream_t *js, const char *key, double value);
+    void json_stream_bool(json_stream_t *js, const char *key, bool value);
+    void json_stream_null(json_stream_t *js, const char *key);
+
+    // Ключ с уже готовым JSON-значением
+    void json_stream_raw(json_stream_t *js, const char *key, const char *raw, size_t len);
+
+    /**
+     * @brief Завершение: сброс остатка в приемник или '\0' в конце буфера
+     *
+     * @return esp_err_t ESP_OK или первая ошибка (ESP_ERR_NO_MEM при переполнении буфера без приемника)
+     */
+    esp_err_t json_stream_finish(json_stream_t *js);
+
+    /**
+     * @brief Буфер из статического пула (JSON_STREAM_POOL_BUF_SIZE байт). Можно вызывать из любой задачи.
+     *        Если пул занят, буфер выделяется в куче и учитывается в статистике
+     *
+     * @return char* Буфер или NULL, если памяти нет
+     */
+    char *json_stream_buf_acquire(void);
+
+    // Возврат буфера, полученного json_stream_buf_acquire()
+    void json_stream_buf_release(char *buf);
+
+    typedef struct
+    {
+        uint32_t acquired;  // выдано из пула
+        uint32_t fallbacks; // пул был занят, выделено в куче
+    } json_stream_pool_stats_t;
+
+    const json_stream_pool_stats_t *json_stream_pool_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JSON_STREAM_H
@@ -0,0 +1,311 @@
+#include "payload_codec.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char *TAG = "PAYLOAD";
+
+static const char *format_names[PAYLOAD_FORMAT_COUNT] = {"json", "cbor"};
+static payload_format_stats_t format_stats[PAYLOAD_FORMAT_COUNT];
+
+const char *payload_format_name(uint8_t format)
+{
+    return format < PAYLOAD_FORMAT_COUNT ? format_names[format] : "unknown";
+}
+
+bool payload_format_from_name(const char *name, uint8_t *format)
+{
+    for (uint8_t i = 0; name && i < PAYLOAD_FORMAT_COUNT; i++)
+    {
+        if (strcmp(name, format_names[i]) == 0)
+        {
+            *format = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void payload_encoder_init(json_stream_t *js, uint8_t format, char *buf, size_t size)
+{
+    if (format == PAYLOAD_FORMAT_CBOR)
+        json_stream_init_cbor(js, buf, size, NULL, NULL);
+    else
+        json_stream_init(js, buf, size, NULL, NULL);
+}
+
+void payload_note_encoded(uint8_t format, size_t bytes, int64_t cpu_us)
+{
+    if (format >= PAYLOAD_FORMAT_COUNT)
+        return;
+    format_stats[format].encoded++;
+    format_stats[format].encoded_bytes += bytes;
+    format_stats[format].encode_us += (uint64_t)cpu_us;
+}
+
+const payload_format_stats_t *payload_get_stats(uint8_t format)
+{
+    return &format_stats[format < PAYLOAD_FORMAT_COUNT ? format : PAYLOAD_FORMAT_JSON];
+}
+
+void payload_reset_stats(void)
+{
+    memset(format_stats, 0, sizeof(format_stats));
+}
+
+// Разбор CBOR (RFC 8949) в дерево cJSON
+typedef struct
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    uint8_t depth;
+} cbor_reader_t;
+
+#define CBOR_INDEFINITE UINT64_MAX
+#define CBOR_BREAK 0xFF
+
+// Заголовок элемента: старший тип, дополнительная информация и аргумент
+static bool read_head(cbor_reader_t *r, uint8_t *major, uint8_t *info, uint64_t *arg)
+{
+    if (r->p >= r->end)
+        return false;
+    uint8_t initial = *r->p++;
+    *major = initial >> 5;
+    *info = initial & 0x1F;
+
+    size_t n;
+    if (*info < 24)
+    {
+        *arg = *info;
+        return true;
+    }
+    else if (*info == 31)
+    {
+        *arg = CBOR_INDEFINITE;
+        return true;
+    }
+    else if (*info <= 27)
+        n = (size_t)1 << (*info - 24);
+    else
+        return false;
+
+    if ((size_t)(r->end - r->p) < n)
+        return false;
+    *arg = 0;
+    for (size_t i = 0; i < n; i++)
+        *arg = (*arg << 8) | *r->p++;
+    return true;
+}
+
+static double half_to_double(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1F;
+    int mantissa = half & 0x3FF;
+    double value;
+    if (exponent == 0)
+        value = ldexp(mantissa, -24);
+    else if (exponent != 31)
+        value = ldexp(mantissa + 1024, exponent - 25);
+    else
+        value = mantissa == 0 ? INFINITY : NAN;
+    return (half & 0x8000) ? -value : value;
+}
+
+// Строка длины len из входа как C-строка (освобождается вызывающим)
+static char *take_string(cbor_reader_t *r, uint64_t len, bool hex)
+{
+    if (len == CBOR_INDEFINITE || len > (uint64_t)(r->end - r->p))
+        return NULL;
+    char *str = (char *)malloc(hex ? (size_t)len * 2 + 1 : (size_t)len + 1);
+    if (!str)
+        return NULL;
+    if (hex)
+    {
+        static const char digits[] = "0123456789abcdef";
+        for (size_t i = 0; i < len; i++)
+        {
+            str[2 * i] = digits[r->p[i] >> 4];
+            str[2 * i + 1] = digits[r->p[i] & 0x0F];
+        }
+        str[len * 2] = '\0';
+    }
+    else
+    {
+        memcpy(str, r->p, (size_t)len);
+        str[len] = '\0';
+    }
+    r->p += len;
+    return str;
+}
+
+static inline bool at_break(const cbor_reader_t *r)
+{
+    return r->p < r->end && *r->p == CBOR_BREAK;
+}
+
+static cJSON *decode_item(cbor_reader_t *r);
+
+// Ключ map: text string или целое число (как десятичная строка)
+static char *decode_key(cbor_reader_t *r)
+{
+    uint8_t major, info;
+    uint64_t arg;
+    if (!read_head(r, &major, &info, &arg))
+        return NULL;
+    if (major == 3)
+        return take_string(r, arg, false);
+    if (major == 0 || major == 1)
+    {
+        char *key = (char *)malloc(24);
+        if (key)
+        {
+            if (major == 0)
+                snprintf(key, 24, "%" PRIu64, arg);
+            else
+                snprintf(key, 24, "-%" PRIu64, arg + 1);
+        }
+        return key;
+    }
+    return NULL;
+}
+
+static cJSON *decode_container(cbor_reader_t *r, bool map, uint64_t count)
+{
+    if (++r->depth > PAYLOAD_CBOR_MAX_DEPTH)
+        return NULL;
+
+    cJSON *container = map ? cJSON_CreateObject() : cJSON_CreateArray();
+    for (uint64_t i = 0; container && (count == CBOR_INDEFINITE || i < count); i++)
+    {
+        if (count == CBOR_INDEFINITE && at_break(r))
+        {
+            r->p++;
+            break;
+        }
+        char *key = NULL;
+        if (map && !(key = decode_key(r)))
+        {
+            cJSON_Delete(container);
+            return NULL;
+        }
+        cJSON *item = decode_item(r);
+        if (!item)
+        {
+            free(key);
+            cJSON_Delete(container);
+            return NULL;
+        }
+        if (map)
+            cJSON_AddItemToObject(container, key, item);
+        else
+            cJSON_AddItemToArray(container, item);
+        free(key);
+    }
+    r->depth--;
+    return container;
+}
+
+static cJSON *decode_item(cbor_reader_t *r)
+{
+    uint8_t major, info;
+    uint64_t arg;
+    if (!read_head(r, &major, &info, &arg))
+        return NULL;
+    // теги пропускаются в цикле, значение разбирается как есть; цепочка тегов ограничена как вложенность
+    for (uint8_t tags = 0; major == 6; tags++)
+    {
+        if (arg == CBOR_INDEFINITE || tags == PAYLOAD_CBOR_MAX_DEPTH || !read_head(r, &major, &info, &arg))
+            return NULL;
+    }
+
+    switch (major)
+    {
+    case 0:
+        return arg == CBOR_INDEFINITE ? NULL : cJSON_CreateNumber((double)arg);
+    case 1:
+        return arg == CBOR_INDEFINITE ? NULL : cJSON_CreateNumber(-1.0 - (double)arg);
+    case 2:
+    case 3:
+    {
+        // строки по частям (неопределенной длины) не поддерживаются
+        char *str = take_string(r, arg, major == 2);
+        if (!str)
+            return NULL;
+        cJSON *item = cJSON_CreateString(str);
+        free(str);
+        return item;
+    }
+    case 4:
+    case 5:
+        return decode_container(r, major == 5, arg);
+    default:
+        switch (info)
+        {
+        case 20:
+            return cJSON_CreateFalse();
+        case 21:
+            return cJSON_CreateTrue();
+        case 22:
+        case 23:
+            return cJSON_CreateNull();
+        case 25:
+            return cJSON_CreateNumber(half_to_double((uint16_t)arg));
+        case 26:
+        {
+            uint32_t bits = (uint32_t)arg;
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return cJSON_CreateNumber(value);
+        }
+        case 27:
+        {
+            double value;
+            memcpy(&value, &arg, sizeof(value));
+            return cJSON_CreateNumber(value);
+        }
+        default:
+            return NULL;
+        }
+    }
+}
+
+cJSON *payload_decode(const char *data, size_t len, uint8_t *format)
+{
+    // JSON не начинается с байта >= 0x80, CBOR map - всегда 0xA0..0xBF
+    uint8_t first = len > 0 ? (uint8_t)data[0] : 0;
+    uint8_t fmt = (first >> 5) == 5 ? PAYLOAD_FORMAT_CBOR : PAYLOAD_FORMAT_JSON;
+    if (format)
+        *format = fmt;
+
+    int64_t started_us = esp_timer_get_time();
+    cJSON *root;
+    if (fmt == PAYLOAD_FORMAT_CBOR)
+    {
+        cbor_reader_t r = {(const uint8_t *)data, (const uint8_t *)data + len, 0};
+        root = decode_item(&r);
+        if (root && r.p != r.end)
+        {
+            ESP_LOGW(TAG, "%u trailing bytes after CBOR payload", (unsigned)(r.end - r.p));
+        }
+    }
+    else
+    {
+        root = cJSON_ParseWithLength(data, len);
+    }
+
+    payload_format_stats_t *stats = &format_stats[fmt];
+    if (!root)
+    {
+        stats->errors++;
+        ESP_LOGE(TAG, "Invalid %s payload (%u bytes)", format_names[fmt], (unsigned)len);
+        return NULL;
+    }
+    stats->decoded++;
+    stats->decoded_bytes += len;
+    stats->decode_us += (uint64_t)(esp_timer_get_time() - started_us);
+    return root;
+}
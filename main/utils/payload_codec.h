@@ -0,0 +1,67 @@
+#ifndef PAYLOAD_CODEC_H
+#define PAYLOAD_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cJSON.h"
+#include "json_stream.h"
+
+// Форматы сообщений (sys_settings.payload.fd_format)
+#define PAYLOAD_FORMAT_JSON 0
+#define PAYLOAD_FORMAT_CBOR 1
+#define PAYLOAD_FORMAT_COUNT 2
+
+// Вложенность входящего CBOR не больше
+#define PAYLOAD_CBOR_MAX_DEPTH 16
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // "json" / "cbor"
+    const char *payload_format_name(uint8_t format);
+
+    // Формат по имени, false - неизвестное имя
+    bool payload_format_from_name(const char *name, uint8_t *format);
+
+    // Writer для исходящего сообщения в заданном формате (без приемника, документ целиком в буфере)
+    void payload_encoder_init(json_stream_t *js, uint8_t format, char *buf, size_t size);
+
+    // Учет закодированного сообщения в статистике формата
+    void payload_note_encoded(uint8_t format, size_t bytes, int64_t cpu_us);
+
+    /**
+     * @brief Разбор входящего сообщения. Формат определяется по первому байту: CBOR map (0xA0..0xBF)
+     *        или JSON. Ключи-числа CBOR становятся десятичными строками, byte string - hex-строками,
+     *        так что обработчики работают с одним и тем же деревом cJSON
+     *
+     * @param data Данные (без '\0' в конце)
+     * @param len Длина
+     * @param format Формат сообщения (может быть NULL)
+     * @return cJSON* Дерево (освобождается cJSON_Delete) или NULL, если сообщение не разбирается
+     */
+    cJSON *payload_decode(const char *data, size_t len, uint8_t *format);
+
+    typedef struct
+    {
+        uint32_t encoded;       // сообщений закодировано
+        uint64_t encoded_bytes; // их размер
+        uint64_t encode_us;     // время кодирования
+        uint32_t decoded;       // сообщений разобрано
+        uint64_t decoded_bytes;
+        uint64_t decode_us;
+        uint32_t errors;        // не разобрано
+    } payload_format_stats_t;
+
+    const payload_format_stats_t *payload_get_stats(uint8_t format);
+
+    void payload_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PAYLOAD_CODEC_H
@@ -3,9 +3,9 @@
 #include <stddef.h>
 #include <string.h>
 
-//#include "freertos/FreeRTOS.h"
-//#include "freertos/task.h"
-//#include "freertos/semphr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 //#include "freertos/queue.h"
 
 #include "lwip/sockets.h"
@@ -18,6 +18,9 @@
 #include "wifi/mqtt_command.h"
 #include "mqtt_command.h"
 #include "settings.h"
+#include "mqtt_outbox.h"
+#include "mqtt_topics.h"
+#include "mqtt.h"
 
 
 static const char *TAG = "MQTT";
@@ -40,24 +43,206 @@ static void log_error_if_nonzero(const char *message, int error_code)
 }
 static esp_mqtt_client_handle_t mqtt_client;
 
-esp_err_t mqtt_publish_data(const char *topic, const char *data)
+#ifdef CONFIG_MQTT_PROTOCOL_5
+#include "mqtt5_client.h"
+
+// Соединение по MQTT 5 (sys_settings.mqtt5.enabled)
+static bool mqtt5_active = false;
+
+// Публикация с properties не атомарна (set_publish_property, затем publish), отправители сериализуются
+static SemaphoreHandle_t mqtt5_send_lock = NULL;
+
+// Псевдонимы топиков fd на текущее соединение: псевдоним = индекс + 1
+static char *alias_topics[MQTT5_MAX_TOPIC_ALIASES];
+static uint16_t alias_next = 0;
+static bool aliases_disabled = false;
+
+static void mqtt5_aliases_reset(void)
+{
+    for (int i = 0; i < MQTT5_MAX_TOPIC_ALIASES; i++)
+    {
+        free(alias_topics[i]);
+        alias_topics[i] = NULL;
+    }
+    alias_next = 0;
+    aliases_disabled = false;
+}
+
+// Псевдоним топика; при нехватке занимается следующий по кругу, клиент переназначит его отправкой топика
+static uint16_t mqtt5_alias_for(const char *topic)
+{
+    uint16_t count = sys_settings.mqtt5.topic_aliases;
+    if (count > MQTT5_MAX_TOPIC_ALIASES)
+        count = MQTT5_MAX_TOPIC_ALIASES;
+    if (count == 0 || aliases_disabled)
+        return 0;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (alias_topics[i] && strcmp(alias_topics[i], topic) == 0)
+            return i + 1;
+    }
+
+    uint16_t slot = alias_next % count;
+    alias_next = slot + 1;
+    char *copy = strdup(topic);
+    if (!copy)
+        return 0;
+    free(alias_topics[slot]);
+    alias_topics[slot] = copy;
+    return slot + 1;
+}
+#endif
+
+// Отправка клиентом; вызывается очередью mqtt_outbox
+static esp_err_t client_send(const mqtt_outbox_item_t *item)
 {
     if (!client || !sys_settings.mqtt.mqtt_connected) {
-        ESP_LOGE("MQTT", "Client not ready (init: %d, connected: %d)", 
-            client != NULL, sys_settings.mqtt.mqtt_connected);
         return ESP_ERR_INVALID_STATE;
     }
 
-    int msg_id = esp_mqtt_client_publish(client, topic, data, 0, 1, 0);
+    int msg_id;
+    int retain = (item->flags & MQTT_OUTBOX_RETAIN) ? 1 : 0;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (mqtt5_active) {
+        esp_mqtt5_publish_property_config_t property = {0};
+        if ((item->flags & MQTT_OUTBOX_STATE) && !(item->flags & MQTT_OUTBOX_RETAIN)) {
+            // устаревшее состояние не доставляется подписчику, подключившемуся позже
+            property.message_expiry_interval = sys_settings.mqtt5.state_expiry;
+        }
+        if (item->correlation_len) {
+            property.correlation_data = (const char *)item->correlation;
+            property.correlation_data_len = item->correlation_len;
+        }
+
+        xSemaphoreTake(mqtt5_send_lock, portMAX_DELAY);
+        if (item->flags & MQTT_OUTBOX_STATE) {
+            property.topic_alias = mqtt5_alias_for(item->topic);
+        }
+        esp_mqtt5_client_set_publish_property(client, &property);
+        msg_id = esp_mqtt_client_publish(client, item->topic, item->data, (int)item->len, 1, retain);
+        if (msg_id < 0 && property.topic_alias) {
+            // брокер принимает меньше псевдонимов, чем настроено: до переподключения без них
+            ESP_LOGW(TAG, "Publish with topic alias %u failed, disabling aliases", property.topic_alias);
+            aliases_disabled = true;
+            property.topic_alias = 0;
+            esp_mqtt5_client_set_publish_property(client, &property);
+            msg_id = esp_mqtt_client_publish(client, item->topic, item->data, (int)item->len, 1, retain);
+        }
+        xSemaphoreGive(mqtt5_send_lock);
+    } else
+#endif
+    {
+        msg_id = esp_mqtt_client_publish(client, item->topic, item->data, (int)item->len, 1, retain);
+    }
     if (msg_id < 0) {
         ESP_LOGE("MQTT", "Publish failed (error %d)", msg_id);
         return ESP_FAIL;
     }
-    
-//    ESP_LOGI("MQTT", "Published to [%s]: %s", topic, data);
+
+//    ESP_LOGI("MQTT", "Published to [%s]: %.*s", item->topic, (int)item->len, item->data);
     return ESP_OK;
 }
 
+// Команда, которая выполняется сейчас в задаче команд: ответы на нее в топик событий
+// уходят в response topic команды с ее correlation data (MQTT 5)
+static struct {
+    TaskHandle_t task;
+    char response_topic[MQTT_RESPONSE_TOPIC_MAX];
+    uint8_t correlation[MQTT_OUTBOX_MAX_CORRELATION];
+    uint8_t correlation_len;
+} request;
+
+void mqtt_request_begin(const char *response_topic, size_t response_topic_len,
+                        const uint8_t *correlation, size_t correlation_len)
+{
+    request.task = NULL;
+    request.response_topic[0] = '\0';
+    request.correlation_len = 0;
+    if (response_topic && response_topic_len > 0 && response_topic_len < sizeof(request.response_topic)) {
+        memcpy(request.response_topic, response_topic, response_topic_len);
+        request.response_topic[response_topic_len] = '\0';
+    }
+    if (correlation && correlation_len > 0 && correlation_len <= sizeof(request.correlation)) {
+        memcpy(request.correlation, correlation, correlation_len);
+        request.correlation_len = (uint8_t)correlation_len;
+    }
+    if (request.response_topic[0] || request.correlation_len) {
+        request.task = xTaskGetCurrentTaskHandle();
+    }
+}
+
+void mqtt_request_end(void)
+{
+    request.task = NULL;
+}
+
+// Входящее сообщение со свойствами MQTT 5, которые нужны для ответа
+static void inbound_from_event(esp_mqtt_event_handle_t event, mqtt_inbound_t *msg)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->topic = event->topic;
+    msg->topic_len = (size_t)event->topic_len;
+    msg->data = event->data;
+    msg->data_len = (size_t)event->data_len;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (!mqtt5_active || !event->property) {
+        return;
+    }
+    const esp_mqtt5_event_property_t *property = event->property;
+    if (property->response_topic && property->response_topic_len > 0) {
+        if (property->response_topic_len < MQTT_RESPONSE_TOPIC_MAX) {
+            msg->response_topic = property->response_topic;
+            msg->response_topic_len = (size_t)property->response_topic_len;
+        } else {
+            ESP_LOGW(TAG, "Response topic too long, replying to event topic");
+        }
+    }
+    if (property->correlation_data && property->correlation_data_len > 0) {
+        if (property->correlation_data_len <= MQTT_OUTBOX_MAX_CORRELATION) {
+            msg->correlation = (const uint8_t *)property->correlation_data;
+            msg->correlation_len = property->correlation_data_len;
+        } else {
+            ESP_LOGW(TAG, "Correlation data too long (%u bytes), ignored", property->correlation_data_len);
+        }
+    }
+#endif
+}
+
+static esp_err_t publish(const char *topic, const char *data, size_t len, uint8_t flags)
+{
+    mqtt_outbox_item_t item = {topic, data, len, flags, NULL, 0};
+    if (request.task && request.task == xTaskGetCurrentTaskHandle() && topic &&
+        strcmp(topic, mqtt_topic(MQTT_TOPIC_EVENT)) == 0) {
+        if (request.response_topic[0]) {
+            item.topic = request.response_topic;
+        }
+        item.correlation = request.correlation_len ? request.correlation : NULL;
+        item.correlation_len = request.correlation_len;
+    }
+    return mqtt_outbox_publish_item(&item);
+}
+
+esp_err_t mqtt_publish_data(const char *topic, const char *data)
+{
+    return publish(topic, data, data ? strlen(data) : 0, 0);
+}
+
+esp_err_t mqtt_publish_data_len(const char *topic, const char *data, size_t len)
+{
+    return publish(topic, data, len, 0);
+}
+
+esp_err_t mqtt_publish_state_len(const char *topic, const char *data, size_t len)
+{
+    return publish(topic, data, len, MQTT_OUTBOX_STATE);
+}
+
+esp_err_t mqtt_publish_retained_len(const char *topic, const char *data, size_t len)
+{
+    return publish(topic, data, len, MQTT_OUTBOX_STATE | MQTT_OUTBOX_RETAIN);
+}
+
 void *get_mqtt_client()
 {
     return client;
@@ -91,26 +276,10 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
     client = event->client;
     int msg_id;
 
-    // Выносим объявления переменных в начало функции
-    const char *mqttPrefixIN = sys_settings.mqtt.prefix;
-    const char *topicIN = "/td/matter/#";
-    char completeTopicIN[strlen(mqttPrefixIN) + strlen(topicIN) + 1];
-    strcpy(completeTopicIN, mqttPrefixIN);
-    strcat(completeTopicIN, topicIN);
-    const char *topicIN_csa = "/td/matter_csa/#";
-    char completeTopicIN_csa[strlen(mqttPrefixIN) + strlen(topicIN_csa) + 1];
-    strcpy(completeTopicIN_csa, mqttPrefixIN);
-    strcat(completeTopicIN_csa, topicIN_csa);
-
-    
-    size_t topic_len = strlen(mqttPrefixIN) + strlen("/command/matter") + 1;
-    char commandTopic[topic_len];
-    snprintf(commandTopic, topic_len, "%s/command/matter", mqttPrefixIN);
-
-    // Объявляем переменные для MQTT_EVENT_CONNECTED заранее
-    const char *mqttPrefix = sys_settings.mqtt.prefix;
-    const char *topic = "/device/matter/";
-    char completeTopiclwt[strlen(mqttPrefix) + strlen(topic) + strlen(deviceName) + 1];
+    // Топики строятся один раз при смене префикса (mqtt_topics)
+    const char *completeTopicIN = mqtt_topic(MQTT_TOPIC_TD);
+    const char *completeTopicIN_csa = mqtt_topic(MQTT_TOPIC_TD_CSA);
+    const char *commandTopic = mqtt_topic(MQTT_TOPIC_COMMAND);
 
     switch ((esp_mqtt_event_id_t)event_id)
     {
@@ -123,11 +292,21 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
         ESP_LOGI(TAG, "subscribe successful to %s, msg_id=%d", completeTopicIN_csa, msg_id);
         msg_id = esp_mqtt_client_subscribe(client, commandTopic, 0);
         ESP_LOGI(TAG, "subscribe successful to %s, msg_id=%d", commandTopic, msg_id);
+        msg_id = esp_mqtt_client_subscribe(client, mqtt_topic(MQTT_TOPIC_TD_BATCH), 0);
+        ESP_LOGI(TAG, "subscribe successful to %s, msg_id=%d", mqtt_topic(MQTT_TOPIC_TD_BATCH), msg_id);
+        msg_id = esp_mqtt_client_subscribe(client, mqtt_topic(MQTT_TOPIC_TD_GROUP), 0);
+        ESP_LOGI(TAG, "subscribe successful to %s, msg_id=%d", mqtt_topic(MQTT_TOPIC_TD_GROUP), msg_id);
         sys_settings.mqtt.mqtt_connected = true;
-        strcpy(completeTopiclwt, mqttPrefix);
-        strcat(completeTopiclwt, topic);
-        strcat(completeTopiclwt, deviceName);
-        esp_mqtt_client_publish(client, completeTopiclwt, "{\"status\":\"online\"}", 0, 0, 0);
+#ifdef CONFIG_MQTT_PROTOCOL_5
+        // псевдонимы действуют в пределах соединения
+        if (mqtt5_active) {
+            xSemaphoreTake(mqtt5_send_lock, portMAX_DELAY);
+            mqtt5_aliases_reset();
+            xSemaphoreGive(mqtt5_send_lock);
+        }
+#endif
+        mqtt_outbox_set_connected(true);
+        esp_mqtt_client_publish(client, mqtt_topic(MQTT_TOPIC_STATUS), "{\"status\":\"online\"}", 0, 0, 0);
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
@@ -137,6 +316,7 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
         }
         MQTT_CONNEECTED = 0;
         sys_settings.mqtt.mqtt_connected = false;
+        mqtt_outbox_set_connected(false);
         break;
     case MQTT_EVENT_SUBSCRIBED:
         //ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -148,9 +328,13 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
     //    ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
         break;
     case MQTT_EVENT_DATA:
-    
-        handle_mqtt_data(event);
+    {
+        // задача MQTT только ставит сообщение в очередь, выполняет его задача команд
+        mqtt_inbound_t msg;
+        inbound_from_event(event, &msg);
+        mqtt_command_enqueue(&msg);
         break;
+    }
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
         if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT)
@@ -176,13 +360,7 @@ esp_err_t mqtt_app_start(void)
     }
 
     // Публикуем доступность устройства
-    const char *mqttPrefix = sys_settings.mqtt.prefix;
-    const char *topic = "/device/matter/";
-    
-    char completeTopiclwt[strlen(mqttPrefix) + strlen(topic) + strlen(deviceName) + 1];
-    strcpy(completeTopiclwt, mqttPrefix);
-    strcat(completeTopiclwt, topic);
-    strcat(completeTopiclwt, deviceName);
+    const char *completeTopiclwt = mqtt_topic(MQTT_TOPIC_STATUS);
 
     esp_mqtt_client_config_t mqtt_cfg = {
         .broker.address.uri = sys_settings.mqtt.server,
@@ -194,6 +372,23 @@ esp_err_t mqtt_app_start(void)
         .session.last_will.retain = true,
     };
 
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    mqtt5_active = false;
+    if (sys_settings.mqtt5.enabled) {
+        if (!mqtt5_send_lock) {
+            mqtt5_send_lock = xSemaphoreCreateMutex();
+        }
+        mqtt5_active = mqtt5_send_lock != NULL;
+        if (mqtt5_active) {
+            mqtt_cfg.session.protocol_ver = MQTT_PROTOCOL_V_5;
+        }
+    }
+#else
+    if (sys_settings.mqtt5.enabled) {
+        ESP_LOGW(TAG, "MQTT 5 requested but CONFIG_MQTT_PROTOCOL_5 is disabled, using MQTT 3.1.1");
+    }
+#endif
+
     client = esp_mqtt_client_init(&mqtt_cfg);
     if (client == NULL) {
         ESP_LOGE(TAG, "Failed to initialize MQTT client");
@@ -219,6 +414,7 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
             client = NULL;
             MQTT_CONNEECTED = 0;
             sys_settings.mqtt.mqtt_connected = false;
+            mqtt_outbox_set_connected(false);
         }
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
@@ -241,6 +437,13 @@ void Publisher_Task(void *params)
 void init_wifi_mqtt_handler()
 {
     if (strcmp(sys_settings.mqtt.server, "") != 0){
+    // сообщения, отправленные без соединения, ждут переподключения в очереди
+    if (mqtt_outbox_init(client_send) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start MQTT outbox");
+    }
+    if (mqtt_command_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start MQTT command worker");
+    }
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL, NULL));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL, NULL));
     
@@ -2,6 +2,7 @@
 #include "esp_err.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -11,6 +12,28 @@ extern "C"
     // Функция для отправки данных в MQTT
     esp_err_t mqtt_publish_data(const char *topic, const char *data);
 
+    // Отправка данных заданной длины (без завершающего '\0'), например части потокового JSON
+    esp_err_t mqtt_publish_data_len(const char *topic, const char *data, size_t len);
+
+    // Публикация состояния: пока нет соединения, в очереди хранится только последнее значение топика
+    esp_err_t mqtt_publish_state_len(const char *topic, const char *data, size_t len);
+
+    // Состояние с флагом retain: брокер отдает последнее значение новым подписчикам (пустое сообщение удаляет его)
+    esp_err_t mqtt_publish_retained_len(const char *topic, const char *data, size_t len);
+
+    // Response topic команды (MQTT 5) не длиннее
+#define MQTT_RESPONSE_TOPIC_MAX 128
+
+    /**
+     * @brief Начало выполнения команды в текущей задаче: ее ответы в топик событий уходят
+     *        в response topic с correlation data (MQTT 5). Без response topic и correlation data ничего не меняется
+     */
+    void mqtt_request_begin(const char *response_topic, size_t response_topic_len,
+                            const uint8_t *correlation, size_t correlation_len);
+
+    // Конец выполнения команды
+    void mqtt_request_end(void);
+
     // Получаем указатель на клиент (если нужно напрямую)
     void *get_mqtt_client();
 
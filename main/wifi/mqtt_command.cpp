@@ -3,6 +3,8 @@
 #include "esp_log.h"
 #include "mqtt_client.h"
 #include "mqtt.h"
+#include "mqtt_command.h"
+#include "mqtt_router.h"
 
 #include <esp_matter.h>
 #include <esp_matter_core.h>
@@ -19,6 +21,8 @@
 #include <esp_check.h>
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 #include <lib/shell/Engine.h>
 #include <memory>
 #include <platform/ESP32/OpenthreadLauncher.h>
@@ -27,12 +31,32 @@
 #include <openthread/instance.h>
 #include <esp_openthread.h>
 #include <esp_err.h>
+#include <inttypes.h>
+#include <strings.h>
 
 // #include "../matter/matter_command.h"
 #include "matter_command.h"
 #include "matter_callbacks.h"
 
 #include "devices.h"
+#include "interview_cache.h"
+#include "registry_export.h"
+#include "json_stream.h"
+#include "report_coalescer.h"
+#include "mqtt_outbox.h"
+#include "mqtt_topics.h"
+#include "payload_codec.h"
+#include "command_batch.h"
+#include "command_tracker.h"
+#include "command_sequence.h"
+#include "group_control.h"
+#include "scene_engine.h"
+#include "typed_command.h"
+#include "chip_work.h"
+#include "session_warm.h"
+#include "node_reachability.h"
+#include "command_policy.h"
+#include "matter_controller_device_mgr.h"
 
 #include <stdio.h>
 #include "cJSON.h"
@@ -49,6 +73,28 @@ using namespace chip::app::Clusters;
 
 static const char *TAG = "MQTT";
 
+// Ответ {"action":..,["id":..,]"status":..}. action и id приходят из входящего сообщения и экранируются,
+// слишком длинный ответ не публикуется обрезанным
+static esp_err_t publish_action_status(const char *topic, const char *action, const char *status, const char *id = nullptr)
+{
+    char msg[192];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", action);
+    if (id && id[0])
+        json_stream_string(&js, "id", id);
+    json_stream_string(&js, "status", status);
+    json_stream_object_end(&js);
+    esp_err_t err = json_stream_finish(&js);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Reply for action '%.32s' does not fit", action);
+        return err;
+    }
+    return mqtt_publish_data(topic, msg);
+}
+
 // Отправка комманд создания новой Thread сети
 static esp_err_t otcli_string_handler(const char *input_str)
 {
@@ -68,10 +114,94 @@ static esp_err_t otcli_string_handler(const char *input_str)
     return ESP_OK;
 }
 
-extern "C" void handle_command(cJSON *json, const char *action_type, const char *eventTopic)
+// id команды из входящего сообщения: строка или число, NULL - нет
+static const char *read_command_id(cJSON *json, char *buf, size_t size)
+{
+    cJSON *id = cJSON_GetObjectItem(json, "id");
+    if (cJSON_IsString(id) && id->valuestring[0])
+        return id->valuestring;
+    if (cJSON_IsNumber(id))
+    {
+        snprintf(buf, size, "%.0f", id->valuedouble);
+        return buf;
+    }
+    return nullptr;
+}
+
+// Отслеживаемая команда из аргументов "<node-id> <endpoint-ids> <cluster-ids> <command-id | attribute-ids> ...",
+// из списков берется первый элемент
+static bool track_from_args(command_track_kind_t kind, int argc, char **argv, command_track_t *track)
+{
+    if (kind == COMMAND_TRACK_NONE || argc < 4)
+        return false;
+    track->kind = kind;
+    track->node_id = strtoull(argv[0], NULL, 0);
+    track->endpoint_id = (uint16_t)strtoul(argv[1], NULL, 0);
+    track->cluster_id = (uint32_t)strtoul(argv[2], NULL, 0);
+    track->item_id = (uint32_t)strtoul(argv[3], NULL, 0);
+    return true;
+}
+
+// Разбиение строки на аргументы по пробелам (строка меняется)
+static int split_args(char *line, char **argv, int max)
+{
+    int argc = 0;
+    char *save = nullptr;
+    char *token = strtok_r(line, " ", &save);
+    while (token != nullptr && argc < max)
+    {
+        argv[argc++] = token;
+        token = strtok_r(nullptr, " ", &save);
+    }
+    return argc;
+}
+
+// Команда контроллера в записи очереди chip_work: строка payload копируется целиком
+typedef struct
+{
+    esp_err_t (*command)(int argc, char **argv);
+    const char *action; // имя из mqtt_actions[]
+    command_track_kind_t track_kind;
+    char id[24];
+    char line[160];
+} controller_work_t;
+static_assert(sizeof(controller_work_t) <= CHIP_WORK_ARG_SIZE, "controller_work_t does not fit a chip_work record");
+
+// На потоке CHIP: стек не блокируется, ошибка неотслеживаемой команды публикуется в топик событий
+static void run_controller_work(void *arg)
+{
+    controller_work_t *work = static_cast<controller_work_t *>(arg);
+    char *argv[10];
+    int argc = split_args(work->line, argv, 10);
+
+    command_track_t track = {};
+    track.id = work->id;
+    track.action = work->action;
+    bool tracked = track_from_args(work->track_kind, argc, argv, &track);
+    uint32_t token = tracked ? command_tracker_begin(&track) : 0;
+    // чтение и запись esp_matter недоступному узлу не отправляются (invoke проверяет command_tracker_send_invoke)
+    esp_err_t result = tracked && track.kind != COMMAND_TRACK_INVOKE && !node_reachability_admit(track.node_id)
+                           ? ESP_ERR_INVALID_STATE
+                           : work->command(argc, argv);
+    command_tracker_sent(token, result);
+    if (result != ESP_OK && token == 0)
+    {
+        ESP_LOGE(TAG, "%s command failed: %s", work->action, esp_err_to_name(result));
+        publish_action_status(mqtt_topic(MQTT_TOPIC_EVENT), work->action, esp_err_to_name(result), work->id);
+    }
+}
+
+// Команда контроллера из строки payload ("<node-id> <endpoint-id> ..."), результат - в топик событий.
+// Команды стека (chip_thread) выполняются на потоке CHIP через очередь chip_work, "progress" - команда принята.
+// Для отслеживаемых команд с "id" после "progress" публикуется итог, см. command_tracker_begin()
+static void run_controller_command(cJSON *json, const char *action_type, const char *eventTopic,
+                                   esp_err_t (*command)(int argc, char **argv), bool chip_thread,
+                                   command_track_kind_t track_kind)
 {
 
     ESP_LOGW(TAG, "%s command", action_type);
+    char id_buf[24];
+    const char *id = read_command_id(json, id_buf, sizeof(id_buf));
     cJSON *payload = cJSON_GetObjectItem(json, "payload");
     if (payload && cJSON_IsString(payload))
     {
@@ -79,10 +209,30 @@ extern "C" void handle_command(cJSON *json, const char *action_type, const char
         // Проверка входной строки
         if (input_str == nullptr || strlen(input_str) == 0)
         {
-            char error_msg[64];
             // формат {"action":action_type,"status":"INVALID_ARG"}
-            snprintf(error_msg, sizeof(error_msg), "{\"action\":\"%s\",\"status\":\"INVALID_ARG\"}", action_type);
-            mqtt_publish_data(eventTopic, error_msg);
+            publish_action_status(eventTopic, action_type, "INVALID_ARG", id);
+            return;
+        }
+
+        esp_err_t result;
+        if (chip_thread)
+        {
+            // без выделения памяти и блокировки стека: строка копируется в запись очереди
+            controller_work_t work = {command, action_type, track_kind};
+            strlcpy(work.id, id ? id : "", sizeof(work.id));
+            if (strlcpy(work.line, input_str, sizeof(work.line)) >= sizeof(work.line))
+            {
+                publish_action_status(eventTopic, action_type, "INVALID_SIZE", id);
+                return;
+            }
+            result = chip_work_post(run_controller_work, &work, sizeof(work));
+            if (result != ESP_OK)
+            {
+                publish_action_status(eventTopic, action_type, result == ESP_ERR_NO_MEM ? "busy" : esp_err_to_name(result),
+                                      id);
+                return;
+            }
+            publish_action_status(eventTopic, action_type, "progress", id);
             return;
         }
 
@@ -90,110 +240,29 @@ extern "C" void handle_command(cJSON *json, const char *action_type, const char
         char *input_copy = strdup(input_str);
         if (input_copy == nullptr)
         {
-            char error_msg[64];
-            snprintf(error_msg, sizeof(error_msg), "{\"action\":\"%s\",\"status\":\"ERR_NO_MEM\"}", action_type);
-            mqtt_publish_data(eventTopic, error_msg);
+            publish_action_status(eventTopic, action_type, "ERR_NO_MEM", id);
             return;
         }
 
         // Разбиваем строку на токены
         char *argv[10];
-        int argc = 0;
+        int argc = split_args(input_copy, argv, 10);
 
-        char *token = strtok(input_copy, " ");
-        while (token != nullptr && argc < 10)
-        {
-            argv[argc++] = token;
-            token = strtok(nullptr, " ");
-        }
-        esp_err_t result = ESP_FAIL;
         // Вызываем  обработчик
-        if (strcmp(action_type, "pairing") == 0)
-        {
-
-            // chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_pairing(argc, argv);
-            // chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "subs-attr") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_subscribe_attr(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "invoke-cmd") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_invoke_command(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "read-attr") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_read_attr(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "write-attr") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_write_attr(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "read-event") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_read_event(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "subscribe-event") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_subscribe_event(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "shutdown-subscription") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_shutdown_subscription(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "shutdown-subscriptions") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_shutdown_subscriptions(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "shutdown-all-subscriptions") == 0)
-        {
-            chip::DeviceLayer::PlatformMgr().LockChipStack();
-            result = esp_matter::command::controller_shutdown_all_subscriptions(argc, argv);
-            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
-        }
-        if (strcmp(action_type, "remove-node") == 0)
-
-        {
-            uint64_t node_id = strtoull(argv[0], NULL, 10); // Десятичное число
-                                                            // или, если payload содержит HEX:
-                                                            // uint64_t node_id = strtoull(payload, NULL, 16);
-            result = remove_device(&g_controller, node_id);
-        }
+        result = command(argc, argv);
 
         // Prepare MQTT payload
         if (result != ESP_OK)
         {
             free(input_copy);
-            ESP_LOGE(TAG, "Memory allocation for JSON payload failed");
-            char error_msg[64];
-            snprintf(error_msg, sizeof(error_msg), "{\"action\":\"%s\",\"status\":\"ERR_NO_MEM\"}", action_type);
-            mqtt_publish_data(eventTopic, error_msg);
+            ESP_LOGE(TAG, "%s command failed: %s", action_type, esp_err_to_name(result));
+            publish_action_status(eventTopic, action_type, esp_err_to_name(result), id);
             return;
         }
         else
         {
-            char msg[64];
-            snprintf(msg, sizeof(msg), "{\"action\":\"%s\",\"status\":\"progress\"}", action_type);
             // Publish result
-            esp_err_t mqtt_ret = mqtt_publish_data(eventTopic, msg);
+            esp_err_t mqtt_ret = publish_action_status(eventTopic, action_type, "progress", id);
             if (mqtt_ret != ESP_OK)
             {
                 ESP_LOGE(TAG, "MQTT publish failed: %s", esp_err_to_name(mqtt_ret));
@@ -203,6 +272,15 @@ extern "C" void handle_command(cJSON *json, const char *action_type, const char
         free(input_copy);
     }
 }
+
+static esp_err_t remove_node_command(int argc, char **argv)
+{
+    if (argc < 1)
+        return ESP_ERR_INVALID_ARG;
+    uint64_t node_id = strtoull(argv[0], NULL, 10); // Десятичное число
+    return remove_device(&g_controller, node_id);
+}
+
 void getTLVs(const char *eventTopic)
 {
     ESP_LOGW(TAG, "Get TLVs");
@@ -278,30 +356,24 @@ struct ClusterCommandArgs
     uint64_t endpoint_id;
     uint64_t cluster_id;
     uint32_t attribute_id;
-    char value[64]; // Use char array for string value
-                    // uint32_t value;
+    uint8_t data[TYPED_COMMAND_MAX_TLV]; // поля команды или значение атрибута в TLV
+    uint8_t data_len;                    // 0 - команда без данных
+    char id[COMMAND_TRACKER_ID_MAX]; // id входящего сообщения, "" - итог не публикуется
 };
+static_assert(sizeof(ClusterCommandArgs) <= CHIP_WORK_ARG_SIZE, "ClusterCommandArgs does not fit a chip_work record");
 
-// 2. Define a static function to call from ScheduleWork
-static void SendInvokeClusterCommand(intptr_t arg)
+// Выполняется на потоке CHIP из очереди chip_work, args - копия в записи очереди
+static void SendInvokeClusterCommand(void *arg)
 {
-    ClusterCommandArgs *args = reinterpret_cast<ClusterCommandArgs *>(arg);
-
-    // Для OnOff cluster (6) и команд 0, 1, 2 не передавать value!
-    const char *cmd_data = args->value;
-    if (args->cluster_id == 6 && (args->attribute_id == 0 || args->attribute_id == 1 || args->attribute_id == 2))
-    {
-        cmd_data = nullptr;
-    }
-
-    controller::send_invoke_cluster_command(
-        args->node_id,
-        static_cast<uint16_t>(args->endpoint_id),
-        static_cast<uint32_t>(args->cluster_id),
-        args->attribute_id,
-        cmd_data,
-        chip::NullOptional);
-    delete args; // Clean up
+    const ClusterCommandArgs *args = static_cast<const ClusterCommandArgs *>(arg);
+
+    command_track_t track = {COMMAND_TRACK_INVOKE, args->node_id, static_cast<uint16_t>(args->endpoint_id),
+                             static_cast<uint32_t>(args->cluster_id), args->attribute_id, args->id, "td"};
+    uint32_t token = command_tracker_begin(&track);
+    esp_err_t err = typed_command_invoke(args->node_id, static_cast<uint16_t>(args->endpoint_id),
+                                         static_cast<uint32_t>(args->cluster_id), args->attribute_id, args->data,
+                                         args->data_len, token);
+    command_tracker_sent(token, err);
 }
 /*
 static void SendWriteClusterCommand(intptr_t arg)
@@ -344,537 +416,1452 @@ void rgb_to_xy(uint8_t r, uint8_t g, uint8_t b, uint16_t *x, uint16_t *y)
     *y = (uint16_t)(y_val * 65279.0f);
 }
 
-static void SendWriteClusterCommand(intptr_t arg)
+static void SendWriteClusterCommand(void *arg)
 {
-    ClusterCommandArgs *args = reinterpret_cast<ClusterCommandArgs *>(arg);
-
-    chip::Platform::ScopedMemoryBufferWithSize<uint16_t> endpoint_ids;
-    chip::Platform::ScopedMemoryBufferWithSize<uint32_t> cluster_ids;
-    chip::Platform::ScopedMemoryBufferWithSize<uint32_t> attribute_ids;
-
-    endpoint_ids.Alloc(1);
-    cluster_ids.Alloc(1);
-    attribute_ids.Alloc(1);
+    const ClusterCommandArgs *args = static_cast<const ClusterCommandArgs *>(arg);
+
+    // значение уже в TLV с типом атрибута (typed_command_attr_type()), итог - по ответу на запись
+    command_track_t track = {COMMAND_TRACK_WRITE, args->node_id, static_cast<uint16_t>(args->endpoint_id),
+                             static_cast<uint32_t>(args->cluster_id), args->attribute_id, args->id, "td"};
+    uint32_t token = command_tracker_begin(&track);
+    esp_err_t err = typed_command_write(args->node_id, static_cast<uint16_t>(args->endpoint_id),
+                                        static_cast<uint32_t>(args->cluster_id), args->attribute_id, args->data,
+                                        args->data_len, token);
+    command_tracker_sent(token, err);
+}
 
-    if (!endpoint_ids.Get() || !cluster_ids.Get() || !attribute_ids.Get())
+// Отправка на потоке CHIP через очередь chip_work (аргументы копируются), id - для итога команды (command_tracker)
+static void schedule_cluster_command(chip_work_fn_t send, ClusterCommandArgs *args, const char *id,
+                                     const char *eventTopic)
+{
+    strlcpy(args->id, id ? id : "", sizeof(args->id));
+    esp_err_t err = chip_work_post(send, args, sizeof(*args));
+    if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to allocate memory for attribute write");
-        delete args;
-        return;
+        ESP_LOGE(TAG, "Cluster command not queued: %s", esp_err_to_name(err));
+        publish_action_status(eventTopic, "td", err == ESP_ERR_NO_MEM ? "busy" : esp_err_to_name(err), id);
     }
-
-    endpoint_ids[0] = static_cast<uint16_t>(args->endpoint_id);
-    cluster_ids[0] = static_cast<uint32_t>(args->cluster_id);
-    attribute_ids[0] = args->attribute_id;
-
-    // Формируем JSON-объект для значения атрибута: {"0:U8": <value>}
-    char attr_val_json[80];
-    snprintf(attr_val_json, sizeof(attr_val_json), "{\"0:U8\": %s}", args->value);
-
-    esp_matter::controller::send_write_attr_command(
-        args->node_id,
-        endpoint_ids,
-        cluster_ids,
-        attribute_ids,
-        attr_val_json,
-        chip::MakeOptional(1000));
-    delete args;
 }
 
-extern "C" void handle_mqtt_data(esp_mqtt_event_handle_t event)
+// Управление устройством: {"status":"on"|"off"|"toggle","level":<0..254>,"color":[r,g,b],"id":..}
+static void handle_td_matter(cJSON *root, uint64_t node_id, uint64_t endpoint_id, const char *eventTopic)
 {
-    // Extract topic and data
-    char topic[event->topic_len + 1];
-    memcpy(topic, event->topic, event->topic_len);
-    topic[event->topic_len] = '\0';
-
-    char data[event->data_len + 1];
-    memcpy(data, event->data, event->data_len);
-    data[event->data_len] = '\0';
-
-    const char *mqttPrefix = sys_settings.mqtt.prefix;
-    const char *envtopic = "/event/matter/";
-    char eventTopic[strlen(mqttPrefix) + strlen(envtopic) + 1];
-    strcpy(eventTopic, mqttPrefix);
-    strcat(eventTopic, envtopic);
-
-    //    ESP_LOGI(TAG, "TOPIC=%s", topic);
-    //    ESP_LOGI(TAG, "DATA=%s", data);
-    cJSON *json = cJSON_Parse(data);
-    if (json == NULL)
+    ESP_LOGI(TAG, "Node ID: 0x%" PRIx64 ", Endpoint ID: 0x%" PRIx64, node_id, endpoint_id);
+    char id_buf[24];
+    const char *id = read_command_id(root, id_buf, sizeof(id_buf));
+    cJSON *outer_item = NULL;
+    cJSON_ArrayForEach(outer_item, root)
     {
-        ESP_LOGE(TAG, "Invalid JSON received");
-        const char *error_ptr = cJSON_GetErrorPtr();
-        if (error_ptr != NULL)
-        {
-            ESP_LOGE(TAG, "JSON error before: %s", error_ptr);
-        }
-        return;
-    }
-    if (strstr(topic, "/td/matter") != NULL)
-    {
-        ESP_LOGI(TAG, "TOPIC=%s", topic);
-        ESP_LOGI(TAG, "DATA=%s", data);
-
-        // получаем из топика Node_id и Endpoint_id
-        char *node_id_str = strstr(topic, "/td/matter/") + strlen("/td/matter/");
-        char *endpoint_id_str = strchr(node_id_str, '/');
-        uint64_t endpoint_id = 1;
-        if (endpoint_id_str != NULL)
-        {
-            *endpoint_id_str = '\0';
-            endpoint_id_str++;
-            endpoint_id = strtoull(endpoint_id_str, NULL, 0);
-        }
-
-        uint64_t node_id = strtoull(node_id_str, NULL, 0);
-        ESP_LOGI(TAG, "Node ID: 0x%" PRIx64 ", Endpoint ID: 0x%" PRIx64, node_id, endpoint_id);
-        // разбираем JSON
-        cJSON *root = cJSON_Parse(data);
-        if (root == NULL)
-        {
-            ESP_LOGE(TAG, "Ошибка парсинга JSON!");
-            return;
-        }
-
-        cJSON *outer_item = NULL;
-        cJSON_ArrayForEach(outer_item, root)
+        // Проверяем, что текущий элемент - это объект с ключом "status"
+        if (outer_item->string && strcmp(outer_item->string, "status") == 0)
         {
-            // Проверяем, что текущий элемент - это объект с ключом "status"
-            if (outer_item->string && strcmp(outer_item->string, "status") == 0)
+            // Получаем значение элемента (уже сам outer_item содержит значение)
+            if (cJSON_IsString(outer_item))
             {
-                // Получаем значение элемента (уже сам outer_item содержит значение)
-                if (cJSON_IsString(outer_item))
+                // Определяем команду на основе значения
+                ClusterCommandArgs args = {node_id, endpoint_id, 6};
+
+                // Приводим значение к нижнему регистру для сравнения
+                char lower_val[32];
+                strncpy(lower_val, outer_item->valuestring, sizeof(lower_val) - 1);
+                lower_val[sizeof(lower_val) - 1] = '\0';
+                for (char *p = lower_val; *p; ++p)
+                    *p = tolower(*p);
+
+                // Устанавливаем соответствующий аргумент
+                if (strcmp(lower_val, "on") == 0 || strcmp(lower_val, "1") == 0)
                 {
-                    // Определяем команду на основе значения
-                    ClusterCommandArgs *args = nullptr;
-
-                    // Приводим значение к нижнему регистру для сравнения
-                    char lower_val[32];
-                    strncpy(lower_val, outer_item->valuestring, sizeof(lower_val) - 1);
-                    lower_val[sizeof(lower_val) - 1] = '\0';
-                    for (char *p = lower_val; *p; ++p)
-                        *p = tolower(*p);
-
-                    // Устанавливаем соответствующий аргумент
-                    if (strcmp(lower_val, "on") == 0 || strcmp(lower_val, "1") == 0)
-                    {
-                        args = new ClusterCommandArgs{node_id, endpoint_id, 6, 1};
-                    }
-                    else if (strcmp(lower_val, "off") == 0 || strcmp(lower_val, "0") == 0)
-                    {
-                        args = new ClusterCommandArgs{node_id, endpoint_id, 6, 0};
-                    }
-                    else if (strcmp(lower_val, "toggle") == 0)
-                    {
-                        args = new ClusterCommandArgs{node_id, endpoint_id, 6, 2};
-                    }
-                    else
-                    {
-                        ESP_LOGE(TAG, "Unknown status value: %s", outer_item->valuestring);
-                        continue;
-                    }
-
-                    // Копируем значение
-                    strncpy(args->value, outer_item->valuestring, sizeof(args->value) - 1);
-                    args->value[sizeof(args->value) - 1] = '\0';
-
-                    // Отправляем команду
-                    chip::DeviceLayer::PlatformMgr().ScheduleWork(
-                        SendInvokeClusterCommand,
-                        reinterpret_cast<intptr_t>(args));
+                    args.attribute_id = 1;
                 }
-            }
-
-            if (outer_item->string && strcmp(outer_item->string, "level") == 0)
-            {
-                if (cJSON_IsNumber(outer_item))
+                else if (strcmp(lower_val, "off") == 0 || strcmp(lower_val, "0") == 0)
                 {
-                    // 1. Включаем устройство (OnOff cluster, On command)
-                    {
-                        ClusterCommandArgs *on_args = new ClusterCommandArgs{
-                            node_id,
-                            endpoint_id,
-                            6, // OnOff cluster
-                            1  // On command
-                        };
-                        on_args->value[0] = '\0';
-                        chip::DeviceLayer::PlatformMgr().ScheduleWork(
-                            SendInvokeClusterCommand,
-                            reinterpret_cast<intptr_t>(on_args));
-                    }
-
-                    // 2. Формируем JSON для MoveToLevel: {"0:U8": <level>, "1:U16": 0, "2:U8": 0, "3:U8": 0}
-                    char cmd_data[80];
-                    uint8_t level = (uint8_t)outer_item->valueint;
-                    if (level > 254)
-                        level = 254;
-                    snprintf(cmd_data, sizeof(cmd_data),
-                             "{\"0:U8\": %u, \"1:U16\": 0, \"2:U8\": 0, \"3:U8\": 0}", level);
-
-                    ClusterCommandArgs *args = new ClusterCommandArgs{
-                        node_id,
-                        endpoint_id,
-                        8, // LevelControl cluster
-                        0  // MoveToLevel command
-                    };
-                    strncpy(args->value, cmd_data, sizeof(args->value) - 1);
-                    args->value[sizeof(args->value) - 1] = '\0';
-
-                    chip::DeviceLayer::PlatformMgr().ScheduleWork(
-                        SendInvokeClusterCommand,
-                        reinterpret_cast<intptr_t>(args));
+                    args.attribute_id = 0;
                 }
-            }
-            // цвет {"color":[167,255,120]}
-            if (strcmp(outer_item->string, "color") == 0 && cJSON_IsArray(outer_item))
-            {
-
-                // 2. Получаем значения RGB из массива
-                cJSON *r_item = cJSON_GetArrayItem(outer_item, 0);
-                cJSON *g_item = cJSON_GetArrayItem(outer_item, 1);
-                cJSON *b_item = cJSON_GetArrayItem(outer_item, 2);
-
-                if (r_item && g_item && b_item &&
-                    cJSON_IsNumber(r_item) && cJSON_IsNumber(g_item) && cJSON_IsNumber(b_item))
+                else if (strcmp(lower_val, "toggle") == 0)
                 {
-                    uint8_t r = (uint8_t)r_item->valueint;
-                    uint8_t g = (uint8_t)g_item->valueint;
-                    uint8_t b = (uint8_t)b_item->valueint;
-                    uint16_t x, y;
-                    // 1. Установка Options=1
-                    {
-                        char options_cmd[20];
-                        snprintf(options_cmd, sizeof(options_cmd), "{\"0:U8\": 1}");
-
-                        ClusterCommandArgs *options_args = new ClusterCommandArgs{
-                            node_id, endpoint_id, 768, 0x10};
-                        strncpy(options_args->value, options_cmd, sizeof(options_args->value) - 1);
-                        chip::DeviceLayer::PlatformMgr().ScheduleWork(
-                            SendInvokeClusterCommand, reinterpret_cast<intptr_t>(options_args));
-
-                        vTaskDelay(100 / portTICK_PERIOD_MS);
-                    }
-
-                    // 2. Установка ColorMode=1 (XY)
-                    {
-                        char mode_cmd[20];
-                        snprintf(mode_cmd, sizeof(mode_cmd), "{\"0:U8\": 1}");
-
-                        ClusterCommandArgs *mode_args = new ClusterCommandArgs{
-                            node_id, endpoint_id, 768, 8};
-                        strncpy(mode_args->value, mode_cmd, sizeof(mode_args->value) - 1);
-                        chip::DeviceLayer::PlatformMgr().ScheduleWork(
-                            SendInvokeClusterCommand, reinterpret_cast<intptr_t>(mode_args));
-
-                        vTaskDelay(200 / portTICK_PERIOD_MS);
-                    }
-
-                    // 3. Отправка цвета
-                    rgb_to_xy(r, g, b, &x, &y);
-
-                    char color_cmd[50];
-                    snprintf(color_cmd, sizeof(color_cmd),
-                             "{\"0:U16\": %u, \"1:U16\": %u, \"2:U16\": 0}", x, y);
-
-                    ClusterCommandArgs *color_args = new ClusterCommandArgs{
-                        node_id, endpoint_id, 768, 7};
-                    strncpy(color_args->value, color_cmd, sizeof(color_args->value) - 1);
-                    chip::DeviceLayer::PlatformMgr().ScheduleWork(
-                        SendInvokeClusterCommand, reinterpret_cast<intptr_t>(color_args));
+                    args.attribute_id = 2;
                 }
+                else
+                {
+                    ESP_LOGE(TAG, "Unknown status value: %s", outer_item->valuestring);
+                    continue;
+                }
+
+                // Отправляем команду (On, Off, Toggle - без данных)
+                schedule_cluster_command(SendInvokeClusterCommand, &args, id, eventTopic);
             }
         }
-    }
 
-    // Check for /td/matter_csa topic
-    if (strstr(topic, "/td/matter_csa") != NULL)
-    {
-        // topic = "esp_matter_server/td/matter_csa/Node_id/Endpoint_id"
-        // получаем из топика Node_id и Endpoint_id
-        ESP_LOGI(TAG, "Processing /td/matter_csa topic");
-        char *node_id_str = strstr(topic, "/td/matter_csa/") + strlen("/td/matter_csa/");
-        char *endpoint_id_str = strchr(node_id_str, '/');
-        if (endpoint_id_str != NULL)
-        {
-            *endpoint_id_str = '\0';
-            endpoint_id_str++;
-        }
-        else
+        if (outer_item->string && strcmp(outer_item->string, "level") == 0)
         {
-            ESP_LOGE(TAG, "Invalid topic format for /td/matter_csa");
-            cJSON_Delete(json);
-            return;
+            if (cJSON_IsNumber(outer_item))
+            {
+                // MoveToLevel: Level, TransitionTime, OptionsMask, OptionsOverride
+                uint8_t level = (uint8_t)outer_item->valueint;
+                if (level > 254)
+                    level = 254;
+                const typed_field_t move_to_level[] = {typed_field_uint(0, level), typed_field_uint(1, 0),
+                                                       typed_field_uint(2, 0), typed_field_uint(3, 0)};
+
+                // Сначала включаем устройство (OnOff, On), уровень - после ответа на On
+                command_sequence_t seq;
+                command_sequence_init(&seq, node_id, static_cast<uint16_t>(endpoint_id), id, "td");
+                // ползунок: пока значение в пути, новые заменяют друг друга
+                seq.latest_wins = true;
+                command_sequence_add(&seq, 6, 1, nullptr, 0, 0, false);
+                command_sequence_add(&seq, 8, 0, move_to_level, 4, 0, false);
+                esp_err_t err = command_sequence_start(&seq);
+                if (err != ESP_OK)
+                {
+                    ESP_LOGE(TAG, "Failed to start level change: %s", esp_err_to_name(err));
+                }
+            }
         }
-        uint64_t node_id = strtoull(node_id_str, NULL, 0);
-        uint64_t endpoint_id = strtoull(endpoint_id_str, NULL, 0);
-        ESP_LOGI(TAG, "Node ID: 0x%" PRIx64 ", Endpoint ID: 0x%" PRIx64, node_id, endpoint_id);
-
-        // разбираем JSON
-        cJSON *root = cJSON_Parse(data);
-        if (root == NULL)
+        // цвет {"color":[167,255,120]}
+        if (strcmp(outer_item->string, "color") == 0 && cJSON_IsArray(outer_item))
         {
-            ESP_LOGE(TAG, "Ошибка парсинга JSON!");
-            return;
-        }
 
-        cJSON *outer_item = NULL;
-        cJSON_ArrayForEach(outer_item, root)
-        {
-            const char *cluster = outer_item->string;
-            uint64_t cluster_id = strtoull(cluster, NULL, 0);
-            ESP_LOGI(TAG, "cluster_id: %s\n", cluster);
+            // Получаем значения RGB из массива
+            cJSON *r_item = cJSON_GetArrayItem(outer_item, 0);
+            cJSON *g_item = cJSON_GetArrayItem(outer_item, 1);
+            cJSON *b_item = cJSON_GetArrayItem(outer_item, 2);
 
-            // Перебираем внутренние ключи
-            cJSON *inner_item = NULL;
-            cJSON_ArrayForEach(inner_item, outer_item)
+            if (r_item && g_item && b_item &&
+                cJSON_IsNumber(r_item) && cJSON_IsNumber(g_item) && cJSON_IsNumber(b_item))
             {
-                const char *attribute = inner_item->string;
-                uint64_t attribute_id = strtoull(attribute, NULL, 0);
-
-                ESP_LOGI(TAG, "  attribute_id: %s\n", attribute);
-                if (cJSON_IsNumber(inner_item))
-                {
-                    ESP_LOGI(TAG, "Значение int: %d\n", inner_item->valueint);
-                }
-                else if (cJSON_IsString(inner_item))
-                {
-                    ESP_LOGI(TAG, "Значение string: %s\n", inner_item->valuestring);
-                }
-                else if (cJSON_IsBool(inner_item))
-                {
-                    ESP_LOGI(TAG, "Значение bool: %s\n", inner_item->valueint ? "true" : "false");
-                }
-                if (cluster_id == 6)
-                {
-                    auto *args = new ClusterCommandArgs{
-                        node_id,
-                        endpoint_id,
-                        cluster_id,
-                        static_cast<uint32_t>(attribute_id)};
-                    strncpy(args->value, inner_item->valuestring ? inner_item->valuestring : "", sizeof(args->value) - 1);
-                    args->value[sizeof(args->value) - 1] = '\0';
-
-                    chip::DeviceLayer::PlatformMgr().ScheduleWork(SendInvokeClusterCommand, reinterpret_cast<intptr_t>(args));
-                }
-                else
+                uint8_t r = (uint8_t)r_item->valueint;
+                uint8_t g = (uint8_t)g_item->valueint;
+                uint8_t b = (uint8_t)b_item->valueint;
+                uint16_t x, y;
+                rgb_to_xy(r, g, b, &x, &y);
+
+                // MoveToColor: ColorX, ColorY, TransitionTime
+                const typed_field_t move_to_color[] = {typed_field_uint(0, x), typed_field_uint(1, y),
+                                                       typed_field_uint(2, 0)};
+                const typed_field_t xy_mode[] = {typed_field_uint(0, 1)};
+
+                // Каждый шаг - после ответа на предыдущий. Options=1 и ColorMode=1 (XY) поддерживают не все
+                // устройства, их ошибка не отменяет отправку цвета
+                command_sequence_t seq;
+                command_sequence_init(&seq, node_id, static_cast<uint16_t>(endpoint_id), id, "td");
+                // ползунок: пока значение в пути, новые заменяют друг друга
+                seq.latest_wins = true;
+                command_sequence_add(&seq, 768, 0x10, xy_mode, 1, 0, true);
+                command_sequence_add(&seq, 768, 8, xy_mode, 1, 0, true);
+                command_sequence_add(&seq, 768, 7, move_to_color, 3, 0, false);
+                esp_err_t err = command_sequence_start(&seq);
+                if (err != ESP_OK)
                 {
-                    auto *args = new ClusterCommandArgs{
-                        node_id,
-                        endpoint_id,
-                        cluster_id,
-                        static_cast<uint32_t>(attribute_id)};
-                    strncpy(args->value, inner_item->valuestring ? inner_item->valuestring : "", sizeof(args->value) - 1);
-                    args->value[sizeof(args->value) - 1] = '\0';
-
-                    chip::DeviceLayer::PlatformMgr().ScheduleWork(SendWriteClusterCommand, reinterpret_cast<intptr_t>(args));
+                    ESP_LOGE(TAG, "Failed to start color change: %s", esp_err_to_name(err));
                 }
             }
         }
-
-        cJSON_Delete(root);
     }
+}
 
-    // Check for Matter command topic
-    if (strstr(topic, "/command/matter") != NULL)
+// Запись атрибутов и команды по номерам: {"<кластер>":{"<атрибут>":"<значение>"},"id":..}
+static void handle_td_matter_csa(cJSON *root, uint64_t node_id, uint64_t endpoint_id, const char *eventTopic)
+{
+    ESP_LOGI(TAG, "Node ID: 0x%" PRIx64 ", Endpoint ID: 0x%" PRIx64, node_id, endpoint_id);
+    char id_buf[24];
+    const char *id = read_command_id(root, id_buf, sizeof(id_buf));
+    cJSON *outer_item = NULL;
+    cJSON_ArrayForEach(outer_item, root)
     {
-        cJSON *json = cJSON_Parse(data);
-        if (json == NULL)
+        if (!cJSON_IsObject(outer_item))
+            continue;
+        const char *cluster = outer_item->string;
+        uint64_t cluster_id = strtoull(cluster, NULL, 0);
+        ESP_LOGI(TAG, "cluster_id: %s\n", cluster);
+
+        // Перебираем внутренние ключи
+        cJSON *inner_item = NULL;
+        cJSON_ArrayForEach(inner_item, outer_item)
         {
-            ESP_LOGE(TAG, "Invalid JSON received");
-            const char *error_ptr = cJSON_GetErrorPtr();
-            if (error_ptr != NULL)
+            const char *attribute = inner_item->string;
+            uint64_t attribute_id = strtoull(attribute, NULL, 0);
+
+            ESP_LOGI(TAG, "  attribute_id: %s\n", attribute);
+            if (cJSON_IsNumber(inner_item))
             {
-                ESP_LOGE(TAG, "JSON error before: %s", error_ptr);
+                ESP_LOGI(TAG, "Значение int: %d\n", inner_item->valueint);
             }
-            return;
-        }
-
-        cJSON *action = cJSON_GetObjectItem(json, "action");
-        if (action && cJSON_IsString(action))
-        {
-            const char *action_str = action->valuestring;
-            if (strcmp(action_str, "reboot") == 0)
+            else if (cJSON_IsString(inner_item))
             {
-                ESP_LOGW(TAG, "Reboot ESP");
-
-                mqtt_publish_data(eventTopic, "{\"action\":\"reboot\",\"status\":\"progress\"}");
-
-                vTaskDelay(3000 / portTICK_PERIOD_MS);
-                esp_restart();
+                ESP_LOGI(TAG, "Значение string: %s\n", inner_item->valuestring);
             }
-            else if (strcmp(action_str, "factoryreset") == 0)
+            else if (cJSON_IsBool(inner_item))
             {
-                ESP_LOGW(TAG, "Matter factory reset");
-                mqtt_publish_data(eventTopic, "{\"action\":\"factoryreset\",\"status\":\"progress\"}");
-                settings_set_defaults();
-                matter_controller_free(&g_controller);
-                // сохраняем nvs
-                esp_err_t ret = save_devices_to_nvs(&g_controller);
-                if (ret != ESP_OK)
-                {
-                    ESP_LOGE(TAG, "Failed to delete devices from NVS: 0x%x", ret);
-                }
-
-                else
-                {
-                    ESP_LOGI(TAG, "Devices deleted from NVS");
-                }
-                vTaskDelay(5000 / portTICK_PERIOD_MS);
-                esp_matter::factory_reset();
+                ESP_LOGI(TAG, "Значение bool: %s\n", inner_item->valueint ? "true" : "false");
             }
-            else if (strcmp(action_str, "initOpenThread") == 0)
+            ClusterCommandArgs args = {node_id, endpoint_id, cluster_id, static_cast<uint32_t>(attribute_id)};
+            size_t len = 0;
+            esp_err_t err = ESP_OK;
+            if (cluster_id == 6)
             {
-
-                ESP_LOGW(TAG, "Init new OpenThread network");
-                // vTaskDelay(1000 / portTICK_PERIOD_MS);
-                ESP_LOGI(TAG, "dataset init new");
-                const char *payload_str = "dataset init new";
-                esp_err_t result = otcli_string_handler(payload_str);
-                if (result != ESP_OK)
-                {
-                    printf("Error sending the command: %s\n", payload_str);
-                    mqtt_publish_data(eventTopic, "{\"action\":\"dataset_init_new\",\"status\":\"failed\"}");
-                }
-                else
-                {
-                    mqtt_publish_data(eventTopic, "{\"action\":\"dataset_init_new\",\"status\":\"success\"}");
-                }
-                // vTaskDelay(2000 / portTICK_PERIOD_MS);
-                payload_str = "dataset commit active";
-                result = otcli_string_handler(payload_str);
-                if (result != ESP_OK)
-                {
-                    printf("Error sending the command: %s\n", payload_str);
-                    mqtt_publish_data(eventTopic, "{\"action\":\"dataset_commit_active\",\"status\":\"failed\"}");
-                }
-                else
-                {
-                    mqtt_publish_data(eventTopic, "{\"action\":\"dataset_commit_active\",\"status\":\"success\"}");
-                }
-                // vTaskDelay(2000 / portTICK_PERIOD_MS);
-                payload_str = "dataset active -x";
-                result = otcli_string_handler(payload_str);
-                if (result != ESP_OK)
-                {
-                    printf("Error sending the command: %s\n", payload_str);
-                    mqtt_publish_data(eventTopic, "{\"action\":\"dataset_active_x\",\"status\":\"failed\"}");
-                }
-                else
-                {
-                    mqtt_publish_data(eventTopic, "{\"action\":\"dataset_active_x\",\"status\":\"success\"}");
-                }
-                // vTaskDelay(1000 / portTICK_PERIOD_MS);
-                payload_str = "ifconfig up";
-                result = otcli_string_handler(payload_str);
-                if (result != ESP_OK)
-                {
-                    printf("Error sending the command: %s\n", payload_str);
-                    mqtt_publish_data(eventTopic, "{\"action\":\"ifconfig_up\",\"status\":\"failed\"}");
-                }
-                else
-                {
-                    mqtt_publish_data(eventTopic, "{\"action\":\"ifconfig_up\",\"status\":\"success\"}");
-                }
-                // vTaskDelay(2000 / portTICK_PERIOD_MS);
-                payload_str = "thread start";
-                result = otcli_string_handler(payload_str);
-                if (result != ESP_OK)
-                {
-                    printf("Error sending the command: %s\n", payload_str);
-                    mqtt_publish_data(eventTopic, "{\"action\":\"thread_start\",\"status\":\"failed\"}");
-                }
-                else
+                // данные команды: объект полей {"0":..,"1:U16":..} или он же строкой, иначе команда без данных
+                if (cJSON_IsObject(inner_item))
                 {
-                    mqtt_publish_data(eventTopic, "{\"action\":\"thread_start\",\"status\":\"success\"}");
+                    err = typed_command_fields_from_json(inner_item, args.data, sizeof(args.data), &len);
                 }
-                getTLVs(eventTopic);
-                // сохраняем nvs system_settings_t sys_settings;
-                esp_err_t ret = settings_save_to_nvs();
-                if (ret != ESP_OK)
+                else if (cJSON_IsString(inner_item) && inner_item->valuestring[0] == '{')
                 {
-                    ESP_LOGE(TAG, "Failed to save system settings to NVS: 0x%x", ret);
+                    cJSON *fields = cJSON_Parse(inner_item->valuestring);
+                    err = typed_command_fields_from_json(fields, args.data, sizeof(args.data), &len);
+                    cJSON_Delete(fields);
                 }
-                else
-                {
-                    ESP_LOGI(TAG, "System settings saved to NVS");
-                }
-            }
-            else if (strcmp(action_str, "getTLVs") == 0)
-            {
-                getTLVs(eventTopic);
-            }
-            else if (strcmp(action_str, "setTLV") == 0)
-            {
-                // TODO
-            }
-            else if (strcmp(action_str, "pairing") == 0)
-            {
-                handle_command(json, "pairing", eventTopic);
-            }
-            else if (strcmp(action_str, "subs-attr") == 0)
-            {
-                handle_command(json, "subs-attr", eventTopic);
-            }
-            else if (strcmp(action_str, "invoke-cmd") == 0)
-            {
-                handle_command(json, "invoke-cmd", eventTopic);
-            }
-            else if (strcmp(action_str, "read-attr") == 0)
-            {
-                handle_command(json, "read-attr", eventTopic);
-            }
-            else if (strcmp(action_str, "write-attr") == 0)
-            {
-                handle_command(json, "write-attr", eventTopic);
-            }
-            else if (strcmp(action_str, "read-event") == 0)
-            {
-                handle_command(json, "read-event", eventTopic);
-            }
-            else if (strcmp(action_str, "subscribe-event") == 0)
-            {
-                handle_command(json, "subscribe-event", eventTopic);
-            }
-            else if (strcmp(action_str, "shutdown-subscription") == 0)
-            {
-                handle_command(json, "shutdown-subscription", eventTopic);
-            }
-            else if (strcmp(action_str, "shutdown-subscriptions") == 0)
-            {
-                handle_command(json, "shutdown-subscriptions", eventTopic);
-            }
-            else if (strcmp(action_str, "shutdown-all-subscriptions") == 0)
-            {
-                handle_command(json, "shutdown-all-subscriptions", eventTopic);
-            }
-            else if (strcmp(action_str, "subs-all-attrs") == 0)
-            {
-                chip::DeviceLayer::PlatformMgr().ScheduleWork(
-                    [](intptr_t ctx)
-                    {
-                        esp_err_t ret = subscribe_all_marked_attributes(&g_controller);
-                        if (ret != ESP_OK)
-                        {
-                            ESP_LOGE(TAG, "Failed to subscribe to all marked attributes: %s", esp_err_to_name(ret));
-                        }
-                    },
-                    0);
-            }
-            else if (strcmp(action_str, "log_controller_structure") == 0)
-            {
-                log_controller_structure(&g_controller);
             }
-            else if (strcmp(action_str, "remove-node") == 0)
+            else
             {
-                handle_command(json, "remove-node", eventTopic);
+                // тип значения - из метаданных атрибута, а не всегда U8
+                typed_value_t value;
+                err = typed_command_value_from_json(
+                    inner_item, typed_command_attr_type(static_cast<uint32_t>(cluster_id), args.attribute_id), &value);
+                if (err == ESP_OK)
+                    err = typed_command_encode_value(&value, args.data, sizeof(args.data), &len);
             }
-            else
+            if (err != ESP_OK)
             {
-                ESP_LOGE(TAG, "No valid 'action' field in JSON");
+                ESP_LOGE(TAG, "Invalid value for cluster %s item %s: %s", cluster, attribute, esp_err_to_name(err));
+                publish_action_status(eventTopic, "td", esp_err_to_name(err), id);
+                continue;
             }
+            args.data_len = (uint8_t)len;
+            schedule_cluster_command(cluster_id == 6 ? SendInvokeClusterCommand : SendWriteClusterCommand, &args, id,
+                                     eventTopic);
+        }
+    }
+}
+
+// Групповая команда в записи очереди chip_work, разобранная на задаче MQTT
+typedef struct
+{
+    uint16_t group_id;
+    uint8_t on_off; // команда OnOff: 0 - Off, 1 - On, 2 - Toggle, GROUP_WORK_NONE - нет
+    bool has_level;
+    uint8_t level;
+    bool has_color;
+    uint16_t color_x;
+    uint16_t color_y;
+    char id[24];
+} group_work_t;
+
+#define GROUP_WORK_NONE 0xFF
+
+// На потоке CHIP: команды группе отправляются сразу (ответов нет), затем обновляются значения участников
+static void run_group_work(void *arg)
+{
+    const group_work_t *work = static_cast<const group_work_t *>(arg);
+    uint16_t gid = work->group_id;
+    const char *id = work->id;
+
+    esp_err_t err = ESP_OK;
+    if (work->on_off != GROUP_WORK_NONE)
+    {
+        if ((err = group_control_invoke_fields(gid, 6, work->on_off, nullptr, 0, id)) == ESP_OK)
+        {
+            esp_matter_attr_val_t on = esp_matter_bool(work->on_off == 1);
+            // Toggle: новое значение неизвестно
+            group_control_apply(gid, 6, 0, work->on_off == 2 ? nullptr : &on);
+        }
+    }
+    if (err == ESP_OK && work->has_level)
+    {
+        // MoveToLevelWithOnOff: последовательность On, MoveToLevel группе не отправить, ответов нет
+        const typed_field_t move_to_level[] = {typed_field_uint(0, work->level), typed_field_uint(1, 0),
+                                               typed_field_uint(2, 0), typed_field_uint(3, 0)};
+        if ((err = group_control_invoke_fields(gid, 8, 4, move_to_level, 4, id)) == ESP_OK)
+        {
+            esp_matter_attr_val_t current = esp_matter_uint32(work->level);
+            esp_matter_attr_val_t on = esp_matter_bool(work->level > 0);
+            group_control_apply(gid, 8, 0, &current);
+            group_control_apply(gid, 6, 0, &on);
+        }
+    }
+    if (err == ESP_OK && work->has_color)
+    {
+        const typed_field_t move_to_color[] = {typed_field_uint(0, work->color_x), typed_field_uint(1, work->color_y),
+                                               typed_field_uint(2, 0)};
+        if ((err = group_control_invoke_fields(gid, 768, 7, move_to_color, 3, id)) == ESP_OK)
+        {
+            esp_matter_attr_val_t current_x = esp_matter_uint32(work->color_x);
+            esp_matter_attr_val_t current_y = esp_matter_uint32(work->color_y);
+            group_control_apply(gid, 768, 3, &current_x);
+            group_control_apply(gid, 768, 4, &current_y);
+        }
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Group 0x%04X command failed: %s", gid, esp_err_to_name(err));
+        publish_action_status(mqtt_topic(MQTT_TOPIC_EVENT), "td-group", esp_err_to_name(err), id);
+    }
+}
 
-            cJSON_Delete(json);
+// Групповая команда одним сообщением всем endpoint'ам группы: {"status":"on"|"off"|"toggle","level":<0..254>,
+// "color":[r,g,b],"id":..}. Ответов у групповых команд нет, значения участников в реестре обновляются сразу.
+// Отправка - на потоке CHIP через очередь chip_work
+static void handle_td_group(cJSON *root, uint64_t group_id, uint64_t endpoint_id, const char *eventTopic)
+{
+    if (group_id == 0 || group_id > UINT16_MAX)
+    {
+        ESP_LOGE(TAG, "Invalid group id %" PRIu64, group_id);
+        return;
+    }
+    group_work_t work = {};
+    work.group_id = static_cast<uint16_t>(group_id);
+    work.on_off = GROUP_WORK_NONE;
+    char id_buf[24];
+    const char *id = read_command_id(root, id_buf, sizeof(id_buf));
+    strlcpy(work.id, id ? id : "", sizeof(work.id));
+    cJSON *status = cJSON_GetObjectItem(root, "status");
+    cJSON *level = cJSON_GetObjectItem(root, "level");
+    cJSON *color = cJSON_GetObjectItem(root, "color");
+
+    if (cJSON_IsString(status))
+    {
+        const char *value = status->valuestring;
+        if (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0)
+            work.on_off = 1;
+        else if (strcasecmp(value, "off") == 0 || strcmp(value, "0") == 0)
+            work.on_off = 0;
+        else if (strcasecmp(value, "toggle") == 0)
+            work.on_off = 2;
+        else
+            ESP_LOGE(TAG, "Unknown status value: %s", value);
+    }
+    if (cJSON_IsNumber(level))
+    {
+        work.has_level = true;
+        work.level = level->valueint < 0 ? 0 : (level->valueint > 254 ? 254 : (uint8_t)level->valueint);
+    }
+    if (cJSON_IsArray(color) && cJSON_GetArraySize(color) == 3)
+    {
+        cJSON *r = cJSON_GetArrayItem(color, 0);
+        cJSON *g = cJSON_GetArrayItem(color, 1);
+        cJSON *b = cJSON_GetArrayItem(color, 2);
+        if (cJSON_IsNumber(r) && cJSON_IsNumber(g) && cJSON_IsNumber(b))
+        {
+            work.has_color = true;
+            rgb_to_xy((uint8_t)r->valueint, (uint8_t)g->valueint, (uint8_t)b->valueint, &work.color_x, &work.color_y);
         }
     }
-}
\ No newline at end of file
+    if (work.on_off == GROUP_WORK_NONE && !work.has_level && !work.has_color)
+        return;
+
+    esp_err_t err = chip_work_post(run_group_work, &work, sizeof(work));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Group 0x%04X command not queued: %s", work.group_id, esp_err_to_name(err));
+        publish_action_status(eventTopic, "td-group", err == ESP_ERR_NO_MEM ? "busy" : esp_err_to_name(err), id);
+    }
+}
+
+static void action_reboot(cJSON *json, const char *eventTopic)
+{
+    ESP_LOGW(TAG, "Reboot ESP");
+
+    mqtt_publish_data(eventTopic, "{\"action\":\"reboot\",\"status\":\"progress\"}");
+
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+    esp_restart();
+}
+
+// Таблицы, которые читает поток CHIP, очищаются на нем же
+static void factoryreset_chip_work(void *arg)
+{
+    (void)arg;
+    group_registry_clear();
+    session_warm_clear();
+    command_policy_clear();
+}
+
+static void action_factoryreset(cJSON *json, const char *eventTopic)
+{
+    ESP_LOGW(TAG, "Matter factory reset");
+    mqtt_publish_data(eventTopic, "{\"action\":\"factoryreset\",\"status\":\"progress\"}");
+    settings_set_defaults();
+    mqtt_topics_invalidate();
+    matter_controller_free(&g_controller);
+    // сохраняем nvs
+    esp_err_t ret = save_devices_to_nvs(&g_controller);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to delete devices from NVS: 0x%x", ret);
+    }
+
+    else
+    {
+        ESP_LOGI(TAG, "Devices deleted from NVS");
+    }
+    interview_cache_clear();
+    ret = chip_work_post(factoryreset_chip_work, nullptr, 0);
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "Failed to queue reset of CHIP thread tables: %s", esp_err_to_name(ret));
+    scene_engine_clear();
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    esp_matter::factory_reset();
+}
+
+static void action_init_open_thread(cJSON *json, const char *eventTopic)
+{
+
+    ESP_LOGW(TAG, "Init new OpenThread network");
+    // vTaskDelay(1000 / portTICK_PERIOD_MS);
+    ESP_LOGI(TAG, "dataset init new");
+    const char *payload_str = "dataset init new";
+    esp_err_t result = otcli_string_handler(payload_str);
+    if (result != ESP_OK)
+    {
+        printf("Error sending the command: %s\n", payload_str);
+        mqtt_publish_data(eventTopic, "{\"action\":\"dataset_init_new\",\"status\":\"failed\"}");
+    }
+    else
+    {
+        mqtt_publish_data(eventTopic, "{\"action\":\"dataset_init_new\",\"status\":\"success\"}");
+    }
+    // vTaskDelay(2000 / portTICK_PERIOD_MS);
+    payload_str = "dataset commit active";
+    result = otcli_string_handler(payload_str);
+    if (result != ESP_OK)
+    {
+        printf("Error sending the command: %s\n", payload_str);
+        mqtt_publish_data(eventTopic, "{\"action\":\"dataset_commit_active\",\"status\":\"failed\"}");
+    }
+    else
+    {
+        mqtt_publish_data(eventTopic, "{\"action\":\"dataset_commit_active\",\"status\":\"success\"}");
+    }
+    // vTaskDelay(2000 / portTICK_PERIOD_MS);
+    payload_str = "dataset active -x";
+    result = otcli_string_handler(payload_str);
+    if (result != ESP_OK)
+    {
+        printf("Error sending the command: %s\n", payload_str);
+        mqtt_publish_data(eventTopic, "{\"action\":\"dataset_active_x\",\"status\":\"failed\"}");
+    }
+    else
+    {
+        mqtt_publish_data(eventTopic, "{\"action\":\"dataset_active_x\",\"status\":\"success\"}");
+    }
+    // vTaskDelay(1000 / portTICK_PERIOD_MS);
+    payload_str = "ifconfig up";
+    result = otcli_string_handler(payload_str);
+    if (result != ESP_OK)
+    {
+        printf("Error sending the command: %s\n", payload_str);
+        mqtt_publish_data(eventTopic, "{\"action\":\"ifconfig_up\",\"status\":\"failed\"}");
+    }
+    else
+    {
+        mqtt_publish_data(eventTopic, "{\"action\":\"ifconfig_up\",\"status\":\"success\"}");
+    }
+    // vTaskDelay(2000 / portTICK_PERIOD_MS);
+    payload_str = "thread start";
+    result = otcli_string_handler(payload_str);
+    if (result != ESP_OK)
+    {
+        printf("Error sending the command: %s\n", payload_str);
+        mqtt_publish_data(eventTopic, "{\"action\":\"thread_start\",\"status\":\"failed\"}");
+    }
+    else
+    {
+        mqtt_publish_data(eventTopic, "{\"action\":\"thread_start\",\"status\":\"success\"}");
+    }
+    getTLVs(eventTopic);
+    // сохраняем nvs system_settings_t sys_settings;
+    esp_err_t ret = settings_save_to_nvs();
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to save system settings to NVS: 0x%x", ret);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "System settings saved to NVS");
+    }
+}
+
+static void action_get_tlvs(cJSON *json, const char *eventTopic)
+{
+    getTLVs(eventTopic);
+}
+
+static void action_set_tlv(cJSON *json, const char *eventTopic)
+{
+    // TODO
+}
+
+static void action_subs_all_attrs(cJSON *json, const char *eventTopic)
+{
+    esp_err_t err = chip_work_post(
+        [](void *arg)
+        {
+            esp_err_t ret = subscribe_all_marked_attributes(&g_controller);
+            if (ret != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Failed to subscribe to all marked attributes: %s", esp_err_to_name(ret));
+            }
+        },
+        nullptr, 0);
+    if (err != ESP_OK)
+        publish_action_status(eventTopic, "subs-all-attrs", err == ESP_ERR_NO_MEM ? "busy" : esp_err_to_name(err));
+}
+
+static void action_report_mode(cJSON *json, const char *eventTopic)
+{
+    // {"action":"report-mode","mode":"delta"|"full","full_interval":300,"coalesce_ms":50,"coalesce_max":32},
+    // без параметров - только статистика
+    cJSON *mode = cJSON_GetObjectItem(json, "mode");
+    cJSON *interval = cJSON_GetObjectItem(json, "full_interval");
+    cJSON *coalesce_ms = cJSON_GetObjectItem(json, "coalesce_ms");
+    cJSON *coalesce_max = cJSON_GetObjectItem(json, "coalesce_max");
+    bool changed = false;
+    if (cJSON_IsString(mode))
+    {
+        if (strcmp(mode->valuestring, "delta") == 0)
+            sys_settings.report.mode = REPORT_MODE_DELTA;
+        else if (strcmp(mode->valuestring, "full") == 0)
+            sys_settings.report.mode = REPORT_MODE_FULL;
+        changed = true;
+    }
+    if (cJSON_IsNumber(interval) && interval->valueint >= 0 && interval->valueint <= UINT16_MAX)
+    {
+        sys_settings.report.full_interval = (uint16_t)interval->valueint;
+        changed = true;
+    }
+    if (cJSON_IsNumber(coalesce_ms) && coalesce_ms->valueint >= 0 && coalesce_ms->valueint <= 1000)
+    {
+        sys_settings.report.coalesce_ms = (uint16_t)coalesce_ms->valueint;
+        changed = true;
+    }
+    if (cJSON_IsNumber(coalesce_max) && coalesce_max->valueint >= 0 && coalesce_max->valueint <= UINT8_MAX)
+    {
+        sys_settings.report.coalesce_max = (uint8_t)coalesce_max->valueint;
+        changed = true;
+    }
+    if (changed)
+        settings_save_to_nvs();
+
+    const fd_publish_stats_t *stats = publish_fd_get_stats();
+    const json_stream_pool_stats_t *pool = json_stream_pool_get_stats();
+    const report_coalescer_stats_t *coalescer = report_coalescer_get_stats();
+    char msg[448];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "report-mode");
+    json_stream_string(&js, "mode", sys_settings.report.mode == REPORT_MODE_DELTA ? "delta" : "full");
+    json_stream_uint(&js, "full_interval", sys_settings.report.full_interval);
+    json_stream_uint(&js, "reports", stats->reports);
+    json_stream_uint(&js, "publishes", stats->publishes);
+    json_stream_uint(&js, "full_publishes", stats->full_publishes);
+    json_stream_uint(&js, "skipped", stats->skipped);
+    json_stream_uint(&js, "bytes", stats->bytes);
+    json_stream_uint(&js, "cpu_us", stats->cpu_us);
+    json_stream_uint(&js, "pool_acquired", pool->acquired);
+    json_stream_uint(&js, "pool_fallbacks", pool->fallbacks);
+    json_stream_uint(&js, "coalesce_ms", sys_settings.report.coalesce_ms);
+    json_stream_uint(&js, "coalesce_max", sys_settings.report.coalesce_max);
+    json_stream_uint(&js, "updates", coalescer->updates);
+    json_stream_uint(&js, "flushes", coalescer->flushes);
+    json_stream_uint(&js, "size_flushes", coalescer->size_flushes);
+    json_stream_uint(&js, "overflow_flushes", coalescer->overflow_flushes);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data(eventTopic, msg);
+}
+
+static void action_outbox(cJSON *json, const char *eventTopic)
+{
+    // {"action":"outbox","flash_spill":true,"replay_rate":20}, без параметров - только статистика
+    cJSON *flash_spill = cJSON_GetObjectItem(json, "flash_spill");
+    cJSON *replay_rate = cJSON_GetObjectItem(json, "replay_rate");
+    bool changed = false;
+    if (cJSON_IsBool(flash_spill))
+    {
+        sys_settings.outbox.flash_spill = cJSON_IsTrue(flash_spill);
+        changed = true;
+    }
+    if (cJSON_IsNumber(replay_rate) && replay_rate->valueint >= 0 && replay_rate->valueint <= 1000)
+    {
+        sys_settings.outbox.replay_rate = (uint16_t)replay_rate->valueint;
+        changed = true;
+    }
+    if (changed)
+        settings_save_to_nvs();
+
+    mqtt_outbox_stats_t stats;
+    mqtt_outbox_get_stats(&stats);
+    char msg[320];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "outbox");
+    json_stream_bool(&js, "flash_spill", sys_settings.outbox.flash_spill);
+    json_stream_uint(&js, "replay_rate", sys_settings.outbox.replay_rate);
+    json_stream_uint(&js, "depth", stats.depth);
+    json_stream_uint(&js, "ram_bytes", stats.ram_bytes);
+    json_stream_uint(&js, "flash_depth", stats.flash_depth);
+    json_stream_uint(&js, "queued", stats.queued);
+    json_stream_uint(&js, "compacted", stats.compacted);
+    json_stream_uint(&js, "spilled", stats.spilled);
+    json_stream_uint(&js, "dropped", stats.dropped);
+    json_stream_uint(&js, "replayed", stats.replayed);
+    json_stream_uint(&js, "measured_replay_rate", stats.replay_rate);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data(eventTopic, msg);
+}
+
+static void action_payload(cJSON *json, const char *eventTopic)
+{
+    // {"action":"payload","fd_format":"cbor","reset":true}, без параметров - только статистика.
+    // Для сравнения форматов: сбросить статистику, поработать в одном формате, затем в другом
+    cJSON *fd_format = cJSON_GetObjectItem(json, "fd_format");
+    uint8_t format;
+    if (cJSON_IsString(fd_format) && payload_format_from_name(fd_format->valuestring, &format) &&
+        format != sys_settings.payload.fd_format)
+    {
+        sys_settings.payload.fd_format = format;
+        settings_save_to_nvs();
+        // топики fd зависят от формата
+        mqtt_topics_invalidate();
+    }
+    if (cJSON_IsTrue(cJSON_GetObjectItem(json, "reset")))
+        payload_reset_stats();
+
+    char msg[448];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "payload");
+    json_stream_string(&js, "fd_format", payload_format_name(sys_settings.payload.fd_format));
+    for (uint8_t f = 0; f < PAYLOAD_FORMAT_COUNT; f++)
+    {
+        const payload_format_stats_t *stats = payload_get_stats(f);
+        json_stream_object_begin(&js, payload_format_name(f));
+        json_stream_uint(&js, "encoded", stats->encoded);
+        json_stream_uint(&js, "encoded_bytes", stats->encoded_bytes);
+        json_stream_uint(&js, "encode_us", stats->encode_us);
+        json_stream_uint(&js, "decoded", stats->decoded);
+        json_stream_uint(&js, "decoded_bytes", stats->decoded_bytes);
+        json_stream_uint(&js, "decode_us", stats->decode_us);
+        json_stream_uint(&js, "errors", stats->errors);
+        json_stream_object_end(&js);
+    }
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data(eventTopic, msg);
+}
+
+static void action_command_queue(cJSON *json, const char *eventTopic)
+{
+    // {"action":"command-queue"} - статистика очередей задачи команд и очереди на поток CHIP (chip_work)
+    mqtt_command_stats_t stats;
+    mqtt_command_get_stats(&stats);
+    chip_work_stats_t chip;
+    chip_work_get_stats(&chip);
+    char msg[320];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "command-queue");
+    json_stream_uint(&js, "control", stats.control);
+    json_stream_uint(&js, "config", stats.config);
+    json_stream_uint(&js, "rejected", stats.rejected);
+    json_stream_uint(&js, "unrouted", stats.unrouted);
+    json_stream_uint(&js, "max_pending", stats.max_pending);
+    json_stream_object_begin(&js, "chip");
+    json_stream_uint(&js, "posted", chip.posted);
+    json_stream_uint(&js, "executed", chip.executed);
+    json_stream_uint(&js, "full", chip.full);
+    json_stream_uint(&js, "max_depth", chip.max_depth);
+    json_stream_uint(&js, "wakeups", chip.wakeups);
+    json_stream_uint(&js, "wakeup_failures", chip.wakeup_failures);
+    json_stream_object_end(&js);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data(eventTopic, msg);
+}
+
+// Административное действие на потоке CHIP: таблицы модулей принадлежат ему, задача команд стек не блокирует.
+// Ответ публикуется в топик событий с потока CHIP
+typedef struct
+{
+    const char *action; // имя из mqtt_actions[]
+    uint64_t node_id;   // 0 - не задан
+    uint8_t op;         // admin_op_t
+    bool reset;
+    int16_t retries;     // command-policy, -1 - не задан
+    uint16_t timeout_ms; // command-policy, 0 - не задан
+    uint16_t value;      // sweep_min или номер группы
+    uint16_t keyset_id;
+    uint8_t epoch_key[GROUP_REGISTRY_EPOCH_KEY_LEN];
+    char name[GROUP_REGISTRY_NAME_MAX];
+    char id[24];
+} admin_work_t;
+static_assert(sizeof(admin_work_t) <= CHIP_WORK_ARG_SIZE, "admin_work_t does not fit a chip_work record");
+
+typedef enum
+{
+    ADMIN_STATS = 0, // только публикация
+    ADMIN_SET,
+    ADMIN_ADD,
+    ADMIN_REMOVE,
+    ADMIN_LIST,
+    ADMIN_CREATE,
+    ADMIN_DELETE,
+} admin_op_t;
+
+static admin_work_t admin_work(const char *action, const char *id)
+{
+    admin_work_t work = {};
+    work.action = action;
+    work.retries = -1;
+    strlcpy(work.id, id ? id : "", sizeof(work.id));
+    return work;
+}
+
+static void post_admin_work(chip_work_fn_t fn, const admin_work_t *work, const char *eventTopic)
+{
+    esp_err_t err = chip_work_post(fn, work, sizeof(*work));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Action '%s' not queued: %s", work->action, esp_err_to_name(err));
+        publish_action_status(eventTopic, work->action, err == ESP_ERR_NO_MEM ? "busy" : esp_err_to_name(err),
+                              work->id);
+    }
+}
+
+// Итог действия с потока CHIP: ESP_OK - ответ уже опубликован модулем
+static void publish_admin_result(const admin_work_t *work, esp_err_t err, const char *ok_status)
+{
+    if (err != ESP_OK || ok_status)
+    {
+        publish_action_status(mqtt_topic(MQTT_TOPIC_EVENT), work->action,
+                              err == ESP_OK ? ok_status : esp_err_to_name(err), work->id);
+    }
+}
+
+static void latency_work(void *arg)
+{
+    const admin_work_t *work = static_cast<const admin_work_t *>(arg);
+    esp_err_t ret = command_tracker_publish_latency(mqtt_topic(MQTT_TOPIC_EVENT), work->node_id);
+    if (work->reset)
+        command_tracker_reset_latency();
+    publish_admin_result(work, ret, nullptr);
+}
+
+static void action_latency(cJSON *json, const char *eventTopic)
+{
+    // {"action":"latency","node":1,"reset":true} - итоги команд и задержки по парам (узел, кластер),
+    // без node - все узлы, reset очищает после публикации
+    admin_work_t work = admin_work("latency", nullptr);
+    cJSON *node = cJSON_GetObjectItem(json, "node");
+    if (node && !command_batch_read_id(node, UINT64_MAX, &work.node_id))
+    {
+        publish_action_status(eventTopic, "latency", "INVALID_ARG");
+        return;
+    }
+    work.reset = cJSON_IsTrue(cJSON_GetObjectItem(json, "reset"));
+    post_admin_work(latency_work, &work, eventTopic);
+}
+
+static void session_warm_work(void *arg)
+{
+    const admin_work_t *work = static_cast<const admin_work_t *>(arg);
+    if (work->op == ADMIN_STATS)
+        publish_admin_result(work, session_warm_publish_stats(mqtt_topic(MQTT_TOPIC_EVENT), work->reset), nullptr);
+    else
+        publish_admin_result(work, work->op == ADMIN_ADD ? session_warm_add(work->node_id)
+                                                         : session_warm_remove(work->node_id),
+                             "done");
+}
+
+static void action_session_warm(cJSON *json, const char *eventTopic)
+{
+    // {"action":"session-warm","op":"add"|"remove","node":1} - сессия с узлом поддерживается заранее
+    // (node - числом или строкой, ID больше 2^53 - только строкой),
+    // {"action":"session-warm","op":"stats","reset":true} - время установки сессий и доля команд с готовой сессией
+    char id_buf[24];
+    admin_work_t work = admin_work("session-warm", read_command_id(json, id_buf, sizeof(id_buf)));
+    cJSON *op = cJSON_GetObjectItem(json, "op");
+    cJSON *node = cJSON_GetObjectItem(json, "node");
+    if (cJSON_IsString(op) && strcmp(op->valuestring, "stats") == 0)
+    {
+        work.op = ADMIN_STATS;
+        work.reset = cJSON_IsTrue(cJSON_GetObjectItem(json, "reset"));
+    }
+    else if (cJSON_IsString(op) && (strcmp(op->valuestring, "add") == 0 || strcmp(op->valuestring, "remove") == 0) &&
+             command_batch_read_id(node, UINT64_MAX, &work.node_id) && work.node_id)
+    {
+        work.op = op->valuestring[0] == 'a' ? ADMIN_ADD : ADMIN_REMOVE;
+    }
+    else
+    {
+        publish_action_status(eventTopic, "session-warm", "INVALID_ARG", work.id);
+        return;
+    }
+    post_admin_work(session_warm_work, &work, eventTopic);
+}
+
+static void reachability_work(void *arg)
+{
+    const admin_work_t *work = static_cast<const admin_work_t *>(arg);
+    esp_err_t err = node_reachability_publish_stats(mqtt_topic(MQTT_TOPIC_EVENT), work->node_id);
+    publish_admin_result(work, err, nullptr);
+}
+
+static void action_reachability(cJSON *json, const char *eventTopic)
+{
+    // {"action":"reachability","fail_threshold":3,"retry_s":30,"silence_s":300}, без параметров - только
+    // состояние узлов и статистика, "node" - состояние одного узла (числом или строкой)
+    cJSON *threshold = cJSON_GetObjectItem(json, "fail_threshold");
+    cJSON *retry = cJSON_GetObjectItem(json, "retry_s");
+    cJSON *silence = cJSON_GetObjectItem(json, "silence_s");
+    bool changed = false;
+    if (cJSON_IsNumber(threshold) && threshold->valueint >= 1 && threshold->valueint <= 20)
+    {
+        sys_settings.reachability.fail_threshold = (uint8_t)threshold->valueint;
+        changed = true;
+    }
+    if (cJSON_IsNumber(retry) && retry->valueint >= 1 && retry->valueint <= 3600)
+    {
+        sys_settings.reachability.retry_s = (uint16_t)retry->valueint;
+        changed = true;
+    }
+    if (cJSON_IsNumber(silence) && silence->valueint >= 0 && silence->valueint <= UINT16_MAX)
+    {
+        sys_settings.reachability.silence_s = (uint16_t)silence->valueint;
+        changed = true;
+    }
+    admin_work_t work = admin_work("reachability", nullptr);
+    cJSON *node = cJSON_GetObjectItem(json, "node");
+    if (node && (!command_batch_read_id(node, UINT64_MAX, &work.node_id) || !work.node_id))
+    {
+        publish_action_status(eventTopic, "reachability", "INVALID_ARG");
+        return;
+    }
+    if (changed)
+        settings_save_to_nvs();
+    post_admin_work(reachability_work, &work, eventTopic);
+}
+
+static void command_policy_work(void *arg)
+{
+    const admin_work_t *work = static_cast<const admin_work_t *>(arg);
+    esp_err_t err = ESP_OK;
+    if (work->node_id && work->reset)
+        err = command_policy_remove_node(work->node_id);
+    else if (work->node_id && (work->timeout_ms || work->retries >= 0))
+        err = command_policy_set_node(work->node_id, work->timeout_ms,
+                                      work->retries >= 0 ? (uint8_t)work->retries : sys_settings.command.retries);
+    if (err == ESP_OK)
+        err = command_policy_publish(mqtt_topic(MQTT_TOPIC_EVENT));
+    publish_admin_result(work, err, nullptr);
+}
+
+static void action_command_policy(cJSON *json, const char *eventTopic)
+{
+    // {"action":"command-policy","timeout_ms":15000,"retries":2,"backoff_ms":500} - общие таймаут и повторы,
+    // {"action":"command-policy","node":1,"timeout_ms":30000,"retries":3} - свои для узла (node - числом или
+    // строкой), "reset":true - снять,
+    // без параметров - политика и статистика повторов
+    char id_buf[24];
+    const char *id = read_command_id(json, id_buf, sizeof(id_buf));
+    admin_work_t work = admin_work("command-policy", id);
+    cJSON *node = cJSON_GetObjectItem(json, "node");
+    cJSON *timeout = cJSON_GetObjectItem(json, "timeout_ms");
+    cJSON *retries = cJSON_GetObjectItem(json, "retries");
+    cJSON *backoff = cJSON_GetObjectItem(json, "backoff_ms");
+    bool valid_timeout = cJSON_IsNumber(timeout) && timeout->valueint >= 1000 && timeout->valueint <= 60000;
+    bool valid_retries = cJSON_IsNumber(retries) && retries->valueint >= 0 &&
+                         retries->valueint <= COMMAND_POLICY_MAX_RETRIES;
+    if ((timeout && !valid_timeout) || (retries && !valid_retries) ||
+        (backoff && !(cJSON_IsNumber(backoff) && backoff->valueint >= 50 &&
+                      backoff->valueint <= COMMAND_POLICY_MAX_BACKOFF_MS)))
+    {
+        publish_action_status(eventTopic, "command-policy", "INVALID_ARG", id);
+        return;
+    }
+
+    if (node && (!command_batch_read_id(node, UINT64_MAX, &work.node_id) || !work.node_id))
+    {
+        publish_action_status(eventTopic, "command-policy", "INVALID_ARG", id);
+        return;
+    }
+
+    // политика узла меняется на потоке CHIP, общая - в настройках
+    if (work.node_id)
+    {
+        work.reset = cJSON_IsTrue(cJSON_GetObjectItem(json, "reset"));
+        work.timeout_ms = valid_timeout ? (uint16_t)timeout->valueint : 0;
+        work.retries = valid_retries ? (int16_t)retries->valueint : -1;
+    }
+    else if (timeout || retries || backoff)
+    {
+        if (valid_timeout)
+            sys_settings.command.timeout_ms = (uint16_t)timeout->valueint;
+        if (valid_retries)
+            sys_settings.command.retries = (uint8_t)retries->valueint;
+        if (backoff)
+            sys_settings.command.backoff_ms = (uint16_t)backoff->valueint;
+        esp_err_t err = settings_save_to_nvs();
+        if (err != ESP_OK)
+        {
+            publish_action_status(eventTopic, "command-policy", esp_err_to_name(err), id);
+            return;
+        }
+    }
+    post_admin_work(command_policy_work, &work, eventTopic);
+}
+
+// На потоке CHIP: таймер сверки реестра и его статистика - у device_mgr
+static void registry_work(void *arg)
+{
+    const admin_work_t *work = static_cast<const admin_work_t *>(arg);
+    if (work->op == ADMIN_SET)
+    {
+        esp_err_t err = esp_matter::controller::device_mgr::set_sweep_interval(work->value);
+        if (err == ESP_OK)
+            err = settings_save_to_nvs();
+        if (err != ESP_OK)
+        {
+            publish_admin_result(work, err, nullptr);
+            return;
+        }
+    }
+
+    using namespace esp_matter::controller::device_mgr;
+    static const char *const change_names[REGISTRY_CHANGE_COUNT] = {"node_added", "node_removed", "topology",
+                                                                     "subscribe", "sweep"};
+    const registry_stats_t *stats = get_stats();
+    char msg[320];
+    json_stream_t js;
+    json_stream_init(&js, msg, sizeof(msg), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "action", "registry");
+    json_stream_uint(&js, "sweep_min", sys_settings.registry.sweep_min);
+    json_stream_uint(&js, "updates", stats->updates);
+    json_stream_uint(&js, "coalesced", stats->coalesced);
+    json_stream_uint(&js, "sweeps", stats->sweeps);
+    json_stream_uint(&js, "sweep_mismatches", stats->sweep_mismatches);
+    json_stream_object_begin(&js, "changes");
+    for (int i = 0; i < REGISTRY_CHANGE_COUNT; i++)
+        json_stream_uint(&js, change_names[i], stats->changes[i]);
+    json_stream_object_end(&js);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data(mqtt_topic(MQTT_TOPIC_EVENT), msg);
+}
+
+static void action_registry(cJSON *json, const char *eventTopic)
+{
+    // {"action":"registry","sweep_min":30} - список устройств обновляется по изменениям реестра, sweep_min -
+    // дополнительная сверка раз в N минут (0 - выключена); без параметров - только статистика обновлений
+    char id_buf[24];
+    admin_work_t work = admin_work("registry", read_command_id(json, id_buf, sizeof(id_buf)));
+    cJSON *sweep = cJSON_GetObjectItem(json, "sweep_min");
+    if (sweep && !(cJSON_IsNumber(sweep) && sweep->valueint >= 0 && sweep->valueint <= 1440))
+    {
+        publish_action_status(eventTopic, "registry", "INVALID_ARG", work.id);
+        return;
+    }
+    if (sweep)
+    {
+        work.op = ADMIN_SET;
+        work.value = (uint16_t)sweep->valueint;
+    }
+    post_admin_work(registry_work, &work, eventTopic);
+}
+
+static void coalescing_work(void *arg)
+{
+    const admin_work_t *work = static_cast<const admin_work_t *>(arg);
+    publish_admin_result(work, command_sequence_publish_coalescing(mqtt_topic(MQTT_TOPIC_EVENT)), nullptr);
+}
+
+static void action_coalescing(cJSON *json, const char *eventTopic)
+{
+    // {"action":"coalescing"} - сколько значений level/color вытеснено более новыми по целям
+    admin_work_t work = admin_work("coalescing", nullptr);
+    post_admin_work(coalescing_work, &work, eventTopic);
+}
+
+// Эпохальный ключ группы из 32 hex-символов
+static bool parse_epoch_key(cJSON *item, uint8_t *key)
+{
+    if (!cJSON_IsString(item) || strlen(item->valuestring) != GROUP_REGISTRY_EPOCH_KEY_LEN * 2)
+        return false;
+    for (size_t i = 0; i < GROUP_REGISTRY_EPOCH_KEY_LEN; i++)
+    {
+        char byte[3] = {item->valuestring[i * 2], item->valuestring[i * 2 + 1], '\0'};
+        char *end;
+        key[i] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end != '\0')
+            return false;
+    }
+    return true;
+}
+
+// Имя группы попадает в данные команды AddGroup как есть
+static bool valid_group_name(cJSON *item)
+{
+    if (!cJSON_IsString(item) || item->valuestring[0] == '\0' || strlen(item->valuestring) >= GROUP_REGISTRY_NAME_MAX)
+        return false;
+    for (const char *p = item->valuestring; *p; p++)
+    {
+        if (*p == '"' || *p == '\\' || (uint8_t)*p < 0x20)
+            return false;
+    }
+    return true;
+}
+
+// На потоке CHIP: группы контроллера и реестр групп
+static void group_admin_work(void *arg)
+{
+    const admin_work_t *work = static_cast<const admin_work_t *>(arg);
+    if (work->op == ADMIN_LIST)
+        publish_admin_result(work, group_control_publish_list(mqtt_topic(MQTT_TOPIC_EVENT)), nullptr);
+    else if (work->op == ADMIN_CREATE)
+        publish_admin_result(work, group_control_create(work->value, work->name, work->keyset_id, work->epoch_key),
+                             "done");
+    else
+        publish_admin_result(work, group_control_delete(work->value), "done");
+}
+
+static void action_group(cJSON *json, const char *eventTopic)
+{
+    // {"action":"group","op":"create","group":257,"name":"living","keyset":42,"epoch_key":"<32 hex>"}
+    // {"action":"group","op":"add"|"remove","group":257,"node":1,"endpoint":1,"id":..}
+    // {"action":"group","op":"delete","group":257}, {"action":"group","op":"list"}
+    char id_buf[24];
+    const char *id = read_command_id(json, id_buf, sizeof(id_buf));
+    admin_work_t work = admin_work("group", id);
+    cJSON *op = cJSON_GetObjectItem(json, "op");
+    cJSON *group = cJSON_GetObjectItem(json, "group");
+    if (!cJSON_IsString(op))
+    {
+        publish_action_status(eventTopic, "group", "INVALID_ARG", id);
+        return;
+    }
+    if (strcmp(op->valuestring, "list") == 0)
+    {
+        work.op = ADMIN_LIST;
+        post_admin_work(group_admin_work, &work, eventTopic);
+        return;
+    }
+    // 0xFF00..0xFFFF - общие группы Matter
+    if (!cJSON_IsNumber(group) || group->valuedouble < 1 || group->valuedouble >= 0xFF00)
+    {
+        publish_action_status(eventTopic, "group", "INVALID_ARG", id);
+        return;
+    }
+    uint16_t group_id = (uint16_t)group->valuedouble;
+
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (strcmp(op->valuestring, "create") == 0)
+    {
+        cJSON *name = cJSON_GetObjectItem(json, "name");
+        cJSON *keyset = cJSON_GetObjectItem(json, "keyset");
+        uint8_t epoch_key[GROUP_REGISTRY_EPOCH_KEY_LEN];
+        // набор ключей 0 - IPK
+        if (valid_group_name(name) && cJSON_IsNumber(keyset) && keyset->valuedouble >= 1 &&
+            keyset->valuedouble <= UINT16_MAX && parse_epoch_key(cJSON_GetObjectItem(json, "epoch_key"), epoch_key))
+        {
+            work.op = ADMIN_CREATE;
+            work.value = group_id;
+            work.keyset_id = (uint16_t)keyset->valuedouble;
+            memcpy(work.epoch_key, epoch_key, sizeof(work.epoch_key));
+            strlcpy(work.name, name->valuestring, sizeof(work.name));
+            post_admin_work(group_admin_work, &work, eventTopic);
+            return;
+        }
+    }
+    else if (strcmp(op->valuestring, "delete") == 0)
+    {
+        work.op = ADMIN_DELETE;
+        work.value = group_id;
+        post_admin_work(group_admin_work, &work, eventTopic);
+        return;
+    }
+    else if (strcmp(op->valuestring, "add") == 0 || strcmp(op->valuestring, "remove") == 0)
+    {
+        cJSON *node = cJSON_GetObjectItem(json, "node");
+        cJSON *endpoint = cJSON_GetObjectItem(json, "endpoint");
+        uint16_t endpoint_id = cJSON_IsNumber(endpoint) ? (uint16_t)endpoint->valueint : 1;
+        uint64_t node_id = 0;
+        if (command_batch_read_id(node, UINT64_MAX, &node_id) && node_id)
+        {
+            // итог - после ответов устройства, см. group_control_add_member()
+            ret = op->valuestring[0] == 'a' ? group_control_add_member(group_id, node_id, endpoint_id, id)
+                                            : group_control_remove_member(group_id, node_id, endpoint_id, id);
+            if (ret == ESP_OK)
+            {
+                publish_action_status(eventTopic, "group", "progress", id);
+                return;
+            }
+        }
+    }
+    publish_action_status(eventTopic, "group", ret == ESP_OK ? "done" : esp_err_to_name(ret), id);
+}
+
+static void action_scene(cJSON *json, const char *eventTopic)
+{
+    // {"action":"scene","op":"store","scene":1,"name":"evening","targets":[{"node":1,"endpoint":1,"cluster":6,"command":1}]}
+    // {"action":"scene","op":"delete","scene":1}, {"action":"scene","op":"list"}
+    char id_buf[24];
+    const char *id = read_command_id(json, id_buf, sizeof(id_buf));
+    cJSON *op = cJSON_GetObjectItem(json, "op");
+    cJSON *scene = cJSON_GetObjectItem(json, "scene");
+    if (!cJSON_IsString(op))
+    {
+        publish_action_status(eventTopic, "scene", "INVALID_ARG", id);
+        return;
+    }
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (strcmp(op->valuestring, "store") == 0)
+    {
+        // ответ публикует scene_engine_store()
+        scene_engine_store(json, eventTopic);
+        return;
+    }
+    else if (strcmp(op->valuestring, "list") == 0)
+    {
+        ret = scene_engine_publish_list(eventTopic);
+        if (ret == ESP_OK)
+            return;
+    }
+    else if (strcmp(op->valuestring, "delete") == 0 && cJSON_IsNumber(scene) && scene->valuedouble >= 1 &&
+             scene->valuedouble <= UINT16_MAX)
+    {
+        ret = scene_engine_delete((uint16_t)scene->valuedouble);
+    }
+    publish_action_status(eventTopic, "scene", ret == ESP_OK ? "done" : esp_err_to_name(ret), id);
+}
+
+static void action_scene_recall(cJSON *json, const char *eventTopic)
+{
+    // {"action":"scene-recall","scene":1,"id":..}, итог - после ответов всех целей, см. scene_engine_recall()
+    char id_buf[24];
+    const char *id = read_command_id(json, id_buf, sizeof(id_buf));
+    cJSON *scene = cJSON_GetObjectItem(json, "scene");
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (cJSON_IsNumber(scene) && scene->valuedouble >= 1 && scene->valuedouble <= UINT16_MAX)
+        ret = scene_engine_recall((uint16_t)scene->valuedouble, id);
+    if (ret != ESP_OK)
+        publish_action_status(eventTopic, "scene-recall", esp_err_to_name(ret), id);
+}
+
+static void action_export(cJSON *json, const char *eventTopic)
+{
+    // {"action":"export","cursor":"<из предыдущей страницы>","limit":16}
+    cJSON *cursor = cJSON_GetObjectItem(json, "cursor");
+    cJSON *limit = cJSON_GetObjectItem(json, "limit");
+    esp_err_t ret = registry_export_schedule(REGISTRY_EXPORT_TO_MQTT,
+                                             cJSON_IsString(cursor) ? cursor->valuestring : NULL,
+                                             cJSON_IsNumber(limit) && limit->valueint > 0 ? (uint16_t)limit->valueint : 0);
+    if (ret != ESP_OK)
+    {
+        publish_action_status(eventTopic, "export", esp_err_to_name(ret));
+    }
+}
+
+static void action_log_controller_structure(cJSON *json, const char *eventTopic)
+{
+    log_controller_structure(&g_controller);
+}
+
+// Действие топика команд: свой обработчик или команда контроллера из строки "payload"
+typedef struct
+{
+    const char *name;
+    void (*handler)(cJSON *json, const char *eventTopic);
+    esp_err_t (*command)(int argc, char **argv);
+    bool chip_thread;           // команда выполняется на потоке CHIP (очередь chip_work)
+    command_track_kind_t track; // ожидание ответа устройства (command_tracker), только с chip_thread
+} mqtt_action_t;
+
+static const mqtt_action_t mqtt_actions[] = {
+    {"reboot", action_reboot, nullptr, false},
+    {"factoryreset", action_factoryreset, nullptr, false},
+    {"initOpenThread", action_init_open_thread, nullptr, false},
+    {"getTLVs", action_get_tlvs, nullptr, false},
+    {"setTLV", action_set_tlv, nullptr, false},
+    {"pairing", nullptr, esp_matter::command::controller_pairing, false},
+    {"subs-attr", nullptr, esp_matter::command::controller_subscribe_attr, true},
+    {"invoke-cmd", nullptr, esp_matter::command::controller_invoke_command, true, COMMAND_TRACK_INVOKE},
+    {"read-attr", nullptr, esp_matter::command::controller_read_attr, true, COMMAND_TRACK_READ},
+    {"write-attr", nullptr, esp_matter::command::controller_write_attr, true, COMMAND_TRACK_WRITE},
+    {"read-event", nullptr, esp_matter::command::controller_read_event, true},
+    {"subscribe-event", nullptr, esp_matter::command::controller_subscribe_event, true},
+    {"shutdown-subscription", nullptr, esp_matter::command::controller_shutdown_subscription, true},
+    {"shutdown-subscriptions", nullptr, esp_matter::command::controller_shutdown_subscriptions, true},
+    {"shutdown-all-subscriptions", nullptr, esp_matter::command::controller_shutdown_all_subscriptions, true},
+    {"subs-all-attrs", action_subs_all_attrs, nullptr, false},
+    {"report-mode", action_report_mode, nullptr, false},
+    {"outbox", action_outbox, nullptr, false},
+    {"payload", action_payload, nullptr, false},
+    {"command-queue", action_command_queue, nullptr, false},
+    {"latency", action_latency, nullptr, false},
+    {"coalescing", action_coalescing, nullptr, false},
+    {"session-warm", action_session_warm, nullptr, false},
+    {"reachability", action_reachability, nullptr, false},
+    {"command-policy", action_command_policy, nullptr, false},
+    {"registry", action_registry, nullptr, false},
+    {"group", action_group, nullptr, false},
+    {"scene", action_scene, nullptr, false},
+    {"scene-recall", action_scene_recall, nullptr, false},
+    {"export", action_export, nullptr, false},
+    {"log_controller_structure", action_log_controller_structure, nullptr, false},
+    {"remove-node", nullptr, remove_node_command, true},
+};
+
+// Поиск действия по хэшу имени (FNV-1a), открытая адресация, см. mqtt_router.h.
+// Ячеек - степень двойки не меньше удвоенного числа действий
+#define MQTT_ACTION_SLOTS 64
+
+static mqtt_router_slot_t action_slots[MQTT_ACTION_SLOTS];
+
+static bool build_action_table(void)
+{
+    static_assert(sizeof(mqtt_actions) / sizeof(mqtt_actions[0]) * 2 <= MQTT_ACTION_SLOTS, "MQTT_ACTION_SLOTS is too small");
+    for (const mqtt_action_t &action : mqtt_actions)
+        mqtt_router_table_add(action_slots, MQTT_ACTION_SLOTS, action.name, &action);
+    return true;
+}
+
+static const mqtt_action_t *find_action(const char *name)
+{
+    static const bool built = build_action_table();
+    (void)built;
+    return static_cast<const mqtt_action_t *>(mqtt_router_table_find(action_slots, MQTT_ACTION_SLOTS, name));
+}
+
+// {"action":"<имя>", ...}
+static void handle_command_topic(cJSON *json, uint64_t node_id, uint64_t endpoint_id, const char *eventTopic)
+{
+    cJSON *action = cJSON_GetObjectItem(json, "action");
+    if (!cJSON_IsString(action))
+    {
+        ESP_LOGE(TAG, "No valid 'action' field in JSON");
+        return;
+    }
+    const mqtt_action_t *entry = find_action(action->valuestring);
+    if (!entry)
+    {
+        ESP_LOGE(TAG, "Unknown action '%.32s'", action->valuestring);
+        return;
+    }
+    if (entry->command)
+        run_controller_command(json, entry->name, eventTopic, entry->command, entry->chip_thread, entry->track);
+    else
+        entry->handler(json, eventTopic);
+}
+
+// Пакет операций управления, см. command_batch_submit()
+static void handle_td_batch(cJSON *json, uint64_t node_id, uint64_t endpoint_id, const char *eventTopic)
+{
+    command_batch_submit(json);
+}
+
+typedef void (*topic_handler_t)(cJSON *json, uint64_t node_id, uint64_t endpoint_id, const char *eventTopic);
+
+// Входящие топики. Для топиков подписки с '#' после базового топика идут числа <node>[/<endpoint>]
+static const struct
+{
+    mqtt_topic_id_t base;
+    uint8_t ids_required; // сколько чисел обязательно
+    uint8_t ids_max;
+    topic_handler_t handler;
+} topic_routes[] = {
+    {MQTT_TOPIC_TD, 1, 2, handle_td_matter},         // <prefix>/td/matter/<node>[/<endpoint>], endpoint по умолчанию 1
+    {MQTT_TOPIC_TD_CSA, 2, 2, handle_td_matter_csa}, // <prefix>/td/matter_csa/<node>/<endpoint>
+    {MQTT_TOPIC_COMMAND, 0, 0, handle_command_topic}, // <prefix>/command/matter
+    {MQTT_TOPIC_TD_BATCH, 0, 0, handle_td_batch},     // <prefix>/td/batch
+    {MQTT_TOPIC_TD_GROUP, 1, 1, handle_td_group},     // <prefix>/td/group/<group>
+};
+
+#define TOPIC_ROUTE_COUNT (sizeof(topic_routes) / sizeof(topic_routes[0]))
+
+// Маршрут топика: базовый топик совпадает целиком, после него только числа (для топиков с '#')
+static int find_route(const char *topic, size_t topic_len, size_t *base_len_out)
+{
+    const char *bases[TOPIC_ROUTE_COUNT];
+    for (size_t i = 0; i < TOPIC_ROUTE_COUNT; i++)
+        bases[i] = mqtt_topic(topic_routes[i].base);
+    return mqtt_router_find(topic, topic_len, bases, TOPIC_ROUTE_COUNT, base_len_out);
+}
+
+static void dispatch_message(const char *topic, size_t topic_len, const char *data, size_t data_len)
+{
+    size_t base_len;
+    int route = find_route(topic, topic_len, &base_len);
+    if (route < 0)
+    {
+        ESP_LOGW(TAG, "No handler for topic %.*s", (int)topic_len, topic);
+        return;
+    }
+
+    uint64_t ids[2] = {0, 1};
+    if (!mqtt_router_parse_ids(topic + base_len, topic_len - base_len, ids, topic_routes[route].ids_required,
+                               topic_routes[route].ids_max))
+    {
+        ESP_LOGE(TAG, "Invalid topic format: %.*s", (int)topic_len, topic);
+        return;
+    }
+
+    // Сообщение разбирается один раз: JSON или CBOR, формат определяется по первому байту
+    cJSON *json = payload_decode(data, data_len, NULL);
+    if (json == NULL || !cJSON_IsObject(json))
+    {
+        ESP_LOGE(TAG, "Invalid payload received on %.*s", (int)topic_len, topic);
+        cJSON_Delete(json);
+        return;
+    }
+    topic_routes[route].handler(json, ids[0], ids[1], mqtt_topic(MQTT_TOPIC_EVENT));
+    cJSON_Delete(json);
+}
+
+// Сообщение в очереди задачи команд: заголовок, за ним одним блоком топик, данные,
+// response topic и correlation data
+typedef struct
+{
+    uint16_t topic_len;
+    uint16_t response_topic_len;
+    uint32_t data_len;
+    uint8_t correlation_len;
+} queued_msg_t;
+
+static QueueHandle_t control_queue = NULL;
+static QueueHandle_t config_queue = NULL;
+static TaskHandle_t worker_task = NULL;
+static mqtt_command_stats_t command_stats;
+
+static void worker_task_fn(void *arg)
+{
+    for (;;)
+    {
+        // сначала управление устройствами, затем по одному сообщению настройки
+        queued_msg_t *msg = NULL;
+        if (xQueueReceive(control_queue, &msg, 0) != pdTRUE && xQueueReceive(config_queue, &msg, 0) != pdTRUE)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        const char *topic = reinterpret_cast<const char *>(msg + 1);
+        const char *data = topic + msg->topic_len;
+        const char *response_topic = data + msg->data_len;
+        const uint8_t *correlation = reinterpret_cast<const uint8_t *>(response_topic + msg->response_topic_len);
+
+        mqtt_request_begin(response_topic, msg->response_topic_len, correlation, msg->correlation_len);
+        dispatch_message(topic, msg->topic_len, data, msg->data_len);
+        mqtt_request_end();
+        free(msg);
+    }
+}
+
+extern "C" esp_err_t mqtt_command_init(void)
+{
+    if (worker_task)
+        return ESP_OK;
+
+    control_queue = xQueueCreate(MQTT_COMMAND_CONTROL_QUEUE, sizeof(queued_msg_t *));
+    config_queue = xQueueCreate(MQTT_COMMAND_CONFIG_QUEUE, sizeof(queued_msg_t *));
+    if (!control_queue || !config_queue ||
+        xTaskCreate(worker_task_fn, "mqtt_command", MQTT_COMMAND_TASK_STACK, NULL, MQTT_COMMAND_TASK_PRIORITY,
+                    &worker_task) != pdPASS)
+    {
+        if (control_queue)
+            vQueueDelete(control_queue);
+        if (config_queue)
+            vQueueDelete(config_queue);
+        control_queue = config_queue = NULL;
+        worker_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Ответ отправителю, сообщение которого не принято
+static void reject_message(const char *topic, size_t topic_len)
+{
+    command_stats.rejected++;
+    ESP_LOGW(TAG, "Command queue full, rejected %.*s (%" PRIu32 " rejected)", (int)topic_len, topic,
+             command_stats.rejected);
+
+    char reply[192];
+    json_stream_t js;
+    json_stream_init(&js, reply, sizeof(reply), NULL, NULL);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "status", "busy");
+    json_stream_string_len(&js, "topic", topic, topic_len);
+    json_stream_object_end(&js);
+    if (json_stream_finish(&js) == ESP_OK)
+        mqtt_publish_data(mqtt_topic(MQTT_TOPIC_EVENT), reply);
+}
+
+extern "C" esp_err_t mqtt_command_enqueue(const mqtt_inbound_t *in)
+{
+    size_t base_len;
+    int route = find_route(in->topic, in->topic_len, &base_len);
+    if (route < 0)
+    {
+        command_stats.unrouted++;
+        ESP_LOGW(TAG, "No handler for topic %.*s", (int)in->topic_len, in->topic);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (!worker_task)
+        return ESP_ERR_INVALID_STATE;
+
+    size_t response_topic_len = in->response_topic ? in->response_topic_len : 0;
+    size_t correlation_len = in->correlation ? in->correlation_len : 0;
+    if (in->topic_len > UINT16_MAX || response_topic_len > UINT16_MAX || correlation_len > UINT8_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    bool control = topic_routes[route].base != MQTT_TOPIC_COMMAND;
+    QueueHandle_t queue = control ? control_queue : config_queue;
+    queued_msg_t *msg = (queued_msg_t *)malloc(sizeof(queued_msg_t) + in->topic_len + in->data_len +
+                                               response_topic_len + correlation_len);
+    if (!msg)
+    {
+        reject_message(in->topic, in->topic_len);
+        return ESP_ERR_NO_MEM;
+    }
+    msg->topic_len = (uint16_t)in->topic_len;
+    msg->data_len = (uint32_t)in->data_len;
+    msg->response_topic_len = (uint16_t)response_topic_len;
+    msg->correlation_len = (uint8_t)correlation_len;
+    char *p = reinterpret_cast<char *>(msg + 1);
+    memcpy(p, in->topic, in->topic_len);
+    p += in->topic_len;
+    memcpy(p, in->data, in->data_len);
+    p += in->data_len;
+    if (response_topic_len)
+        memcpy(p, in->response_topic, response_topic_len);
+    p += response_topic_len;
+    if (correlation_len)
+        memcpy(p, in->correlation, correlation_len);
+
+    if (xQueueSend(queue, &msg, 0) != pdTRUE)
+    {
+        free(msg);
+        reject_message(in->topic, in->topic_len);
+        return ESP_ERR_NO_MEM;
+    }
+    if (control)
+        command_stats.control++;
+    else
+        command_stats.config++;
+    uint32_t pending = uxQueueMessagesWaiting(control_queue) + uxQueueMessagesWaiting(config_queue);
+    if (pending > command_stats.max_pending)
+        command_stats.max_pending = pending;
+    xTaskNotifyGive(worker_task);
+    return ESP_OK;
+}
+
+extern "C" void mqtt_command_get_stats(mqtt_command_stats_t *stats)
+{
+    *stats = command_stats;
+}
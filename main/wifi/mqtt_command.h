@@ -1,21 +1,57 @@
 #ifndef MQTT_COMMAND_H
 #define MQTT_COMMAND_H
 
-#include "mqtt_client.h"
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Очереди задачи команд: управление устройствами (td/...) выполняется раньше настройки (command/...)
+#define MQTT_COMMAND_CONTROL_QUEUE 16
+#define MQTT_COMMAND_CONFIG_QUEUE 8
+#define MQTT_COMMAND_TASK_STACK 8192
+#define MQTT_COMMAND_TASK_PRIORITY 5
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Входящее сообщение. Данные принадлежат событию MQTT и копируются при постановке в очередь
+typedef struct {
+    const char *topic;
+    size_t topic_len;
+    const char *data;
+    size_t data_len;
+    const char *response_topic; // MQTT 5, NULL - нет
+    size_t response_topic_len;
+    const uint8_t *correlation; // MQTT 5, NULL - нет
+    size_t correlation_len;
+} mqtt_inbound_t;
+
+typedef struct {
+    uint32_t control;     // принято сообщений управления
+    uint32_t config;      // принято сообщений настройки
+    uint32_t rejected;    // отклонено: очередь заполнена или нет памяти
+    uint32_t unrouted;    // топик без обработчика
+    uint32_t max_pending; // наибольшая суммарная глубина очередей
+} mqtt_command_stats_t;
+
 /**
- * @brief 
- * 
- * @param event 
+ * @brief Запуск задачи команд. Повторный вызов ничего не делает
  */
-void handle_mqtt_data(esp_mqtt_event_handle_t event);
+esp_err_t mqtt_command_init(void);
+
+/**
+ * @brief Постановка входящего сообщения в очередь задачи команд. Вызывается из задачи MQTT и не блокируется:
+ *        при заполненной очереди сообщение отклоняется с ответом {"status":"busy"} в топик событий
+ *
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND (топик без обработчика), ESP_ERR_NO_MEM (очередь заполнена)
+ */
+esp_err_t mqtt_command_enqueue(const mqtt_inbound_t *msg);
+
+void mqtt_command_get_stats(mqtt_command_stats_t *stats);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif // MQTT_COMMAND_H
\ No newline at end of file
+#endif // MQTT_COMMAND_H
@@ -0,0 +1,472 @@
+#include "mqtt_outbox.h"
+#include "settings.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "mqtt_outbox";
+
+#define NVS_NAMESPACE "mqtt_outbox"
+static const char *OPT_HEAD = "head";
+static const char *OPT_TAIL = "tail";
+
+typedef struct
+{
+    uint8_t flags;
+    uint8_t correlation_len;
+    uint16_t topic_len;
+    uint32_t data_len;
+    char buf[]; // топик, '\0', данные, correlation data
+} outbox_msg_t;
+
+// Кольцо сообщений в порядке поступления. NULL - место сообщения, замененного более новым значением
+static outbox_msg_t *ring[MQTT_OUTBOX_MAX_ENTRIES];
+static uint16_t ring_head = 0;
+static uint16_t ring_count = 0;
+static size_t ram_budget = MQTT_OUTBOX_RAM_BUDGET;
+static uint32_t msg_caps = MALLOC_CAP_8BIT;
+
+// Сообщения во flash - самые старые, номера [flash_head, flash_tail)
+static uint32_t flash_head = 0;
+static uint32_t flash_tail = 0;
+
+static mqtt_outbox_stats_t stats;
+static SemaphoreHandle_t lock = NULL;
+static TaskHandle_t replay_task = NULL;
+static mqtt_outbox_send_t send_fn = NULL;
+static volatile bool connected = false;
+// Задача повтора отправляет извлеченное сообщение: прямая отправка ждет очереди, иначе
+// новое значение топика может уйти раньше старого
+static bool replay_in_flight = false;
+
+static inline size_t msg_size(const outbox_msg_t *msg)
+{
+    return sizeof(outbox_msg_t) + msg->topic_len + 1 + msg->data_len + msg->correlation_len;
+}
+
+static inline const char *msg_data(const outbox_msg_t *msg)
+{
+    return msg->buf + msg->topic_len + 1;
+}
+
+static outbox_msg_t *msg_create(const mqtt_outbox_item_t *item)
+{
+    size_t topic_len = strlen(item->topic);
+    size_t size = sizeof(outbox_msg_t) + topic_len + 1 + item->len + item->correlation_len;
+    outbox_msg_t *msg = (outbox_msg_t *)heap_caps_malloc(size, msg_caps);
+    if (!msg && msg_caps != MALLOC_CAP_8BIT)
+        msg = (outbox_msg_t *)malloc(size);
+    if (!msg)
+        return NULL;
+
+    msg->flags = item->flags;
+    msg->correlation_len = item->correlation_len;
+    msg->topic_len = (uint16_t)topic_len;
+    msg->data_len = (uint32_t)item->len;
+    memcpy(msg->buf, item->topic, topic_len + 1);
+    if (item->len)
+        memcpy(msg->buf + topic_len + 1, item->data, item->len);
+    if (item->correlation_len)
+        memcpy(msg->buf + topic_len + 1 + item->len, item->correlation, item->correlation_len);
+    return msg;
+}
+
+static void msg_item(const outbox_msg_t *msg, mqtt_outbox_item_t *item)
+{
+    item->topic = msg->buf;
+    item->data = msg_data(msg);
+    item->len = msg->data_len;
+    item->flags = msg->flags;
+    item->correlation_len = msg->correlation_len;
+    item->correlation = msg->correlation_len ? (const uint8_t *)msg_data(msg) + msg->data_len : NULL;
+}
+
+static inline outbox_msg_t **ring_at(uint16_t i)
+{
+    return &ring[(ring_head + i) % MQTT_OUTBOX_MAX_ENTRIES];
+}
+
+// Убираем пустые места, оставшиеся от замененных сообщений
+static void ring_compact(void)
+{
+    uint16_t out = 0;
+    for (uint16_t i = 0; i < ring_count; i++)
+    {
+        outbox_msg_t *msg = *ring_at(i);
+        if (msg)
+            *ring_at(out++) = msg;
+    }
+    for (uint16_t i = out; i < ring_count; i++)
+        *ring_at(i) = NULL;
+    ring_count = out;
+}
+
+static outbox_msg_t *ring_pop_front(void)
+{
+    while (ring_count > 0)
+    {
+        outbox_msg_t *msg = *ring_at(0);
+        *ring_at(0) = NULL;
+        ring_head = (ring_head + 1) % MQTT_OUTBOX_MAX_ENTRIES;
+        ring_count--;
+        if (msg)
+        {
+            stats.depth--;
+            stats.ram_bytes -= msg_size(msg);
+            return msg;
+        }
+    }
+    return NULL;
+}
+
+static bool ring_push(outbox_msg_t *msg, bool front)
+{
+    if (ring_count == MQTT_OUTBOX_MAX_ENTRIES)
+        ring_compact();
+    if (ring_count == MQTT_OUTBOX_MAX_ENTRIES)
+        return false;
+
+    if (front)
+    {
+        ring_head = (ring_head + MQTT_OUTBOX_MAX_ENTRIES - 1) % MQTT_OUTBOX_MAX_ENTRIES;
+        *ring_at(0) = msg;
+    }
+    else
+    {
+        *ring_at(ring_count) = msg;
+    }
+    ring_count++;
+    stats.depth++;
+    stats.ram_bytes += msg_size(msg);
+    return true;
+}
+
+// Состояние устарело: убираем из очереди предыдущее значение топика
+static void compact_topic(const char *topic)
+{
+    for (uint16_t i = 0; i < ring_count; i++)
+    {
+        outbox_msg_t **slot = ring_at(i);
+        if (*slot && ((*slot)->flags & MQTT_OUTBOX_STATE) && strcmp((*slot)->buf, topic) == 0)
+        {
+            stats.depth--;
+            stats.ram_bytes -= msg_size(*slot);
+            stats.compacted++;
+            free(*slot);
+            *slot = NULL;
+        }
+    }
+}
+
+static void flash_key(uint32_t seq, char *key, size_t size)
+{
+    snprintf(key, size, "m%08" PRIx32, seq);
+}
+
+static esp_err_t flash_push(const outbox_msg_t *msg)
+{
+    nvs_handle_t nvs;
+    char key[12];
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+        return err;
+
+    flash_key(flash_tail, key, sizeof(key));
+    err = nvs_set_blob(nvs, key, msg, msg_size(msg));
+    if (err == ESP_OK)
+        err = nvs_set_u32(nvs, OPT_TAIL, flash_tail + 1);
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+
+    if (err == ESP_OK)
+    {
+        flash_tail++;
+        stats.flash_depth = flash_tail - flash_head;
+    }
+    return err;
+}
+
+static void flash_pop(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+
+    char key[12];
+    flash_key(flash_head, key, sizeof(key));
+    nvs_erase_key(nvs, key);
+    flash_head++;
+    if (flash_head == flash_tail)
+    {
+        // flash пуст, нумерация с начала
+        flash_head = flash_tail = 0;
+        nvs_set_u32(nvs, OPT_TAIL, 0);
+    }
+    nvs_set_u32(nvs, OPT_HEAD, flash_head);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+    stats.flash_depth = flash_tail - flash_head;
+}
+
+// Чтение самого старого сообщения из flash без удаления. Нечитаемые записи пропускаются
+static outbox_msg_t *flash_peek(void)
+{
+    while (flash_head != flash_tail)
+    {
+        nvs_handle_t nvs;
+        if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+            return NULL;
+
+        char key[12];
+        flash_key(flash_head, key, sizeof(key));
+        size_t size = 0;
+        outbox_msg_t *msg = NULL;
+        if (nvs_get_blob(nvs, key, NULL, &size) == ESP_OK && size > sizeof(outbox_msg_t))
+        {
+            msg = (outbox_msg_t *)malloc(size);
+            if (!msg)
+            {
+                nvs_close(nvs);
+                return NULL; // повтор позже
+            }
+            if (nvs_get_blob(nvs, key, msg, &size) != ESP_OK || msg_size(msg) != size)
+            {
+                free(msg);
+                msg = NULL;
+            }
+        }
+        nvs_close(nvs);
+        if (msg)
+            return msg;
+
+        ESP_LOGW(TAG, "Skipping unreadable flash entry %s", key);
+        stats.dropped++;
+        flash_pop();
+    }
+    return NULL;
+}
+
+// Освобождаем место под size байт: самые старые сообщения уходят во flash или теряются
+static bool make_room(size_t size)
+{
+    if (size > ram_budget)
+        return false;
+
+    while (stats.depth > 0 && (ring_count == MQTT_OUTBOX_MAX_ENTRIES || stats.ram_bytes + size > ram_budget))
+    {
+        if (ring_count == MQTT_OUTBOX_MAX_ENTRIES && stats.depth < ring_count)
+        {
+            ring_compact();
+            continue;
+        }
+        outbox_msg_t *oldest = ring_pop_front();
+        if (sys_settings.outbox.flash_spill && stats.flash_depth < MQTT_OUTBOX_FLASH_MAX && flash_push(oldest) == ESP_OK)
+        {
+            stats.spilled++;
+        }
+        else
+        {
+            stats.dropped++;
+        }
+        free(oldest);
+    }
+    return true;
+}
+
+esp_err_t mqtt_outbox_publish(const char *topic, const char *data, size_t len, uint8_t flags)
+{
+    mqtt_outbox_item_t item = {topic, data, len, flags, NULL, 0};
+    return mqtt_outbox_publish_item(&item);
+}
+
+esp_err_t mqtt_outbox_publish_item(const mqtt_outbox_item_t *item)
+{
+    if (!lock)
+        return ESP_ERR_INVALID_STATE;
+    if (!item || !item->topic || (!item->data && item->len) ||
+        item->correlation_len > MQTT_OUTBOX_MAX_CORRELATION || (!item->correlation && item->correlation_len))
+        return ESP_ERR_INVALID_ARG;
+
+    const char *topic = item->topic;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool direct = connected && stats.depth == 0 && stats.flash_depth == 0 && !replay_in_flight;
+    xSemaphoreGive(lock);
+
+    if (direct && send_fn(item) == ESP_OK)
+        return ESP_OK;
+
+    outbox_msg_t *msg = msg_create(item);
+    if (!msg)
+    {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        stats.dropped++;
+        xSemaphoreGive(lock);
+        ESP_LOGE(TAG, "No memory to queue message for %s", topic);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (item->flags & MQTT_OUTBOX_STATE)
+        compact_topic(topic);
+    if (make_room(msg_size(msg)) && ring_push(msg, false))
+    {
+        stats.queued++;
+    }
+    else
+    {
+        stats.dropped++;
+        free(msg);
+        err = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(lock);
+
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Message for %s dropped, outbox full", topic);
+    else if (connected)
+        xTaskNotifyGive(replay_task);
+    return err;
+}
+
+static void replay_task_fn(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        if (!connected)
+            continue;
+
+        uint32_t sent = 0;
+        int64_t started_us = esp_timer_get_time();
+        while (connected)
+        {
+            // сначала flash: там самые старые сообщения
+            xSemaphoreTake(lock, portMAX_DELAY);
+            bool from_flash = true;
+            outbox_msg_t *msg = flash_peek();
+            if (!msg)
+            {
+                from_flash = false;
+                msg = ring_pop_front();
+            }
+            replay_in_flight = msg != NULL;
+            xSemaphoreGive(lock);
+            if (!msg)
+                break;
+
+            mqtt_outbox_item_t item;
+            msg_item(msg, &item);
+            esp_err_t err = send_fn(&item);
+
+            xSemaphoreTake(lock, portMAX_DELAY);
+            replay_in_flight = false;
+            if (err == ESP_OK)
+            {
+                if (from_flash)
+                    flash_pop();
+                stats.replayed++;
+                sent++;
+                free(msg);
+            }
+            else if (!from_flash && !ring_push(msg, true))
+            {
+                stats.dropped++;
+                free(msg);
+            }
+            else if (from_flash)
+            {
+                free(msg);
+            }
+            xSemaphoreGive(lock);
+
+            if (err != ESP_OK)
+                break; // повтор по следующему уведомлению или через секунду
+
+            uint16_t rate = sys_settings.outbox.replay_rate;
+            if (rate)
+            {
+                TickType_t delay = pdMS_TO_TICKS(1000 / rate);
+                vTaskDelay(delay ? delay : 1);
+            }
+        }
+
+        if (sent > 1)
+        {
+            int64_t elapsed_us = esp_timer_get_time() - started_us;
+            stats.replay_rate = elapsed_us > 0 ? (uint32_t)(sent * 1000000LL / elapsed_us) : sent;
+            ESP_LOGI(TAG, "Replayed %" PRIu32 " messages (%" PRIu32 "/s), %" PRIu32 " left",
+                     sent, stats.replay_rate, stats.depth + stats.flash_depth);
+        }
+    }
+}
+
+void mqtt_outbox_set_connected(bool is_connected)
+{
+    connected = is_connected;
+    if (is_connected && replay_task)
+        xTaskNotifyGive(replay_task);
+}
+
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *out)
+{
+    if (!out)
+        return;
+    if (!lock)
+    {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(lock);
+}
+
+esp_err_t mqtt_outbox_init(mqtt_outbox_send_t send)
+{
+    if (lock)
+        return ESP_OK;
+    if (!send)
+        return ESP_ERR_INVALID_ARG;
+
+    if (heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0)
+    {
+        msg_caps = MALLOC_CAP_SPIRAM;
+        ram_budget = MQTT_OUTBOX_PSRAM_BUDGET;
+    }
+
+    // сообщения, не досланные до перезагрузки
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK)
+    {
+        nvs_get_u32(nvs, OPT_HEAD, &flash_head);
+        nvs_get_u32(nvs, OPT_TAIL, &flash_tail);
+        nvs_close(nvs);
+        if (flash_tail < flash_head)
+            flash_head = flash_tail = 0;
+        stats.flash_depth = flash_tail - flash_head;
+    }
+
+    send_fn = send;
+    lock = xSemaphoreCreateMutex();
+    if (!lock)
+        return ESP_ERR_NO_MEM;
+    if (xTaskCreate(replay_task_fn, "mqtt_outbox", 4096, NULL, 5, &replay_task) != pdPASS)
+    {
+        vSemaphoreDelete(lock);
+        lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Outbox started: RAM budget %u bytes%s, %" PRIu32 " messages in flash",
+             (unsigned)ram_budget, msg_caps == MALLOC_CAP_SPIRAM ? " (PSRAM)" : "", stats.flash_depth);
+    return ESP_OK;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Сообщений в очереди RAM не больше
+#define MQTT_OUTBOX_MAX_ENTRIES 256
+// Бюджет RAM очереди в байтах: во внутренней памяти и в PSRAM, если она есть
+#define MQTT_OUTBOX_RAM_BUDGET 16384
+#define MQTT_OUTBOX_PSRAM_BUDGET 131072
+// Сообщений во flash не больше (flash spill, sys_settings.outbox.flash_spill)
+#define MQTT_OUTBOX_FLASH_MAX 64
+
+// Флаги сообщения
+#define MQTT_OUTBOX_STATE 0x01 // состояние: в очереди остается только последнее значение топика
+#define MQTT_OUTBOX_RETAIN 0x02 // сохраняется брокером для новых подписчиков, без срока хранения MQTT 5
+// Correlation data ответа на команду (MQTT 5) не длиннее
+#define MQTT_OUTBOX_MAX_CORRELATION 64
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        const char *topic;
+        const char *data;
+        size_t len;
+        uint8_t flags;              // MQTT_OUTBOX_*
+        const uint8_t *correlation; // correlation data команды, на которую это ответ (NULL - нет)
+        uint8_t correlation_len;
+    } mqtt_outbox_item_t;
+
+    /**
+     * @brief Отправка сообщения клиентом MQTT
+     *
+     * @return ESP_OK, если сообщение принято клиентом
+     */
+    typedef esp_err_t (*mqtt_outbox_send_t)(const mqtt_outbox_item_t *item);
+
+    typedef struct
+    {
+        uint32_t depth;       // сообщений в RAM
+        uint32_t ram_bytes;   // занято RAM
+        uint32_t flash_depth; // сообщений во flash
+        uint32_t queued;      // поставлено в очередь (не было соединения)
+        uint32_t compacted;   // заменено более новым значением того же топика
+        uint32_t spilled;     // вытеснено во flash
+        uint32_t dropped;     // потеряно: очередь и flash заполнены или нет памяти
+        uint32_t replayed;    // дослано после переподключения
+        uint32_t replay_rate; // сообщений в секунду при последней досылке
+    } mqtt_outbox_stats_t;
+
+    /**
+     * @brief Запуск очереди и задачи досылки. Повторный вызов ничего не делает
+     *
+     * @param send Функция отправки через клиент MQTT
+     */
+    esp_err_t mqtt_outbox_init(mqtt_outbox_send_t send);
+
+    /**
+     * @brief Публикация через очередь. При соединении и пустой очереди сообщение отправляется сразу,
+     *        иначе ставится в конец очереди и досылается по порядку после переподключения
+     *
+     * @param topic Топик
+     * @param data Данные
+     * @param len Длина данных
+     * @param flags MQTT_OUTBOX_*
+     * @return esp_err_t ESP_OK, если сообщение отправлено или поставлено в очередь
+     */
+    esp_err_t mqtt_outbox_publish(const char *topic, const char *data, size_t len, uint8_t flags);
+
+    // То же с correlation data (не длиннее MQTT_OUTBOX_MAX_CORRELATION)
+    esp_err_t mqtt_outbox_publish_item(const mqtt_outbox_item_t *item);
+
+    // Состояние соединения с брокером, при подключении запускается досылка
+    void mqtt_outbox_set_connected(bool connected);
+
+    void mqtt_outbox_get_stats(mqtt_outbox_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
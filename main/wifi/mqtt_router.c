@@ -0,0 +1,97 @@
+#include "mqtt_router.h"
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+
+uint32_t mqtt_router_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool mqtt_router_table_add(mqtt_router_slot_t *slots, uint32_t slot_count, const char *name, const void *entry)
+{
+    uint32_t hash = mqtt_router_hash(name);
+    uint32_t index = hash & (slot_count - 1);
+    for (uint32_t i = 0; i < slot_count; i++)
+    {
+        mqtt_router_slot_t *slot = &slots[(index + i) & (slot_count - 1)];
+        if (!slot->entry)
+        {
+            slot->hash = hash;
+            slot->name = name;
+            slot->entry = entry;
+            return true;
+        }
+    }
+    return false;
+}
+
+const void *mqtt_router_table_find(const mqtt_router_slot_t *slots, uint32_t slot_count, const char *name)
+{
+    uint32_t hash = mqtt_router_hash(name);
+    uint32_t index = hash & (slot_count - 1);
+    for (uint32_t i = 0; i < slot_count; i++)
+    {
+        const mqtt_router_slot_t *slot = &slots[(index + i) & (slot_count - 1)];
+        if (!slot->entry)
+            break;
+        if (slot->hash == hash && strcmp(slot->name, name) == 0)
+            return slot->entry;
+    }
+    return NULL;
+}
+
+int mqtt_router_find(const char *topic, size_t topic_len, const char *const *bases, size_t count,
+                     size_t *base_len_out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *base = bases[i];
+        size_t base_len = strlen(base);
+        bool wildcard = base_len > 0 && base[base_len - 1] == '#';
+        if (wildcard)
+            base_len--; // остается '/' перед '#'
+        if (topic_len < base_len || memcmp(topic, base, base_len) != 0 || (!wildcard && topic_len != base_len))
+            continue;
+        *base_len_out = base_len;
+        return (int)i;
+    }
+    return -1;
+}
+
+bool mqtt_router_parse_ids(const char *rest, size_t len, uint64_t *ids, uint8_t required, uint8_t max)
+{
+    uint8_t count = 0;
+    size_t pos = 0;
+    while (pos < len)
+    {
+        size_t end = pos;
+        while (end < len && rest[end] != '/')
+            end++;
+
+        char segment[24];
+        size_t segment_len = end - pos;
+        if (count == max || segment_len == 0 || segment_len >= sizeof(segment) || end + 1 == len)
+            return false;
+        memcpy(segment, rest + pos, segment_len);
+        segment[segment_len] = '\0';
+
+        // strtoull принимает пробелы и знак, "-1" стал бы UINT64_MAX
+        if (!isdigit((unsigned char)segment[0]))
+            return false;
+        char *stop;
+        errno = 0;
+        ids[count++] = strtoull(segment, &stop, 0);
+        if (*stop != '\0' || errno == ERANGE)
+            return false;
+        pos = end + 1;
+    }
+    return count >= required;
+}
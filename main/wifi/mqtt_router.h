@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Ячейка таблицы действий: хэш имени, имя и запись вызывающего (NULL - ячейка свободна)
+    typedef struct
+    {
+        uint32_t hash;
+        const char *name;
+        const void *entry;
+    } mqtt_router_slot_t;
+
+    // Хэш имени действия (FNV-1a)
+    uint32_t mqtt_router_hash(const char *name);
+
+    /**
+     * @brief Добавление в таблицу с открытой адресацией
+     *
+     * @param slot_count Степень двойки, не меньше удвоенного числа записей
+     * @return bool false - таблица заполнена
+     */
+    bool mqtt_router_table_add(mqtt_router_slot_t *slots, uint32_t slot_count, const char *name, const void *entry);
+
+    // Запись по имени или NULL
+    const void *mqtt_router_table_find(const mqtt_router_slot_t *slots, uint32_t slot_count, const char *name);
+
+    /**
+     * @brief Маршрут топика: базовый топик совпадает целиком, базовый с '#' на конце - и с продолжением после '/'
+     *
+     * @param base_len_out Длина совпавшей части (у топика с '#' - вместе с '/')
+     * @return int Индекс в bases или -1
+     */
+    int mqtt_router_find(const char *topic, size_t topic_len, const char *const *bases, size_t count,
+                         size_t *base_len_out);
+
+    /**
+     * @brief Числа (десятичные или 0x...) через '/' после базового топика. Пустые, лишние, нечисловые,
+     *        со знаком и больше UINT64_MAX сегменты - ошибка
+     *
+     * @param ids Не меньше max чисел, незаданные сохраняют прежнее значение
+     */
+    bool mqtt_router_parse_ids(const char *rest, size_t len, uint64_t *ids, uint8_t required, uint8_t max);
+
+#ifdef __cplusplus
+}
+#endif
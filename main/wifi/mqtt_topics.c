@@ -0,0 +1,176 @@
+#include "mqtt_topics.h"
+#include "settings.h"
+#include "payload_codec.h"
+#include "chip_work.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+static const char *TAG = "mqtt_topics";
+
+extern const char *deviceName; // mqtt.c
+
+static const char *const topic_suffix[MQTT_TOPIC_COUNT] = {
+    [MQTT_TOPIC_EVENT] = "/event/matter/",
+    [MQTT_TOPIC_COMMAND] = "/command/matter",
+    [MQTT_TOPIC_TD] = "/td/matter/#",
+    [MQTT_TOPIC_TD_CSA] = "/td/matter_csa/#",
+    [MQTT_TOPIC_STATUS] = "/device/matter/",
+    [MQTT_TOPIC_TD_BATCH] = "/td/batch",
+    [MQTT_TOPIC_TD_GROUP] = "/td/group/#",
+    [MQTT_TOPIC_AVAILABILITY] = "/availability/matter/",
+};
+
+// Самый длинный топик префикса: статус с именем контроллера
+#define PREFIX_TOPIC_LEN (sizeof(sys_settings.mqtt.prefix) + sizeof("/device/matter/") + 24)
+
+// Две таблицы: новая строится в неактивной и затем подменяет текущую. Строки активной таблицы
+// не переписываются, их читают задача MQTT, консоль и поток CHIP
+static char prefix_tables[2][MQTT_TOPIC_COUNT][PREFIX_TOPIC_LEN];
+static atomic_int prefix_active = -1; // -1: таблица еще не построена
+static atomic_flag prefix_building = ATOMIC_FLAG_INIT;
+
+typedef enum
+{
+    SLOT_EMPTY = 0,
+    SLOT_USED,
+    SLOT_DELETED, // удаленная запись, поиск идет дальше
+} slot_state_t;
+
+typedef struct
+{
+    uint64_t node_id;
+    uint16_t endpoint_id;
+    uint8_t state;
+    char *topic;
+} fd_slot_t;
+
+static fd_slot_t fd_slots[MQTT_TOPICS_FD_SLOTS];
+
+static int build_prefix_topics(bool rebuild)
+{
+    // сборки из разных задач выполняются по очереди, чтобы не писать в одну неактивную таблицу
+    while (atomic_flag_test_and_set(&prefix_building))
+        vTaskDelay(1);
+
+    int active = atomic_load(&prefix_active);
+    if (active < 0 || rebuild)
+    {
+        int next = active < 0 ? 0 : active ^ 1;
+        for (int i = 0; i < MQTT_TOPIC_COUNT; i++)
+        {
+            snprintf(prefix_tables[next][i], PREFIX_TOPIC_LEN, "%s%s%s", sys_settings.mqtt.prefix, topic_suffix[i],
+                     i == MQTT_TOPIC_STATUS ? deviceName : "");
+        }
+        atomic_store(&prefix_active, next);
+        active = next;
+    }
+
+    atomic_flag_clear(&prefix_building);
+    return active;
+}
+
+const char *mqtt_topic(mqtt_topic_id_t id)
+{
+    if (id >= MQTT_TOPIC_COUNT)
+        id = MQTT_TOPIC_EVENT;
+    int active = atomic_load(&prefix_active);
+    if (active < 0)
+        active = build_prefix_topics(false);
+    return prefix_tables[active][id];
+}
+
+static inline uint32_t slot_hash(uint64_t node_id, uint16_t endpoint_id)
+{
+    uint64_t key = node_id * 0x9E3779B97F4A7C15ULL ^ endpoint_id;
+    return (uint32_t)(key >> 32) & (MQTT_TOPICS_FD_SLOTS - 1);
+}
+
+const char *mqtt_topic_fd(uint64_t node_id, uint16_t endpoint_id)
+{
+    uint32_t home = slot_hash(node_id, endpoint_id);
+    fd_slot_t *free_slot = NULL;
+
+    for (uint32_t i = 0; i < MQTT_TOPICS_FD_SLOTS; i++)
+    {
+        fd_slot_t *slot = &fd_slots[(home + i) & (MQTT_TOPICS_FD_SLOTS - 1)];
+        if (slot->state == SLOT_USED)
+        {
+            if (slot->node_id == node_id && slot->endpoint_id == endpoint_id)
+                return slot->topic;
+            continue;
+        }
+        if (!free_slot)
+            free_slot = slot;
+        if (slot->state == SLOT_EMPTY)
+            break;
+    }
+
+    // кэш заполнен: вытесняем запись в домашней ячейке
+    if (!free_slot)
+    {
+        free_slot = &fd_slots[home];
+        free(free_slot->topic);
+        free_slot->state = SLOT_DELETED;
+    }
+
+    char topic[PREFIX_TOPIC_LEN + 48];
+    // бинарные сообщения в отдельной ветке, чтобы не попасть к подписчикам JSON
+    int len = snprintf(topic, sizeof(topic), "%s/%s/matter_csa_name/%" PRIu64 "/%u", sys_settings.mqtt.prefix,
+                       sys_settings.payload.fd_format == PAYLOAD_FORMAT_CBOR ? "fdc" : "fd", node_id, endpoint_id);
+    char *copy = (char *)malloc((size_t)len + 1);
+    if (!copy)
+    {
+        ESP_LOGE(TAG, "No memory for topic of node %" PRIu64 " endpoint %u", node_id, endpoint_id);
+        return NULL;
+    }
+    memcpy(copy, topic, (size_t)len + 1);
+
+    free_slot->node_id = node_id;
+    free_slot->endpoint_id = endpoint_id;
+    free_slot->topic = copy;
+    free_slot->state = SLOT_USED;
+    return copy;
+}
+
+// Кэш fd принадлежит потоку CHIP: publish_fd держит строку, пока отправляет сообщение
+static void invalidate_fd_work(void *arg)
+{
+    (void)arg;
+    for (uint32_t i = 0; i < MQTT_TOPICS_FD_SLOTS; i++)
+    {
+        if (fd_slots[i].state == SLOT_USED)
+            free(fd_slots[i].topic);
+        fd_slots[i].topic = NULL;
+        fd_slots[i].state = SLOT_EMPTY;
+    }
+}
+
+void mqtt_topics_invalidate(void)
+{
+    // таблица префикса подменяется сразу: переподключение MQTT должно увидеть новый префикс
+    build_prefix_topics(true);
+
+    esp_err_t err = chip_work_post(invalidate_fd_work, NULL, 0);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Failed to post fd topic reset: %s", esp_err_to_name(err));
+}
+
+void mqtt_topics_forget_node(uint64_t node_id)
+{
+    for (uint32_t i = 0; i < MQTT_TOPICS_FD_SLOTS; i++)
+    {
+        fd_slot_t *slot = &fd_slots[i];
+        if (slot->state == SLOT_USED && slot->node_id == node_id)
+        {
+            free(slot->topic);
+            slot->topic = NULL;
+            slot->state = SLOT_DELETED;
+        }
+    }
+}
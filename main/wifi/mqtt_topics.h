@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Ячеек кэша топиков endpoint'ов (степень двойки)
+#define MQTT_TOPICS_FD_SLOTS 128
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Топики, зависящие только от префикса
+    typedef enum
+    {
+        MQTT_TOPIC_EVENT = 0, // <prefix>/event/matter/
+        MQTT_TOPIC_COMMAND,   // <prefix>/command/matter
+        MQTT_TOPIC_TD,        // <prefix>/td/matter/#
+        MQTT_TOPIC_TD_CSA,    // <prefix>/td/matter_csa/#
+        MQTT_TOPIC_STATUS,    // <prefix>/device/matter/<имя контроллера>, online/offline
+        MQTT_TOPIC_TD_BATCH,  // <prefix>/td/batch, пакет операций
+        MQTT_TOPIC_TD_GROUP,  // <prefix>/td/group/#, групповые команды
+        MQTT_TOPIC_AVAILABILITY, // <prefix>/availability/matter/, за ним ID узла: online/offline (retained)
+        MQTT_TOPIC_COUNT,
+    } mqtt_topic_id_t;
+
+    /**
+     * @brief Топик префикса. Строка строится один раз; после mqtt_topics_invalidate() новые строки
+     *        берутся из второй таблицы, прежние остаются неизменными до следующего сброса
+     *
+     * @return const char* Топик (не NULL)
+     */
+    const char *mqtt_topic(mqtt_topic_id_t id);
+
+    /**
+     * @brief Топик значений endpoint'а <prefix>/fd/matter_csa_name/<node>/<endpoint>
+     *        (<prefix>/fdc/... при sys_settings.payload.fd_format = CBOR). Строится при первом обращении,
+     *        затем только поиск в кэше. Как и реестр устройств, используется на потоке CHIP
+     *
+     * @return const char* Топик или NULL, если нет памяти
+     */
+    const char *mqtt_topic_fd(uint64_t node_id, uint16_t endpoint_id);
+
+    // Сброс всех топиков после изменения sys_settings.mqtt.prefix или sys_settings.payload.fd_format.
+    // Топики префикса подменяются сразу, кэш fd очищается на потоке CHIP через chip_work
+    void mqtt_topics_invalidate(void);
+
+    // Удаление топиков узла из кэша (узел удален из реестра). Только на потоке CHIP
+    void mqtt_topics_forget_node(uint64_t node_id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,5 +1,6 @@
 #include "settings.h"
 #include <string.h>
+#include <stdlib.h>
 #include <esp_err.h>
 #include <esp_log.h>
 
@@ -38,7 +39,7 @@ static void init_string_field(void* dest, const char* src, size_t size) {
     strlcpy((char*)dest, src, size);
 }
 
-void settings_set_defaults() {
+static void apply_defaults(void) {
     memset(&sys_settings, 0, sizeof(sys_settings));
 
     // Device settings
@@ -89,7 +90,42 @@ void settings_set_defaults() {
     init_string_field(sys_settings.mqtt.user, "", sizeof(sys_settings.mqtt.user));
     init_string_field(sys_settings.mqtt.password, "", sizeof(sys_settings.mqtt.password));
     init_string_field(sys_settings.mqtt.path, "", sizeof(sys_settings.mqtt.path));
-    
+
+    // Report Settings
+    sys_settings.report.mode = DEFAULT_REPORT_MODE;
+    sys_settings.report.full_interval = DEFAULT_REPORT_FULL_INTERVAL;
+    sys_settings.report.coalesce_ms = DEFAULT_REPORT_COALESCE_MS;
+    sys_settings.report.coalesce_max = DEFAULT_REPORT_COALESCE_MAX;
+
+    // Outbox Settings
+    sys_settings.outbox.flash_spill = DEFAULT_OUTBOX_FLASH_SPILL;
+    sys_settings.outbox.replay_rate = DEFAULT_OUTBOX_REPLAY_RATE;
+
+    // MQTT 5 Settings
+    sys_settings.mqtt5.enabled = DEFAULT_MQTT5_ENABLED;
+    sys_settings.mqtt5.topic_aliases = DEFAULT_MQTT5_TOPIC_ALIASES;
+    sys_settings.mqtt5.state_expiry = DEFAULT_MQTT5_STATE_EXPIRY;
+
+    // Payload Settings
+    sys_settings.payload.fd_format = DEFAULT_PAYLOAD_FD_FORMAT;
+
+    // Reachability Settings
+    sys_settings.reachability.fail_threshold = DEFAULT_REACHABILITY_FAIL_THRESHOLD;
+    sys_settings.reachability.retry_s = DEFAULT_REACHABILITY_RETRY_S;
+    sys_settings.reachability.silence_s = DEFAULT_REACHABILITY_SILENCE_S;
+
+    // Command Settings
+    sys_settings.command.timeout_ms = DEFAULT_COMMAND_TIMEOUT_MS;
+    sys_settings.command.retries = DEFAULT_COMMAND_RETRIES;
+    sys_settings.command.backoff_ms = DEFAULT_COMMAND_BACKOFF_MS;
+
+    // Registry Settings
+    sys_settings.registry.sweep_min = DEFAULT_REGISTRY_SWEEP_MIN;
+}
+
+void settings_set_defaults() {
+    apply_defaults();
+
     ESP_LOGI(TAG, "Loaded default settings");
     //log_wifi_settings();
 
@@ -138,17 +174,40 @@ esp_err_t settings_load_from_nvs() {
         return ESP_FAIL;
     }
 
-    // Load settings blob
-    size_t required_size = sizeof(sys_settings);
-    err = nvs_get_blob(nvs, OPT_SETTINGS, &sys_settings, &required_size);
-    nvs_close(nvs);
+    // Load settings blob. Blob от прошлой версии прошивки короче текущей структуры:
+    // читаем его поверх значений по умолчанию, новые поля остаются по умолчанию
+    size_t stored_size = 0;
+    err = nvs_get_blob(nvs, OPT_SETTINGS, NULL, &stored_size);
+    if (err != ESP_OK || stored_size == 0) {
+        nvs_close(nvs);
+        ESP_LOGW(TAG, "Invalid settings size or read error");
+        settings_set_defaults();
+        return ESP_FAIL;
+    }
 
-    if (err != ESP_OK || required_size != sizeof(sys_settings)) {
+    uint8_t *blob = malloc(stored_size);
+    if (!blob) {
+        nvs_close(nvs);
+        return ESP_ERR_NO_MEM;
+    }
+    err = nvs_get_blob(nvs, OPT_SETTINGS, blob, &stored_size);
+    nvs_close(nvs);
+    if (err != ESP_OK) {
+        free(blob);
         ESP_LOGW(TAG, "Invalid settings size or read error");
         settings_set_defaults();
         return ESP_FAIL;
     }
 
+    apply_defaults();
+    memcpy(&sys_settings, blob, stored_size < sizeof(sys_settings) ? stored_size : sizeof(sys_settings));
+    free(blob);
+
+    if (stored_size != sizeof(sys_settings)) {
+        ESP_LOGW(TAG, "Settings migrated (%u -> %u bytes)", (unsigned)stored_size, (unsigned)sizeof(sys_settings));
+        settings_save_to_nvs();
+    }
+
     ESP_LOGD(TAG, "Settings successfully loaded");
    // log_wifi_settings();
     return ESP_OK;
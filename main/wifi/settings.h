@@ -14,6 +14,30 @@
 #define DEFAULT_WIFI_AP_AUTHMODE WIFI_AUTH_WPA_WPA2_PSK
 #define DEFAULT_WIFI_STA_AUTHMODE WIFI_AUTH_WPA2_PSK
 
+// Режимы публикации значений атрибутов в <prefix>/fd/...
+#define REPORT_MODE_FULL 0  // все атрибуты endpoint'а при каждом отчете
+#define REPORT_MODE_DELTA 1 // только изменившиеся с прошлой публикации
+#define DEFAULT_REPORT_MODE REPORT_MODE_FULL
+#define DEFAULT_REPORT_FULL_INTERVAL 300
+#define DEFAULT_REPORT_COALESCE_MS 50
+#define DEFAULT_REPORT_COALESCE_MAX 32
+#define DEFAULT_OUTBOX_FLASH_SPILL false
+#define DEFAULT_OUTBOX_REPLAY_RATE 20
+#define DEFAULT_MQTT5_ENABLED false
+#define DEFAULT_MQTT5_TOPIC_ALIASES 10
+#define DEFAULT_MQTT5_STATE_EXPIRY 600
+#define MQTT5_MAX_TOPIC_ALIASES 64
+#define DEFAULT_PAYLOAD_FD_FORMAT 0 // PAYLOAD_FORMAT_JSON
+#define DEFAULT_REACHABILITY_FAIL_THRESHOLD 3
+#define DEFAULT_REACHABILITY_RETRY_S 30
+#define DEFAULT_REACHABILITY_SILENCE_S 300
+#define DEFAULT_COMMAND_TIMEOUT_MS 15000
+#define DEFAULT_COMMAND_RETRIES 2
+#define DEFAULT_COMMAND_BACKOFF_MS 500
+#define DEFAULT_REGISTRY_SWEEP_MIN 0
+
+// Новые поля добавляются только в конец структуры: более короткий blob из NVS
+// накладывается поверх значений по умолчанию
 typedef struct {
     struct {
         char devicename[16];
@@ -51,6 +75,45 @@ typedef struct {
     struct {
         char TLVs[300];        
     } thread;
+
+    struct {
+        uint8_t mode;           // REPORT_MODE_*
+        uint16_t full_interval; // полная публикация в режиме delta не реже, с (0 - только изменения)
+        uint16_t coalesce_ms;   // окно объединения обновлений endpoint'а в одно сообщение, мс (0 - без объединения)
+        uint8_t coalesce_max;   // публикация до конца окна, если набралось столько обновлений (0 - без ограничения)
+    } report;
+
+    struct {
+        bool flash_spill;     // сообщения, не поместившиеся в очередь RAM, сохранять во flash
+        uint16_t replay_rate; // досылка после переподключения, сообщений в секунду (0 - без паузы)
+    } outbox;
+
+    // Продолжение настроек mqtt (поля добавляются только в конец структуры)
+    struct {
+        bool enabled;           // MQTT 5, нужен CONFIG_MQTT_PROTOCOL_5
+        uint16_t topic_aliases; // псевдонимов для топиков fd, не больше Topic Alias Maximum брокера (0 - без псевдонимов)
+        uint32_t state_expiry;  // срок хранения сообщений состояния на брокере, с (0 - без ограничения)
+    } mqtt5;
+
+    struct {
+        uint8_t fd_format; // PAYLOAD_FORMAT_* (payload_codec.h) для <prefix>/fd/..., CBOR публикуется в <prefix>/fdc/...
+    } payload;
+
+    struct {
+        uint8_t fail_threshold; // ошибок подряд до признания узла недоступным
+        uint16_t retry_s;       // недоступному узлу одна команда или проверка не чаще, с
+        uint16_t silence_s;     // доступный узел молчит дольше - проверка чтением атрибута, с (0 - без проверок)
+    } reachability;
+
+    struct {
+        uint16_t timeout_ms; // срок итога команды узлу с учетом повторов, мс (узлы могут переопределить, command_policy)
+        uint8_t retries;     // повторов идемпотентной команды после временной неудачи
+        uint16_t backoff_ms; // задержка перед первым повтором, далее удваивается
+    } command;
+
+    struct {
+        uint16_t sweep_min; // сверка реестра со списком устройств device_mgr, мин (0 - только по изменениям)
+    } registry;
 } system_settings_t;
 
 extern system_settings_t sys_settings;
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// Минимум PlatformManager для chip_work: ScheduleWork реализован в тесте потоком "CHIP"
+typedef int CHIP_ERROR;
+#define CHIP_NO_ERROR 0
+
+namespace chip {
+namespace DeviceLayer {
+
+typedef void (*AsyncWorkFunct)(intptr_t arg);
+
+class PlatformManager
+{
+public:
+    CHIP_ERROR ScheduleWork(AsyncWorkFunct workFunct, intptr_t arg = 0);
+};
+
+PlatformManager &PlatformMgr();
+
+} // namespace DeviceLayer
+} // namespace chip
@@ -0,0 +1,313 @@
+// Тест очереди chip_work на хосте: несколько производителей, один поток "CHIP".
+// ScheduleWork заглушки ставит обработчик в очередь потока, который выполняет их по одному, как поток CHIP
+#include "chip_work.h"
+#include <platform/CHIPDeviceLayer.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+static std::atomic<int> failures{0};
+
+#define CHECK(cond)                                                      \
+    do                                                                   \
+    {                                                                    \
+        if (!(cond))                                                     \
+        {                                                                \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                  \
+        }                                                                \
+    } while (0)
+
+// ---- поток "CHIP" ----
+
+static std::mutex chip_mutex;
+static std::condition_variable chip_cv;
+static std::deque<std::pair<chip::DeviceLayer::AsyncWorkFunct, intptr_t>> chip_events;
+static bool chip_stop = false;
+static std::atomic<int> schedule_failures_left{0};
+
+CHIP_ERROR chip::DeviceLayer::PlatformManager::ScheduleWork(AsyncWorkFunct workFunct, intptr_t arg)
+{
+    if (schedule_failures_left.load() > 0)
+    {
+        schedule_failures_left--;
+        return -1;
+    }
+    std::lock_guard<std::mutex> guard(chip_mutex);
+    chip_events.emplace_back(workFunct, arg);
+    chip_cv.notify_one();
+    return CHIP_NO_ERROR;
+}
+
+chip::DeviceLayer::PlatformManager &chip::DeviceLayer::PlatformMgr()
+{
+    static PlatformManager mgr;
+    return mgr;
+}
+
+static void chip_thread_fn()
+{
+    for (;;)
+    {
+        std::unique_lock<std::mutex> guard(chip_mutex);
+        chip_cv.wait(guard, [] { return chip_stop || !chip_events.empty(); });
+        if (chip_events.empty())
+            return;
+        auto event = chip_events.front();
+        chip_events.pop_front();
+        guard.unlock();
+        event.first(event.second);
+    }
+}
+
+static chip_work_stats_t stats_now()
+{
+    chip_work_stats_t stats;
+    chip_work_get_stats(&stats);
+    return stats;
+}
+
+// Ожидание, пока поток CHIP выполнит executed записей
+static bool wait_executed(uint32_t executed)
+{
+    for (int i = 0; i < 10000; i++)
+    {
+        if (stats_now().executed >= executed)
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+// ---- записи ----
+
+typedef struct
+{
+    uint32_t producer;
+    uint32_t seq;
+} item_t;
+
+#define MAX_PRODUCERS 16
+
+// пишет поток CHIP, проверяет основной поток после ожидания
+static std::atomic<uint32_t> next_seq[MAX_PRODUCERS];
+static std::atomic<uint32_t> out_of_order{0};
+
+static void reset_order()
+{
+    for (auto &seq : next_seq)
+        seq = 0;
+}
+
+static void check_order(void *arg)
+{
+    const item_t *item = static_cast<const item_t *>(arg);
+    if (item->seq != next_seq[item->producer])
+        out_of_order++;
+    next_seq[item->producer].store(item->seq + 1);
+}
+
+static std::mutex gate_mutex;
+static std::condition_variable gate_cv;
+static bool gate_open = false;
+
+static void wait_gate(void *arg)
+{
+    (void)arg;
+    std::unique_lock<std::mutex> guard(gate_mutex);
+    gate_cv.wait(guard, [] { return gate_open; });
+}
+
+static void open_gate()
+{
+    std::lock_guard<std::mutex> guard(gate_mutex);
+    gate_open = true;
+    gate_cv.notify_all();
+}
+
+// ---- тесты ----
+
+static void test_invalid_args()
+{
+    chip_work_stats_t before = stats_now();
+    uint8_t big[CHIP_WORK_ARG_SIZE + 1] = {};
+    CHECK(chip_work_post(check_order, big, sizeof(big)) == ESP_ERR_INVALID_SIZE);
+    CHECK(chip_work_post(nullptr, nullptr, 0) == ESP_ERR_INVALID_ARG);
+    CHECK(chip_work_post(check_order, nullptr, sizeof(item_t)) == ESP_ERR_INVALID_ARG);
+    chip_work_stats_t after = stats_now();
+    CHECK(after.posted == before.posted);
+    CHECK(after.full == before.full);
+}
+
+// ScheduleWork не принят: запись ждет следующей постановки и выполняется вместе с ней, по порядку
+static void test_wakeup_failure()
+{
+    reset_order();
+    chip_work_stats_t before = stats_now();
+    item_t item = {0, 0};
+    schedule_failures_left = 1;
+    CHECK(chip_work_post(check_order, &item, sizeof(item)) == ESP_OK);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(stats_now().executed == before.executed);
+    CHECK(stats_now().wakeup_failures == before.wakeup_failures + 1);
+
+    item.seq = 1;
+    CHECK(chip_work_post(check_order, &item, sizeof(item)) == ESP_OK);
+    CHECK(wait_executed(before.executed + 2));
+    CHECK(next_seq[0] == 2);
+    CHECK(out_of_order == 0);
+}
+
+// Запись освобождается после выполнения: пока поток CHIP занят первой, принимается ровно QUEUE_DEPTH записей
+static void test_full()
+{
+    reset_order();
+    chip_work_stats_t before = stats_now();
+    CHECK(chip_work_post(wait_gate, nullptr, 0) == ESP_OK);
+    for (uint32_t i = 1; i < CHIP_WORK_QUEUE_DEPTH; i++)
+    {
+        item_t item = {0, i - 1};
+        CHECK(chip_work_post(check_order, &item, sizeof(item)) == ESP_OK);
+    }
+    item_t extra = {0, CHIP_WORK_QUEUE_DEPTH - 1};
+    CHECK(chip_work_post(check_order, &extra, sizeof(extra)) == ESP_ERR_NO_MEM);
+    CHECK(chip_work_post(check_order, &extra, sizeof(extra)) == ESP_ERR_NO_MEM);
+    chip_work_stats_t full = stats_now();
+    CHECK(full.full == before.full + 2);
+    CHECK(full.posted == before.posted + CHIP_WORK_QUEUE_DEPTH);
+    CHECK(full.max_depth == CHIP_WORK_QUEUE_DEPTH);
+
+    open_gate();
+    CHECK(wait_executed(before.executed + CHIP_WORK_QUEUE_DEPTH));
+    CHECK(next_seq[0] == CHIP_WORK_QUEUE_DEPTH - 1);
+    // после освобождения записи очередь снова принимает
+    CHECK(chip_work_post(check_order, &extra, sizeof(extra)) == ESP_OK);
+    CHECK(wait_executed(before.executed + CHIP_WORK_QUEUE_DEPTH + 1));
+    CHECK(out_of_order == 0);
+}
+
+// N производителей без пауз: порядок каждого сохраняется, отказы совпадают со счетчиком full
+static void test_producers(uint32_t producers, uint32_t per_producer)
+{
+    reset_order();
+    chip_work_stats_t before = stats_now();
+    std::vector<uint32_t> rejected(producers, 0);
+    std::vector<std::thread> threads;
+
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t p = 0; p < producers; p++)
+    {
+        threads.emplace_back([p, per_producer, &rejected] {
+            for (uint32_t seq = 0; seq < per_producer; seq++)
+            {
+                item_t item = {p, seq};
+                esp_err_t err;
+                while ((err = chip_work_post(check_order, &item, sizeof(item))) == ESP_ERR_NO_MEM)
+                {
+                    rejected[p]++;
+                    std::this_thread::yield();
+                }
+                if (err != ESP_OK)
+                    failures++;
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    uint32_t total = producers * per_producer;
+    CHECK(wait_executed(before.executed + total));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    chip_work_stats_t after = stats_now();
+    uint32_t rejected_total = 0;
+    for (uint32_t p = 0; p < producers; p++)
+    {
+        rejected_total += rejected[p];
+        CHECK(next_seq[p] == per_producer);
+    }
+    CHECK(out_of_order == 0);
+    CHECK(after.posted - before.posted == total);
+    CHECK(after.executed - before.executed == total);
+    CHECK(after.full - before.full == rejected_total);
+    CHECK(after.max_depth <= CHIP_WORK_QUEUE_DEPTH);
+
+    printf("%u producers x %u: %.0f items/s, %u rejected (full), %u wakeups, max depth %u\n", producers,
+           per_producer, total / seconds, rejected_total, after.wakeups - before.wakeups, after.max_depth);
+}
+
+// Пул объектов: каждый объект занят не больше чем одним потоком, после освобождения снова выдается
+typedef struct
+{
+    std::atomic<int> owners;
+    uint32_t value;
+} pool_item_t;
+
+static void test_pool()
+{
+    static chip_work_pool<pool_item_t, 8> pool;
+    pool_item_t *items[8];
+    for (auto &item : items)
+        CHECK((item = pool.acquire()) != nullptr);
+    CHECK(pool.acquire() == nullptr);
+    CHECK(pool.in_use() == 8);
+    pool.release(items[3]);
+    CHECK(pool.acquire() == items[3]);
+    for (auto &item : items)
+        pool.release(item);
+    CHECK(pool.in_use() == 0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+    {
+        threads.emplace_back([] {
+            for (int i = 0; i < 100000; i++)
+            {
+                pool_item_t *item = pool.acquire();
+                if (!item)
+                    continue;
+                if (item->owners.fetch_add(1) != 0 || item->value != 0)
+                    failures++;
+                item->value = 1;
+                item->value = 0;
+                item->owners.fetch_sub(1);
+                pool.release(item);
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    CHECK(pool.in_use() == 0);
+}
+
+int main()
+{
+    std::thread chip_thread(chip_thread_fn);
+
+    test_invalid_args();
+    test_pool();
+    test_wakeup_failure();
+    test_full();
+    test_producers(1, 200000);
+    test_producers(4, 200000);
+    test_producers(MAX_PRODUCERS, 50000);
+
+    {
+        std::lock_guard<std::mutex> guard(chip_mutex);
+        chip_stop = true;
+        chip_cv.notify_one();
+    }
+    chip_thread.join();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures.load());
+        return 1;
+    }
+    printf("chip_work: all checks passed\n");
+    return 0;
+}
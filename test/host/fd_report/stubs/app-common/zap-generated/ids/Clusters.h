@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace chip
+{
+typedef uint32_t ClusterId;
+typedef uint32_t AttributeId;
+typedef uint32_t CommandId;
+typedef uint32_t DeviceTypeId;
+} // namespace chip
@@ -0,0 +1,61 @@
+#pragma once
+
+// Значение атрибута esp_matter: только то, что читает запись fd
+#include <stdint.h>
+#include <stdbool.h>
+#include <optional>
+
+typedef enum
+{
+    ESP_MATTER_VAL_TYPE_INVALID = 0,
+    ESP_MATTER_VAL_TYPE_BOOLEAN = 1,
+    ESP_MATTER_VAL_TYPE_INTEGER = 2,
+    ESP_MATTER_VAL_TYPE_FLOAT = 3,
+    ESP_MATTER_VAL_TYPE_ARRAY = 4,
+    ESP_MATTER_VAL_TYPE_CHAR_STRING = 5,
+    ESP_MATTER_VAL_TYPE_OCTET_STRING = 6,
+    ESP_MATTER_VAL_TYPE_INT8 = 7,
+    ESP_MATTER_VAL_TYPE_UINT8 = 8,
+    ESP_MATTER_VAL_TYPE_INT16 = 9,
+    ESP_MATTER_VAL_TYPE_UINT16 = 10,
+    ESP_MATTER_VAL_TYPE_INT32 = 11,
+    ESP_MATTER_VAL_TYPE_UINT32 = 12,
+    ESP_MATTER_VAL_TYPE_INT64 = 13,
+    ESP_MATTER_VAL_TYPE_UINT64 = 14,
+    ESP_MATTER_VAL_TYPE_ENUM8 = 15,
+    ESP_MATTER_VAL_TYPE_BITMAP8 = 16,
+    ESP_MATTER_VAL_TYPE_BITMAP16 = 17,
+    ESP_MATTER_VAL_TYPE_BITMAP32 = 18,
+    ESP_MATTER_VAL_TYPE_ENUM16 = 19,
+    ESP_MATTER_VAL_TYPE_LONG_CHAR_STRING = 20,
+    ESP_MATTER_VAL_TYPE_LONG_OCTET_STRING = 21,
+} esp_matter_val_type_t;
+
+typedef union
+{
+    bool b;
+    int i;
+    float f;
+    int8_t i8;
+    uint8_t u8;
+    int16_t i16;
+    uint16_t u16;
+    int32_t i32;
+    uint32_t u32;
+    int64_t i64;
+    uint64_t u64;
+    struct
+    {
+        uint8_t *b;
+        uint16_t s;
+        uint16_t n;
+        uint16_t t;
+    } a;
+    void *p;
+} esp_matter_val_t;
+
+typedef struct
+{
+    esp_matter_val_type_t type;
+    esp_matter_val_t val;
+} esp_matter_attr_val_t;
@@ -0,0 +1,9 @@
+#pragma once
+
+namespace chip
+{
+namespace TLV
+{
+class TLVReader;
+} // namespace TLV
+} // namespace chip
@@ -0,0 +1,298 @@
+// Тест записи сообщения fd на хосте: full и delta, флаги changed снимаются только после успешной отправки,
+// и замер сообщений в секунду для полного состояния и для delta с несколькими изменениями
+#include "fd_report.h"
+#include "EntryToText.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do                                                                               \
+    {                                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                              \
+        }                                                                            \
+    } while (0)
+
+// ---- заглушки: имена из EntryToText.cpp и полное значение из attr_value.cpp ----
+
+char const *ClusterIdToText(chip::ClusterId id)
+{
+    switch (id)
+    {
+    case 0x0006:
+        return "OnOff";
+    case 0x0008:
+        return "LevelControl";
+    case 0x0028:
+        return "BasicInformation";
+    default:
+        return nullptr;
+    }
+}
+
+char const *AttributeIdToText(chip::ClusterId cluster, chip::AttributeId id)
+{
+    if (cluster == 0x0006 && id == 0x0000)
+        return "OnOff";
+    if (cluster == 0x0008 && id == 0x0000)
+        return "CurrentLevel";
+    if (cluster == 0x0028 && id == 0x0001)
+        return "VendorName";
+    return nullptr;
+}
+
+void attr_value_write_json(const attr_value_t *value, json_stream_t *js, const char *key)
+{
+    (void)value;
+    json_stream_null(js, key);
+}
+
+// ---- узел ----
+
+struct test_node
+{
+    matter_device_t node = {};
+    std::vector<endpoint_entry_t> endpoints;
+    std::vector<matter_cluster_t> clusters;
+    std::vector<std::vector<matter_attribute_t>> attributes;
+
+    matter_cluster_t *add_cluster(uint16_t endpoint_id, uint32_t cluster_id, uint16_t attribute_count)
+    {
+        endpoint_entry_t *ep = nullptr;
+        for (auto &entry : endpoints)
+            if (entry.endpoint_id == endpoint_id)
+                ep = &entry;
+        if (!ep)
+        {
+            endpoints.push_back({});
+            ep = &endpoints.back();
+            ep->endpoint_id = endpoint_id;
+        }
+        ep->clusters[ep->cluster_count++] = (uint16_t)cluster_id;
+
+        attributes.emplace_back(attribute_count);
+        for (uint16_t i = 0; i < attribute_count; i++)
+        {
+            matter_attribute_t &attr = attributes.back()[i];
+            attr.attribute_id = i;
+            attr.current_value.type = ESP_MATTER_VAL_TYPE_UINT16;
+            attr.current_value.val.u16 = (uint16_t)(cluster_id + i);
+        }
+        matter_cluster_t cluster = {};
+        cluster.cluster_id = cluster_id;
+        cluster.attributes_count = attribute_count;
+        clusters.push_back(cluster);
+        return &clusters.back();
+    }
+
+    // указатели в node и кластерах выставляются после того, как векторы заполнены
+    matter_device_t *done()
+    {
+        for (size_t i = 0; i < clusters.size(); i++)
+            clusters[i].attributes = attributes[i].data();
+        node.node_id = 0x1234;
+        node.endpoints = endpoints.data();
+        node.endpoints_count = (uint16_t)endpoints.size();
+        node.server_clusters = clusters.data();
+        node.server_clusters_count = (uint16_t)clusters.size();
+        return &node;
+    }
+
+    matter_attribute_t *attr(size_t cluster, size_t index) { return &attributes[cluster][index]; }
+};
+
+// Узел для проверок: endpoint 0 - BasicInformation, endpoint 1 - OnOff, LevelControl и кластер производителя
+static void build_small(test_node &t)
+{
+    t.add_cluster(0, 0x0028, 2);
+    t.add_cluster(1, 0x0006, 1);
+    t.add_cluster(1, 0x0008, 2);
+    t.add_cluster(1, 0xFC00, 2);
+    t.done();
+
+    static char vendor[] = "IKEA of Sweden";
+    matter_attribute_t *name = t.attr(0, 1);
+    name->current_value.type = ESP_MATTER_VAL_TYPE_CHAR_STRING;
+    name->current_value.val.a.b = (uint8_t *)vendor;
+    name->current_value.val.a.s = (uint16_t)strlen(vendor);
+    t.attr(1, 0)->current_value.type = ESP_MATTER_VAL_TYPE_BOOLEAN;
+    t.attr(1, 0)->current_value.val.b = true;
+    t.attr(2, 1)->current_value.type = ESP_MATTER_VAL_TYPE_INVALID; // значение еще не пришло
+    t.attr(3, 0)->current_value.type = ESP_MATTER_VAL_TYPE_FLOAT;
+    t.attr(3, 0)->current_value.val.f = 21.5f;
+}
+
+static bool write(matter_device_t *node, uint16_t endpoint_id, bool full, char *buf, size_t size,
+                  esp_err_t *finish = nullptr)
+{
+    json_stream_t js;
+    json_stream_init(&js, buf, size, NULL, NULL);
+    bool has_data = fd_report_write(node, endpoint_id, full, &js);
+    esp_err_t err = json_stream_finish(&js);
+    if (finish)
+        *finish = err;
+    else
+        CHECK(err == ESP_OK);
+    return has_data;
+}
+
+// Последовательность publish_fd(): запись, отправка, снятие флагов только при успехе
+static bool publish(matter_device_t *node, uint16_t endpoint_id, bool full, bool sent, char *buf, size_t size)
+{
+    esp_err_t err;
+    if (!write(node, endpoint_id, full, buf, size, &err))
+        return false;
+    if (err != ESP_OK || !sent)
+        return false;
+    fd_report_commit();
+    return true;
+}
+
+// ---- тесты ----
+
+static void test_full(void)
+{
+    test_node t;
+    build_small(t);
+    char buf[256];
+    CHECK(write(&t.node, 1, true, buf, sizeof(buf)));
+    CHECK(strcmp(buf, "{\"OnOff\":{\"OnOff\":true},\"LevelControl\":{\"CurrentLevel\":8},"
+                      "\"0xFC00\":{\"0x0000\":21.5,\"0x0001\":64513}}") == 0);
+    CHECK(write(&t.node, 0, true, buf, sizeof(buf)));
+    CHECK(strcmp(buf, "{\"BasicInformation\":{\"0x0000\":40,\"VendorName\":\"IKEA of Sweden\"}}") == 0);
+    CHECK(!write(&t.node, 7, true, buf, sizeof(buf)));
+    CHECK(strcmp(buf, "{}") == 0);
+}
+
+// delta: только измененные атрибуты, объект кластера только при изменениях в нем
+static void test_delta(void)
+{
+    test_node t;
+    build_small(t);
+    char buf[256];
+    CHECK(!write(&t.node, 1, false, buf, sizeof(buf)));
+    CHECK(strcmp(buf, "{}") == 0);
+
+    t.attr(2, 0)->changed = true;
+    t.attr(3, 1)->changed = true;
+    t.attr(2, 1)->changed = true; // без значения: не пишется
+    CHECK(write(&t.node, 1, false, buf, sizeof(buf)));
+    CHECK(strcmp(buf, "{\"LevelControl\":{\"CurrentLevel\":8},\"0xFC00\":{\"0x0001\":64513}}") == 0);
+}
+
+// Отправка не удалась: изменения остаются и попадают в следующее сообщение; после успешной
+// снимаются флаги только атрибутов этого сообщения
+static void test_commit_after_publish(void)
+{
+    test_node t;
+    build_small(t);
+    char buf[256];
+    t.attr(1, 0)->changed = true;
+    t.attr(3, 0)->changed = true;
+    t.attr(0, 1)->changed = true; // endpoint 0, в сообщение endpoint 1 не входит
+    t.attr(2, 1)->changed = true; // без значения
+
+    CHECK(!publish(&t.node, 1, false, false, buf, sizeof(buf)));
+    CHECK(t.attr(1, 0)->changed && t.attr(3, 0)->changed);
+    CHECK(strcmp(buf, "{\"OnOff\":{\"OnOff\":true},\"0xFC00\":{\"0x0000\":21.5}}") == 0);
+
+    // сообщение не поместилось в буфер: тоже не отправлено
+    char small[16];
+    CHECK(!publish(&t.node, 1, false, true, small, sizeof(small)));
+    CHECK(t.attr(1, 0)->changed && t.attr(3, 0)->changed);
+
+    CHECK(publish(&t.node, 1, false, true, buf, sizeof(buf)));
+    CHECK(strcmp(buf, "{\"OnOff\":{\"OnOff\":true},\"0xFC00\":{\"0x0000\":21.5}}") == 0);
+    CHECK(!t.attr(1, 0)->changed && !t.attr(3, 0)->changed);
+    CHECK(t.attr(0, 1)->changed);
+    CHECK(t.attr(2, 1)->changed);
+    CHECK(!write(&t.node, 1, false, buf, sizeof(buf)));
+
+    // полное сообщение снимает флаги всех своих атрибутов
+    t.attr(2, 0)->changed = true;
+    CHECK(publish(&t.node, 1, true, true, buf, sizeof(buf)));
+    CHECK(!t.attr(2, 0)->changed);
+
+    // commit относится только к последнему сообщению: повтор ничего не снимает
+    t.attr(1, 0)->changed = true;
+    fd_report_commit();
+    CHECK(t.attr(1, 0)->changed);
+    // сообщение без данных не снимает флаги своих атрибутов у другого endpoint'а
+    CHECK(!publish(&t.node, 7, false, true, buf, sizeof(buf)));
+    fd_report_commit();
+    CHECK(t.attr(1, 0)->changed && t.attr(0, 1)->changed);
+}
+
+// ---- замер ----
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Endpoint с clusters кластерами по attributes атрибутов, в сообщении changed атрибутов (0 - full)
+static void bench(uint16_t clusters, uint16_t attributes, uint32_t changed, uint32_t rounds)
+{
+    test_node t;
+    t.add_cluster(0, 0x0028, 8);
+    for (uint16_t c = 0; c < clusters; c++)
+        t.add_cluster(1, 0x0100 + c, attributes);
+    t.done();
+
+    char *buf = json_stream_buf_acquire();
+    size_t bytes = 0;
+    double started = now_seconds();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        for (uint32_t i = 0; i < changed; i++)
+        {
+            // изменения разбросаны по кластерам
+            uint32_t index = (r * 7 + i * 13) % (clusters * attributes);
+            t.attr(1 + index / attributes, index % attributes)->changed = true;
+        }
+        json_stream_t js;
+        json_stream_init(&js, buf, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+        if (!fd_report_write(&t.node, 1, changed == 0, &js) || json_stream_finish(&js) != ESP_OK)
+            failures++;
+        fd_report_commit();
+        bytes += js.len;
+    }
+    double seconds = now_seconds() - started;
+    json_stream_buf_release(buf);
+
+    if (changed)
+        printf("  delta, %2" PRIu32 " changed: %8.0f msg/s, %4zu bytes/msg\n", changed, rounds / seconds,
+               bytes / rounds);
+    else
+        printf("  full:             %8.0f msg/s, %4zu bytes/msg\n", rounds / seconds, bytes / rounds);
+}
+
+int main(void)
+{
+    test_full();
+    test_delta();
+    test_commit_after_publish();
+
+    printf("endpoint with 8 clusters x 12 attributes:\n");
+    bench(8, 12, 0, 100000);
+    bench(8, 12, 1, 100000);
+    bench(8, 12, 4, 100000);
+    bench(8, 12, 16, 100000);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("fd_report: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,380 @@
+// Тест json_stream на хосте: побайтное совпадение сообщения fd с cJSON_PrintUnformatted,
+// сброс в приемник частями, переполнение буфера, и замер против дерева cJSON (прежний путь publish_fd)
+#include "json_stream.h"
+#include "cJSON.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do                                                                               \
+    {                                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                              \
+        }                                                                            \
+    } while (0)
+
+// ---- сообщение fd: значения как в attribute_value_write_json() ----
+
+typedef enum
+{
+    VALUE_BOOL,
+    VALUE_UINT,
+    VALUE_INT,
+    VALUE_UINT64, // в cJSON только через raw, double теряет младшие разряды
+    VALUE_FLOAT,  // ESP_MATTER_VAL_TYPE_FLOAT, float
+    VALUE_STRING,
+    VALUE_OCTETS,
+    VALUE_NULL,   // полное значение null (tlv_value)
+} value_type_t;
+
+typedef struct
+{
+    const char *name;
+    value_type_t type;
+    int64_t i;
+    float f;
+    const char *s;
+    size_t len; // для VALUE_OCTETS
+} attr_t;
+
+typedef struct
+{
+    const char *name;
+    const attr_t *attrs;
+    size_t count;
+} cluster_t;
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static const attr_t on_off[] = {
+    {"OnOff", VALUE_BOOL, 1},       {"GlobalSceneControl", VALUE_BOOL, 1}, {"OnTime", VALUE_UINT, 0},
+    {"OffWaitTime", VALUE_UINT, 0}, {"StartUpOnOff", VALUE_NULL},
+};
+static const attr_t level[] = {
+    {"CurrentLevel", VALUE_UINT, 254}, {"RemainingTime", VALUE_UINT, 0}, {"MinLevel", VALUE_UINT, 1},
+    {"MaxLevel", VALUE_UINT, 254},     {"OnLevel", VALUE_NULL},          {"Options", VALUE_UINT, 0},
+};
+static const attr_t color[] = {
+    {"CurrentX", VALUE_UINT, 24939},
+    {"CurrentY", VALUE_UINT, 24701},
+    {"ColorTemperatureMireds", VALUE_UINT, 370},
+    {"ColorMode", VALUE_UINT, 2},
+    {"ColorTempPhysicalMinMireds", VALUE_UINT, 153},
+    {"ColorTempPhysicalMaxMireds", VALUE_UINT, 500},
+};
+static const attr_t basic[] = {
+    {"VendorName", VALUE_STRING, 0, 0, "IKEA of Sweden"},
+    {"VendorID", VALUE_UINT, 4476},
+    {"ProductName", VALUE_STRING, 0, 0, "TRADFRI bulb E27 CWS 806lm"},
+    {"NodeLabel", VALUE_STRING, 0, 0, "Kitchen \"main\"\n\t\x01"},
+    {"SoftwareVersion", VALUE_UINT, 16777216},
+    {"UniqueID", VALUE_STRING, 0, 0, "a1b2c3d4e5f60718"},
+};
+static const attr_t temperature[] = {
+    {"MeasuredValue", VALUE_INT, -215},
+    {"MinMeasuredValue", VALUE_INT, -4000},
+    {"MaxMeasuredValue", VALUE_INT, 12500},
+};
+// неизвестный кластер: ключи в hex
+static const attr_t vendor[] = {
+    {"0x0000", VALUE_OCTETS, 0, 0, "\x0a\x1b\x2c\x3d", 4},
+    {"0x0001", VALUE_FLOAT, 0, 21.5f},
+    {"0x0002", VALUE_FLOAT, 0, -3.25f},
+    {"0x0003", VALUE_BOOL, 0},
+    {"0x0004", VALUE_UINT64, -1},
+};
+
+static const cluster_t fd_payload[] = {
+    {"OnOff", on_off, ARRAY_SIZE(on_off)},
+    {"LevelControl", level, ARRAY_SIZE(level)},
+    {"ColorControl", color, ARRAY_SIZE(color)},
+    {"BasicInformation", basic, ARRAY_SIZE(basic)},
+    {"TemperatureMeasurement", temperature, ARRAY_SIZE(temperature)},
+    {"0xFC00", vendor, ARRAY_SIZE(vendor)},
+};
+
+static const char fd_expected[] =
+    "{\"OnOff\":{\"OnOff\":true,\"GlobalSceneControl\":true,\"OnTime\":0,\"OffWaitTime\":0,\"StartUpOnOff\":null},"
+    "\"LevelControl\":{\"CurrentLevel\":254,\"RemainingTime\":0,\"MinLevel\":1,\"MaxLevel\":254,\"OnLevel\":null,"
+    "\"Options\":0},"
+    "\"ColorControl\":{\"CurrentX\":24939,\"CurrentY\":24701,\"ColorTemperatureMireds\":370,\"ColorMode\":2,"
+    "\"ColorTempPhysicalMinMireds\":153,\"ColorTempPhysicalMaxMireds\":500},"
+    "\"BasicInformation\":{\"VendorName\":\"IKEA of Sweden\",\"VendorID\":4476,"
+    "\"ProductName\":\"TRADFRI bulb E27 CWS 806lm\",\"NodeLabel\":\"Kitchen \\\"main\\\"\\n\\t\\u0001\","
+    "\"SoftwareVersion\":16777216,\"UniqueID\":\"a1b2c3d4e5f60718\"},"
+    "\"TemperatureMeasurement\":{\"MeasuredValue\":-215,\"MinMeasuredValue\":-4000,\"MaxMeasuredValue\":12500},"
+    "\"0xFC00\":{\"0x0000\":\"0a1b2c3d\",\"0x0001\":21.5,\"0x0002\":-3.25,\"0x0003\":false,"
+    "\"0x0004\":18446744073709551615}}";
+
+// Сообщение так, как его пишет publish_fd()
+static void write_stream(json_stream_t *js)
+{
+    json_stream_object_begin(js, NULL);
+    for (size_t c = 0; c < ARRAY_SIZE(fd_payload); c++)
+    {
+        const cluster_t *cluster = &fd_payload[c];
+        json_stream_object_begin(js, cluster->name);
+        for (size_t a = 0; a < cluster->count; a++)
+        {
+            const attr_t *attr = &cluster->attrs[a];
+            switch (attr->type)
+            {
+            case VALUE_BOOL:
+                json_stream_bool(js, attr->name, attr->i != 0);
+                break;
+            case VALUE_UINT:
+                json_stream_uint(js, attr->name, (uint64_t)attr->i);
+                break;
+            case VALUE_INT:
+                json_stream_int(js, attr->name, attr->i);
+                break;
+            case VALUE_UINT64:
+                json_stream_uint(js, attr->name, (uint64_t)attr->i);
+                break;
+            case VALUE_FLOAT:
+                json_stream_double(js, attr->name, attr->f);
+                break;
+            case VALUE_STRING:
+                json_stream_string(js, attr->name, attr->s);
+                break;
+            case VALUE_OCTETS:
+                json_stream_hex(js, attr->name, (const uint8_t *)attr->s, attr->len);
+                break;
+            case VALUE_NULL:
+                json_stream_null(js, attr->name);
+                break;
+            }
+        }
+        json_stream_object_end(js);
+    }
+    json_stream_object_end(js);
+}
+
+// Прежний путь: дерево cJSON, полные значения и 64-битные числа - готовым JSON через raw
+static char *print_cjson(void)
+{
+    cJSON *root = cJSON_CreateObject();
+    for (size_t c = 0; c < ARRAY_SIZE(fd_payload); c++)
+    {
+        const cluster_t *cluster = &fd_payload[c];
+        cJSON *object = cJSON_CreateObject();
+        cJSON_AddItemToObject(root, cluster->name, object);
+        for (size_t a = 0; a < cluster->count; a++)
+        {
+            const attr_t *attr = &cluster->attrs[a];
+            char raw[48];
+            switch (attr->type)
+            {
+            case VALUE_BOOL:
+                cJSON_AddBoolToObject(object, attr->name, attr->i != 0);
+                break;
+            case VALUE_UINT:
+            case VALUE_INT:
+                cJSON_AddNumberToObject(object, attr->name, (double)attr->i);
+                break;
+            case VALUE_UINT64:
+                snprintf(raw, sizeof(raw), "%" PRIu64, (uint64_t)attr->i);
+                cJSON_AddRawToObject(object, attr->name, raw);
+                break;
+            case VALUE_FLOAT:
+                cJSON_AddNumberToObject(object, attr->name, attr->f);
+                break;
+            case VALUE_STRING:
+                cJSON_AddStringToObject(object, attr->name, attr->s);
+                break;
+            case VALUE_OCTETS:
+            {
+                size_t n = 0;
+                raw[n++] = '"';
+                for (size_t i = 0; i < attr->len; i++)
+                    n += (size_t)snprintf(raw + n, sizeof(raw) - n, "%02x", (uint8_t)attr->s[i]);
+                raw[n++] = '"';
+                raw[n] = '\0';
+                cJSON_AddRawToObject(object, attr->name, raw);
+                break;
+            }
+            case VALUE_NULL:
+                cJSON_AddRawToObject(object, attr->name, "null");
+                break;
+            }
+        }
+    }
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+// ---- тесты ----
+
+static void test_fd_exact(void)
+{
+    char buf[JSON_STREAM_POOL_BUF_SIZE];
+    json_stream_t js;
+    json_stream_init(&js, buf, sizeof(buf), NULL, NULL);
+    write_stream(&js);
+    CHECK(json_stream_finish(&js) == ESP_OK);
+    CHECK(js.len == sizeof(fd_expected) - 1);
+    CHECK(strcmp(buf, fd_expected) == 0);
+
+    char *printed = print_cjson();
+    CHECK(printed && strcmp(printed, fd_expected) == 0);
+    CHECK(printed && strcmp(printed, buf) == 0);
+    if (printed && strcmp(printed, buf) != 0)
+        fprintf(stderr, "json_stream: %s\ncJSON:       %s\n", buf, printed);
+    cJSON_free(printed);
+
+    // документ разбирается обратно и дает тот же текст
+    cJSON *parsed = cJSON_Parse(buf);
+    CHECK(parsed != NULL);
+    CHECK(cJSON_GetArraySize(parsed) == (int)ARRAY_SIZE(fd_payload));
+    cJSON_Delete(parsed);
+}
+
+typedef struct
+{
+    char data[JSON_STREAM_POOL_BUF_SIZE];
+    size_t len;
+    uint32_t calls;
+    uint32_t fail_at; // 0 - не отказывать
+} sink_t;
+
+static esp_err_t sink_write(const char *data, size_t len, void *ctx)
+{
+    sink_t *sink = (sink_t *)ctx;
+    if (++sink->calls == sink->fail_at)
+        return ESP_FAIL;
+    if (sink->len + len > sizeof(sink->data))
+        return ESP_ERR_NO_MEM;
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    return ESP_OK;
+}
+
+// Маленький буфер с приемником: части складываются в тот же документ, ошибка приемника останавливает запись
+static void test_flush(void)
+{
+    static sink_t sink;
+    char small[16];
+    json_stream_t js;
+
+    memset(&sink, 0, sizeof(sink));
+    json_stream_init(&js, small, sizeof(small), sink_write, &sink);
+    write_stream(&js);
+    CHECK(json_stream_finish(&js) == ESP_OK);
+    CHECK(sink.len == sizeof(fd_expected) - 1);
+    CHECK(js.total == sizeof(fd_expected) - 1);
+    CHECK(memcmp(sink.data, fd_expected, sink.len) == 0);
+    CHECK(sink.calls == (sizeof(fd_expected) - 1 + sizeof(small) - 1) / sizeof(small));
+
+    memset(&sink, 0, sizeof(sink));
+    sink.fail_at = 3;
+    json_stream_init(&js, small, sizeof(small), sink_write, &sink);
+    write_stream(&js);
+    CHECK(json_stream_finish(&js) == ESP_FAIL);
+    CHECK(sink.calls == 3);
+    CHECK(sink.len == 2 * sizeof(small));
+}
+
+// Без приемника документ не помещается: ESP_ERR_NO_MEM, в буфере строка с '\0' в пределах размера
+static void test_overflow(void)
+{
+    char buf[65];
+    memset(buf, 'x', sizeof(buf));
+    json_stream_t js;
+    json_stream_init(&js, buf, sizeof(buf) - 1, NULL, NULL);
+    write_stream(&js);
+    CHECK(json_stream_finish(&js) == ESP_ERR_NO_MEM);
+    CHECK(js.len == sizeof(buf) - 2);
+    CHECK(buf[sizeof(buf) - 2] == '\0');
+    CHECK(buf[sizeof(buf) - 1] == 'x');
+    CHECK(memcmp(buf, fd_expected, js.len) == 0);
+}
+
+// Числа, которые cJSON_PrintUnformatted без raw пишет иначе
+static void test_numbers(void)
+{
+    char buf[128];
+    json_stream_t js;
+    json_stream_init(&js, buf, sizeof(buf), NULL, NULL);
+    json_stream_array_begin(&js, NULL);
+    json_stream_uint(&js, NULL, 9007199254740993ULL); // 2^53 + 1, через double станет ...992
+    json_stream_int(&js, NULL, INT64_MIN);
+    json_stream_double(&js, NULL, 0.1f); // float без потерь: 17 знаков
+    json_stream_double(&js, NULL, 1.0 / 0.0);
+    json_stream_array_end(&js);
+    CHECK(json_stream_finish(&js) == ESP_OK);
+    CHECK(strcmp(buf, "[9007199254740993,-9223372036854775808,0.10000000149011612,null]") == 0);
+    CHECK(strtod("0.10000000149011612", NULL) == (double)0.1f);
+}
+
+// ---- замер ----
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(uint32_t rounds)
+{
+    size_t bytes = 0;
+    double started = now_seconds();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        char *buf = json_stream_buf_acquire();
+        json_stream_t js;
+        json_stream_init(&js, buf, JSON_STREAM_POOL_BUF_SIZE, NULL, NULL);
+        write_stream(&js);
+        if (json_stream_finish(&js) != ESP_OK)
+            failures++;
+        bytes += js.len;
+        json_stream_buf_release(buf);
+    }
+    double stream_seconds = now_seconds() - started;
+
+    started = now_seconds();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        char *json = print_cjson();
+        if (!json)
+            failures++;
+        else
+            bytes -= strlen(json);
+        cJSON_free(json);
+    }
+    double cjson_seconds = now_seconds() - started;
+    CHECK(bytes == 0); // оба пути выдали одинаковый объем
+
+    printf("fd message, %zu bytes:\n", sizeof(fd_expected) - 1);
+    printf("  json_stream (pool buffer):           %.0f msg/s, %.1f us/msg\n", rounds / stream_seconds,
+           stream_seconds * 1e6 / rounds);
+    printf("  cJSON tree + cJSON_PrintUnformatted: %.0f msg/s, %.1f us/msg\n", rounds / cjson_seconds,
+           cjson_seconds * 1e6 / rounds);
+    const json_stream_pool_stats_t *pool = json_stream_pool_get_stats();
+    printf("  pool: %" PRIu32 " acquired, %" PRIu32 " fallbacks\n", pool->acquired, pool->fallbacks);
+}
+
+int main(void)
+{
+    test_fd_exact();
+    test_flush();
+    test_overflow();
+    test_numbers();
+    bench(200000);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("json_stream: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,232 @@
+// Тест mqtt_router на хосте: таблица действий, маршруты топиков, разбор чисел после топика,
+// и замер сообщений в секунду для разбора топика и поиска действия против линейного strcmp
+#include "mqtt_router.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do                                                                               \
+    {                                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                              \
+        }                                                                            \
+    } while (0)
+
+// Имена из mqtt_actions[] (mqtt_command.cpp), в том же порядке
+static const char *const action_names[] = {
+    "reboot", "factoryreset", "initOpenThread", "getTLVs", "setTLV", "pairing", "subs-attr", "invoke-cmd",
+    "read-attr", "write-attr", "read-event", "subscribe-event", "shutdown-subscription", "shutdown-subscriptions",
+    "shutdown-all-subscriptions", "subs-all-attrs", "report-mode", "outbox", "payload", "command-queue", "latency",
+    "coalescing", "session-warm", "reachability", "command-policy", "registry", "group", "scene", "scene-recall",
+    "export", "log_controller_structure", "remove-node",
+};
+#define ACTION_COUNT (sizeof(action_names) / sizeof(action_names[0]))
+#define ACTION_SLOTS 64 // MQTT_ACTION_SLOTS
+
+// Базовые топики topic_routes[] для префикса "home/ctrl" (mqtt_topics.c)
+static const char *const bases[] = {
+    "home/ctrl/td/matter/#", "home/ctrl/td/matter_csa/#", "home/ctrl/command/matter", "home/ctrl/td/batch",
+    "home/ctrl/td/group/#",
+};
+static const uint8_t ids_required[] = {1, 2, 0, 0, 1};
+static const uint8_t ids_max[] = {2, 2, 0, 0, 1};
+#define ROUTE_COUNT (sizeof(bases) / sizeof(bases[0]))
+
+static mqtt_router_slot_t slots[ACTION_SLOTS];
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void build_table(void)
+{
+    memset(slots, 0, sizeof(slots));
+    for (size_t i = 0; i < ACTION_COUNT; i++)
+        CHECK(mqtt_router_table_add(slots, ACTION_SLOTS, action_names[i], &action_names[i]));
+}
+
+// ---- тесты ----
+
+static void test_table(void)
+{
+    build_table();
+    for (size_t i = 0; i < ACTION_COUNT; i++)
+        CHECK(mqtt_router_table_find(slots, ACTION_SLOTS, action_names[i]) == &action_names[i]);
+    CHECK(mqtt_router_table_find(slots, ACTION_SLOTS, "unknown") == NULL);
+    CHECK(mqtt_router_table_find(slots, ACTION_SLOTS, "") == NULL);
+    // префикс и продолжение существующего имени - другие действия
+    CHECK(mqtt_router_table_find(slots, ACTION_SLOTS, "scene-") == NULL);
+    CHECK(mqtt_router_table_find(slots, ACTION_SLOTS, "shutdown-subscriptionss") == NULL);
+
+    // заполненная таблица: добавление отклоняется, поиск отсутствующего имени завершается
+    mqtt_router_slot_t small[4];
+    memset(small, 0, sizeof(small));
+    for (size_t i = 0; i < 4; i++)
+        CHECK(mqtt_router_table_add(small, 4, action_names[i], &action_names[i]));
+    CHECK(!mqtt_router_table_add(small, 4, action_names[4], &action_names[4]));
+    for (size_t i = 0; i < 4; i++)
+        CHECK(mqtt_router_table_find(small, 4, action_names[i]) == &action_names[i]);
+    CHECK(mqtt_router_table_find(small, 4, "unknown") == NULL);
+}
+
+static int route(const char *topic, size_t *base_len)
+{
+    return mqtt_router_find(topic, strlen(topic), bases, ROUTE_COUNT, base_len);
+}
+
+static void test_routes(void)
+{
+    size_t base_len = 0;
+    CHECK(route("home/ctrl/td/matter/5", &base_len) == 0);
+    CHECK(base_len == strlen("home/ctrl/td/matter/"));
+    CHECK(route("home/ctrl/td/matter_csa/5/1", &base_len) == 1);
+    CHECK(base_len == strlen("home/ctrl/td/matter_csa/"));
+    CHECK(route("home/ctrl/command/matter", &base_len) == 2);
+    CHECK(route("home/ctrl/td/batch", &base_len) == 3);
+    CHECK(route("home/ctrl/td/group/7", &base_len) == 4);
+
+    // без '#' топик совпадает только целиком
+    CHECK(route("home/ctrl/command/matter/1", &base_len) == -1);
+    CHECK(route("home/ctrl/td/batchx", &base_len) == -1);
+    // у '#' обязателен '/' после базового топика
+    CHECK(route("home/ctrl/td/matter", &base_len) == -1);
+    CHECK(route("home/ctrl/td/group", &base_len) == -1);
+    CHECK(route("home/other/td/matter/5", &base_len) == -1);
+    CHECK(route("", &base_len) == -1);
+    // длина задается явно, данные после нее не читаются
+    CHECK(mqtt_router_find("home/ctrl/td/batch/extra", strlen("home/ctrl/td/batch"), bases, ROUTE_COUNT,
+                           &base_len) == 3);
+}
+
+static bool parse(const char *rest, uint64_t *ids, uint8_t required, uint8_t max)
+{
+    return mqtt_router_parse_ids(rest, strlen(rest), ids, required, max);
+}
+
+static void test_ids(void)
+{
+    uint64_t ids[2] = {0, 1};
+    CHECK(parse("5", ids, 1, 2) && ids[0] == 5 && ids[1] == 1); // endpoint по умолчанию сохраняется
+    CHECK(parse("0x1F/2", ids, 2, 2) && ids[0] == 0x1F && ids[1] == 2);
+    CHECK(parse("18446744073709551615/0", ids, 2, 2) && ids[0] == UINT64_MAX && ids[1] == 0);
+    CHECK(parse("", ids, 0, 0));
+
+    CHECK(!parse("", ids, 1, 2));           // нет обязательного
+    CHECK(!parse("5", ids, 2, 2));          // нет второго обязательного
+    CHECK(!parse("5/1/2", ids, 1, 2));      // лишний сегмент
+    CHECK(!parse("5/", ids, 1, 2));         // пустой последний сегмент
+    CHECK(!parse("5//1", ids, 1, 2));       // пустой сегмент в середине
+    CHECK(!parse("/5", ids, 1, 2));         // пустой первый сегмент
+    CHECK(!parse("abc", ids, 1, 2));        // не число
+    CHECK(!parse("5x", ids, 1, 2));         // хвост после числа
+    CHECK(!parse("-1", ids, 1, 2));         // знак
+    CHECK(!parse("+1", ids, 1, 2));         // знак
+    CHECK(!parse(" 1", ids, 1, 2));         // пробел
+    CHECK(!parse("18446744073709551616", ids, 1, 2)); // больше UINT64_MAX
+    CHECK(!parse("123456789012345678901234", ids, 1, 2)); // длиннее буфера сегмента
+    CHECK(!parse("1", ids, 0, 0));          // топик без чисел
+}
+
+// ---- замер ----
+
+typedef struct
+{
+    const char *topic;
+    const char *action; // для command/matter
+} message_t;
+
+static const message_t messages[] = {
+    {"home/ctrl/td/matter/4660/1", NULL},
+    {"home/ctrl/td/matter_csa/0x1234/2", NULL},
+    {"home/ctrl/td/group/12", NULL},
+    {"home/ctrl/td/batch", NULL},
+    {"home/ctrl/command/matter", "invoke-cmd"},
+    {"home/ctrl/command/matter", "read-attr"},
+    {"home/ctrl/command/matter", "log_controller_structure"},
+    {"home/ctrl/command/matter", "remove-node"},
+};
+#define MESSAGE_COUNT (sizeof(messages) / sizeof(messages[0]))
+
+static const void *linear_find(const char *name)
+{
+    for (size_t i = 0; i < ACTION_COUNT; i++)
+        if (strcmp(action_names[i], name) == 0)
+            return &action_names[i];
+    return NULL;
+}
+
+// Разбор как в dispatch_message(): маршрут, числа, для command/matter - действие
+static uintptr_t route_message(const message_t *message, bool hashed)
+{
+    size_t topic_len = strlen(message->topic);
+    size_t base_len;
+    int index = mqtt_router_find(message->topic, topic_len, bases, ROUTE_COUNT, &base_len);
+    if (index < 0)
+        return 0;
+    uint64_t ids[2] = {0, 1};
+    if (!mqtt_router_parse_ids(message->topic + base_len, topic_len - base_len, ids, ids_required[index],
+                               ids_max[index]))
+        return 0;
+    uintptr_t result = (uintptr_t)ids[0] + (uintptr_t)index;
+    if (message->action)
+        result += (uintptr_t)(hashed ? mqtt_router_table_find(slots, ACTION_SLOTS, message->action)
+                                     : linear_find(message->action));
+    return result;
+}
+
+static void bench(uint32_t rounds)
+{
+    build_table();
+    volatile uintptr_t sink = 0;
+    double rates[2];
+    for (int hashed = 1; hashed >= 0; hashed--)
+    {
+        double started = now_seconds();
+        for (uint32_t r = 0; r < rounds; r++)
+            for (size_t m = 0; m < MESSAGE_COUNT; m++)
+                sink += route_message(&messages[m], hashed);
+        rates[hashed] = rounds * MESSAGE_COUNT / (now_seconds() - started);
+    }
+    (void)sink;
+
+    double started = now_seconds();
+    uint32_t lookups = rounds * (uint32_t)ACTION_COUNT;
+    for (uint32_t r = 0; r < rounds; r++)
+        for (size_t i = 0; i < ACTION_COUNT; i++)
+            sink += (uintptr_t)mqtt_router_table_find(slots, ACTION_SLOTS, action_names[i]);
+    double hashed_lookups = lookups / (now_seconds() - started);
+    started = now_seconds();
+    for (uint32_t r = 0; r < rounds; r++)
+        for (size_t i = 0; i < ACTION_COUNT; i++)
+            sink += (uintptr_t)linear_find(action_names[i]);
+    double linear_lookups = lookups / (now_seconds() - started);
+
+    printf("messages (route + ids + action): %.0f msg/s hashed, %.0f msg/s linear strcmp\n", rates[1], rates[0]);
+    printf("action lookup, all %zu names: %.0f/s hashed, %.0f/s linear strcmp\n", ACTION_COUNT, hashed_lookups,
+           linear_lookups);
+}
+
+int main(void)
+{
+    test_table();
+    test_routes();
+    test_ids();
+    bench(500000);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("mqtt_router: all checks passed\n");
+    return 0;
+}
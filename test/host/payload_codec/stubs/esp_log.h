@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdio.h>
+
+// Ошибки разбора в тесте ожидаемы и не выводятся
+#define ESP_LOGE(tag, fmt, ...) do { if (0) fprintf(stderr, "%s: " fmt, tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGW(tag, fmt, ...) do { if (0) fprintf(stderr, "%s: " fmt, tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGI(tag, fmt, ...) do { if (0) fprintf(stderr, "%s: " fmt, tag, ##__VA_ARGS__); } while (0)
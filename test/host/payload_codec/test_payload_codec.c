@@ -0,0 +1,317 @@
+// Тест payload_codec на хосте: CBOR -> дерево cJSON совпадает с JSON того же сообщения,
+// обрезанный и испорченный вход, ограничения вложенности и цепочки тегов, замер кодирования и разбора
+#include "payload_codec.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do                                                                               \
+    {                                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                              \
+        }                                                                            \
+    } while (0)
+
+// Сообщение fd в том виде, как его пишет publish_fd()
+static void write_fd(json_stream_t *js)
+{
+    static const uint8_t octets[] = {0x0a, 0x1b, 0x2c, 0x3d, 0x00, 0xff};
+    json_stream_object_begin(js, NULL);
+    json_stream_object_begin(js, "OnOff");
+    json_stream_bool(js, "OnOff", true);
+    json_stream_bool(js, "GlobalSceneControl", false);
+    json_stream_uint(js, "OnTime", 0);
+    json_stream_uint(js, "OffWaitTime", 300);
+    json_stream_null(js, "StartUpOnOff");
+    json_stream_object_end(js);
+    json_stream_object_begin(js, "LevelControl");
+    json_stream_uint(js, "CurrentLevel", 254);
+    json_stream_uint(js, "RemainingTime", 65535);
+    json_stream_uint(js, "OnOffTransitionTime", 70000);
+    json_stream_object_end(js);
+    json_stream_object_begin(js, "BasicInformation");
+    json_stream_string(js, "VendorName", "IKEA of Sweden");
+    json_stream_string(js, "NodeLabel", "Kitchen \"main\"\n");
+    json_stream_uint(js, "SoftwareVersion", 16777216);
+    json_stream_object_end(js);
+    json_stream_object_begin(js, "TemperatureMeasurement");
+    json_stream_int(js, "MeasuredValue", -215);
+    json_stream_int(js, "MinMeasuredValue", -40000);
+    json_stream_int(js, "0x0010", -5000000000LL);
+    json_stream_object_end(js);
+    json_stream_object_begin(js, "0xFC00");
+    json_stream_hex(js, "0x0000", octets, sizeof(octets));
+    json_stream_double(js, "0x0001", 21.5f);
+    json_stream_double(js, "0x0002", 0.1);
+    json_stream_uint(js, "0x0003", 4294967296ULL);
+    json_stream_array_begin(js, "0x0004");
+    json_stream_uint(js, NULL, 1);
+    json_stream_string(js, NULL, "two");
+    json_stream_object_begin(js, NULL);
+    json_stream_bool(js, "three", true);
+    json_stream_object_end(js);
+    json_stream_array_end(js);
+    json_stream_object_end(js);
+    json_stream_object_end(js);
+}
+
+static size_t encode_fd(uint8_t format, char *buf, size_t size)
+{
+    json_stream_t js;
+    payload_encoder_init(&js, format, buf, size);
+    write_fd(&js);
+    return json_stream_finish(&js) == ESP_OK ? js.len : 0;
+}
+
+// Дерево как текст: одинаковые деревья дают одинаковую строку
+static char *decode_print(const char *data, size_t len, uint8_t *format)
+{
+    cJSON *root = payload_decode(data, len, format);
+    if (!root)
+        return NULL;
+    char *printed = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return printed;
+}
+
+// ---- тесты ----
+
+static void test_round_trip(void)
+{
+    char json[JSON_STREAM_POOL_BUF_SIZE], cbor[JSON_STREAM_POOL_BUF_SIZE];
+    size_t json_len = encode_fd(PAYLOAD_FORMAT_JSON, json, sizeof(json));
+    size_t cbor_len = encode_fd(PAYLOAD_FORMAT_CBOR, cbor, sizeof(cbor));
+    CHECK(json_len > 0 && cbor_len > 0);
+    CHECK(cbor_len < json_len);
+    CHECK((uint8_t)cbor[0] == 0xBF); // map неопределенной длины
+
+    uint8_t format = 0xFF;
+    char *from_json = decode_print(json, json_len, &format);
+    CHECK(format == PAYLOAD_FORMAT_JSON);
+    char *from_cbor = decode_print(cbor, cbor_len, &format);
+    CHECK(format == PAYLOAD_FORMAT_CBOR);
+    CHECK(from_json && from_cbor && strcmp(from_json, from_cbor) == 0);
+    if (from_json && from_cbor && strcmp(from_json, from_cbor) != 0)
+        fprintf(stderr, "json: %s\ncbor: %s\n", from_json, from_cbor);
+    cJSON_free(from_json);
+    cJSON_free(from_cbor);
+
+    // значения по отдельности
+    cJSON *root = payload_decode(cbor, cbor_len, NULL);
+    CHECK(root != NULL);
+    cJSON *vendor = cJSON_GetObjectItemCaseSensitive(root, "0xFC00");
+    cJSON *octets = cJSON_GetObjectItemCaseSensitive(vendor, "0x0000");
+    CHECK(cJSON_IsString(octets) && strcmp(octets->valuestring, "0a1b2c3d00ff") == 0);
+    CHECK(cJSON_GetObjectItemCaseSensitive(vendor, "0x0001")->valuedouble == 21.5);
+    CHECK(cJSON_GetObjectItemCaseSensitive(vendor, "0x0002")->valuedouble == 0.1);
+    CHECK(cJSON_GetObjectItemCaseSensitive(vendor, "0x0003")->valuedouble == 4294967296.0);
+    CHECK(cJSON_GetArraySize(cJSON_GetObjectItemCaseSensitive(vendor, "0x0004")) == 3);
+    cJSON *temperature = cJSON_GetObjectItemCaseSensitive(root, "TemperatureMeasurement");
+    CHECK(cJSON_GetObjectItemCaseSensitive(temperature, "0x0010")->valuedouble == -5000000000.0);
+    cJSON *label = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(root, "BasicInformation"),
+                                                     "NodeLabel");
+    CHECK(cJSON_IsString(label) && strcmp(label->valuestring, "Kitchen \"main\"\n") == 0);
+    CHECK(cJSON_IsNull(cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(root, "OnOff"),
+                                                        "StartUpOnOff")));
+    cJSON_Delete(root);
+}
+
+// CBOR от других отправителей: map определенной длины, ключи-числа, half float, теги
+static void test_foreign_cbor(void)
+{
+    static const uint8_t data[] = {
+        0xA5,                               // map(5)
+        0x01, 0x82, 0x01, 0x20,             // 1: [1, -1]
+        0x20, 0xF9, 0x3E, 0x00,             // -1: 1.5 (half)
+        0x61, 'h', 0xF9, 0x7C, 0x00,        // "h": +inf (half)
+        0x61, 't', 0xC1, 0x1A, 0x5F, 0x5E, 0x10, 0x00, // "t": 1(1600000000)
+        0x61, 'u', 0xF7,                    // "u": undefined -> null
+    };
+    char *printed = decode_print((const char *)data, sizeof(data), NULL);
+    CHECK(printed && strcmp(printed, "{\"1\":[1,-1],\"-1\":1.5,\"h\":null,\"t\":1600000000,\"u\":null}") == 0);
+    cJSON_free(printed);
+
+    // лишние байты после документа не мешают разбору
+    static const uint8_t trailing[] = {0xA1, 0x61, 'a', 0x01, 0x00, 0x00};
+    printed = decode_print((const char *)trailing, sizeof(trailing), NULL);
+    CHECK(printed && strcmp(printed, "{\"a\":1}") == 0);
+    cJSON_free(printed);
+}
+
+// Каждый обрезанный префикс и испорченные заголовки: NULL без чтения за концом
+static void test_invalid(void)
+{
+    char cbor[JSON_STREAM_POOL_BUF_SIZE];
+    size_t cbor_len = encode_fd(PAYLOAD_FORMAT_CBOR, cbor, sizeof(cbor));
+    for (size_t len = 1; len < cbor_len; len++)
+    {
+        // отдельная копия нужной длины, чтобы ASan увидел чтение за концом
+        char *copy = (char *)malloc(len);
+        memcpy(copy, cbor, len);
+        cJSON *root = payload_decode(copy, len, NULL);
+        CHECK(root == NULL);
+        cJSON_Delete(root);
+        free(copy);
+    }
+
+    static const uint8_t bad[][8] = {
+        {0xA1, 0x61, 'a', 0x1C},             // info 28 не определен
+        {0xA1, 0x61, 'a', 0x5F},             // byte string неопределенной длины
+        {0xA1, 0x61, 'a', 0x7A, 0xFF, 0xFF}, // длина строки за концом
+        {0xA1, 0xF5, 0x01},                  // ключ true
+        {0xA1, 0x61, 'a', 0xDF},             // тег неопределенной длины
+        {0xA1, 0x61, 'a', 0x3F},             // отрицательное число неопределенной длины
+        {0xA1, 0x61, 'a', 0xFF},             // break вне контейнера неопределенной длины
+    };
+    static const size_t bad_len[] = {4, 4, 6, 3, 4, 4, 4};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+        CHECK(payload_decode((const char *)bad[i], bad_len[i], NULL) == NULL);
+
+    CHECK(payload_decode("{\"a\":", 5, NULL) == NULL);
+    CHECK(payload_decode("", 0, NULL) == NULL);
+}
+
+// {"k": <tags> 1}
+static size_t tagged(uint8_t *buf, size_t tags)
+{
+    size_t n = 0;
+    buf[n++] = 0xA1;
+    buf[n++] = 0x61;
+    buf[n++] = 'k';
+    memset(buf + n, 0xC0, tags);
+    n += tags;
+    buf[n++] = 0x01;
+    return n;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Цепочка тегов ограничена как вложенность: до PAYLOAD_CBOR_MAX_DEPTH тегов разбираются, длинная цепочка
+// отклоняется сразу после предела, не дочитывая вход
+static void test_tag_chain(void)
+{
+    enum
+    {
+        LONG_CHAIN = 200000
+    };
+    uint8_t *buf = (uint8_t *)malloc(LONG_CHAIN + 8);
+
+    size_t len = tagged(buf, PAYLOAD_CBOR_MAX_DEPTH);
+    cJSON *root = payload_decode((const char *)buf, len, NULL);
+    CHECK(root && cJSON_GetObjectItemCaseSensitive(root, "k")->valuedouble == 1);
+    cJSON_Delete(root);
+
+    len = tagged(buf, PAYLOAD_CBOR_MAX_DEPTH + 1);
+    CHECK(payload_decode((const char *)buf, len, NULL) == NULL);
+
+    len = tagged(buf, LONG_CHAIN);
+    double started = now_seconds();
+    for (int i = 0; i < 1000; i++)
+        CHECK(payload_decode((const char *)buf, len, NULL) == NULL);
+    double us = (now_seconds() - started) * 1e3; // на одно сообщение
+    // при разборе всей цепочки вышло бы порядка сотен мкс на сообщение
+    CHECK(us < 20);
+    printf("tag chain of %d: rejected in %.2f us\n", LONG_CHAIN, us);
+    free(buf);
+}
+
+// Вложенность: PAYLOAD_CBOR_MAX_DEPTH контейнеров разбирается, на один больше - нет
+static void test_depth(void)
+{
+    uint8_t buf[PAYLOAD_CBOR_MAX_DEPTH + 8];
+    for (size_t depth = PAYLOAD_CBOR_MAX_DEPTH; depth <= PAYLOAD_CBOR_MAX_DEPTH + 1; depth++)
+    {
+        size_t n = 0;
+        buf[n++] = 0xA1;
+        buf[n++] = 0x61;
+        buf[n++] = 'k';
+        for (size_t i = 1; i < depth; i++)
+            buf[n++] = 0x81; // array(1)
+        buf[n++] = 0x01;
+        cJSON *root = payload_decode((const char *)buf, n, NULL);
+        CHECK((root != NULL) == (depth == PAYLOAD_CBOR_MAX_DEPTH));
+        cJSON_Delete(root);
+    }
+}
+
+static void test_stats(void)
+{
+    char cbor[JSON_STREAM_POOL_BUF_SIZE];
+    size_t cbor_len = encode_fd(PAYLOAD_FORMAT_CBOR, cbor, sizeof(cbor));
+    payload_reset_stats();
+    cJSON_Delete(payload_decode(cbor, cbor_len, NULL));
+    CHECK(payload_decode(cbor, cbor_len - 1, NULL) == NULL);
+    CHECK(payload_decode("x", 1, NULL) == NULL);
+    const payload_format_stats_t *stats = payload_get_stats(PAYLOAD_FORMAT_CBOR);
+    CHECK(stats->decoded == 1 && stats->decoded_bytes == cbor_len && stats->errors == 1);
+    CHECK(payload_get_stats(PAYLOAD_FORMAT_JSON)->errors == 1);
+
+    uint8_t format = 0xFF;
+    CHECK(payload_format_from_name("cbor", &format) && format == PAYLOAD_FORMAT_CBOR);
+    CHECK(!payload_format_from_name("xml", &format) && format == PAYLOAD_FORMAT_CBOR);
+    CHECK(strcmp(payload_format_name(PAYLOAD_FORMAT_JSON), "json") == 0);
+    CHECK(strcmp(payload_format_name(7), "unknown") == 0);
+}
+
+// ---- замер ----
+
+static void bench(uint32_t rounds)
+{
+    char buf[PAYLOAD_FORMAT_COUNT][JSON_STREAM_POOL_BUF_SIZE];
+    size_t len[PAYLOAD_FORMAT_COUNT];
+    double encode[PAYLOAD_FORMAT_COUNT], decode[PAYLOAD_FORMAT_COUNT];
+
+    for (uint8_t format = 0; format < PAYLOAD_FORMAT_COUNT; format++)
+    {
+        double started = now_seconds();
+        for (uint32_t r = 0; r < rounds; r++)
+            len[format] = encode_fd(format, buf[format], sizeof(buf[format]));
+        encode[format] = rounds / (now_seconds() - started);
+
+        started = now_seconds();
+        for (uint32_t r = 0; r < rounds; r++)
+        {
+            cJSON *root = payload_decode(buf[format], len[format], NULL);
+            if (!root)
+                failures++;
+            cJSON_Delete(root);
+        }
+        decode[format] = rounds / (now_seconds() - started);
+    }
+
+    printf("fd message: %zu bytes json, %zu bytes cbor\n", len[PAYLOAD_FORMAT_JSON], len[PAYLOAD_FORMAT_CBOR]);
+    for (uint8_t format = 0; format < PAYLOAD_FORMAT_COUNT; format++)
+        printf("  %s: encode %.0f msg/s, decode %.0f msg/s\n", payload_format_name(format), encode[format],
+               decode[format]);
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_foreign_cbor();
+    test_invalid();
+    test_tag_chain();
+    test_depth();
+    test_stats();
+    bench(200000);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("payload_codec: all checks passed\n");
+    return 0;
+}